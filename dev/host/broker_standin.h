@@ -0,0 +1,263 @@
+/*
+ broker_standin.h — localhost MQTT 3.1.1 broker stand-in for host tools
+ ------------------------------------------------------------
+ Just enough broker to exercise the firmware's MQTT path end to end:
+ CONNECT/CONNACK, PUBLISH QoS0/1 with PUBACK, SUBSCRIBE/SUBACK with + and #
+ filters, PINGREQ/PINGRESP. No retained store, no QoS2, no persistence.
+
+ It never blocks: poll() services whatever epoll reports and returns, so it
+ can run inside the firmware's delay()/yield() hook (harness) or next to
+ thousands of simulated nodes on one event loop (fleet simulator).
+
+ Scripting: down() closes the listener and every session, like a crashed
+ broker; up() comes back on the same port. ackDropEvery = N silently
+ swallows every Nth PUBACK so client retries can be observed.
+ */
+#pragma once
+
+#include "pm_mqtt.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class BrokerStandin {
+public:
+    typedef std::function<void(const std::string& clientId, const char* topic,
+                               const uint8_t* payload, size_t len, uint8_t qos, bool dup)> PublishHook;
+    typedef std::function<void(const std::string& clientId)> SessionHook;
+
+    struct Stats {
+        uint64_t connects = 0;        // CONNECT packets accepted
+        uint64_t publishes = 0;       // PUBLISH packets received
+        uint64_t qos1 = 0;
+        uint64_t dups = 0;            // PUBLISHes with the DUP flag
+        uint64_t pubacks = 0;         // PUBACKs sent
+        uint64_t pubacksDropped = 0;  // PUBACKs swallowed by ackDropEvery
+        uint64_t disconnects = 0;     // sessions that ended, either side
+        uint64_t bytesIn = 0;
+    };
+
+    explicit BrokerStandin(uint16_t port = 0) : port_(port) {}
+    ~BrokerStandin() { down(); if (ep_ >= 0) ::close(ep_); }
+
+    bool up() {
+        if (lfd_ >= 0) return true;
+        if (ep_ < 0) ep_ = epoll_create1(0);
+        lfd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(lfd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in a{};
+        a.sin_family = AF_INET; a.sin_port = htons(port_); a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(lfd_, (sockaddr*)&a, sizeof(a)) != 0 || ::listen(lfd_, 4096) != 0) {
+            ::close(lfd_); lfd_ = -1; return false;
+        }
+        socklen_t al = sizeof(a);
+        getsockname(lfd_, (sockaddr*)&a, &al);
+        port_ = ntohs(a.sin_port);
+        fcntl(lfd_, F_SETFL, fcntl(lfd_, F_GETFL) | O_NONBLOCK);
+        watch(lfd_);
+        return true;
+    }
+
+    void down() {
+        if (lfd_ >= 0) { ::close(lfd_); lfd_ = -1; }
+        while (!sessions_.empty()) closeSession(sessions_.begin()->first);
+    }
+
+    bool     isUp() const     { return lfd_ >= 0; }
+    uint16_t port() const     { return port_; }
+    size_t   sessions() const { return sessions_.size(); }
+
+    void poll(int timeoutMs = 0) {
+        if (ep_ < 0) return;
+        epoll_event ev[256];
+        int n = epoll_wait(ep_, ev, 256, timeoutMs);
+        for (int i = 0; i < n; ++i) {
+            int fd = ev[i].data.fd;
+            if (fd == lfd_) accept();
+            else service(fd);
+        }
+    }
+
+    // Broker-originated message to every matching subscriber (QoS0).
+    void publish(const char* topic, const uint8_t* payload, size_t len) {
+        std::vector<uint8_t> pkt(len + strlen(topic) + 8);
+        size_t n = mqtt::encodePublish(pkt.data(), pkt.size(), topic, payload, len, 0, false, false, 0);
+        for (auto& kv : sessions_)
+            for (auto& f : kv.second->filters)
+                if (matches(f.c_str(), topic)) { sendAll(kv.first, pkt.data(), n); break; }
+    }
+
+    Stats       stats;
+    uint32_t    ackDropEvery = 0;
+    PublishHook onPublish;
+    SessionHook onConnect;
+    SessionHook onDisconnect;
+
+private:
+    struct Session {
+        Session() : reader(buf, sizeof(buf)) {}
+        uint8_t                  buf[4096];
+        mqtt::PacketReader       reader;
+        std::string              clientId;
+        std::vector<std::string> filters;
+        bool                     connected = false;
+    };
+
+    void watch(int fd) {
+        epoll_event ev{};
+        ev.events = EPOLLIN; ev.data.fd = fd;
+        epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void accept() {
+        for (;;) {
+            int fd = ::accept(lfd_, nullptr, nullptr);
+            if (fd < 0) return;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            sessions_[fd].reset(new Session);
+            watch(fd);
+        }
+    }
+
+    void closeSession(int fd) {
+        auto it = sessions_.find(fd);
+        if (it == sessions_.end()) return;
+        if (it->second->connected) {
+            ++stats.disconnects;
+            if (onDisconnect) onDisconnect(it->second->clientId);
+        }
+        epoll_ctl(ep_, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        sessions_.erase(it);
+    }
+
+    // A stand-in does not queue writes: a full socket buffer just drops the packet.
+    void sendAll(int fd, const uint8_t* p, size_t n) {
+        ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+        (void)w;
+    }
+
+    void service(int fd) {
+        uint8_t in[2048];
+        ssize_t r = ::recv(fd, in, sizeof(in), 0);
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) { closeSession(fd); return; }
+        if (r < 0) return;
+        stats.bytesIn += (uint64_t)r;
+        for (ssize_t i = 0; i < r; ++i) {
+            auto it = sessions_.find(fd);
+            if (it == sessions_.end()) return;
+            if (it->second->reader.feed(in[i]) && !handle(fd, *it->second)) { closeSession(fd); return; }
+        }
+    }
+
+    static std::string str(const uint8_t*& p, const uint8_t* end) {
+        if (end - p < 2) { p = end; return std::string(); }
+        uint16_t n = mqtt::getU16(p); p += 2;
+        if (end - p < n) { p = end; return std::string(); }
+        std::string s((const char*)p, n); p += n;
+        return s;
+    }
+
+    // Returns false to drop the session.
+    bool handle(int fd, Session& s) {
+        const mqtt::PacketReader& r = s.reader;
+        if (r.truncated()) return false;
+        const uint8_t* d = r.data();
+        const uint8_t* end = d + r.length();
+        uint8_t out[8];
+        switch (r.type()) {
+            case mqtt::CONNECT: {
+                if (r.length() < 10) return false;
+                const uint8_t* p = d;
+                str(p, end);                           // "MQTT"
+                p += 4;                                // level, flags, keepalive
+                s.clientId = str(p, end);
+                s.connected = true;
+                ++stats.connects;
+                out[0] = mqtt::CONNACK; out[1] = 2; out[2] = 0; out[3] = 0;
+                sendAll(fd, out, 4);
+                if (onConnect) onConnect(s.clientId);
+                return true;
+            }
+            case mqtt::PUBLISH: {
+                if (!s.connected) return false;
+                const uint8_t qos = (r.header() >> 1) & 0x03;
+                const bool dup = (r.header() & 0x08) != 0;
+                const uint8_t* p = d;
+                std::string topic = str(p, end);
+                uint16_t id = 0;
+                if (qos) { if (end - p < 2) return false; id = mqtt::getU16(p); p += 2; }
+                ++stats.publishes;
+                if (qos) ++stats.qos1;
+                if (dup) ++stats.dups;
+                if (onPublish) onPublish(s.clientId, topic.c_str(), p, (size_t)(end - p), qos, dup);
+                if (qos == 1) {
+                    if (ackDropEvery && stats.qos1 % ackDropEvery == 0) { ++stats.pubacksDropped; return true; }
+                    sendAll(fd, out, mqtt::encodeAck(out, mqtt::PUBACK, id));
+                    ++stats.pubacks;
+                }
+                return true;
+            }
+            case mqtt::SUBSCRIBE: {
+                if (!s.connected || r.length() < 2) return false;
+                const uint8_t* p = d;
+                uint16_t id = mqtt::getU16(p); p += 2;
+                uint8_t granted[16]; size_t g = 0;
+                while (p < end && g < sizeof(granted)) {
+                    s.filters.push_back(str(p, end));
+                    if (p < end) ++p;                  // requested QoS, always granted 0
+                    granted[g++] = 0;
+                }
+                uint8_t ack[4 + sizeof(granted)];
+                ack[0] = mqtt::SUBACK; ack[1] = (uint8_t)(2 + g);
+                mqtt::putU16(ack + 2, id);
+                memcpy(ack + 4, granted, g);
+                sendAll(fd, ack, 4 + g);
+                return true;
+            }
+            case mqtt::PINGREQ:
+                sendAll(fd, out, mqtt::encodeEmpty(out, mqtt::PINGRESP));
+                return true;
+            case mqtt::DISCONNECT:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    static bool matches(const char* f, const char* t) {
+        for (;;) {
+            if (*f == '#') return true;
+            if (*f == '+') {
+                while (*t && *t != '/') ++t;
+                ++f;
+            } else {
+                if (*f != *t) return false;
+                if (!*f) return true;
+                ++f; ++t;
+                continue;
+            }
+            if (!*f || !*t) return !*f && !*t;
+        }
+    }
+
+    uint16_t port_;
+    int      lfd_ = -1;
+    int      ep_ = -1;
+    std::unordered_map<int, std::unique_ptr<Session>> sessions_;
+};
@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+# dram_report.sh — where the firmware's constant bytes end up
+# ------------------------------------------------------------
+# On the ESP8266, .rodata is copied to DRAM at boot; only PROGMEM data (PSTR,
+# F(), PROGMEM arrays) stays in flash. This compiles the firmware translation
+# unit against the host HAL, which collects PROGMEM into its own .pm_flash
+# section, and prints the split for the working tree and for a git revision.
+#
+#   dev/host/dram_report.sh [REV] [-- extra g++ flags]     (default REV: HEAD)
+#   dev/host/dram_report.sh --elf firmware.elf             (real device build)
+#
+# Host numbers are x86-64 objects: string bytes match the device, the HAL's
+# own constants add the same fixed offset to both columns. For the device
+# build, xtensa-lx106-elf-size reports .data + .rodata + .bss = DRAM used.
+set -euo pipefail
+cd "$(dirname "$0")/../.."
+
+if [[ "${1:-}" == "--elf" ]]; then
+    xtensa-lx106-elf-size -A "$2" | awk '
+        $1 ~ /^\.(data|rodata|bss)$/ { dram += $2; printf "%-10s %8d\n", $1, $2 }
+        $1 ~ /^\.irom0\.text$/       { printf "%-10s %8d  (flash: code + PROGMEM)\n", $1, $2 }
+        END { printf "DRAM total %8d of 81920\n", dram }'
+    exit 0
+fi
+
+rev="${1:-HEAD}"; shift || true
+[[ "${1:-}" == "--" ]] && shift
+tmp="$(mktemp -d)"; trap 'rm -rf "$tmp"' EXIT
+
+measure() {   # $1 = firmware source, $2.. = extra flags; prints "rodata data bss flash"
+    local src="$1"; shift
+    printf '#include "%s"\n' "$src" > "$tmp/tu.cpp"
+    g++ -std=gnu++17 -Os -c -w -DHAL_COUNT_ALLOCS=0 -Idev/host/hal -Isrc/cpp "$@" "$tmp/tu.cpp" -o "$tmp/tu.o"
+    size -A "$tmp/tu.o" | awk '
+        $1 ~ /^\.rodata/   { r += $2 }
+        $1 ~ /^\.data/     { d += $2 }
+        $1 ~ /^\.bss/      { b += $2 }
+        $1 == ".pm_flash"  { f += $2 }
+        END { printf "%d %d %d %d\n", r, d, b, f }'
+}
+
+git show "$rev:src/cpp/ParticularMatter_public.cpp" > "$tmp/before.cpp"
+cp src/cpp/*.h "$tmp/"   # headers as in the working tree; older revisions only use a subset
+
+for flags in "-DENABLE_NETWORK=0" "-DENABLE_NETWORK=1"; do
+    read -r r0 d0 b0 f0 < <(measure "$tmp/before.cpp" $flags "$@")
+    read -r r1 d1 b1 f1 < <(measure "$PWD/src/cpp/ParticularMatter_public.cpp" $flags "$@")
+    echo "== $flags"
+    printf "%-22s %10s %10s %8s\n" "" "$rev" "worktree" "delta"
+    printf "%-22s %10d %10d %+8d\n" ".rodata (DRAM)" "$r0" "$r1" $((r1 - r0))
+    printf "%-22s %10d %10d %+8d\n" ".data (DRAM)" "$d0" "$d1" $((d1 - d0))
+    printf "%-22s %10d %10d %+8d\n" ".bss (DRAM)" "$b0" "$b1" $((b1 - b0))
+    printf "%-22s %10d %10d %+8d\n" "PROGMEM (flash)" "$f0" "$f1" $((f1 - f0))
+done
@@ -0,0 +1,159 @@
+/*
+ fake_bme280.h — register-level BME280 for the host harness
+ ------------------------------------------------------------
+ Answers on the HAL's I2C bus like the real part: chip id 0x60, calibration
+ words at 0x88/0xE1, ctrl_hum latched by the next ctrl_meas write, forced
+ mode that sets status.measuring for the datasheet conversion time and then
+ drops back to sleep, data registers updated only when a conversion ends.
+
+ The harness sets the "true" temperature, humidity and pressure. Raw ADC
+ values are found by bisecting the datasheet's floating-point compensation
+ (§8.1), so the firmware's integer path is checked against an independent
+ implementation, not against itself.
+
+ Counters: conversions, status polls while measuring, data reads while
+ measuring (a driver bug: it would read the previous result).
+ */
+#pragma once
+
+#include "hal/Wire.h"
+
+#include <math.h>
+
+class FakeBme280 : public hal::I2cDevice {
+public:
+    struct Truth { double tC, rh, pPa; };
+
+    FakeBme280() {
+        // calibration of a real sensor
+        T1 = 28485; T2 = 26735; T3 = 50;
+        P1 = 37520; P2 = -10697; P3 = 3024; P4 = 7131; P5 = -95; P6 = -7; P7 = 9900; P8 = -10230; P9 = 4285;
+        H1 = 75; H2 = 366; H3 = 0; H4 = 313; H5 = 50; H6 = 30;
+        reg_[0xD0] = 0x60;
+        put16(0x88, T1); put16(0x8A, (uint16_t)T2); put16(0x8C, (uint16_t)T3);
+        put16(0x8E, P1); put16(0x90, (uint16_t)P2); put16(0x92, (uint16_t)P3); put16(0x94, (uint16_t)P4);
+        put16(0x96, (uint16_t)P5); put16(0x98, (uint16_t)P6); put16(0x9A, (uint16_t)P7);
+        put16(0x9C, (uint16_t)P8); put16(0x9E, (uint16_t)P9);
+        reg_[0xA1] = H1;
+        put16(0xE1, (uint16_t)H2);
+        reg_[0xE3] = H3;
+        reg_[0xE4] = (uint8_t)(H4 >> 4);
+        reg_[0xE5] = (uint8_t)((H4 & 0x0F) | (H5 & 0x0F) << 4);
+        reg_[0xE6] = (uint8_t)(H5 >> 4);
+        reg_[0xE7] = (uint8_t)H6;
+        setRaw(0x80000, 0x80000, 0x8000);   // reset values: "skipped"
+    }
+
+    Truth truth{21.0, 45.0, 101325.0};
+    Truth converted{};                    // truth at the end of the last conversion
+    uint32_t conversions = 0, busyPolls = 0, busyDataReads = 0;
+
+    // ---- I2C ----
+    bool write(const uint8_t* p, size_t n) override {
+        update();
+        ptr_ = p[0];                                        // a lone byte only sets the pointer
+        for (size_t i = 0; i + 1 < n; i += 2) writeReg(p[i], p[i + 1]);   // writes are reg/value pairs
+        return true;
+    }
+
+    size_t read(uint8_t* p, size_t n) override {
+        update();
+        if (measuring()) {
+            if (ptr_ == 0xF3) ++busyPolls;
+            else if (ptr_ >= 0xF7 && ptr_ <= 0xFE) ++busyDataReads;
+        }
+        for (size_t i = 0; i < n; ++i) p[i] = reg_[(uint8_t)(ptr_ + i)];
+        ptr_ = (uint8_t)(ptr_ + n);
+        return n;
+    }
+
+    // ---- datasheet floating-point compensation (§8.1) ----
+    double tFine(int32_t adcT) const {
+        const double v1 = (adcT / 16384.0 - T1 / 1024.0) * T2;
+        const double d  = adcT / 131072.0 - T1 / 8192.0;
+        return v1 + d * d * T3;
+    }
+    double temperature(int32_t adcT) const { return tFine(adcT) / 5120.0; }
+    double pressure(int32_t adcP, double tf) const {
+        double v1 = tf / 2.0 - 64000.0;
+        double v2 = v1 * v1 * P6 / 32768.0;
+        v2 = v2 + v1 * P5 * 2.0;
+        v2 = v2 / 4.0 + P4 * 65536.0;
+        v1 = (P3 * v1 * v1 / 524288.0 + P2 * v1) / 524288.0;
+        v1 = (1.0 + v1 / 32768.0) * P1;
+        if (v1 == 0) return 0;
+        double p = 1048576.0 - adcP;
+        p = (p - v2 / 4096.0) * 6250.0 / v1;
+        v1 = P9 * p * p / 2147483648.0;
+        v2 = p * P8 / 32768.0;
+        return p + (v1 + v2 + P7) / 16.0;
+    }
+    double humidity(int32_t adcH, double tf) const {
+        double h = tf - 76800.0;
+        h = (adcH - (H4 * 64.0 + H5 / 16384.0 * h)) *
+            (H2 / 65536.0 * (1.0 + H6 / 67108864.0 * h * (1.0 + H3 / 67108864.0 * h)));
+        h = h * (1.0 - H1 * h / 524288.0);
+        return h < 0 ? 0 : h > 100 ? 100 : h;
+    }
+
+private:
+    static constexpr uint64_t kMeasureUs = 9300;   // t_measure,max at x1/x1/x1
+
+    bool measuring() const { return doneUs_ && hal::clockUs < doneUs_; }
+
+    void writeReg(uint8_t r, uint8_t v) {
+        if (r == 0xE0 && v == 0xB6) { reg_[0xF2] = reg_[0xF4] = reg_[0xF5] = 0; return; }   // soft reset
+        if (r != 0xF2 && r != 0xF4 && r != 0xF5) return;                                  // read-only
+        reg_[r] = v;
+        if (r == 0xF4) {
+            osrsH_ = reg_[0xF2] & 7;                      // ctrl_hum latches here
+            if ((v & 3) == 1 || (v & 3) == 2) {           // forced
+                doneUs_ = hal::clockUs + kMeasureUs;
+                reg_[0xF3] |= 0x08;
+            }
+        }
+    }
+
+    // Finishes a conversion whose time is up.
+    void update() {
+        if (!doneUs_ || hal::clockUs < doneUs_) return;
+        doneUs_ = 0;
+        reg_[0xF3] &= ~0x08;
+        reg_[0xF4] &= ~3;                                 // back to sleep
+        const uint8_t os = reg_[0xF4];
+        const int32_t adcT = (os >> 5) ? solve(0, 0xFFFFF, [&](int32_t a) { return temperature(a); }, truth.tC, true) : 0x80000;
+        const double  tf   = tFine(adcT);
+        const int32_t adcP = ((os >> 2) & 7) ? solve(0, 0xFFFFF, [&](int32_t a) { return pressure(a, tf); }, truth.pPa, false) : 0x80000;
+        const int32_t adcH = osrsH_ ? solve(0, 0xFFFF, [&](int32_t a) { return humidity(a, tf); }, truth.rh, true) : 0x8000;
+        setRaw(adcT, adcP, adcH);
+        converted = {temperature(adcT), humidity(adcH, tf), pressure(adcP, tf)};
+        ++conversions;
+    }
+
+    // Smallest ADC code whose compensated value reaches want (monotonic f).
+    template<typename F>
+    static int32_t solve(int32_t lo, int32_t hi, F f, double want, bool rising) {
+        while (lo < hi) {
+            const int32_t mid = lo + (hi - lo) / 2;
+            const bool below = rising ? f(mid) < want : f(mid) > want;
+            if (below) lo = mid + 1; else hi = mid;
+        }
+        return lo;
+    }
+
+    void setRaw(int32_t t, int32_t p, int32_t h) {
+        reg_[0xF7] = (uint8_t)(p >> 12); reg_[0xF8] = (uint8_t)(p >> 4); reg_[0xF9] = (uint8_t)(p << 4);
+        reg_[0xFA] = (uint8_t)(t >> 12); reg_[0xFB] = (uint8_t)(t >> 4); reg_[0xFC] = (uint8_t)(t << 4);
+        reg_[0xFD] = (uint8_t)(h >> 8);  reg_[0xFE] = (uint8_t)h;
+    }
+
+    void put16(uint8_t r, uint16_t v) { reg_[r] = (uint8_t)v; reg_[r + 1] = (uint8_t)(v >> 8); }
+
+    uint16_t T1, P1; int16_t T2, T3, P2, P3, P4, P5, P6, P7, P8, P9;
+    uint8_t  H1, H3; int16_t H2, H4, H5; int8_t H6;
+
+    uint8_t  reg_[256] = {};
+    uint8_t  ptr_ = 0;
+    uint8_t  osrsH_ = 0;
+    uint64_t doneUs_ = 0;
+};
@@ -0,0 +1,157 @@
+/*
+ fake_sunrise.h — Senseair Sunrise on the host HAL's I2C bus
+ ------------------------------------------------------------
+ Models what the single-measurement driver has to get right:
+ • EN: the sensor is powered while its EN GPIO is not driven low (open
+ drain with a pull-up); it needs 35 ms after power-on or a soft reset
+ before it answers, and loses its RAM (sensor state, last result) when
+ EN goes low;
+ • wake-up: asleep, it NACKs its address once and wakes on that NACK, then
+ stays awake for 15 ms after its last transfer;
+ • measurement mode is an EE register that takes effect at the next reset.
+ The factory setting is continuous, so a start command is ignored until
+ the driver has switched the mode and reset the sensor;
+ • a start command (0xC3 = 1), optionally followed by the 24-byte sensor
+ state, runs one measurement of convertUs; ErrorStatus bit 7 ("no
+ measurement completed") and nRDY stay set until it is done.
+
+ Sensor state: the fake evolves bytes 2..23 with every measurement and
+ remembers what it handed out. A start that restores different bytes is a
+ mismatch; a start without state on a freshly powered sensor is a cold
+ start (the ABC history would be lost). ABC time must never go backwards.
+
+ The harness sets truthPpm; `converted` is the value of the last finished
+ measurement, for comparison with what the firmware reports.
+ */
+#pragma once
+
+#include "hal/Wire.h"
+
+#include <string.h>
+
+class FakeSunrise : public hal::I2cDevice {
+public:
+    int      enPin = -1, nrdyPin = -1;          // -1 = EN tied high / nRDY not wired
+    uint64_t convertUs = 2000000;                // 8 samples
+    double   truthPpm = 420;
+    int16_t  truthT_x100 = 2500;
+
+    uint16_t converted = 0;
+    uint16_t abcHoursIn = 0;                    // ABC time of the last restored state
+    uint32_t powerOns = 0, wakeNacks = 0, offNacks = 0, resets = 0, eeWrites = 0;
+    uint32_t starts = 0, startsIgnored = 0, restores = 0, coldStarts = 0, stateMismatches = 0, abcRewinds = 0;
+    uint32_t conversions = 0, earlyReads = 0, abortedByPowerOff = 0;
+    uint64_t poweredUs = 0;
+
+    // Call every virtual millisecond: follows EN and finishes measurements.
+    void tick() { update(); }
+
+    // ---- I2C ----
+    bool ackAddress(bool) override {
+        update();
+        const uint64_t now = hal::clockUs;
+        if (!powered_ || now < bootDoneUs_) { ++offNacks; return false; }
+        if (now >= awakeUntilUs_) { ++wakeNacks; awakeUntilUs_ = now + kAwakeUs; return false; }
+        awakeUntilUs_ = now + kAwakeUs;
+        return true;
+    }
+
+    bool write(const uint8_t* p, size_t n) override {
+        ptr_ = p[0];
+        if (n >= 2 && p[0] == 0xC3 && p[1] == 1) { start(n >= 2 + kStateLen ? p + 2 : nullptr); return true; }
+        for (size_t i = 1; i < n; ++i) writeReg((uint8_t)(p[0] + i - 1), p[i]);
+        return true;
+    }
+
+    size_t read(uint8_t* p, size_t n) override {
+        update();
+        if (measuringUntilUs_ && ptr_ <= 0x09) ++earlyReads;
+        uint8_t r[256] = {};
+        const uint16_t status = done_ ? 0 : 0x0080;
+        r[0x00] = (uint8_t)(status >> 8); r[0x01] = (uint8_t)status;
+        r[0x06] = (uint8_t)(co2_ >> 8);   r[0x07] = (uint8_t)co2_;
+        r[0x08] = (uint8_t)((uint16_t)t_ >> 8); r[0x09] = (uint8_t)t_;
+        r[0x0D] = count_;
+        r[0x95] = eeMode_;
+        memcpy(r + 0xC4, state_, kStateLen);
+        for (size_t i = 0; i < n; ++i) p[i] = r[(uint8_t)(ptr_ + i)];
+        if (ptr_ <= 0xC4 && ptr_ + n >= 0xC4 + kStateLen) memcpy(handedOut_, state_, kStateLen), haveHandedOut_ = true;
+        ptr_ = (uint8_t)(ptr_ + n);
+        return n;
+    }
+
+private:
+    static constexpr uint64_t kBootUs = 35000, kAwakeUs = 15000;
+    static constexpr size_t   kStateLen = 24;
+
+    bool enHigh() const {
+        return enPin < 0 || hal::pinModes[enPin] != OUTPUT || hal::pinLevel[enPin] == HIGH;
+    }
+
+    void update() {
+        const uint64_t now = hal::clockUs;
+        if (powered_) poweredUs += now - lastUs_;
+        lastUs_ = now;
+        if (enHigh() != powered_) {
+            powered_ = !powered_;
+            if (powered_) { ++powerOns; boot(now); }
+            else if (measuringUntilUs_) { ++abortedByPowerOff; measuringUntilUs_ = 0; }
+        }
+        if (measuringUntilUs_ && now >= measuringUntilUs_) finish();
+        if (nrdyPin >= 0) hal::pinLevel[nrdyPin] = powered_ && !measuringUntilUs_ && done_ ? LOW : HIGH;
+    }
+
+    // Power-on or soft reset: RAM gone, EE mode latched.
+    void boot(uint64_t now) {
+        bootDoneUs_ = now + kBootUs;
+        awakeUntilUs_ = 0;
+        measuringUntilUs_ = 0;
+        activeMode_ = eeMode_;
+        memset(state_, 0, kStateLen);
+        fresh_ = true;
+        done_ = false;
+        co2_ = 0; t_ = 0; count_ = 0;
+    }
+
+    void writeReg(uint8_t r, uint8_t v) {
+        if (r == 0x95) { if (eeMode_ != v) ++eeWrites; eeMode_ = v; }
+        else if (r == 0xA3 && v == 0xFF) { ++resets; boot(hal::clockUs); }
+    }
+
+    void start(const uint8_t* restored) {
+        update();
+        ++starts;
+        if (activeMode_ != 1) { ++startsIgnored; return; }
+        if (restored) {
+            ++restores;
+            if (haveHandedOut_ && memcmp(restored + 2, handedOut_ + 2, kStateLen - 2)) ++stateMismatches;
+            abcHoursIn = (uint16_t)(restored[0] << 8 | restored[1]);
+            if (haveHandedOut_ && abcHoursIn < (uint16_t)(handedOut_[0] << 8 | handedOut_[1])) ++abcRewinds;
+            memcpy(state_, restored, kStateLen);
+        } else if (fresh_ && haveHandedOut_) {
+            ++coldStarts;
+        }
+        fresh_ = false;
+        done_ = false;
+        measuringUntilUs_ = hal::clockUs + convertUs;
+    }
+
+    void finish() {
+        measuringUntilUs_ = 0;
+        done_ = true;
+        co2_ = (uint16_t)(truthPpm + 0.5);
+        t_ = truthT_x100;
+        converted = co2_;
+        ++count_;
+        ++conversions;
+        for (size_t i = 2; i < kStateLen; ++i) state_[i] = (uint8_t)(state_[i] * 31 + i + count_ + (co2_ >> (i & 7)));
+    }
+
+    uint8_t  eeMode_ = 0, activeMode_ = 0;      // 0 = continuous (factory), 1 = single
+    uint8_t  state_[kStateLen] = {}, handedOut_[kStateLen] = {};
+    bool     haveHandedOut_ = false, fresh_ = true, done_ = false, powered_ = false;
+    uint16_t co2_ = 0;
+    int16_t  t_ = 0;
+    uint8_t  count_ = 0, ptr_ = 0;
+    uint64_t bootDoneUs_ = 0, awakeUntilUs_ = 0, measuringUntilUs_ = 0, lastUs_ = 0;
+};
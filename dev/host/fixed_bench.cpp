@@ -0,0 +1,181 @@
+/*
+ fixed_bench.cpp — integer aggregation and formatting vs. the float path
+ ------------------------------------------------------------
+ Checks pm_fixed.h against a double-precision reference, then times both
+ ways of producing a payload from one publish window of PMS readings:
+ • float: accumulate in float, mean/variance in float, snprintf("%.1f");
+ • fixed: SampleStats / Ema, appendFixed() into a FixedString.
+
+ Timing uses the CPU's cycle counter (rdtsc on x86, cntvct on arm64; falls
+ back to nanoseconds elsewhere), best of --reps runs. A desktop CPU has an
+ FPU, so the host ratio understates the gain on the lx106, where every
+ float op is a libgcc call. To measure there, wrap the same two functions
+ in ESP.getCycleCount().
+
+ Exit status: 0 = all checks passed, 1 = a mismatch (printed).
+
+ Build & run (see dev/host/README.md):
+   g++ -std=gnu++17 -O2 -Isrc/cpp dev/host/fixed_bench.cpp -o fixed_bench
+   ./fixed_bench --reps=200
+ */
+#include "pm_fixed.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles() { return __rdtsc(); }
+static const char* kUnit = "TSC cycles";
+#elif defined(__aarch64__)
+static inline uint64_t cycles() { uint64_t v; asm volatile("mrs %0, cntvct_el0" : "=r"(v)); return v; }
+static const char* kUnit = "timer ticks";
+#else
+static inline uint64_t cycles() { timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec; }
+static const char* kUnit = "ns";
+#endif
+
+namespace {
+
+int failures = 0;
+
+void fail(const char* what, long a, const char* got, const char* want) {
+    if (++failures <= 10) printf("MISMATCH %s(%ld): got '%s', want '%s'\n", what, a, got, want);
+}
+
+// ---- correctness ----
+void checkFormat() {
+    char got[FIXED_TEXT_MAX], want[32];
+    for (int32_t v = -200000; v <= 700000; ++v) {           // every PMS value in tenths, and then some
+        formatFixed(got, v, 1);
+        snprintf(want, sizeof(want), "%.1f", v / 10.0);
+        if (strcmp(got, want)) fail("formatFixed/1", v, got, want);
+    }
+    const int32_t edge[] = {0, 1, 9, 10, 99, 81919, 81920, 81921, 999999, INT32_MAX, INT32_MIN + 1, INT32_MIN};
+    for (int32_t v : edge)
+        for (uint8_t d = 0; d <= 9; ++d) {
+            formatFixed(got, v, d);
+            snprintf(want, sizeof(want), "%.*f", d, v / pow(10.0, d));
+            if (strcmp(got, want)) fail("formatFixed/d", v, got, want);
+        }
+    for (uint32_t x = 0; x < 81920; ++x)
+        if (fixedDiv10(x) != x / 10) { fail("fixedDiv10", x, "", ""); break; }
+}
+
+void checkStats() {
+    srand(1);
+    char got[24], want[24];
+    for (int w = 0; w < 20000; ++w) {
+        const uint32_t n = 1 + rand() % 3600;
+        const uint16_t range = (uint16_t)(w % 3 == 0 ? 65535 : 1 + rand() % 1000);
+        SampleStats s;
+        double sum = 0, sq = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            const uint16_t x = (uint16_t)(rand() % (range + 1));
+            s.add(x); sum += x; sq += (double)x * x;
+        }
+        const double mean = sum / n, var = n > 1 ? sq / n - mean * mean : 0;
+        const long m = lround(mean * 10), v = std::min(lround(var * 10), 0xFFFFFFFFl), sd = lround(sqrt(var) * 10);
+        // exact integer results vs. a double reference: allow its last-bit noise
+        if (labs((long)s.mean(10) - m) > 0)   { snprintf(got, 24, "%u", s.mean(10));     snprintf(want, 24, "%ld", m);  fail("mean", n, got, want); }
+        if (labs((long)s.variance(10) - v) > 1) { snprintf(got, 24, "%u", s.variance(10)); snprintf(want, 24, "%ld", v);  fail("variance", n, got, want); }
+        if (labs((long)s.stddev(10) - sd) > 1)  { snprintf(got, 24, "%u", s.stddev(10));   snprintf(want, 24, "%ld", sd); fail("stddev", n, got, want); }
+    }
+    Ema e(4);
+    double ref = 0;
+    for (int i = 0; i < 5000; ++i) {
+        const uint16_t x = (uint16_t)(i < 2500 ? 30 + i % 7 : 400);
+        e.add(x);
+        ref = i ? ref + (x - ref) / 16 : x;
+    }
+    if (labs((long)e.value(10) - lround(ref * 10)) > 1) {
+        snprintf(got, 24, "%u", e.value(10)); snprintf(want, 24, "%ld", lround(ref * 10));
+        fail("ema", 5000, got, want);
+    }
+}
+
+// ---- the two payload paths ----
+struct Reading { uint16_t pm1, pm25, pm10; };
+
+volatile size_t sink;
+
+__attribute__((noinline)) size_t floatPath(const Reading* r, size_t n, char* out, size_t cap) {
+    float s1 = 0, s25 = 0, s10 = 0, q25 = 0;
+    for (size_t i = 0; i < n; ++i) {
+        s1 += r[i].pm1; s25 += r[i].pm25; s10 += r[i].pm10; q25 += (float)r[i].pm25 * r[i].pm25;
+    }
+    const float m1 = s1 / n, m25 = s25 / n, m10 = s10 / n;
+    const float sd = sqrtf(q25 / n - m25 * m25);
+    return (size_t)snprintf(out, cap, "{\"measurement\":{\"pm1\":%.1f,\"pm25\":%.1f,\"pm10\":%.1f},\"sd\":%.1f}",
+                            m1, m25, m10, sd);
+}
+
+__attribute__((noinline)) size_t fixedPath(const Reading* r, size_t n, char* out, size_t cap) {
+    SampleStats s1, s25, s10;
+    for (size_t i = 0; i < n; ++i) { s1.add(r[i].pm1); s25.add(r[i].pm25); s10.add(r[i].pm10); }
+    StrBuf p(out, cap);
+    p += "{\"measurement\":{\"pm1\":"; appendFixed(p, s1.mean(10), 1);
+    p += ",\"pm25\":";                appendFixed(p, s25.mean(10), 1);
+    p += ",\"pm10\":";                appendFixed(p, s10.mean(10), 1);
+    p += "},\"sd\":";                 appendFixed(p, s25.stddev(10), 1);
+    p += '}';
+    return p.length();
+}
+
+__attribute__((noinline)) size_t floatFormat(uint32_t v, char* out, size_t cap) {
+    return (size_t)snprintf(out, cap, "%.1f", (float)v / 10.0f);
+}
+
+__attribute__((noinline)) size_t fixedFormat(uint32_t v, char* out, size_t) {
+    return formatFixed(out, (int32_t)v, 1);
+}
+
+template<typename F>
+uint64_t best(int reps, F&& f) {
+    uint64_t b = UINT64_MAX;
+    for (int r = 0; r < reps; ++r) {
+        const uint64_t t0 = cycles();
+        f();
+        const uint64_t t = cycles() - t0;
+        if (t < b) b = t;
+    }
+    return b;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int reps = 200;
+    for (int i = 1; i < argc; ++i)
+        if (!strncmp(argv[i], "--reps=", 7)) reps = std::max(1, atoi(argv[i] + 7));
+
+    checkFormat();
+    checkStats();
+    printf("checks                 : %s\n", failures ? "FAIL" : "ok (formatFixed vs %.1f, SampleStats/Ema vs double)");
+
+    // one publish window: 20 frames, plus a large batch for the per-value formatter
+    std::vector<Reading> win(20);
+    srand(7);
+    for (auto& r : win) { r.pm25 = (uint16_t)(5 + rand() % 60); r.pm1 = r.pm25 * 7 / 10; r.pm10 = r.pm25 * 13 / 10; }
+    char a[160], b[160];
+    const size_t na = floatPath(win.data(), win.size(), a, sizeof(a));
+    const size_t nb = fixedPath(win.data(), win.size(), b, sizeof(b));
+    printf("payload (float)        : %.*s\n", (int)na, a);
+    printf("payload (fixed)        : %.*s\n", (int)nb, b);
+
+    const uint64_t pf = best(reps, [&] { sink = floatPath(win.data(), win.size(), a, sizeof(a)); });
+    const uint64_t px = best(reps, [&] { sink = fixedPath(win.data(), win.size(), b, sizeof(b)); });
+    constexpr uint32_t kValues = 10000;
+    const uint64_t ff = best(reps, [&] { for (uint32_t v = 0; v < kValues; ++v) sink = floatFormat(v, a, sizeof(a)); });
+    const uint64_t fx = best(reps, [&] { for (uint32_t v = 0; v < kValues; ++v) sink = fixedFormat(v, b, sizeof(b)); });
+
+    printf("window -> payload      : float %6llu  fixed %6llu %s  (x%.1f)\n",
+           (unsigned long long)pf, (unsigned long long)px, kUnit, (double)pf / px);
+    printf("one value, 1 decimal   : float %6.1f  fixed %6.1f %s  (x%.1f)\n",
+           (double)ff / kValues, (double)fx / kValues, kUnit, (double)ff / fx);
+    return failures ? 1 : 0;
+}
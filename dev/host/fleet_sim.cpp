@@ -0,0 +1,407 @@
+/*
+ fleet_sim.cpp — thousands of virtual nodes in one process
+ ------------------------------------------------------------
+ Load generator for the ingest pipeline. Each node is a small state machine
+ built from the firmware's own pieces:
+ • provisioning fields as stored in ESPConfig (node_id, MQTT credentials);
+ • PmsParser (pm_pms.h), fed one synthetic PMS5003 frame per second;
+ • mqtt::Client + mqtt::PublishQueue (pm_mqtt.h), i.e. the QoS1 publisher;
+ • the reconnect policy of mqttEnsureConnected(): Backoff (pm_backoff.h),
+ seeded from a per-node chip id exactly like the firmware seeds it.
+ --backoff=linear replays the old fixed +5 s rule for comparison.
+ All nodes share one single-threaded event loop and non-blocking sockets.
+
+ The broker is either the in-process stand-in (default, restartable on a
+ script) or any external broker given with --broker=HOST:PORT.
+
+ Reported every --report seconds: connected nodes, connect attempts/s,
+ acknowledged publishes/s, queue backlog. At the end: reconnect storm
+ profile after each scripted broker restart and memory per node.
+
+ Build & run (see dev/host/README.md):
+   g++ -std=gnu++17 -O2 -Isrc/cpp -Idev/host dev/host/fleet_sim.cpp -o fleet_sim
+   ./fleet_sim --nodes=2000 --duration=600 --broker-restart=300:20 --speed=4
+ */
+#include "pm_mqtt.h"
+#include "pm_pms.h"
+#include "pm_backoff.h"
+#include "pm_fixed.h"
+#include "broker_standin.h"
+
+#include <math.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// ================================ Options ==================================
+struct Restart { uint32_t atMs, downMs; };
+
+struct Options {
+    uint32_t nodes       = 500;
+    uint32_t durationMs  = 300000;
+    uint32_t publishMs   = 20000;     // firmware: mqttMaybePublish() cadence
+    uint32_t bootSpread  = 20000;     // nodes power up uniformly over this window
+    uint32_t stepMs      = 50;        // how often each node's loop() runs
+    uint32_t reportMs    = 10000;
+    double   speed       = 1.0;       // virtual ms per real ms
+    const char* host     = "127.0.0.1";
+    uint16_t port        = 0;         // 0 = in-process stand-in
+    bool     linear      = false;     // pre-jitter reconnect rule
+    std::vector<Restart> restarts;
+} opt;
+
+// ============================== Virtual clock ==============================
+uint64_t startNs = 0;
+uint64_t monoNs() { timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec; }
+unsigned long simMillis() { return (unsigned long)((monoNs() - startNs) / 1e6 * opt.speed); }
+
+// ============================== Global stats ===============================
+struct Totals {
+    uint64_t attempts = 0, connects = 0, losses = 0, acked = 0, sent = 0, dropped = 0, frames = 0;
+} totals;
+std::vector<uint32_t> attemptsPerSec;          // connect attempts per virtual second
+
+// ================================ Transport ================================
+// WiFiClient-shaped, non-blocking. write() buffers so CONNECT can be queued
+// while the TCP handshake is still in progress.
+class SimSocket {
+public:
+    ~SimSocket() { stop(); }
+
+    int connect(const char* host, uint16_t port) {
+        stop();
+        sockaddr_in a{};
+        a.sin_family = AF_INET; a.sin_port = htons(port);
+        if (inet_pton(AF_INET, host, &a.sin_addr) != 1) return 0;
+        fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd_ < 0) return 0;
+        int one = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (::connect(fd_, (sockaddr*)&a, sizeof(a)) != 0 && errno != EINPROGRESS) { stop(); return 0; }
+        closed_ = false; rxLen_ = rxPos_ = txLen_ = 0;
+        return 1;
+    }
+
+    size_t write(const uint8_t* p, size_t n) {
+        if (fd_ < 0 || closed_ || txLen_ + n > sizeof(tx_)) return 0;
+        memcpy(tx_ + txLen_, p, n); txLen_ += n;
+        flush();
+        return n;
+    }
+
+    void flush() {
+        if (fd_ < 0 || closed_ || !txLen_) return;
+        ssize_t w = ::send(fd_, tx_, txLen_, MSG_NOSIGNAL);
+        if (w > 0) { memmove(tx_, tx_ + w, txLen_ - (size_t)w); txLen_ -= (size_t)w; }
+        else if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOTCONN) closed_ = true;
+    }
+
+    int available() { fill(); return (int)(rxLen_ - rxPos_); }
+    int read() { if (rxPos_ == rxLen_) fill(); return rxPos_ < rxLen_ ? rx_[rxPos_++] : -1; }
+    uint8_t connected() { if (fd_ < 0) return 0; fill(); return !closed_ || rxPos_ < rxLen_; }
+    void stop() { if (fd_ >= 0) ::close(fd_); fd_ = -1; rxLen_ = rxPos_ = txLen_ = 0; }
+
+private:
+    void fill() {
+        if (fd_ < 0 || closed_) return;
+        if (rxPos_ == rxLen_) rxPos_ = rxLen_ = 0;
+        if (rxLen_ == sizeof(rx_)) return;
+        ssize_t r = ::recv(fd_, rx_ + rxLen_, sizeof(rx_) - rxLen_, 0);
+        if (r > 0) rxLen_ += (size_t)r;
+        else if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOTCONN)) closed_ = true;
+    }
+
+    int     fd_ = -1;
+    bool    closed_ = false;
+    uint8_t rx_[256];
+    uint8_t tx_[512];
+    size_t  rxLen_ = 0, rxPos_ = 0, txLen_ = 0;
+};
+
+// ================================== Node ===================================
+constexpr size_t QUEUE_LEN = 32, INFLIGHT_MAX = 4;   // firmware defaults
+constexpr uint32_t ACK_TIMEOUT_MS = 10000;
+
+struct Sample { PmsReading pms; uint32_t seq; };
+
+void routeAck(uint16_t id);
+
+class Node {
+public:
+    explicit Node(uint32_t idx)
+        : client_(net_, simMillis), backoff_(2000, 60000, 30000), rng_(0x9E3779B9u ^ (idx * 2654435761u)) {
+        const uint32_t chipId = 0x00A00000u + idx;          // what ESP.getChipId() would return
+        backoff_.seed(chipId * 2246822519u + 1);
+        snprintf(node_id, sizeof(node_id), "00000000-0000-0000-0000-%012x", idx);
+        snprintf(mqtt_username, sizeof(mqtt_username), "sim-%u", idx);
+        snprintf(mqtt_password, sizeof(mqtt_password), "sim-pass-%u", idx);
+        snprintf(topic_, sizeof(topic_), "measurements/%s/00000000-0000-0000-0000-00000000SENS", node_id);
+        base_  = 5.0 + 20.0 * uniform();
+        phase_ = 6.283 * uniform();
+        bootAt_ = (uint32_t)(opt.bootSpread * uniform());
+        nextStep_ = bootAt_;
+        nextFrame_ = bootAt_ + 1000 + (uint32_t)(1000 * uniform());
+        nextPub_ = nextFrame_ + opt.publishMs;
+        client_.setAckCallback(routeAck);
+    }
+
+    bool due(uint32_t now) const { return (int32_t)(now - nextStep_) >= 0; }
+
+    // One firmware loop() iteration.
+    void step(uint32_t now) {
+        nextStep_ = now + opt.stepMs;
+        sensor(now);
+        ensureConnected(now);
+        client_.loop();
+        publish(now);
+        net_.flush();
+    }
+
+    bool connected() { return wasConnected_; }
+    size_t backlog() const { return queue_.size(); }
+
+    // Provisioning result, as ESPConfig stores it.
+    char node_id[37];
+    char mqtt_username[64];
+    char mqtt_password[64];
+
+    static Node* current;                // node whose loop() is running right now
+
+private:
+    // ---- PMS5003: synthetic diurnal series + AR(1) noise + rare plumes ----
+    void sensor(uint32_t now) {
+        if ((int32_t)(now - nextFrame_) < 0) return;
+        nextFrame_ += 1000;
+        double day = sin(6.283 * now / 86400000.0 + phase_);
+        noise_ = 0.9 * noise_ + gauss() * 0.8;
+        if (uniform() < 0.0005) plume_ = 40 + 80 * uniform();
+        plume_ *= 0.97;
+        double pm25 = std::max(0.0, base_ * (1.0 + 0.3 * day) + noise_ + plume_);
+        PmsReading r;
+        r.pm25_atm = (uint16_t)pm25;           r.pm25_cf1 = (uint16_t)(pm25 * 1.05);
+        r.pm1_atm  = (uint16_t)(pm25 * 0.7);   r.pm1_cf1  = (uint16_t)(pm25 * 0.7 * 1.05);
+        r.pm10_atm = (uint16_t)(pm25 * 1.3);   r.pm10_cf1 = (uint16_t)(pm25 * 1.3 * 1.05);
+        uint8_t frame[32];
+        size_t n = pmsEncodeFrame(frame, r);
+        for (size_t i = 0; i < n; ++i)
+            if (parser_.feed(frame[i]) == PmsParser::FRAME) { latest_ = parser_.reading(); valid_ = true; ++totals.frames; }
+    }
+
+    // ---- mqttEnsureConnected(), same policy as the firmware ----
+    void ensureConnected(uint32_t now) {
+        if (client_.connected()) {
+            if (!wasConnected_) { ++totals.connects; backoff_.onConnected(now); linearMs_ = 0; }
+            wasConnected_ = true;
+            return;
+        }
+        if (wasConnected_) { wasConnected_ = false; ++totals.losses; queue_.requeueInFlight(); backoff_.onDisconnected(now); }
+        if (client_.connecting()) return;
+        if (opt.linear ? (attempted_ && now - lastAttempt_ < linearMs_) : !backoff_.ready(now)) return;
+        client_.setServer(opt.host, opt.port);
+        client_.connect(node_id, mqtt_username, mqtt_password);
+        ++totals.attempts;
+        size_t sec = now / 1000;
+        if (sec >= attemptsPerSec.size()) attemptsPerSec.resize(sec + 1);
+        ++attemptsPerSec[sec];
+        backoff_.onAttempt(now);
+        linearMs_ = std::min<uint32_t>(linearMs_ + 5000, 60000);
+        lastAttempt_ = now; attempted_ = true;
+    }
+
+    // ---- mqttMaybePublish() + mqttDrainQueue() ----
+    void publish(uint32_t now) {
+        if (valid_ && (int32_t)(now - nextPub_) >= 0) {
+            nextPub_ += opt.publishMs;
+            if (!queue_.push(Sample{latest_, ++seq_})) ++totals.dropped;
+        }
+        if (!client_.connected()) return;
+        while (auto* e = queue_.due(now, ACK_TIMEOUT_MS)) {
+            const bool dup = e->packetId != 0;
+            const uint16_t id = dup ? e->packetId : client_.nextPacketId();
+            // same shape as makeMeasurementPayload(); one frame per sample here
+            FixedString<127> payload;
+            payload += "{\"measurement\":{\"pm1\":"; appendFixed(payload, e->item.pms.pm1_atm * 10, 1);
+            payload += ",\"pm25\":";                appendFixed(payload, e->item.pms.pm25_atm * 10, 1);
+            payload += ",\"pm10\":";                appendFixed(payload, e->item.pms.pm10_atm * 10, 1);
+            payload.appendf("},\"seq\":%u,\"n\":1}", e->item.seq);
+            if (!client_.publish(topic_, (const uint8_t*)payload.c_str(), payload.length(), 1, true, dup, id)) return;
+            queue_.markSent(e, id, now);
+            ++totals.sent;
+        }
+    }
+
+public:
+    void onAck(uint16_t id) { if (queue_.ack(id)) ++totals.acked; }
+
+private:
+    double uniform() { rng_ ^= rng_ << 13; rng_ ^= rng_ >> 17; rng_ ^= rng_ << 5; return (rng_ & 0xFFFFFF) / 16777216.0; }
+    double gauss()   { return uniform() + uniform() + uniform() - 1.5; }
+
+    SimSocket net_;
+    mqtt::Client<SimSocket> client_;
+    mqtt::PublishQueue<Sample, QUEUE_LEN, INFLIGHT_MAX> queue_;
+    Backoff    backoff_;
+    PmsParser  parser_;
+    PmsReading latest_ = {};
+    bool       valid_ = false;
+    uint32_t   seq_ = 0;
+    char       topic_[96];
+    uint32_t   rng_;
+    double     base_, phase_, noise_ = 0, plume_ = 0;
+    uint32_t   bootAt_, nextStep_, nextFrame_, nextPub_;
+    uint32_t   lastAttempt_ = 0, linearMs_ = 0;
+    bool       attempted_ = false, wasConnected_ = false;
+};
+Node* Node::current = nullptr;
+
+// mqtt::Client takes a plain function pointer for PUBACKs; the event loop is
+// single-threaded, so the node currently inside step() is the recipient.
+void routeAck(uint16_t id) { if (Node::current) Node::current->onAck(id); }
+
+void stepNode(Node& n, uint32_t now) {
+    Node::current = &n;
+    n.step(now);
+    Node::current = nullptr;
+}
+
+// ================================ Helpers ==================================
+size_t rssBytes() {
+    long pages = 0, rss = 0;
+    if (FILE* f = fopen("/proc/self/statm", "r")) { if (fscanf(f, "%ld %ld", &pages, &rss) != 2) rss = 0; fclose(f); }
+    return (size_t)rss * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+void raiseFdLimit(uint32_t nodes) {
+    rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    const rlim_t need = (rlim_t)nodes * (opt.port ? 1 : 2) + 64;
+    if (rl.rlim_cur < need)
+        fprintf(stderr, "warning: fd limit %llu < %llu needed; raise `ulimit -n`\n",
+                (unsigned long long)rl.rlim_cur, (unsigned long long)need);
+}
+
+void parseArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        auto val = [&](const char* k) -> const char* { size_t n = strlen(k); return strncmp(a, k, n) == 0 ? a + n : nullptr; };
+        if (const char* v = val("--nodes="))                opt.nodes = (uint32_t)atoi(v);
+        else if (const char* v = val("--duration="))        opt.durationMs = (uint32_t)(atof(v) * 1000);
+        else if (const char* v = val("--publish-interval=")) opt.publishMs = (uint32_t)(atof(v) * 1000);
+        else if (const char* v = val("--boot-spread="))     opt.bootSpread = (uint32_t)(atof(v) * 1000);
+        else if (const char* v = val("--step-ms="))         opt.stepMs = (uint32_t)atoi(v);
+        else if (const char* v = val("--report="))          opt.reportMs = (uint32_t)(atof(v) * 1000);
+        else if (const char* v = val("--speed="))           opt.speed = atof(v);
+        else if (const char* v = val("--backoff="))         opt.linear = !strcmp(v, "linear");
+        else if (const char* v = val("--broker-restart=")) {
+            double at = 0, len = 0;
+            if (sscanf(v, "%lf:%lf", &at, &len) == 2) opt.restarts.push_back({(uint32_t)(at * 1000), (uint32_t)(len * 1000)});
+        } else if (const char* v = val("--broker=")) {
+            static char host[64];
+            if (sscanf(v, "%63[^:]:%hu", host, &opt.port) == 2) opt.host = host;
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--nodes=N] [--duration=S] [--speed=X] [--publish-interval=S]\n"
+                    "          [--boot-spread=S] [--step-ms=MS] [--report=S] [--backoff=jitter|linear]\n"
+                    "          [--broker=IP:PORT | --broker-restart=AT_S:DOWN_S ...]\n", argv[0]);
+            exit(2);
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    parseArgs(argc, argv);
+    raiseFdLimit(opt.nodes);
+
+    std::unique_ptr<BrokerStandin> broker;
+    if (!opt.port) {
+        broker.reset(new BrokerStandin());
+        if (!broker->up()) { fprintf(stderr, "broker stand-in: bind failed\n"); return 1; }
+        opt.port = broker->port();
+    }
+    if (!opt.restarts.empty() && !broker) fprintf(stderr, "note: --broker-restart ignored with an external broker\n");
+
+    const size_t rss0 = rssBytes();
+    std::vector<std::unique_ptr<Node>> nodes;
+    nodes.reserve(opt.nodes);
+    for (uint32_t i = 0; i < opt.nodes; ++i) nodes.emplace_back(new Node(i));
+    const size_t rssNodes = rssBytes() - rss0;
+
+    printf("fleet: %u nodes -> %s:%u, speed x%.1f, publish every %u ms, %s backoff\n",
+           opt.nodes, opt.host, opt.port, opt.speed, opt.publishMs, opt.linear ? "linear" : "jittered");
+    printf("%8s %9s %10s %9s %9s %9s\n", "t[s]", "connected", "attempts/s", "acked/s", "broker/s", "backlog");
+
+    startNs = monoNs();
+    std::vector<uint32_t> upAt;                 // when each scripted restart brought the broker back
+    uint32_t nextReport = opt.reportMs;
+    Totals last;
+    uint64_t lastBroker = 0;
+    for (;;) {
+        const uint32_t now = simMillis();
+        if (now >= opt.durationMs) break;
+
+        if (broker) {
+            bool down = false;
+            for (auto& r : opt.restarts) if (now >= r.atMs && now < r.atMs + r.downMs) down = true;
+            if (down && broker->isUp()) broker->down();
+            else if (!down && !broker->isUp()) { broker->up(); upAt.push_back(now); }
+            broker->poll();
+        }
+        for (auto& n : nodes) if (n->due(now)) stepNode(*n, now);
+        if (broker) broker->poll(1); else usleep(1000);
+
+        if (now >= nextReport) {
+            const double dt = opt.reportMs / 1000.0;
+            size_t conn = 0, backlog = 0;
+            for (auto& n : nodes) { conn += n->connected(); backlog += n->backlog(); }
+            const uint64_t b = broker ? broker->stats.publishes : 0;
+            printf("%8.0f %9zu %10.1f %9.1f %9.1f %9zu\n", now / 1000.0, conn,
+                   (totals.attempts - last.attempts) / dt, (totals.acked - last.acked) / dt,
+                   (b - lastBroker) / dt, backlog);
+            fflush(stdout);
+            last = totals; lastBroker = b;
+            nextReport += opt.reportMs;
+        }
+    }
+
+    const double secs = simMillis() / 1000.0;
+    printf("\n=== fleet summary (%.0f s virtual, %u nodes) ===\n", secs, opt.nodes);
+    printf("publishes sent / acked : %llu / %llu (%.1f acked msg/s)\n",
+           (unsigned long long)totals.sent, (unsigned long long)totals.acked, totals.acked / secs);
+    printf("connect attempts       : %llu, sessions %llu, lost %llu, queue evictions %llu\n",
+           (unsigned long long)totals.attempts, (unsigned long long)totals.connects,
+           (unsigned long long)totals.losses, (unsigned long long)totals.dropped);
+    if (broker)
+        printf("broker received        : %llu PUBLISH (%llu DUP), %llu CONNECT\n",
+               (unsigned long long)broker->stats.publishes, (unsigned long long)broker->stats.dups,
+               (unsigned long long)broker->stats.connects);
+    for (size_t i = 0; i < upAt.size(); ++i) {
+        const uint32_t s0 = upAt[i] / 1000;
+        uint32_t peak = 0, total = 0, p99sec = 0, busy = 0;
+        const uint32_t window = std::min<uint32_t>(120, (uint32_t)attemptsPerSec.size() > s0 ? (uint32_t)attemptsPerSec.size() - s0 : 0);
+        for (uint32_t s = 0; s < window; ++s) total += attemptsPerSec[s0 + s];
+        uint32_t run = 0;
+        printf("restart %zu: connect attempts per second after broker came back (t=%u s)\n  ", i + 1, s0);
+        for (uint32_t s = 0; s < window; ++s) {
+            uint32_t a = attemptsPerSec[s0 + s];
+            peak = std::max(peak, a);
+            busy += a > 0;
+            run += a;
+            if (!p99sec && run >= total * 0.99) p99sec = s + 1;
+            printf("%u%s", a, s + 1 < window ? " " : "\n");
+        }
+        printf("  peak %u/s (%.0f%% of attempts), %u attempts spread over %u distinct seconds, 99%% within %u s\n",
+               peak, total ? 100.0 * peak / total : 0.0, total, busy, p99sec);
+    }
+    printf("memory per node        : %zu B struct, %.0f B RSS (incl. sockets' user-space buffers)\n",
+           sizeof(Node), opt.nodes ? (double)rssNodes / opt.nodes : 0.0);
+    return 0;
+}
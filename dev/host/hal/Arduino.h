@@ -0,0 +1,318 @@
+/*
+ Host HAL — Arduino core subset for building the firmware natively
+ ------------------------------------------------------------
+ Only what ParticularMatter_public.cpp touches is provided. Time is virtual:
+ millis() returns hal::clock and only moves when the harness advances it or
+ the firmware calls delay(). Every delay()/yield() step runs hal::idleHook,
+ which is where the harness services its broker stand-in, so code that busy
+ waits on the network still makes progress in a single thread.
+ */
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "umm_malloc/umm_malloc.h"   // malloc accounting + shadow heap behind ESP.getFreeHeap()
+
+using std::min;
+using std::max;
+
+// ================================ Clock ====================================
+namespace hal {
+inline uint64_t clockUs  = 0;            // virtual time since boot
+inline void   (*idleHook)() = nullptr;   // run on every delay()/yield() step
+inline void   (*radioTick)() = nullptr;  // "SDK" work per ms: Wi-Fi state, event callbacks
+inline bool     quiet    = false;        // suppress Serial output
+
+inline void advanceMs(uint32_t ms) {
+    AllocPause host;
+    for (uint32_t i = 0; i < ms; ++i) {
+        clockUs += 1000;
+        if (radioTick) radioTick();
+        if (idleHook) idleHook();
+    }
+}
+} // namespace hal
+
+
+inline unsigned long millis() { return (unsigned long)(uint32_t)(hal::clockUs / 1000); }
+inline unsigned long micros() { return (unsigned long)(uint32_t)hal::clockUs; }
+inline void delay(unsigned long ms) { hal::advanceMs((uint32_t)ms); }
+inline void yield() { hal::AllocPause host; if (hal::idleHook) hal::idleHook(); }
+
+// ================================= GPIO ====================================
+#define INPUT        0x00
+#define OUTPUT       0x01
+#define INPUT_PULLUP 0x02
+#define LOW          0
+#define HIGH         1
+
+namespace hal {
+inline uint8_t pinLevel[17] = {};        // harness drives inputs here
+inline uint8_t pinModes[17] = {};
+} // namespace hal
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin < 17) {
+        hal::pinModes[pin] = mode;
+        if (mode == INPUT_PULLUP) hal::pinLevel[pin] = HIGH;
+    }
+}
+inline int  digitalRead(uint8_t pin) { return pin < 17 ? hal::pinLevel[pin] : LOW; }
+inline void digitalWrite(uint8_t pin, uint8_t v) { if (pin < 17) hal::pinLevel[pin] = v ? HIGH : LOW; }
+
+// ============================ Flash strings ================================
+// <pgmspace.h> subset. On the host everything is byte-addressable, so the
+// _P functions are the plain ones; PROGMEM data is still collected in its own
+// section (.pm_flash) so dram_report.sh can tell what the device would keep
+// in flash from what stays in .rodata (= DRAM on the ESP8266).
+#ifndef HAL_PROGMEM_SECTION
+#define HAL_PROGMEM_SECTION 1
+#endif
+#if HAL_PROGMEM_SECTION
+#define PROGMEM __attribute__((section(".pm_flash")))
+#define PSTR(s) (__extension__({ static const char __pstr__[] PROGMEM = (s); &__pstr__[0]; }))
+#else
+#define PROGMEM
+#define PSTR(s) (s)
+#endif
+#define PGM_P const char*                  // a macro in the core too: headers test #ifdef PGM_P
+class __FlashStringHelper;
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper*>(p))
+#define F(s)     FPSTR(PSTR(s))
+
+#define pgm_read_byte(p)  (*(const uint8_t*)(p))
+#define pgm_read_word(p)  (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#define pgm_read_ptr(p)   (*(const void* const*)(p))
+inline size_t strlen_P(PGM_P s)                          { return strlen(s); }
+inline char*  strcpy_P(char* d, PGM_P s)                 { return strcpy(d, s); }
+inline char*  strncpy_P(char* d, PGM_P s, size_t n)      { return strncpy(d, s, n); }
+inline int    strcmp_P(const char* a, PGM_P b)           { return strcmp(a, b); }
+inline void*  memcpy_P(void* d, const void* s, size_t n) { return memcpy(d, s, n); }
+inline int    vsnprintf_P(char* b, size_t n, PGM_P f, va_list ap) { return vsnprintf(b, n, f, ap); }
+inline int    snprintf_P(char* b, size_t n, PGM_P f, ...) {
+    va_list ap; va_start(ap, f);
+    int r = vsnprintf(b, n, f, ap);
+    va_end(ap);
+    return r;
+}
+
+// ================================ String ===================================
+// Arduino String on top of std::string: same surface, same heap behaviour
+// (every temporary allocates), which is what we want to observe on the host.
+class String {
+public:
+    String() = default;
+    String(const char* s) : s_(s ? s : "") {}
+    String(const __FlashStringHelper* s) : String(reinterpret_cast<const char*>(s)) {}
+    String(const std::string& s) : s_(s) {}
+    explicit String(char c) : s_(1, c) {}
+    explicit String(unsigned char v) : s_(std::to_string(v)) {}
+    explicit String(int v) : s_(std::to_string(v)) {}
+    explicit String(unsigned int v) : s_(std::to_string(v)) {}
+    explicit String(long v) : s_(std::to_string(v)) {}
+    explicit String(unsigned long v) : s_(std::to_string(v)) {}
+    explicit String(float v, unsigned char decimals = 2) : String((double)v, decimals) {}
+    explicit String(double v, unsigned char decimals = 2) {
+        char b[48]; snprintf(b, sizeof(b), "%.*f", decimals, v); s_ = b;
+    }
+
+    const char*  c_str() const   { return s_.c_str(); }
+    unsigned int length() const  { return (unsigned int)s_.size(); }
+    bool         isEmpty() const { return s_.empty(); }
+    bool         reserve(unsigned int n) { s_.reserve(n); return true; }
+    long         toInt() const   { return strtol(s_.c_str(), nullptr, 10); }
+    char         operator[](unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+    char         charAt(unsigned int i) const { return (*this)[i]; }
+
+    int indexOf(char c, unsigned int from = 0) const { auto p = s_.find(c, from); return p == std::string::npos ? -1 : (int)p; }
+    int indexOf(const String& t, unsigned int from = 0) const { auto p = s_.find(t.s_, from); return p == std::string::npos ? -1 : (int)p; }
+    int lastIndexOf(char c) const { auto p = s_.rfind(c); return p == std::string::npos ? -1 : (int)p; }
+    String substring(unsigned int from) const { return from >= s_.size() ? String() : String(s_.substr(from)); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) std::swap(from, to);
+        if (from >= s_.size()) return String();
+        return String(s_.substr(from, to - from));
+    }
+    bool startsWith(const String& p) const { return s_.compare(0, p.s_.size(), p.s_) == 0; }
+    bool equals(const String& o) const { return s_ == o.s_; }
+    void trim() {
+        size_t b = s_.find_first_not_of(" \t\r\n"), e = s_.find_last_not_of(" \t\r\n");
+        s_ = b == std::string::npos ? std::string() : s_.substr(b, e - b + 1);
+    }
+
+    String& operator+=(const String& o) { s_ += o.s_; return *this; }
+    String& operator+=(const char* o)   { if (o) s_ += o; return *this; }
+    String& operator+=(const __FlashStringHelper* o) { return *this += reinterpret_cast<const char*>(o); }
+    String& operator+=(char c)          { s_ += c; return *this; }
+    String& operator+=(int v)           { s_ += std::to_string(v); return *this; }
+    String& operator+=(unsigned int v)  { s_ += std::to_string(v); return *this; }
+    String& operator+=(long v)          { s_ += std::to_string(v); return *this; }
+    String& operator+=(unsigned long v) { s_ += std::to_string(v); return *this; }
+    bool concat(const char* s, unsigned int n) { s_.append(s, n); return true; }
+
+    friend String operator+(const String& a, const String& b) { String r(a); r += b; return r; }
+    friend String operator+(const String& a, const char* b)   { String r(a); r += b; return r; }
+    friend String operator+(const String& a, const __FlashStringHelper* b) { String r(a); r += b; return r; }
+    friend String operator+(const char* a, const String& b)   { String r(a); r += b; return r; }
+    friend String operator+(const String& a, char b)          { String r(a); r += b; return r; }
+    friend bool operator==(const String& a, const String& b) { return a.s_ == b.s_; }
+    friend bool operator!=(const String& a, const String& b) { return a.s_ != b.s_; }
+    friend bool operator==(const String& a, const char* b)   { return a.s_ == (b ? b : ""); }
+    friend bool operator!=(const String& a, const char* b)   { return !(a == b); }
+
+private:
+    std::string s_;
+};
+inline const String emptyString;
+
+// ================================ Serial ===================================
+class HardwareSerial {
+public:
+    void begin(unsigned long) {}
+    operator bool() const { return true; }
+    // stdio's own buffer is the host's, not the node's: output runs uncounted.
+    int printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        hal::AllocPause uart;
+        va_list ap; va_start(ap, fmt);
+        int n = hal::quiet ? 0 : vprintf(fmt, ap);
+        va_end(ap);
+        return n;
+    }
+    int printf_P(PGM_P fmt, ...) {
+        hal::AllocPause uart;
+        va_list ap; va_start(ap, fmt);
+        int n = hal::quiet ? 0 : vprintf(fmt, ap);
+        va_end(ap);
+        return n;
+    }
+    size_t print(char c)              { hal::AllocPause uart; if (!hal::quiet) putchar(c); return 1; }
+    size_t print(const char* s)       { hal::AllocPause uart; if (!hal::quiet) fputs(s, stdout); return strlen(s); }
+    size_t print(const String& s)     { return print(s.c_str()); }
+    size_t print(const __FlashStringHelper* s) { return print(reinterpret_cast<const char*>(s)); }
+    size_t print(int v)               { return (size_t)printf("%d", v); }
+    size_t print(unsigned int v)      { return (size_t)printf("%u", v); }
+    size_t print(unsigned long v)     { return (size_t)printf("%lu", v); }
+    size_t println()                  { return print('\n'); }
+    template <class T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+    void flush() { fflush(stdout); }
+};
+inline HardwareSerial Serial;
+
+// ============================== IPAddress ==================================
+class IPAddress {
+public:
+    IPAddress() = default;
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : b_{a, b, c, d} {}
+    uint8_t operator[](int i) const { return b_[i]; }
+    bool isSet() const { return b_[0] | b_[1] | b_[2] | b_[3]; }
+    String toString() const {
+        char s[16]; snprintf(s, sizeof(s), "%u.%u.%u.%u", b_[0], b_[1], b_[2], b_[3]); return String(s);
+    }
+    bool operator==(const IPAddress& o) const { return memcmp(b_, o.b_, 4) == 0; }
+    bool operator!=(const IPAddress& o) const { return !(*this == o); }
+private:
+    uint8_t b_[4] = {0, 0, 0, 0};
+};
+
+// ================================== ESP ====================================
+namespace hal {
+inline uint32_t chipId      = 0x00C0FFEE;
+inline bool     restartFlag = false;     // harness decides what a reboot means
+inline uint32_t rtcMem[128] = {};        // RTC user memory: survives restart(), not the process
+
+// SPI flash, backed by a file (a temporary one unless flashPath is set).
+// The layout is a 4 MB part with the file system from 2 MB: the free sketch
+// space, where an update goes, is everything between the sketch and that.
+// NOR semantics: erase sets a sector to 0xFF, a write can only clear bits.
+// A write that would set one is counted, and lands as old & new like on
+// the chip. Erase takes the chip's typical time, during which nothing runs.
+inline const char* flashPath    = nullptr;
+inline uint32_t    flashSize    = 4u << 20;
+inline uint32_t    flashFsStart = 2u << 20;
+inline uint32_t    sketchSize   = 420u << 10;
+inline uint32_t    flashEraseUs = 30000;
+inline struct { uint32_t erases = 0, writes = 0, reads = 0, unerasedWrites = 0, misaligned = 0; } flashStats;
+
+inline FILE* flashFile() {
+    static FILE* f = nullptr;
+    if (!f) {
+        AllocPause host;
+        f = flashPath ? fopen(flashPath, "r+b") : nullptr;
+        if (!f) f = flashPath ? fopen(flashPath, "w+b") : tmpfile();
+    }
+    return f;
+}
+
+inline bool flashIo(uint32_t addr, void* buf, size_t n, bool write) {
+    if (addr % 4 || n % 4) { ++flashStats.misaligned; return false; }
+    if (addr + n > flashSize) return false;
+    AllocPause host;
+    FILE* f = flashFile();
+    if (!f || fseek(f, addr, SEEK_SET)) return false;
+    if (write) return fwrite(buf, 1, n, f) == n && fflush(f) == 0;
+    const size_t got = fread(buf, 1, n, f);
+    memset((uint8_t*)buf + got, 0xFF, n - got);  // never written: erased
+    return true;
+}
+} // namespace hal
+
+class EspClass {
+public:
+    uint32_t getFreeHeap() const          { return hal::heapFree(); }
+    uint32_t getMaxFreeBlockSize() const  { return hal::heapMaxBlock(); }
+    uint8_t  getHeapFragmentation() const { return hal::heapFragmentation(); }
+    void     getHeapStats(uint32_t* free = nullptr, uint16_t* max = nullptr, uint8_t* frag = nullptr) const {
+        if (free) *free = getFreeHeap();
+        if (max)  *max  = (uint16_t)std::min<uint32_t>(getMaxFreeBlockSize(), 0xFFFF);
+        if (frag) *frag = getHeapFragmentation();
+    }
+    uint32_t getChipId() const   { return hal::chipId; }
+    void     restart()           { hal::restartFlag = true; }
+    uint32_t random() const      { static uint64_t s = 0x9E3779B97F4A7C15ull ^ hal::chipId; s ^= s << 13; s ^= s >> 7; s ^= s << 17; return (uint32_t)(s >> 32); }
+
+    uint32_t getSketchSize() const      { return hal::sketchSize; }
+    uint32_t getFreeSketchSpace() const { return hal::flashFsStart - ((hal::sketchSize + 4095) & ~4095u); }
+    bool flashEraseSector(uint32_t sector) {
+        hal::AllocPause host;                    // the HAL's buffers are not the node's heap
+        static const std::vector<uint8_t> ff(4096, 0xFF);
+        ++hal::flashStats.erases;
+        hal::clockUs += hal::flashEraseUs;
+        return hal::flashIo(sector * 4096, const_cast<uint8_t*>(ff.data()), ff.size(), true);
+    }
+    bool flashWrite(uint32_t address, const uint32_t* data, size_t size) {
+        hal::AllocPause host;
+        ++hal::flashStats.writes;
+        std::vector<uint32_t> cur(size / 4 + 1);
+        if (!hal::flashIo(address, cur.data(), size, false)) return false;
+        for (size_t i = 0; i < size / 4; ++i) {
+            if (data[i] & ~cur[i]) ++hal::flashStats.unerasedWrites;
+            cur[i] &= data[i];
+        }
+        return hal::flashIo(address, cur.data(), size, true);
+    }
+    bool flashRead(uint32_t address, uint32_t* data, size_t size) {
+        ++hal::flashStats.reads;
+        return hal::flashIo(address, data, size, false);
+    }
+
+    // Same contract as the core: offset in 32-bit blocks, size in bytes, 512 bytes total.
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+        if (offset * 4 + size > sizeof(hal::rtcMem)) return false;
+        memcpy(data, (uint8_t*)hal::rtcMem + offset * 4, size);
+        return true;
+    }
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+        if (offset * 4 + size > sizeof(hal::rtcMem)) return false;
+        memcpy((uint8_t*)hal::rtcMem + offset * 4, data, size);
+        return true;
+    }
+};
+inline EspClass ESP;
@@ -0,0 +1,321 @@
+/*
+ Host HAL — ArduinoJson 6 subset
+ ------------------------------------------------------------
+ Enough of the v6 API for the firmware's config handler:
+ StaticJsonDocument<N>, deserializeJson(doc, input, length),
+ DeserializationError, and read-only JsonObjectConst / JsonPairConst /
+ JsonVariantConst with is<T>() / as<T>() for integers, bool and strings.
+ Only the top-level object's members can be read. Nested objects and arrays
+ are parsed and their size is counted, but they read as neither a number
+ nor a string.
+
+ The capacity is accounted the way ArduinoJson 6 does it on a 32-bit
+ target: 16 bytes per value slot, plus a copy of every key and string
+ (input given as const char*). A document that does not fit fails with
+ NoMemory, as it does on the device. Nesting deeper than 10 fails with
+ TooDeep. No heap: the members live inside the document.
+ */
+#pragma once
+
+#include "Arduino.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <limits>
+#include <type_traits>
+
+class DeserializationError {
+public:
+    enum Code { Ok, EmptyInput, IncompleteInput, InvalidInput, NoMemory, TooDeep };
+    DeserializationError(Code c = Ok) : code_(c) {}
+    explicit operator bool() const { return code_ != Ok; }
+    Code code() const { return code_; }
+    const char* c_str() const {
+        static const char* const names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep"};
+        return names[code_];
+    }
+private:
+    Code code_;
+};
+
+namespace hal_json {
+constexpr size_t kSlot     = 16;     // sizeof(VariantSlot) on a 32-bit target
+constexpr size_t kMembers  = 24;     // top-level members this stand-in can hold
+constexpr int    kMaxDepth = 10;     // ArduinoJson's default nesting limit
+
+enum Kind : uint8_t { NUL, BOOL, INT, FLOAT, STRING, NESTED };
+
+struct Value {
+    Kind        kind = NUL;
+    bool        b = false;
+    long long   i = 0;
+    const char* s = nullptr;
+};
+} // namespace hal_json
+
+class JsonString {
+public:
+    explicit JsonString(const char* s) : s_(s) {}
+    const char* c_str() const { return s_; }
+private:
+    const char* s_;
+};
+
+class JsonVariantConst {
+public:
+    JsonVariantConst() = default;
+    explicit JsonVariantConst(const hal_json::Value* v) : v_(v) {}
+
+    bool isNull() const { return !v_ || v_->kind == hal_json::NUL; }
+
+    template <class T> bool is() const {
+        if (!v_) return false;
+        if constexpr (std::is_same<T, bool>::value) return v_->kind == hal_json::BOOL;
+        else if constexpr (std::is_same<T, const char*>::value) return v_->kind == hal_json::STRING;
+        else if constexpr (std::is_integral<T>::value)
+            return v_->kind == hal_json::INT && v_->i >= (long long)std::numeric_limits<T>::min() &&
+                   v_->i <= (long long)std::numeric_limits<T>::max();
+        else return false;
+    }
+
+    template <class T> T as() const {
+        if constexpr (std::is_same<T, const char*>::value) return is<const char*>() ? v_->s : nullptr;
+        else if constexpr (std::is_same<T, bool>::value) return v_ && v_->kind == hal_json::BOOL && v_->b;
+        else return v_ && v_->kind == hal_json::INT ? (T)v_->i : T();
+    }
+
+private:
+    const hal_json::Value* v_ = nullptr;
+};
+
+class JsonPairConst {
+public:
+    JsonPairConst(const char* k, const hal_json::Value* v) : k_(k), v_(v) {}
+    JsonString       key() const   { return k_; }
+    JsonVariantConst value() const { return v_; }
+private:
+    JsonString       k_;
+    JsonVariantConst v_;
+};
+
+class JsonDocument;
+
+class JsonObjectConst {
+public:
+    class iterator {
+    public:
+        iterator(const JsonDocument* d, size_t i) : d_(d), i_(i) {}
+        JsonPairConst operator*() const;
+        iterator& operator++() { ++i_; return *this; }
+        bool operator!=(const iterator& o) const { return i_ != o.i_; }
+    private:
+        const JsonDocument* d_;
+        size_t i_;
+    };
+
+    JsonObjectConst() = default;
+    explicit JsonObjectConst(const JsonDocument* d) : d_(d) {}
+    bool     isNull() const { return !d_; }
+    size_t   size() const;
+    iterator begin() const { return iterator(d_, 0); }
+    iterator end() const   { return iterator(d_, size()); }
+    JsonVariantConst operator[](const char* key) const;
+private:
+    const JsonDocument* d_ = nullptr;
+};
+
+class JsonDocument {
+public:
+    template <class T> T as() const;
+    size_t memoryUsage() const { return used_; }
+    size_t capacity() const    { return cap_; }
+    void   clear() { n_ = 0; used_ = 0; object_ = false; }
+    JsonVariantConst operator[](const char* key) const;
+
+protected:
+    JsonDocument(char* pool, size_t cap) : pool_(pool), cap_(cap) {}
+
+private:
+    friend class JsonObjectConst;
+    friend DeserializationError deserializeJson(JsonDocument&, const char*, size_t);
+    friend struct JsonParser_;
+
+    char*           pool_;
+    size_t          cap_;
+    size_t          used_ = 0;
+    bool            object_ = false;
+    size_t          n_ = 0;
+    const char*     keys_[hal_json::kMembers] = {};
+    hal_json::Value vals_[hal_json::kMembers];
+};
+
+template <> inline JsonObjectConst JsonDocument::as<JsonObjectConst>() const {
+    return object_ ? JsonObjectConst(this) : JsonObjectConst();
+}
+
+inline JsonVariantConst JsonDocument::operator[](const char* key) const { return as<JsonObjectConst>()[key]; }
+inline size_t JsonObjectConst::size() const { return d_ ? d_->n_ : 0; }
+inline JsonPairConst JsonObjectConst::iterator::operator*() const { return JsonPairConst(d_->keys_[i_], &d_->vals_[i_]); }
+inline JsonVariantConst JsonObjectConst::operator[](const char* key) const {
+    for (size_t i = 0; d_ && i < d_->n_; ++i)
+        if (!strcmp(d_->keys_[i], key)) return JsonVariantConst(&d_->vals_[i]);
+    return JsonVariantConst();
+}
+
+template <size_t N>
+class StaticJsonDocument : public JsonDocument {
+public:
+    StaticJsonDocument() : JsonDocument(pool_, N) {}
+    StaticJsonDocument(const StaticJsonDocument&) = delete;
+private:
+    char pool_[N];
+};
+
+struct JsonParser_ {
+    JsonDocument& d;
+    const char*   p;
+    const char*   end;
+    DeserializationError::Code err = DeserializationError::Ok;
+
+    bool fail(DeserializationError::Code c) { if (!err) err = c; return false; }
+    bool take(size_t n) { if (d.used_ + n > d.cap_) return fail(DeserializationError::NoMemory); d.used_ += n; return true; }
+    void ws() { while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p; }
+    bool lit(const char* w) {
+        const size_t n = strlen(w);
+        if ((size_t)(end - p) < n) return fail(DeserializationError::IncompleteInput);
+        if (strncmp(p, w, n)) return fail(DeserializationError::InvalidInput);
+        p += n;
+        return true;
+    }
+
+    // A string, copied into the pool (escapes decoded, \u limited to ASCII) when out != null.
+    bool str(const char** out) {
+        ++p;                                               // opening quote
+        char* dst = d.pool_ + d.used_;
+        size_t n = 0;
+        for (;;) {
+            if (p >= end) return fail(DeserializationError::IncompleteInput);
+            char c = *p++;
+            if (c == '"') break;
+            if (c == '\\') {
+                if (p >= end) return fail(DeserializationError::IncompleteInput);
+                c = *p++;
+                switch (c) {
+                    case 'n': c = '\n'; break;
+                    case 't': c = '\t'; break;
+                    case 'r': c = '\r'; break;
+                    case 'b': c = '\b'; break;
+                    case 'f': c = '\f'; break;
+                    case 'u': {
+                        if (end - p < 4) return fail(DeserializationError::IncompleteInput);
+                        char hex[5] = {p[0], p[1], p[2], p[3], 0};
+                        c = (char)strtol(hex, nullptr, 16);
+                        p += 4;
+                        break;
+                    }
+                    default: break;                        // " \ /
+                }
+            }
+            if (d.used_ + n + 1 > d.cap_) return fail(DeserializationError::NoMemory);
+            dst[n++] = c;
+        }
+        dst[n] = 0;
+        if (!take(n + 1)) return false;
+        if (out) *out = dst;
+        return true;
+    }
+
+    bool value(hal_json::Value* v, int depth) {
+        ws();
+        if (p >= end) return fail(DeserializationError::IncompleteInput);
+        hal_json::Value tmp;
+        if (!v) v = &tmp;
+        switch (*p) {
+            case '{': case '[': {
+                if (depth >= hal_json::kMaxDepth) return fail(DeserializationError::TooDeep);
+                const char close = *p == '{' ? '}' : ']';
+                const bool obj = close == '}';
+                ++p; ws();
+                v->kind = hal_json::NESTED;
+                if (p < end && *p == close) { ++p; return true; }
+                for (;;) {
+                    ws();
+                    if (obj) {
+                        if (p >= end) return fail(DeserializationError::IncompleteInput);
+                        if (*p != '"' || !str(nullptr)) return fail(DeserializationError::InvalidInput);
+                        ws();
+                        if (p >= end) return fail(DeserializationError::IncompleteInput);
+                        if (*p++ != ':') return fail(DeserializationError::InvalidInput);
+                    }
+                    if (!take(hal_json::kSlot) || !value(nullptr, depth + 1)) return false;
+                    ws();
+                    if (p >= end) return fail(DeserializationError::IncompleteInput);
+                    if (*p == ',') { ++p; continue; }
+                    if (*p++ == close) return true;
+                    return fail(DeserializationError::InvalidInput);
+                }
+            }
+            case '"':
+                v->kind = hal_json::STRING;
+                return str(&v->s);
+            case 't': v->kind = hal_json::BOOL; v->b = true;  return lit("true");
+            case 'f': v->kind = hal_json::BOOL; v->b = false; return lit("false");
+            case 'n': v->kind = hal_json::NUL;                return lit("null");
+            default: {
+                char num[32];
+                size_t n = 0;
+                bool integer = true;
+                while (p < end && n + 1 < sizeof(num) && strchr("+-0123456789.eE", *p)) {
+                    integer &= *p != '.' && *p != 'e' && *p != 'E';
+                    num[n++] = *p++;
+                }
+                num[n] = 0;
+                char* stop = nullptr;
+                if (!n) return fail(DeserializationError::InvalidInput);
+                if (integer) { v->kind = hal_json::INT; v->i = strtoll(num, &stop, 10); }
+                else         { v->kind = hal_json::FLOAT; strtod(num, &stop); }
+                return *stop ? fail(DeserializationError::InvalidInput) : true;
+            }
+        }
+    }
+
+    // The top level: an object's members are kept, anything else is parsed and counted.
+    bool top() {
+        ws();
+        if (p >= end) return fail(DeserializationError::EmptyInput);
+        if (*p != '{') return value(nullptr, 0);
+        ++p; ws();
+        d.object_ = true;
+        if (p < end && *p == '}') { ++p; return true; }
+        for (;;) {
+            ws();
+            if (p >= end) return fail(DeserializationError::IncompleteInput);
+            if (*p != '"') return fail(DeserializationError::InvalidInput);
+            if (d.n_ == hal_json::kMembers) return fail(DeserializationError::NoMemory);
+            if (!take(hal_json::kSlot) || !str(&d.keys_[d.n_])) return false;
+            ws();
+            if (p >= end) return fail(DeserializationError::IncompleteInput);
+            if (*p++ != ':') return fail(DeserializationError::InvalidInput);
+            d.vals_[d.n_] = hal_json::Value();
+            if (!value(&d.vals_[d.n_], 1)) return false;
+            ++d.n_;
+            ws();
+            if (p >= end) return fail(DeserializationError::IncompleteInput);
+            if (*p == ',') { ++p; continue; }
+            if (*p++ == '}') return true;
+            return fail(DeserializationError::InvalidInput);
+        }
+    }
+};
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* input, size_t length) {
+    doc.clear();
+    JsonParser_ ps{doc, input, input + length};
+    if (!ps.top()) { doc.clear(); return ps.err; }
+    return DeserializationError::Ok;
+}
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* input) {
+    return deserializeJson(doc, input, strlen(input));
+}
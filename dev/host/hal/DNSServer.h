@@ -0,0 +1,14 @@
+// Host HAL — DNSServer: the captive DNS has nothing to answer on the host.
+#pragma once
+
+#include "Arduino.h"
+
+class DNSServer {
+public:
+    bool start(uint16_t, const String&, const IPAddress&) { running_ = true; return true; }
+    void stop() { running_ = false; }
+    void processNextRequest() {}
+    bool running() const { return running_; }
+private:
+    bool running_ = false;
+};
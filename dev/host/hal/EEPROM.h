@@ -0,0 +1,47 @@
+/*
+ Host HAL — EEPROM emulation
+ ------------------------------------------------------------
+ Like the real core: begin() copies the backing "flash" sector into a RAM
+ mirror, put()/get() touch the mirror, commit() writes it back. Set
+ hal::eepromPath to persist the sector across harness runs.
+ */
+#pragma once
+
+#include "Arduino.h"
+
+#include <vector>
+
+namespace hal {
+inline const char* eepromPath = nullptr;
+inline uint32_t    eepromCommits = 0;
+} // namespace hal
+
+class EEPROMClass {
+public:
+    void begin(size_t size) {
+        if (flash_.size() < size) {
+            flash_.resize(size, 0xFF);
+            if (hal::eepromPath) if (FILE* f = fopen(hal::eepromPath, "rb")) {
+                size_t n = fread(flash_.data(), 1, size, f); (void)n; fclose(f);
+            }
+        }
+        bytes_.assign(flash_.begin(), flash_.begin() + size);
+    }
+    template <class T> T& get(int addr, T& t) const { memcpy(&t, bytes_.data() + addr, sizeof(T)); return t; }
+    template <class T> const T& put(int addr, const T& t) { memcpy(bytes_.data() + addr, &t, sizeof(T)); return t; }
+    uint8_t read(int addr) const { return bytes_[addr]; }
+    void write(int addr, uint8_t v) { bytes_[addr] = v; }
+    bool commit() {
+        ++hal::eepromCommits;
+        std::copy(bytes_.begin(), bytes_.end(), flash_.begin());
+        if (hal::eepromPath) if (FILE* f = fopen(hal::eepromPath, "wb")) {
+            fwrite(bytes_.data(), 1, bytes_.size(), f); fclose(f);
+        }
+        return true;
+    }
+    void end() {}
+private:
+    std::vector<uint8_t> flash_;
+    std::vector<uint8_t> bytes_;
+};
+inline EEPROMClass EEPROM;
@@ -0,0 +1,87 @@
+/*
+ Host HAL — ESP8266WebServer subset
+ ------------------------------------------------------------
+ No socket: the harness calls hostRequest() to run a route handler and then
+ reads the captured response (lastCode/lastType/lastBody).
+ */
+#pragma once
+
+#include "Arduino.h"
+
+#include <functional>
+#include <map>
+#include <vector>
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+
+class ESP8266WebServer {
+public:
+    typedef std::function<void()> THandlerFunction;
+
+    explicit ESP8266WebServer(int port = 80) : port_(port) {}
+
+    void on(const String& uri, HTTPMethod m, THandlerFunction fn) { routes_.push_back({uri, m, fn}); }
+    void on(const String& uri, THandlerFunction fn) { on(uri, HTTP_ANY, fn); }
+    void onNotFound(THandlerFunction fn) { notFound_ = fn; }
+    void begin() { running_ = true; }
+    void stop()  { running_ = false; }
+    void close() { stop(); }
+    void handleClient() {}
+
+    HTTPMethod method() const { return method_; }
+    String     uri() const    { return uri_; }
+    String     hostHeader() const { return host_; }
+    bool       hasArg(const String& n) const { return args_.count(n.c_str()) != 0; }
+    String     arg(const String& n) const { auto it = args_.find(n.c_str()); return it == args_.end() ? String() : String(it->second); }
+
+    void sendHeader(const String&, const String&, bool = false) {}
+    // The core reads content_type through FPSTR(), so it may be a PROGMEM string.
+    void send(int code, const char* type, const String& body) {
+        hal::AllocPause host;
+        lastCode = code; lastType = FPSTR(type); lastBody = body;
+    }
+    void send(int code, const String& type, const String& body) { send(code, type.c_str(), body); }
+    void send_P(int code, PGM_P type, PGM_P body) { send(code, type, String(FPSTR(body))); }
+
+    // Chunked responses: setContentLength(CONTENT_LENGTH_UNKNOWN), send() the
+    // headers, sendContent() the body, and a zero-length chunk to finish.
+    void setContentLength(size_t) {}
+    void sendContent(const char* data, size_t len) {
+        hal::AllocPause host;
+        lastBody += std::string(data, len).c_str();
+        ++lastChunks;
+    }
+    void sendContent(const String& s) { sendContent(s.c_str(), s.length()); }
+
+    // ---- host side ----
+    int hostRequest(HTTPMethod m, const char* uri, const std::map<std::string, std::string>& args = {},
+                    const char* host = "192.168.4.1") {
+        {
+            hal::AllocPause host_side;            // parsing the request is the core's job
+            lastCode = 0; lastBody = String(); lastChunks = 0;
+            if (!running_) return 0;
+            method_ = m; uri_ = uri; args_ = args; host_ = host;
+        }
+        for (auto& r : routes_)
+            if (r.uri == uri_ && (r.method == HTTP_ANY || r.method == m)) { r.fn(); return lastCode; }
+        if (notFound_) notFound_();
+        return lastCode;
+    }
+
+    int    lastCode = 0;
+    String lastType;
+    String lastBody;
+    int    lastChunks = 0;                  // sendContent() calls, including the final empty one
+
+private:
+    struct Route { String uri; HTTPMethod method; THandlerFunction fn; };
+    int port_;
+    bool running_ = false;
+    std::vector<Route> routes_;
+    THandlerFunction notFound_;
+    HTTPMethod method_ = HTTP_GET;
+    String uri_, host_;
+    std::map<std::string, std::string> args_;
+};
@@ -0,0 +1,292 @@
+/*
+ Host HAL — ESP8266WiFi subset
+ ------------------------------------------------------------
+ WiFi is a small scripted radio: STA joins hal::wifiJoinMs after begin()
+ while hal::apUp is true, and drops when the harness takes the AP down.
+ The radio advances once per virtual ms (hal::radioTick) and fires the
+ onStationModeGotIP / onStationModeDisconnected handlers on every change,
+ from inside delay()/yield() like the SDK does. hostInjectGotIP() and
+ hostInjectDisconnected() deliver an event without any change in the
+ radio, to test how the firmware copes with spurious or reordered events.
+ WiFiClient is a real non-blocking TCP socket, so the firmware talks to a
+ localhost broker stand-in exactly as it would to a remote one.
+ */
+#pragma once
+
+#include "Arduino.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } WiFiMode_t;
+
+typedef enum { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 } WiFiSleepType_t;
+
+typedef enum {
+    WL_IDLE_STATUS     = 0,
+    WL_NO_SSID_AVAIL   = 1,
+    WL_SCAN_COMPLETED  = 2,
+    WL_CONNECTED       = 3,
+    WL_CONNECT_FAILED  = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_WRONG_PASSWORD  = 6,
+    WL_DISCONNECTED    = 7
+} wl_status_t;
+
+typedef enum {
+    WIFI_DISCONNECT_REASON_UNSPECIFIED       = 1,
+    WIFI_DISCONNECT_REASON_AUTH_EXPIRE       = 2,
+    WIFI_DISCONNECT_REASON_ASSOC_LEAVE       = 8,
+    WIFI_DISCONNECT_REASON_BEACON_TIMEOUT    = 200,
+    WIFI_DISCONNECT_REASON_NO_AP_FOUND       = 201,
+    WIFI_DISCONNECT_REASON_AUTH_FAIL         = 202,
+    WIFI_DISCONNECT_REASON_ASSOC_FAIL        = 203,
+    WIFI_DISCONNECT_REASON_HANDSHAKE_TIMEOUT = 204,
+} WiFiDisconnectReason;
+
+struct WiFiEventStationModeGotIP {
+    IPAddress ip;
+    IPAddress mask;
+    IPAddress gw;
+};
+
+struct WiFiEventStationModeDisconnected {
+    String               ssid;
+    uint8_t              bssid[6];
+    WiFiDisconnectReason reason;
+};
+
+// As in the core: the handler stays registered while this handle is alive.
+struct WiFiEventHandlerOpaque {
+    std::function<void(const WiFiEventStationModeGotIP&)>        gotIp;
+    std::function<void(const WiFiEventStationModeDisconnected&)> disconnected;
+};
+typedef std::shared_ptr<WiFiEventHandlerOpaque> WiFiEventHandler;
+
+namespace hal {
+inline bool     apUp       = true;   // the building's access point
+inline uint32_t wifiJoinMs = 1500;   // association + DHCP time
+inline int      rssi       = -61;
+inline uint32_t staBegins  = 0;      // WiFi.begin() calls, i.e. reconnect attempts
+inline uint32_t statusCalls = 0;     // WiFi.status() calls made by the firmware
+inline uint32_t gotIpEvents = 0;     // events delivered, injected ones included
+inline uint32_t disconnectedEvents = 0;
+} // namespace hal
+
+class ESP8266WiFiClass {
+public:
+    ESP8266WiFiClass() { hal::radioTick = [] { instance().tick(); }; }
+    static ESP8266WiFiClass& instance();
+
+    bool       mode(WiFiMode_t m) { mode_ = m; if (!(m & WIFI_STA)) joined_ = false; return true; }
+    WiFiMode_t getMode() const    { return mode_; }
+    bool softAPConfig(IPAddress ip, IPAddress, IPAddress) { apIp_ = ip; return true; }
+    bool softAP(const char*, const char*) { apOn_ = true; return true; }
+    bool softAPdisconnect(bool wifiOff = false) {
+        apOn_ = false;
+        if (wifiOff) mode_ = (WiFiMode_t)(mode_ & ~WIFI_AP);
+        return true;
+    }
+    IPAddress softAPIP() const { return apOn_ && (mode_ & WIFI_AP) ? apIp_ : IPAddress(); }
+
+    void setAutoConnect(bool)   {}
+    void setAutoReconnect(bool v) { autoReconnect_ = v; }
+    void persistent(bool)       {}
+    bool setSleepMode(WiFiSleepType_t t) { sleep_ = t; return true; }
+    WiFiSleepType_t getSleepMode() const { return sleep_; }
+
+    wl_status_t begin(const char* ssid, const char*) {
+        ++hal::staBegins;
+        hasSsid_ = ssid && *ssid;
+        joined_ = false;
+        failReported_ = false;
+        beginAt_ = millis();
+        return link();
+    }
+    bool disconnect(bool = false) { joined_ = false; hasSsid_ = false; return true; }
+
+    wl_status_t status() { ++hal::statusCalls; return link(); }
+
+    IPAddress localIP()  { return link() == WL_CONNECTED ? IPAddress(10, 0, 0, 42) : IPAddress(); }
+    int32_t   RSSI()     { return link() == WL_CONNECTED ? hal::rssi : 31; }
+
+    WiFiEventHandler onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)> fn) {
+        WiFiEventHandler h = std::make_shared<WiFiEventHandlerOpaque>();
+        h->gotIp = fn;
+        handlers_.push_back(h);
+        return h;
+    }
+    WiFiEventHandler onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected&)> fn) {
+        WiFiEventHandler h = std::make_shared<WiFiEventHandlerOpaque>();
+        h->disconnected = fn;
+        handlers_.push_back(h);
+        return h;
+    }
+
+    // ---- host side ----
+    // Radio step: advance the link state and report changes as events. Events
+    // are never delivered from inside begin()/disconnect(), only here.
+    void tick() {
+        const bool up = link() == WL_CONNECTED;
+        if (up && !reportedUp_) {
+            reportedUp_ = true;
+            fireGotIp(IPAddress(10, 0, 0, 42));
+        } else if (!up && reportedUp_) {
+            reportedUp_ = false;
+            fireDisconnected(!(mode_ & WIFI_STA) || !hasSsid_ ? WIFI_DISCONNECT_REASON_ASSOC_LEAVE
+                                                               : WIFI_DISCONNECT_REASON_BEACON_TIMEOUT);
+        } else if (!up && hasSsid_ && (mode_ & WIFI_STA) && !hal::apUp && !failReported_ &&
+                   (uint32_t)(millis() - beginAt_) >= hal::wifiJoinMs) {
+            failReported_ = true;                    // a join attempt that found nothing
+            fireDisconnected(WIFI_DISCONNECT_REASON_NO_AP_FOUND);
+        }
+    }
+
+    bool hostLinkUp() { return link() == WL_CONNECTED; }   // for WiFiClient; not counted as status()
+
+    void hostInjectGotIP(IPAddress ip = IPAddress(10, 0, 0, 42)) { fireGotIp(ip); }
+    void hostInjectDisconnected(WiFiDisconnectReason r = WIFI_DISCONNECT_REASON_BEACON_TIMEOUT) { fireDisconnected(r); }
+
+private:
+    wl_status_t link() {
+        if (!(mode_ & WIFI_STA) || !hasSsid_) return WL_DISCONNECTED;
+        if (joined_ && !hal::apUp) { joined_ = false; lost_ = true; beginAt_ = millis(); }
+        if (!joined_ && hal::apUp && (lost_ ? autoReconnect_ : true) &&
+            (uint32_t)(millis() - beginAt_) >= hal::wifiJoinMs) {
+            joined_ = true; lost_ = false;
+        }
+        if (joined_) return WL_CONNECTED;
+        return lost_ ? WL_CONNECTION_LOST : WL_DISCONNECTED;
+    }
+
+    void fireGotIp(IPAddress ip) {
+        ++hal::gotIpEvents;
+        WiFiEventStationModeGotIP e{ip, IPAddress(255, 255, 255, 0), IPAddress(10, 0, 0, 1)};
+        for (auto& w : live()) if (w->gotIp) w->gotIp(e);
+    }
+
+    void fireDisconnected(WiFiDisconnectReason r) {
+        ++hal::disconnectedEvents;
+        WiFiEventStationModeDisconnected e{String("harness-ap"), {0x02, 0, 0, 0, 0, 0x01}, r};
+        for (auto& w : live()) if (w->disconnected) w->disconnected(e);
+    }
+
+    // Handlers whose handle is still held; dropped handles unregister themselves.
+    std::vector<WiFiEventHandler> live() {
+        std::vector<WiFiEventHandler> out;
+        for (size_t i = 0; i < handlers_.size();) {
+            if (auto h = handlers_[i].lock()) { out.push_back(h); ++i; }
+            else handlers_.erase(handlers_.begin() + (long)i);
+        }
+        return out;
+    }
+
+    std::vector<std::weak_ptr<WiFiEventHandlerOpaque>> handlers_;
+    bool       reportedUp_ = false;
+    bool       failReported_ = false;
+    WiFiMode_t mode_ = WIFI_OFF;
+    IPAddress  apIp_;
+    bool       apOn_ = false;
+    bool       hasSsid_ = false;
+    bool       joined_ = false;
+    bool       lost_ = false;
+    bool       autoReconnect_ = true;
+    uint32_t   beginAt_ = 0;
+    WiFiSleepType_t sleep_ = WIFI_MODEM_SLEEP;
+};
+inline ESP8266WiFiClass WiFi;
+inline ESP8266WiFiClass& ESP8266WiFiClass::instance() { return WiFi; }
+
+// ============================== WiFiClient =================================
+class WiFiClient {
+public:
+    WiFiClient() = default;
+    WiFiClient(const WiFiClient&) = delete;
+    WiFiClient& operator=(const WiFiClient&) = delete;
+    ~WiFiClient() { stop(); }
+
+    int connect(const char* host, uint16_t port) {
+        stop();
+        if (!WiFi.hostLinkUp()) return 0;
+        hal::AllocPause resolver;           // the host resolver's heap is not the node's
+        addrinfo hints{}, *res = nullptr;
+        hints.ai_family = AF_INET; hints.ai_socktype = SOCK_STREAM;
+        char portStr[8]; snprintf(portStr, sizeof(portStr), "%u", port);
+        if (getaddrinfo(host, portStr, &hints, &res) != 0 || !res) return 0;
+        fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        int ok = fd_ >= 0 ? ::connect(fd_, res->ai_addr, res->ai_addrlen) : -1;
+        freeaddrinfo(res);
+        if (ok != 0) { stop(); return 0; }
+        int one = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+        peerClosed_ = false; rxLen_ = rxPos_ = 0;
+        return 1;
+    }
+
+    size_t write(const uint8_t* buf, size_t n) {
+        if (fd_ < 0 || !WiFi.hostLinkUp()) return 0;
+        ssize_t w = ::send(fd_, buf, n, MSG_NOSIGNAL);
+        if (w < 0) { if (errno != EAGAIN) peerClosed_ = true; return 0; }
+        return (size_t)w;
+    }
+
+    int available() {
+        fill();
+        return (int)(rxLen_ - rxPos_);
+    }
+
+    int read() {
+        if (rxPos_ == rxLen_) fill();
+        return rxPos_ < rxLen_ ? rx_[rxPos_++] : -1;
+    }
+
+    int read(uint8_t* buf, size_t n) {
+        if (rxPos_ == rxLen_) fill();
+        const size_t k = std::min(n, rxLen_ - rxPos_);
+        memcpy(buf, rx_ + rxPos_, k);
+        rxPos_ += k;
+        return (int)k;
+    }
+
+    // Like the real core: still "connected" while unread data remains.
+    uint8_t connected() {
+        if (fd_ < 0) return 0;
+        fill();
+        if (!WiFi.hostLinkUp()) { stop(); return 0; }
+        return !peerClosed_ || rxPos_ < rxLen_;
+    }
+
+    void stop() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1; rxLen_ = rxPos_ = 0;
+    }
+
+    explicit operator bool() { return connected(); }
+
+private:
+    void fill() {
+        if (fd_ < 0 || peerClosed_) return;
+        if (rxPos_ == rxLen_) rxPos_ = rxLen_ = 0;
+        if (rxLen_ == sizeof(rx_)) return;
+        ssize_t r = ::recv(fd_, rx_ + rxLen_, sizeof(rx_) - rxLen_, 0);
+        if (r > 0) rxLen_ += (size_t)r;
+        else if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) peerClosed_ = true;
+    }
+
+    int     fd_ = -1;
+    bool    peerClosed_ = false;
+    uint8_t rx_[1460];
+    size_t  rxLen_ = 0;
+    size_t  rxPos_ = 0;
+};
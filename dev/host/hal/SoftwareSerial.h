@@ -0,0 +1,45 @@
+/*
+ Host HAL — SoftwareSerial (RX only)
+ ------------------------------------------------------------
+ The harness pushes sensor bytes with hostInject(). The RX buffer has the
+ capacity passed to begin(), and bytes beyond it are dropped like the real ISR does.
+ */
+#pragma once
+
+#include "Arduino.h"
+
+#include <deque>
+
+enum SoftwareSerialConfig { SWSERIAL_8N1 = 0 };
+
+class SoftwareSerial {
+public:
+    void begin(uint32_t, SoftwareSerialConfig, int8_t rx, int8_t, bool, int bufCap) {
+        rx_ = rx; cap_ = (size_t)bufCap; ok_ = rx >= 0;
+    }
+    explicit operator bool() const { return ok_; }
+    bool listen() { return true; }
+    int  available() const { return (int)q_.size(); }
+    int  peek() const { return q_.empty() ? -1 : q_.front(); }
+    int  read() {
+        if (q_.empty()) return -1;
+        int b = q_.front(); q_.pop_front(); return b;
+    }
+
+    // ---- host side ----
+    size_t hostInject(const uint8_t* p, size_t n) {
+        size_t took = 0;
+        for (; took < n; ++took) {
+            if (q_.size() >= cap_) { overflows += n - took; break; }
+            q_.push_back(p[took]);
+        }
+        return took;
+    }
+    uint32_t overflows = 0;
+
+private:
+    std::deque<uint8_t> q_;
+    size_t cap_ = 64;
+    int8_t rx_ = -1;
+    bool   ok_ = false;
+};
@@ -0,0 +1,4 @@
+// Host HAL — WiFiClientSecureBearSSL: included by the firmware but not used by anything it runs on the host.
+#pragma once
+
+#include "Arduino.h"
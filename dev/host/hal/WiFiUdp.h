@@ -0,0 +1,91 @@
+/*
+ Host HAL — WiFiUDP subset
+ ------------------------------------------------------------
+ A real non-blocking UDP socket, so the firmware's SNTP client talks to a
+ localhost stand-in. begin(port) falls back to any free port if that one
+ is taken, so several harness runs can share a machine. Nothing is sent
+ or received while the STA link is down.
+ */
+#pragma once
+
+#include "ESP8266WiFi.h"
+
+class WiFiUDP {
+public:
+    WiFiUDP() = default;
+    WiFiUDP(const WiFiUDP&) = delete;
+    WiFiUDP& operator=(const WiFiUDP&) = delete;
+    ~WiFiUDP() { stop(); }
+
+    uint8_t begin(uint16_t port) {
+        stop();
+        fd_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd_ < 0) return 0;
+        sockaddr_in a{};
+        a.sin_family = AF_INET; a.sin_addr.s_addr = htonl(INADDR_ANY);
+        a.sin_port = htons(port);
+        if (::bind(fd_, (sockaddr*)&a, sizeof(a)) != 0) {
+            a.sin_port = 0;
+            if (::bind(fd_, (sockaddr*)&a, sizeof(a)) != 0) { stop(); return 0; }
+        }
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+        return 1;
+    }
+
+    void stop() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1; txLen_ = rxLen_ = rxPos_ = 0;
+    }
+
+    int beginPacket(const char* host, uint16_t port) {
+        if (fd_ < 0 || !WiFi.hostLinkUp()) return 0;
+        hal::AllocPause resolver;           // the host resolver's heap is not the node's
+        addrinfo hints{}, *res = nullptr;
+        hints.ai_family = AF_INET; hints.ai_socktype = SOCK_DGRAM;
+        char portStr[8]; snprintf(portStr, sizeof(portStr), "%u", port);
+        if (getaddrinfo(host, portStr, &hints, &res) != 0 || !res) return 0;
+        memcpy(&to_, res->ai_addr, sizeof(to_));
+        freeaddrinfo(res);
+        txLen_ = 0;
+        return 1;
+    }
+
+    size_t write(const uint8_t* buf, size_t n) {
+        n = std::min(n, sizeof(tx_) - txLen_);
+        memcpy(tx_ + txLen_, buf, n);
+        txLen_ += n;
+        return n;
+    }
+
+    int endPacket() {
+        if (fd_ < 0 || !WiFi.hostLinkUp()) return 0;
+        const ssize_t w = ::sendto(fd_, tx_, txLen_, 0, (sockaddr*)&to_, sizeof(to_));
+        txLen_ = 0;
+        return w >= 0;
+    }
+
+    // Size of the next datagram (now readable with read()), 0 if none.
+    int parsePacket() {
+        rxLen_ = rxPos_ = 0;
+        if (fd_ < 0) return 0;
+        const ssize_t r = ::recv(fd_, rx_, sizeof(rx_), 0);
+        if (r <= 0 || !WiFi.hostLinkUp()) return 0;    // a datagram that arrives with the link down is lost
+        rxLen_ = (size_t)r;
+        return (int)r;
+    }
+
+    int read(uint8_t* buf, size_t n) {
+        const size_t k = std::min(n, rxLen_ - rxPos_);
+        memcpy(buf, rx_ + rxPos_, k);
+        rxPos_ += k;
+        return (int)k;
+    }
+
+    int available() const { return (int)(rxLen_ - rxPos_); }
+
+private:
+    int         fd_ = -1;
+    sockaddr_in to_{};
+    uint8_t     tx_[512], rx_[512];
+    size_t      txLen_ = 0, rxLen_ = 0, rxPos_ = 0;
+};
@@ -0,0 +1,99 @@
+/*
+ Host HAL — Wire (I2C master)
+ ------------------------------------------------------------
+ Transactions go to fake devices registered with hal::i2cAttach(). Each
+ device sees the bytes of a write, answers reads, and decides whether to ACK
+ its address (a sleeping Sunrise NACKs it, for example).
+
+ Like the core's bit-banged master, every transfer blocks: it adds its bus
+ time (9 clocks per byte incl. address, plus START/STOP) to the virtual
+ clock without running the idle hook, so I2C shows up in loop() stall
+ figures the way it would on a node. hal::i2cStats counts transactions,
+ bytes and NACKs.
+ */
+#pragma once
+
+#include "Arduino.h"
+
+namespace hal {
+struct I2cDevice {
+    virtual ~I2cDevice() = default;
+    virtual bool   ackAddress(bool read) { (void)read; return true; }
+    virtual bool   write(const uint8_t* p, size_t n) = 0;   // false = NACK on data
+    virtual size_t read(uint8_t* p, size_t n) = 0;          // bytes the device supplied
+};
+
+struct I2cStats {
+    uint32_t transactions, bytes, addrNacks, dataNacks;
+    uint64_t busUs;
+};
+
+inline I2cDevice* i2cDevices[128] = {};
+inline I2cStats   i2cStats = {};
+
+inline void i2cAttach(uint8_t addr, I2cDevice* d) { i2cDevices[addr & 0x7F] = d; }
+
+inline void i2cBusTime(uint32_t hz, size_t bytes) {
+    const uint64_t us = ((uint64_t)(bytes + 1) * 9 + 2) * 1000000u / (hz ? hz : 100000);
+    clockUs += us;
+    i2cStats.busUs += us;
+    ++i2cStats.transactions;
+    i2cStats.bytes += (uint32_t)bytes;
+}
+} // namespace hal
+
+class TwoWire {
+public:
+    void begin(int sda, int scl) { sda_ = sda; scl_ = scl; }
+    void begin()                 { begin(4, 5); }
+    void setClock(uint32_t hz)   { hz_ = hz; }
+    void setClockStretchLimit(uint32_t) {}
+
+    void beginTransmission(uint8_t addr) { txAddr_ = addr & 0x7F; txLen_ = 0; }
+    void beginTransmission(int addr)     { beginTransmission((uint8_t)addr); }
+    size_t write(uint8_t b) {
+        if (txLen_ >= sizeof(tx_)) return 0;
+        tx_[txLen_++] = b;
+        return 1;
+    }
+    size_t write(const uint8_t* p, size_t n) { size_t k = 0; while (k < n && write(p[k])) ++k; return k; }
+
+    // 0 = ok, 2 = NACK on address, 3 = NACK on data (core's codes)
+    uint8_t endTransmission(bool sendStop = true) {
+        (void)sendStop;
+        hal::AllocPause bus;
+        hal::I2cDevice* d = hal::i2cDevices[txAddr_];
+        const bool ack = d && d->ackAddress(false);      // once: a device may wake on it
+        hal::i2cBusTime(hz_, ack ? txLen_ : 0);
+        if (!ack) { ++hal::i2cStats.addrNacks; return 2; }
+        if (txLen_ && !d->write(tx_, txLen_)) { ++hal::i2cStats.dataNacks; return 3; }
+        return 0;
+    }
+    uint8_t endTransmission(uint8_t sendStop) { return endTransmission(sendStop != 0); }
+
+    uint8_t requestFrom(uint8_t addr, uint8_t n, uint8_t sendStop = 1) {
+        (void)sendStop;
+        hal::AllocPause bus;
+        rxLen_ = rxAt_ = 0;
+        hal::I2cDevice* d = hal::i2cDevices[addr & 0x7F];
+        const bool ack = d && d->ackAddress(true);
+        if (n > sizeof(rx_)) n = sizeof(rx_);
+        if (ack) rxLen_ = d->read(rx_, n);
+        hal::i2cBusTime(hz_, ack ? n : 0);
+        if (!ack) ++hal::i2cStats.addrNacks;
+        return (uint8_t)rxLen_;
+    }
+    uint8_t requestFrom(int addr, int n) { return requestFrom((uint8_t)addr, (uint8_t)n); }
+
+    int available() const { return (int)(rxLen_ - rxAt_); }
+    int read()            { return rxAt_ < rxLen_ ? rx_[rxAt_++] : -1; }
+
+private:
+    uint8_t  tx_[32], rx_[32];          // BUFFER_LENGTH in the core
+    size_t   txLen_ = 0, rxLen_ = 0, rxAt_ = 0;
+    uint8_t  txAddr_ = 0;
+    uint32_t hz_ = 100000;
+    int      sda_ = 4, scl_ = 5;
+};
+
+inline TwoWire Wire;
@@ -0,0 +1,27 @@
+/*
+ Host HAL — eboot_command.h
+ ------------------------------------------------------------
+ The core's boot loader command block: after a reset eboot copies
+ args[2] bytes from args[0] to args[1] and boots the result. Here the
+ command is only kept, so the harness can see what would boot next.
+ */
+#pragma once
+
+#include <stdint.h>
+
+enum action_t { ACTION_COPY_RAW = 0x00000002, ACTION_LOAD_APP = 0xffffffff };
+
+struct eboot_command {
+    uint32_t      magic;
+    enum action_t action;
+    uint32_t      args[29];
+    uint32_t      crc32;
+};
+
+namespace hal {
+inline eboot_command ebootCmd{};
+inline uint32_t      ebootWrites = 0;
+} // namespace hal
+
+inline void eboot_command_write(struct eboot_command* cmd) { hal::ebootCmd = *cmd; ++hal::ebootWrites; }
+inline void eboot_command_clear() { hal::ebootCmd = eboot_command{}; }
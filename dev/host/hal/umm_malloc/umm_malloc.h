@@ -0,0 +1,234 @@
+/*
+ Host HAL — umm_malloc subset: allocation accounting and a shadow device heap
+ ------------------------------------------------------------
+ malloc & co. are interposed (glibc lets the program replace the allocator;
+ the real one stays reachable as __libc_*). Every allocation the firmware
+ makes is counted, tagged with its call site, and also placed in a shadow of
+ the device heap: hal::heapSize bytes, first fit over 8-byte blocks with a
+ 4-byte header, as umm_malloc does. So ESP.getFreeHeap(),
+ getMaxFreeBlockSize() and getHeapFragmentation() move the way they would on
+ a node: a long-lived block allocated between two short-lived ones splits
+ the free space for good.
+
+ Host start-up and work done on the firmware's behalf (radio ticks, the
+ harness's idle hook, capturing HTTP responses) run inside an AllocPause and
+ are not counted. Counting starts at hal::heapBegin(), just before setup().
+
+ The HAL behaves as if the core were built with -DUMM_STATS_FULL, so the
+ umm_get_*_count() accessors exist. All definitions live in this header
+ because every host build is a single translation unit; build with
+ -DHAL_COUNT_ALLOCS=0 to link the HAL into more than one.
+ */
+#pragma once
+
+#include <execinfo.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef HAL_COUNT_ALLOCS
+#define HAL_COUNT_ALLOCS 1
+#endif
+#ifndef UMM_STATS_FULL
+#define UMM_STATS_FULL 1
+#endif
+
+namespace hal {
+constexpr uint32_t kHeapBlock  = 8;       // umm_malloc block size
+constexpr uint32_t kHeapHeader = 4;       // per-allocation header inside the first block
+constexpr int      kSiteDepth  = 8;       // return addresses kept per call site
+
+inline uint32_t heapSize    = 40000;      // free heap after Wi-Fi init on a real node
+inline int      allocPaused = 1;          // see heapBegin()
+
+// umm_malloc's UMM_STATS_FULL counters
+inline uint64_t allocCalls  = 0;          // malloc + calloc + realloc
+inline uint32_t mallocCount = 0, reallocCount = 0, freeCount = 0;
+
+struct AllocPause {
+    AllocPause()  { ++allocPaused; }
+    ~AllocPause() { --allocPaused; }
+};
+
+struct AllocSite {
+    void*    pc[kSiteDepth];              // caller of malloc first
+    uint32_t calls;
+    uint64_t bytes;
+    uint32_t liveBlocks, liveBytes;       // still allocated now
+};
+
+namespace heap_ {
+struct Span { uint32_t off, len; };
+struct Live { void* p; uint32_t off, len; uint16_t site; };
+
+constexpr uint32_t kMaxSpans = 512, kLiveCap = 8192, kMaxSites = 128;
+constexpr uint32_t kNoSpace  = 0xFFFFFFFFu;
+
+inline Span      spans[kMaxSpans] = {{0, 40000}};   // free space, sorted by offset, coalesced
+inline uint32_t  nSpans = 1;
+inline Live      live[kLiveCap];          // open addressing on the pointer, linear probing
+inline AllocSite sites[kMaxSites];
+inline uint32_t  nSites = 0, nLive = 0;
+inline uint32_t  freeBytes = 40000, freeMin = 40000, shadowOom = 0;
+inline bool      inHook = false;          // backtrace() may allocate; don't count that
+
+inline uint32_t slot(void* p) { return (uint32_t)(((uintptr_t)p >> 4) * 2654435761u) & (kLiveCap - 1); }
+
+inline uint32_t take(uint32_t len) {
+    for (uint32_t i = 0; i < nSpans; ++i) {
+        if (spans[i].len < len) continue;
+        const uint32_t off = spans[i].off;
+        spans[i].off += len; spans[i].len -= len;
+        if (!spans[i].len) { memmove(&spans[i], &spans[i + 1], (nSpans - i - 1) * sizeof(Span)); --nSpans; }
+        freeBytes -= len;
+        if (freeBytes < freeMin) freeMin = freeBytes;
+        return off;
+    }
+    ++shadowOom;
+    return kNoSpace;
+}
+
+inline void give(uint32_t off, uint32_t len) {
+    uint32_t i = 0;
+    while (i < nSpans && spans[i].off < off) ++i;
+    const bool joinPrev = i > 0 && spans[i - 1].off + spans[i - 1].len == off;
+    const bool joinNext = i < nSpans && off + len == spans[i].off;
+    freeBytes += len;
+    if (joinPrev && joinNext) {
+        spans[i - 1].len += len + spans[i].len;
+        memmove(&spans[i], &spans[i + 1], (nSpans - i - 1) * sizeof(Span)); --nSpans;
+    } else if (joinPrev) {
+        spans[i - 1].len += len;
+    } else if (joinNext) {
+        spans[i].off = off; spans[i].len += len;
+    } else if (nSpans < kMaxSpans) {
+        memmove(&spans[i + 1], &spans[i], (nSpans - i) * sizeof(Span));
+        spans[i] = {off, len}; ++nSpans;
+    }
+}
+
+inline uint16_t siteFor(void* const* pc, int depth) {
+    for (uint32_t i = 0; i < nSites; ++i)
+        if (!memcmp(sites[i].pc, pc, depth * sizeof(void*))) return (uint16_t)i;
+    if (nSites == kMaxSites) return kMaxSites - 1;   // the last site collects the overflow
+    memcpy(sites[nSites].pc, pc, depth * sizeof(void*));
+    return (uint16_t)nSites++;
+}
+
+inline void track(void* p, size_t n, void* const* pc, int depth) {
+    const uint32_t len = (uint32_t)((n + kHeapHeader + kHeapBlock - 1) / kHeapBlock * kHeapBlock);
+    const uint16_t s = siteFor(pc, depth);
+    AllocSite& site = sites[s];
+    ++site.calls; site.bytes += n;
+    if (nLive >= kLiveCap - 1) { ++shadowOom; return; }
+    const uint32_t off = take(len);
+    if (off == kNoSpace) return;
+    ++nLive;
+    ++site.liveBlocks; site.liveBytes += len;
+    uint32_t i = slot(p);
+    while (live[i].p) i = (i + 1) & (kLiveCap - 1);
+    live[i] = {p, off, len, s};
+}
+
+// Forgets p if the firmware allocated it; returns whether it did.
+inline bool untrack(void* p) {
+    if (!p) return false;
+    uint32_t i = slot(p);
+    while (live[i].p && live[i].p != p) i = (i + 1) & (kLiveCap - 1);
+    if (!live[i].p) return false;
+    give(live[i].off, live[i].len);
+    AllocSite& site = sites[live[i].site];
+    --site.liveBlocks; site.liveBytes -= live[i].len;
+    // backward-shift delete keeps probe chains intact without tombstones
+    for (uint32_t j = (i + 1) & (kLiveCap - 1); live[j].p; j = (j + 1) & (kLiveCap - 1)) {
+        const uint32_t home = slot(live[j].p);
+        if (((j - home) & (kLiveCap - 1)) >= ((j - i) & (kLiveCap - 1))) { live[i] = live[j]; i = j; }
+    }
+    live[i].p = nullptr;
+    --nLive;
+    return true;
+}
+
+inline bool counting() { return !allocPaused && !inHook; }
+} // namespace heap_
+
+// Starts accounting: the shadow heap is empty, counters are zero.
+inline void heapBegin() {
+    void* prime[2]; backtrace(prime, 2);   // first call loads libgcc; do it uncounted
+    heap_::nSpans = 1;
+    heap_::spans[0] = {0, heapSize / kHeapBlock * kHeapBlock};
+    heap_::freeBytes = heap_::freeMin = heap_::spans[0].len;
+    allocPaused = 0;
+}
+
+inline uint32_t heapFree()    { return heap_::freeBytes; }
+inline uint32_t heapFreeMin() { return heap_::freeMin; }
+inline uint32_t heapMaxBlock() {
+    uint32_t m = 0;
+    for (uint32_t i = 0; i < heap_::nSpans; ++i) m = heap_::spans[i].len > m ? heap_::spans[i].len : m;
+    return m;
+}
+// umm_malloc's metric: 100 - sqrt(sum of free-run²) * 100 / total free, in blocks.
+inline uint8_t heapFragmentation() {
+    double sum = 0, sq = 0;
+    for (uint32_t i = 0; i < heap_::nSpans; ++i) {
+        const double b = heap_::spans[i].len / kHeapBlock;
+        sum += b; sq += b * b;
+    }
+    return sum ? (uint8_t)(100 - (uint32_t)(sqrt(sq) * 100 / sum)) : 0;
+}
+inline uint32_t heapShadowOom() { return heap_::shadowOom; }
+
+inline const AllocSite* allocSites(uint32_t* n) { *n = heap_::nSites; return heap_::sites; }
+} // namespace hal
+
+inline size_t umm_get_malloc_count()  { return hal::mallocCount; }
+inline size_t umm_get_realloc_count() { return hal::reallocCount; }
+inline size_t umm_get_free_count()    { return hal::freeCount; }
+inline size_t umm_free_heap_size_min() { return hal::heapFreeMin(); }
+
+#if HAL_COUNT_ALLOCS
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void  __libc_free(void*);
+
+// Captures the call stack (minus this frame) and books p in the shadow heap.
+#define HAL_TRACK_(p, n)                                                         \
+    do {                                                                         \
+        hal::heap_::inHook = true;                                               \
+        void* pc_[hal::kSiteDepth + 1] = {};                                     \
+        int d_ = backtrace(pc_, hal::kSiteDepth + 1);                            \
+        (void)d_;                                                                \
+        hal::heap_::track((p), (n), pc_ + 1, hal::kSiteDepth);                   \
+        hal::heap_::inHook = false;                                              \
+    } while (0)
+
+void* malloc(size_t n) noexcept {
+    void* p = __libc_malloc(n);
+    if (p && hal::heap_::counting()) { ++hal::allocCalls; ++hal::mallocCount; HAL_TRACK_(p, n); }
+    return p;
+}
+void* calloc(size_t c, size_t n) noexcept {
+    void* p = __libc_calloc(c, n);
+    if (p && hal::heap_::counting()) { ++hal::allocCalls; ++hal::mallocCount; HAL_TRACK_(p, c * n); }
+    return p;
+}
+void* realloc(void* p, size_t n) noexcept {
+    const bool mine = hal::heap_::untrack(p);
+    void* q = __libc_realloc(p, n);
+    if (q && (mine || hal::heap_::counting())) {
+        if (hal::heap_::counting()) { ++hal::allocCalls; ++hal::reallocCount; }
+        HAL_TRACK_(q, n);
+    }
+    return q;
+}
+void free(void* p) noexcept {
+    if (hal::heap_::untrack(p) && !hal::heap_::inHook) ++hal::freeCount;
+    __libc_free(p);
+}
+#undef HAL_TRACK_
+}
+#endif
@@ -0,0 +1,1673 @@
+/*
+ harness.cpp — run the firmware natively against a localhost broker stand-in
+ ------------------------------------------------------------
+ The firmware translation unit is compiled in directly (unity build) on top
+ of the host HAL in dev/host/hal, so setup()/loop() run unmodified. Time is
+ virtual: one loop() iteration = 1 ms unless the firmware itself delays.
+
+ Every virtual millisecond the harness:
+ • streams the next byte of a PMS5003 frame into SoftwareSerial (9600 baud
+ is ~1 byte/ms), with a frame counter encoded in PM1 (ATM). A payload
+ carries the mean over n consecutive frames a..b, i.e. (a+b)/2, so the
+ newest one is mean + (n-1)/2 and the payload can be traced back to the
+ instant its last sensor byte arrived;
+ • services the in-process broker stand-in;
+ • applies the scripted broker / access point outages and button presses,
+ and injects spurious Wi-Fi "disconnected" events (--sta-event).
+ • publishes scripted firmware update requests (--ota) and services the
+ HTTP stand-in that serves the signed images, in full, compressed or as
+ a delta against the build it puts in flash;
+ • answers SNTP requests with a true time that drifts against millis()
+ and jumps on cue (--ntp-drift, --ntp-step, --ntp-down), and checks the
+ node's wall clock and every payload's "ts" against it;
+ • checks each record on aggregates/<node_id> against the frames whose
+ true time falls in its interval, and each longer one against the
+ shorter records it merges;
+ • scrapes GET /metrics every 15 s and checks the OpenMetrics text and
+ its values against the firmware's state;
+ • checks that no scheduler timer ran twice in the loop() pass.
+
+ Reported: sensor-byte-to-PUBLISH latency, messages/s, duplicates and gaps
+ (QoS1 "seq"), reconnect count and time-to-reconnect after each outage,
+ Wi-Fi events and WiFi.status() polls, setup-window open/close times, loop() passes per second and the share of time spent idle, and the
+ longest single loop() stall (time in loop() minus its scheduled idle).
+
+ Heap check: the HAL counts every malloc the firmware makes. A loop() pass
+ that starts and ends with the MQTT session up and the setup window closed
+ is "steady state", and must not allocate: if one does, the harness exits
+ with status 3. The summary also shows the shadow device heap (free,
+ low-water, largest block, fragmentation) and the top allocation call
+ sites, resolved with addr2line.
+
+ Build & run (see dev/host/README.md):
+   g++ -std=gnu++17 -O2 -g -Idev/host/hal -Isrc/cpp -Idev/host -DENABLE_NETWORK=1 \
+       dev/host/harness.cpp -o harness
+   ./harness --duration=600 --broker-down=120:45 --ap-down=400:30 --quiet
+ */
+#include "../../src/cpp/ParticularMatter_public.cpp"
+#if !ENABLE_NETWORK
+#error "The harness drives the real MQTT path: build with -DENABLE_NETWORK=1"
+#endif
+
+#include "broker_standin.h"
+#include "fake_bme280.h"
+#include "fake_sunrise.h"
+#include "http_standin.h"
+#include "ntp_standin.h"
+#include "ota_delta.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+namespace {
+
+struct Window { uint32_t startMs, lenMs; };
+struct ConfigMsg { uint32_t atMs; std::string json; bool expectOk; };
+
+struct Options {
+    uint32_t durationMs   = 300000;
+    uint32_t pmsPeriodMs  = 1000;     // PMS5003 active mode: roughly one frame per second
+    uint32_t pmsSpikeEvery = 0;       // bit-slip spike in every Nth frame; 0 = none
+    uint32_t pmsWarmupMs  = 20000;    // frames jump around for this long after power-on
+    uint32_t ackDropEvery = 0;
+    std::vector<Window> brokerDown, apDown, button;
+    std::vector<uint32_t> staEvents;  // times to inject a Disconnected event
+    bool     bme          = true;     // fake BME280 on the I2C bus
+    double   envT = 21.0, envRh = 45.0, envHpa = 1013.25;
+    bool     co2          = true;     // fake Sunrise on the I2C bus
+    uint32_t co2ConvMs    = 2000;
+    std::vector<ConfigMsg> configs;   // published to config/<node_id>
+    std::vector<std::pair<uint32_t, std::string>> otas;   // (time, mode) published to ota/<node_id>
+    uint32_t otaRate      = 64;       // HTTP bytes per virtual ms per connection (~64 KB/s)
+    double   ntpDriftPpm  = 40;       // the node's crystal is this much slow against true time
+    std::vector<std::pair<uint32_t, int32_t>> ntpSteps;   // (time, ms) the server's time jumps
+    std::vector<Window> ntpDown;      // the SNTP server does not answer
+} opt;
+
+BrokerStandin broker;
+FakeBme280    fakeBme;
+FakeSunrise   fakeCo2;
+HttpStandin   http;                  // firmware images for --ota
+NtpStandin    ntp;
+
+// ---- PMS5003 byte source ----
+uint8_t  frame[32];
+size_t   frameAt = sizeof(frame);     // next byte to send; == size means idle
+uint32_t nextFrameMs = 0;
+uint16_t frameNo = 0;
+std::map<uint16_t, uint32_t> frameDoneMs;   // frame number -> time its last byte was sent
+
+// PM2.5 ramps 0..350..0 µg/m³ over 700 frames, through every segment of the
+// EPA correction. CF=1 equals ATM, as on a real PMS5003 below ~30 µg/m³.
+// The ramp is scaled down by a factor that changes every five ramps (3500
+// frames, about an hour, at a ramp's zero), so the hourly means differ and
+// NowCast weights are not trivial. --pms-spikes=N flips bit 12 of ATM PM2.5
+// in every Nth frame: a bit slip the checksum misses. For the first
+// --pms-warmup seconds PM2.5 reads 0..2x the ramp, frame to frame, as a
+// sensor whose fan is still spinning up.
+bool spikedFrame = false, noisyFrame = false;
+uint16_t lastNoisyFrame = 0;
+
+uint16_t pm25At(uint32_t n) {
+    static const uint8_t scalePct[] = {100, 30, 60, 15, 80};
+    const uint32_t ramp = n % 700 < 350 ? n % 700 : 700 - n % 700;
+    return (uint16_t)(ramp * scalePct[(n / 3500) % 5] / 100);
+}
+
+bool spikedAt(uint32_t n) { return opt.pmsSpikeEvery && n % opt.pmsSpikeEvery == opt.pmsSpikeEvery / 2; }
+
+void buildFrame(uint16_t n) {
+    uint16_t pm25 = pm25At(n);
+    noisyFrame = millis() < opt.pmsWarmupMs;
+    if (noisyFrame) { pm25 = (uint16_t)(pm25 * (n * 7 % 5) / 2); lastNoisyFrame = n; }
+    spikedFrame = spikedAt(n);
+    const uint16_t atm25 = spikedFrame ? (uint16_t)(pm25 ^ 0x1000) : pm25;
+    pmsEncodeFrame(frame, PmsReading{n, pm25, (uint16_t)(pm25 + 8), n, atm25, (uint16_t)(pm25 + 8)});
+}
+
+// Drops since the previous frame started belong to that frame. Noisy
+// warm-up frames, and the Hampel window's worth after them, may be dropped;
+// so may the first frames, which the filter drops unjudged while its window
+// fills (a spike among them counts as caught). A frame the parser never
+// saw (sent before setup() opened the UART) is not counted at all.
+struct {
+    uint32_t injected = 0, caught = 0, missed = 0, falseRejects = 0, warmupDrops = 0, fillDrops = 0;
+    uint32_t lastRejected = 0, lastUnjudged = 0, lastParsed = 0;
+} spikeCheck;
+
+void spikeAttribute() {
+#if PMS_SPIKE_FILTER
+    const uint32_t rej = pmsFilter.rejected(), d = rej - spikeCheck.lastRejected;
+    const uint32_t unj = pmsFilter.unjudged(), u = unj - spikeCheck.lastUnjudged;
+    const uint32_t parsed = pmsParser.frames(), p = parsed - spikeCheck.lastParsed;
+    spikeCheck.lastRejected = rej;
+    spikeCheck.lastUnjudged = unj;
+    spikeCheck.lastParsed = parsed;
+    if (!frameNo || !p) return;                        // sent before the UART listened
+    if (spikedFrame) { ++spikeCheck.injected; d || u ? ++spikeCheck.caught : ++spikeCheck.missed; }
+    else if (u) spikeCheck.fillDrops += u;
+    else if (lastNoisyFrame && frameNo <= lastNoisyFrame + PMS_HAMPEL_N) spikeCheck.warmupDrops += d;
+    else spikeCheck.falseRejects += d;
+#endif
+}
+
+void feedPms(uint32_t now) {
+    if (frameAt == sizeof(frame) && (int32_t)(now - nextFrameMs) >= 0) {
+        spikeAttribute();
+        buildFrame(++frameNo);
+        frameAt = 0;
+        nextFrameMs = now + opt.pmsPeriodMs;
+    }
+    if (frameAt < sizeof(frame)) {
+        pmsSerial.hostInject(&frame[frameAt++], 1);
+        if (frameAt == sizeof(frame)) frameDoneMs[frameNo] = now;
+    }
+}
+
+// ---- Scripted outages ----
+bool inWindow(const std::vector<Window>& ws, uint32_t now) {
+    for (auto& w : ws) if (now >= w.startMs && now < w.startMs + w.lenMs) return true;
+    return false;
+}
+
+std::vector<uint32_t> recoveredAt;     // first CONNECT after each broker outage
+uint32_t brokerBackAt = 0;
+bool     waitingReconnect = false;
+
+void applyOutages(uint32_t now) {
+    const bool down = inWindow(opt.brokerDown, now);
+    if (down && broker.isUp()) {
+        broker.down();
+        LOGW("[HARNESS] broker DOWN");
+    } else if (!down && !broker.isUp()) {
+        broker.up();
+        brokerBackAt = now; waitingReconnect = true;
+        LOGW("[HARNESS] broker UP");
+    }
+    hal::apUp = !inWindow(opt.apDown, now);
+    for (uint32_t t : opt.staEvents)
+        if (t == now) { LOGW("[HARNESS] injected STA disconnected event"); WiFi.hostInjectDisconnected(); }
+#if SETUP_BUTTON_PIN >= 0
+    hal::pinLevel[SETUP_BUTTON_PIN] = inWindow(opt.button, now) ? LOW : HIGH;
+#endif
+}
+
+// ---- BME280: slowly drifting truth, firmware readings checked against it ----
+struct EnvCheck {
+    uint32_t readings = 0, lastTs = 0;
+    double   maxDt = 0, maxDrh = 0, maxDp = 0;
+} envCheck;
+
+void driveEnv(uint32_t now) {
+    const double ph = 6.283185 * now / 600000.0;           // 10-minute cycle
+    fakeBme.truth = {opt.envT + 4.0 * sin(ph), std::min(100.0, std::max(0.0, opt.envRh + 20.0 * sin(ph * 1.3))),
+                     opt.envHpa * 100.0 + 150.0 * sin(ph * 0.7)};
+    if (!g_env.valid || g_env.ts_ms == envCheck.lastTs) return;
+    envCheck.lastTs = g_env.ts_ms;
+    ++envCheck.readings;
+    envCheck.maxDt  = std::max(envCheck.maxDt,  fabs(g_env.t_x100 / 100.0 - fakeBme.converted.tC));
+    envCheck.maxDrh = std::max(envCheck.maxDrh, fabs(g_env.rh_x10 / 10.0 - fakeBme.converted.rh));
+    envCheck.maxDp  = std::max(envCheck.maxDp,  fabs((double)g_env.p_pa - fakeBme.converted.pPa));
+}
+
+// ---- Sunrise: drifting CO2, every firmware reading must be the last measurement ----
+struct Co2Check {
+    uint32_t readings = 0, wrong = 0, lastTs = 0;
+} co2Check;
+
+void driveCo2(uint32_t now) {
+    fakeCo2.truthPpm = 700 + 300 * sin(6.283185 * now / 900000.0);   // 15-minute cycle
+    fakeCo2.tick();
+    if (!g_co2.valid || g_co2.ts_ms == co2Check.lastTs) return;
+    co2Check.lastTs = g_co2.ts_ms;
+    ++co2Check.readings;
+    if (g_co2.ppm != fakeCo2.converted) ++co2Check.wrong;
+}
+
+// ---- PMS5003 warm-up: nothing published from before it, reported in telemetry ----
+struct WarmCheck {
+    bool     warm = false;
+    uint16_t warmFrame = 0;               // the frame that completed the warm-up
+    uint32_t firstPublished = 0;          // oldest frame in the first measurement payload
+    uint32_t telemetry = 0, telemetryWarm = 0, telemetryWrong = 0;
+} warmCheck;
+
+void warmObserve() {
+    if (warmCheck.warm || !pmsWarmup.warm()) return;
+    warmCheck.warm = true;
+    warmCheck.warmFrame = g_pms.pm1_atm;  // the frame counter
+}
+
+std::vector<std::pair<uint32_t, bool>> portalChanges;   // (time, now open)
+bool lastPortal = false;
+
+// ---- Wall clock: the node's epoch time against the true time it is synced to ----
+// The true time starts at 2026-01-01 00:17:23.456 UTC, so boot-relative
+// minutes and hours are not UTC ones, and runs ntpDriftPpm faster than the
+// node's millis(); each --ntp-step moves it, and the server with it. Every
+// virtual ms the firmware's clock must not go backwards (a counted back
+// step aside), and its error must be explained by the offset it is still
+// slewing out plus the drift not yet corrected since the last sync:
+// 5 ms + (|true - estimated drift| + 2 ppm) × time since then. After a
+// server step the error is not checked until the node's next sync has
+// stepped or slewed it out.
+constexpr int64_t EPOCH0_US = 1767225600000000LL + 1043456000LL;
+
+int64_t trueUs(uint32_t ms) {
+    int64_t t = EPOCH0_US + (int64_t)ms * 1000 + (int64_t)llround(ms * opt.ntpDriftPpm / 1000);
+    for (auto& st : opt.ntpSteps) if (st.first <= ms) t += (int64_t)st.second * 1000;
+    return t;
+}
+
+struct {
+    uint32_t firstSyncMs = 0, lastSyncMs = 0, syncs = 0, checked = 0, backwards = 0, over = 0, backSteps = 0;
+    uint64_t last = 0;
+    double   maxErrMs = 0, maxAllowedMs = 0, worstErrMs = 0;
+    uint32_t worstAt = 0;
+    size_t   nextStep = 0;
+    bool     settling = false;
+    uint32_t settleSyncs = 0, settleUntil = 0, settleStepMs = 0;
+    std::vector<Window> unchecked;     // step -> settled: payload stamps not checked either
+    std::vector<std::pair<uint64_t, uint64_t>> uncheckedWall;   // the node's and the true times in them, ms
+    uint32_t payloads = 0, missing = 0, disorder = 0, off = 0;
+    double   payloadMaxErrMs = 0;
+    std::map<uint32_t, uint64_t> tsBySeq;
+    uint64_t lastQos0 = 0;
+} clockCheck;
+
+void clockObserve(uint32_t now) {
+    auto& c = clockCheck;
+    while (c.nextStep < opt.ntpSteps.size() && opt.ntpSteps[c.nextStep].first <= now) {
+        const int32_t ms = opt.ntpSteps[c.nextStep++].second;
+        LOGW("[HARNESS] SNTP server time jumps %+d ms", ms);
+        if (!c.settling) c.unchecked.push_back({now, UINT32_MAX});
+        c.settling = true; c.settleSyncs = wallClock.syncs(); c.settleUntil = 0;
+        const bool slewed = ms * 1000LL <= WallClock::STEP_US && ms * -1000LL <= WallClock::BACK_STEP_US;
+        c.settleStepMs = std::max(slewed ? (uint32_t)abs(ms) : 0u, c.settleStepMs);
+    }
+    ntp.down = inWindow(opt.ntpDown, now);
+    if (!wallClock.valid()) return;
+    if (wallClock.syncs() != c.syncs) {
+        c.syncs = wallClock.syncs(); c.lastSyncMs = now;
+        if (!c.firstSyncMs) c.firstSyncMs = now;
+    }
+    if (c.settling && !c.settleUntil && wallClock.syncs() > c.settleSyncs)
+        c.settleUntil = now + c.settleStepMs * WallClock::SLEW_DIV + 1000;
+    if (c.settling && c.settleUntil && (int32_t)(now - c.settleUntil) >= 0) {
+        c.settling = false; c.settleStepMs = 0;
+        c.unchecked.back().lenMs = now - c.unchecked.back().startMs;
+    }
+    const uint64_t t = wallClock.nowMs(now);
+    if (c.settling) {
+        const uint64_t tt = (uint64_t)(trueUs(now) / 1000);
+        if (c.uncheckedWall.size() < c.unchecked.size()) c.uncheckedWall.push_back({std::min(t, tt), std::max(t, tt)});
+        auto& w = c.uncheckedWall.back();
+        w.first = std::min(w.first, std::min(t, tt)); w.second = std::max(w.second, std::max(t, tt));
+    }
+    if (t < c.last && wallClock.backSteps() == c.backSteps) ++c.backwards;
+    c.backSteps = wallClock.backSteps();
+    c.last = t;
+    if (c.settling) return;
+    const double err = (double)(int64_t)(t - (uint64_t)(trueUs(now) / 1000));
+    const double slewing = std::max(0.0, fabs((double)wallClock.slewingUs()) / 1000 - (now - c.lastSyncMs) / (double)WallClock::SLEW_DIV);
+    const double allowed = 5 + slewing + (fabs(opt.ntpDriftPpm * 1000 - wallClock.driftPpb()) + 2000) * (now - c.lastSyncMs) / 1e9;
+    ++c.checked;
+    c.maxErrMs = std::max(c.maxErrMs, fabs(err));
+    c.maxAllowedMs = std::max(c.maxAllowedMs, allowed);
+    if (fabs(err) > allowed) { if (!c.over++) { c.worstErrMs = err; c.worstAt = now; } }
+}
+
+// A measurement payload's "ts": present once the clock is set (QoS1 stamps
+// queued samples late), rising with seq (retries keep it), and between the
+// true times of the sample's newest frame and the next frame.
+void clockPayload(const uint8_t* p, size_t n, long seq, long frame) {
+    auto& c = clockCheck;
+    const std::string s((const char*)p, n);
+    const size_t at = s.find("\"ts\":");
+    if (at == std::string::npos) { if (seq > 0 && wallClock.valid()) ++c.missing; return; }
+    const uint64_t ts = strtoull(s.c_str() + at + 5, nullptr, 10);
+    ++c.payloads;
+    if (seq > 0) {
+        auto it = c.tsBySeq.find((uint32_t)seq);
+        if (it != c.tsBySeq.end() && it->second != ts) ++c.disorder;
+        c.tsBySeq[(uint32_t)seq] = ts;
+    } else {
+        if (ts <= c.lastQos0) ++c.disorder;
+        c.lastQos0 = ts;
+    }
+    // a dropped spike shifts the mean the frame number is read from
+    auto f = frame >= 0 && !opt.pmsSpikeEvery ? frameDoneMs.find((uint16_t)frame) : frameDoneMs.end();
+    if (f == frameDoneMs.end() || wallClock.backSteps()) return;
+    for (const Window& w : c.unchecked) if (f->second >= w.startMs && f->second - w.startMs < w.lenMs) return;
+    const double lo = trueUs(f->second) / 1000.0, hi = trueUs(f->second + opt.pmsPeriodMs + 100) / 1000.0;
+    const double err = ts < lo ? ts - lo : ts > hi ? ts - hi : 0;
+    c.payloadMaxErrMs = std::max(c.payloadMaxErrMs, fabs(err));
+    if (fabs(err) > 30) ++c.off;
+}
+
+void configSend(uint32_t now);
+#if ENABLE_OTA
+void otaSend(uint32_t now);
+#endif
+
+uint32_t lastTick = 0;
+void tick() {
+    const uint32_t now = millis();
+    if (now == lastTick) { broker.poll(); return; }   // yield() without time passing
+    lastTick = now;
+    applyOutages(now);
+    if (portalUp != lastPortal) { lastPortal = portalUp; portalChanges.push_back({now, portalUp}); }
+    feedPms(now);
+    warmObserve();
+    configSend(now);
+#if ENABLE_OTA
+    otaSend(now);
+    http.poll();
+#endif
+    if (opt.bme) driveEnv(now);
+    if (opt.co2) driveCo2(now);
+    clockObserve(now);
+    ntp.poll();
+    broker.poll();
+}
+
+// ---- Broker-side observations ----
+std::vector<uint32_t> latencies;
+std::map<uint32_t, uint32_t> seqSeen;    // seq -> copies received
+uint32_t envPayloads = 0, co2Payloads = 0;
+
+long jsonInt(const uint8_t* p, size_t n, const char* key) {
+    std::string s((const char*)p, n);
+    size_t at = s.find(key);
+    return at == std::string::npos ? -1 : strtol(s.c_str() + at + strlen(key), nullptr, 10);
+}
+
+double jsonNum(const uint8_t* p, size_t n, const char* key) {
+    std::string s((const char*)p, n);
+    size_t at = s.find(key);
+    return at == std::string::npos ? -1 : strtod(s.c_str() + at + strlen(key), nullptr);
+}
+
+// Telemetry carries "warming_ms" before the gate opens, then the firmware's own warm-up time.
+void warmTelemetry(const uint8_t* p, size_t n) {
+    ++warmCheck.telemetry;
+    const long ms = jsonInt(p, n, "\"pms\":{\"warmup_ms\":");
+    if (ms < 0) { if (pmsWarmup.warm() || jsonInt(p, n, "\"pms\":{\"warming_ms\":") < 0) ++warmCheck.telemetryWrong; return; }
+    ++warmCheck.telemetryWarm;
+    if ((uint32_t)ms != pmsWarmup.durationMs()) ++warmCheck.telemetryWrong;
+}
+
+// ---- PM2.5 humidity correction, recomputed in double from the payload ----
+struct {
+    uint32_t payloads = 0, missing = 0;
+    double   maxDiff = 0, rawMax = 0;
+} corrCheck;
+
+double refEpa(double x, double rh) {
+    if (x < 30)  return 0.524 * x - 0.0862 * rh + 5.75;
+    if (x < 50)  { const double w = x / 20 - 1.5; return (0.786 * w + 0.524 * (1 - w)) * x - 0.0862 * rh + 5.75; }
+    if (x < 210) return 0.786 * x - 0.0862 * rh + 5.75;
+    if (x < 260) {
+        const double w = x / 50 - 4.2;
+        return (0.69 * w + 0.786 * (1 - w)) * x - 0.0862 * rh * (1 - w) + 2.966 * w + 5.75 * (1 - w) + 8.84e-4 * x * x * w;
+    }
+    return 2.966 + 0.69 * x + 8.84e-4 * x * x;
+}
+
+double refKappa(double pm, double rh) {
+    const double aw = std::min(rh, RH_CORR_MAX_X10 / 10.0) / 100.0;
+    return pm / (1 + settings.kappa_x1000 / 1000.0 * aw / (1 - aw));
+}
+
+void corrObserve(const uint8_t* p, size_t n) {
+    const double rh = jsonNum(p, n, "\"rh\":"), pm = jsonNum(p, n, "\"pm25\":"), c = jsonNum(p, n, "\"pm25_corr\":");
+    if (!PM25_RH_CORRECTION || rh < 0 || pm < 0) return;
+    if (c < 0) { ++corrCheck.missing; return; }
+    const double want = std::max(0.0, PM25_RH_CORRECTION == 1 ? refKappa(pm, rh) : refEpa(pm, rh));
+    ++corrCheck.payloads;
+    corrCheck.maxDiff = std::max(corrCheck.maxDiff, fabs(c - want));
+    corrCheck.rawMax  = std::max(corrCheck.rawMax, pm);
+}
+
+// ---- Remote configuration: replies, persistence, and the settings taking effect ----
+// Every message sent must get exactly one reply on config/<node>/state,
+// accepted or rejected as the option said (a leading '!' expects a
+// rejection). A rejection must leave the live settings and EEPROM as they
+// were; an accepted change must be committed to EEPROM and reported back.
+// Payloads sampled after the last change must carry the calibration, and
+// consecutive QoS1 samples must be one publish period apart.
+struct {
+    uint32_t sent = 0, replies = 0, accepted = 0, rejected = 0, unexpected = 0, notPersisted = 0, badReport = 0;
+    uint32_t commits0 = 0, lastChangeMs = 0;
+    NodeSettings before{};
+    uint32_t calChecked = 0, calBad = 0;
+    double   calMaxDiff = 0;
+    uint32_t lastSeq = 0, lastSeqMs = 0, periodChecked = 0, periodBad = 0;
+} cfgCheck;
+size_t nextConfig = 0;
+
+void configSend(uint32_t now) {
+    while (nextConfig < opt.configs.size() && opt.configs[nextConfig].atMs <= now) {
+        const ConfigMsg& m = opt.configs[nextConfig++];
+        cfgCheck.before = settings;
+        cfgCheck.commits0 = hal::eepromCommits;
+        ++cfgCheck.sent;
+        const std::string topic = std::string("config/") + config.node_id;
+        LOGW("[HARNESS] config -> %s", m.json.c_str());
+        broker.publish(topic.c_str(), (const uint8_t*)m.json.data(), m.json.size());
+    }
+}
+
+void configReply(const uint8_t* p, size_t n) {
+    const std::string s((const char*)p, n);
+    if (s.find("\"ok\":") == std::string::npos) return;           // the report after a connect
+    ++cfgCheck.replies;
+    const bool ok = s.find("\"ok\":true") != std::string::npos, changed = s.find("\"changed\":true") != std::string::npos;
+    const size_t idx = cfgCheck.replies - 1;
+    if (idx >= opt.configs.size() || opt.configs[idx].expectOk != ok) ++cfgCheck.unexpected;
+    ok ? ++cfgCheck.accepted : ++cfgCheck.rejected;
+    NodeSettings stored;
+    EEPROM.get(SETTINGS_ADDR, stored);
+    const bool same = !memcmp(&settings, &cfgCheck.before, sizeof(settings));
+    if (!ok || !changed) {
+        if (!same || hal::eepromCommits != cfgCheck.commits0) ++cfgCheck.notPersisted;
+    } else {
+        if (memcmp(&stored, &settings, sizeof(settings)) || hal::eepromCommits == cfgCheck.commits0) ++cfgCheck.notPersisted;
+        cfgCheck.lastChangeMs = millis();
+        cfgCheck.lastSeq = 0;
+    }
+    if (jsonInt(p, n, "\"publish_s\":") != settings.publish_s || jsonInt(p, n, "\"kappa_x1000\":") != settings.kappa_x1000)
+        ++cfgCheck.badReport;
+}
+
+// Frames a..b made this payload: its PM2.5/PM10 must be the calibrated mean.
+void calObserve(const uint8_t* p, size_t n, long a, long b) {
+    const double pm25 = jsonNum(p, n, "\"pm25\":"), pm10 = jsonNum(p, n, "\"pm10\":");
+    if (pm25 < 0 || a <= 0 || b < a) return;
+    double sum = 0;
+    for (long f = a - 1; f <= b + 1; ++f) if (spikedAt((uint32_t)f)) return;   // the pm1 trace is off
+    for (long f = a; f <= b; ++f) sum += pm25At((uint32_t)f);
+    const double raw = sum / (b - a + 1);
+    const double want25 = std::max(0.0, raw * settings.pm25_gain_x1000 / 1000.0 + settings.pm25_offset_x10 / 10.0);
+    const double want10 = std::max(0.0, (raw + 8) * settings.pm10_gain_x1000 / 1000.0 + settings.pm10_offset_x10 / 10.0);
+    const double d = std::max(fabs(pm25 - want25), fabs(pm10 - want10));
+    ++cfgCheck.calChecked;
+    cfgCheck.calMaxDiff = std::max(cfgCheck.calMaxDiff, d);
+    if (d > 0.16) ++cfgCheck.calBad;                   // the mean and the calibration each round to 0.1
+}
+
+// Consecutive samples, timed by their newest frame (queued ones too), one
+// frame either way for the pm1 trace.
+void periodObserve(long seq, uint32_t sampledMs) {
+    if (seq <= 0) return;
+    if (cfgCheck.lastSeq && (uint32_t)seq == cfgCheck.lastSeq + 1) {
+        ++cfgCheck.periodChecked;
+        const uint32_t d = sampledMs - cfgCheck.lastSeqMs, want = settings.publish_s * 1000u, tol = 2 * opt.pmsPeriodMs + 100;
+        if (d + tol < want || d > want + tol) ++cfgCheck.periodBad;
+    }
+    if ((uint32_t)seq > cfgCheck.lastSeq) { cfgCheck.lastSeq = (uint32_t)seq; cfgCheck.lastSeqMs = sampledMs; }
+}
+
+#if ENABLE_OTA
+// ---- Firmware update: signed images from the HTTP stand-in, flash checked ----
+// Every request sent must end in exactly one "ok", "failed" or "rejected"
+// report, with the error its mode was scripted to cause, or "rejected busy"
+// when the previous update was still running (a rejection overtakes the
+// running update's report, so outcomes are matched, not ordered). "download" percentages must
+// rise. No boot command may be written before "ok"; after it, the command
+// must copy exactly the streamed bin, and flash must hold it byte for byte.
+// The restart comes OTA_REBOOT_MS after "ok".
+//
+// The private exponent of dev/host/ota_pubkey.h. It is a test key and public:
+// an image signed with it proves nothing to a real node.
+const char kTestKeyD[] =
+    "09120191c3aef49382af2158b7c78ca370af9ddaacccd1cb2a70fd942597020a78d95161e5b1b027821611b75284df4c"
+    "94cca46f822f000d638e39e025dda2582ca9c55b7f40c1579e609e9e122c8c030664d52b740d45c89a01d260fa3286bd"
+    "ee062a97f9c65e2a6578a72edee20dc31cfc596ece3689f5cab355f9c3650db0cd57f18f59a4c66bb0931d0e63122442"
+    "b7354645ac0917598a4a2cb9c27ebd2992cfd796ebea37144463bede575e51db28cfee28f6db7484dbed981f069093df"
+    "a41f9469d1c1f14b7de327b1b729eff0076f9c619d50a63f440fa0e8cbde79a1730cf2d08cbd133882850593e6b43a6c"
+    "8a0ad92ac47f026150b7a6c10f9ac6a1";
+
+// What each --ota mode serves, and the error it must fail with (null: must succeed).
+struct OtaMode { const char* name; const char* error; };
+const OtaMode kOtaModes[] = {
+    {"ok", nullptr},               // signed image
+    {"corrupt", "signature"},      // one bit flipped in the bin after signing
+    {"badsig", "signature"},       // one bit flipped in the signature
+    {"cut", "truncated"},          // the server hangs up two thirds in
+    {"404", "http status"},        // nothing at that path
+    {"notfw", "not firmware"},     // signed, but not an ESP image
+    {"nolength", "no content-length"},
+    {"huge", "no space"},          // bigger than the free sketch space
+    {"delta", nullptr},            // patch against the running build (ota_delta.h)
+    {"packed", nullptr},           // the new build compressed, no base
+    {"wrongbase", "wrong base"},   // patch against a build the node does not run
+    {"badpatch", "bad patch"},     // an invalid op in the middle of the patch
+};
+constexpr size_t OTA_IMAGE_BYTES = 300 * 1024 + 3;   // odd on purpose: the last flash word is partial
+
+std::string otaOld;                   // the build the node runs: flash from address 0
+std::string otaBin;                   // the new build's firmware.bin, which every good mode delivers
+size_t      otaPatchBytes[2];         // delta, packed
+
+struct {
+    uint32_t sent = 0, ended = 0, ok = 0, failed = 0, rejected = 0, unexpected = 0;
+    uint32_t progress = 0, outOfOrder = 0, lastPct = 0, earlyCommit = 0;
+    uint32_t startMs = 0, longestMs = 0, okMs = 0, restartMs = 0;
+    bool     imageOk = false;
+    std::multiset<std::string> expect;  // outstanding: "ok", "failed:<error>" or "rejected:busy"
+} otaCheck;
+size_t nextOta = 0;
+
+// EMSA-PKCS1-v1_5 with SHA-256, raised to d: what openssl dgst -sha256 -sign writes.
+std::string otaSign(const std::string& bin) {
+    static const uint8_t info[19] = {0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+                                     0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20};
+    uint8_t digest[Sha256::DIGEST], em[ota::rsa::BYTES], d[ota::rsa::BYTES], sig[ota::rsa::BYTES];
+    Sha256 h;
+    h.update(bin.data(), bin.size());
+    h.finish(digest);
+    memset(em, 0xFF, sizeof(em));
+    em[0] = 0x00; em[1] = 0x01;
+    const size_t at = sizeof(em) - sizeof(info) - sizeof(digest);
+    em[at - 1] = 0x00;
+    memcpy(em + at, info, sizeof(info));
+    memcpy(em + at + sizeof(info), digest, sizeof(digest));
+    for (size_t i = 0; i < sizeof(d); ++i) d[i] = (uint8_t)strtoul(std::string(kTestKeyD + 2 * i, 2).c_str(), nullptr, 16);
+    ota::rsa::modPow(sig, em, d, sizeof(d), kOtaPubKey);
+    const uint8_t len[4] = {(uint8_t)ota::rsa::BYTES, (uint8_t)(ota::rsa::BYTES >> 8), 0, 0};
+    return bin + std::string((const char*)sig, sizeof(sig)) + std::string((const char*)len, sizeof(len));
+}
+
+// Two builds a release apart. Code is tokens from a skewed vocabulary, so
+// it compresses about as badly as real Xtensa code. The new build has
+// relocated addresses throughout, a function added and one dropped.
+void otaBuilds() {
+    uint32_t x = 0x2545F491;                                  // xorshift: repeatable
+    auto rnd = [&x] { x ^= x << 13; x ^= x >> 17; x ^= x << 5; return x; };
+    std::vector<std::string> vocab(3000);
+    for (std::string& t : vocab) for (uint32_t k = 2 + rnd() % 5; k; --k) t += (char)rnd();
+    auto code = [&](size_t n) {
+        std::string c;
+        while (c.size() < n) { const uint64_t r = rnd() % vocab.size(); c += vocab[r * r / vocab.size()]; }
+        c.resize(n);
+        return c;
+    };
+    otaOld = code(OTA_IMAGE_BYTES - 2000);
+    otaOld[0] = (char)ota::IMAGE_MAGIC;
+    otaBin = otaOld;
+    for (size_t at = 1000; at + 4 < otaBin.size(); at += 1500 + rnd() % 3000) otaBin[at] = (char)rnd();
+    otaBin.insert(otaBin.size() / 3, code(6000));
+    otaBin.erase(otaBin.size() * 2 / 3, 4000);
+    otaBin.resize(OTA_IMAGE_BYTES, '\0');
+    otaBin[2] = 0x02;                                         // the header as the build writes it
+    // esptool set the flash mode and size when it flashed the node
+    std::string flash = otaOld;
+    flash[2] = 0x03; flash[3] = 0x40;
+    flash.resize((flash.size() + 3) & ~(size_t)3, (char)0xFF);
+    hal::sketchSize = (uint32_t)otaOld.size();
+    hal::flashIo(0, flash.data(), flash.size(), true);
+}
+
+// Where the first op past the middle of a patch's op stream starts.
+size_t otaOpNear(const std::string& patch, size_t trailer) {
+    delta::Decoder dec;
+    dec.reset();
+    const uint8_t* p = (const uint8_t*)patch.data();
+    const size_t end = patch.size() - trailer;
+    for (size_t at = delta::HEADER; at < end;) {
+        if (at >= (delta::HEADER + end) / 2) return at;
+        delta::Op op{};
+        size_t used = 0;
+        if (!dec.next(p + at, end - at, used, op)) break;
+        at += used + (op.kind == delta::LIT ? op.len : 0);
+    }
+    return delta::HEADER;
+}
+
+void otaServe() {
+    otaBuilds();
+    const std::string image = otaSign(otaBin);
+    HttpStandin::File f;
+    f.body = image;
+    http.serve("/fw-ok.bin", f);
+    f.body[otaBin.size() / 2] ^= 0x01;
+    http.serve("/fw-corrupt.bin", f);
+    f.body = image;
+    f.body[otaBin.size() + 100] ^= 0x01;
+    http.serve("/fw-badsig.bin", f);
+    f.body = image;
+    f.cutAt = image.size() * 2 / 3;
+    http.serve("/fw-cut.bin", f);
+    f.cutAt = std::string::npos;
+    std::string notFw = otaBin;
+    notFw[0] = 0x00;
+    f.body = otaSign(notFw);
+    http.serve("/fw-notfw.bin", f);
+    f.body = image;
+    f.noLength = true;
+    http.serve("/fw-nolength.bin", f);
+    f.noLength = false;
+    f.body = otaSign(std::string(hal::flashFsStart, (char)ota::IMAGE_MAGIC));
+    http.serve("/fw-huge.bin", f);
+    const std::string trailer = image.substr(otaBin.size());
+    f.body = delta::encode(otaOld, otaBin, trailer);
+    otaPatchBytes[0] = f.body.size();
+    http.serve("/fw-delta.bin", f);
+    f.body[otaOpNear(f.body, trailer.size())] = (char)0xFF;      // kind 3
+    http.serve("/fw-badpatch.bin", f);
+    std::string other = otaOld;
+    other[otaOld.size() / 2] ^= 0x01;
+    f.body = delta::encode(other, otaBin, trailer);
+    http.serve("/fw-wrongbase.bin", f);
+    f.body = delta::encode("", otaBin, trailer);
+    otaPatchBytes[1] = f.body.size();
+    http.serve("/fw-packed.bin", f);
+}
+
+void otaSend(uint32_t now) {
+    while (nextOta < opt.otas.size() && opt.otas[nextOta].first <= now) {
+        const std::string& mode = opt.otas[nextOta++].second;
+        const OtaMode* m = nullptr;
+        for (const OtaMode& k : kOtaModes) if (mode == k.name) m = &k;
+        otaCheck.expect.insert(otaUpdate.busy() ? "rejected:busy" : !m->error ? "ok" : std::string("failed:") + m->error);
+        ++otaCheck.sent;
+        char json[160];
+        snprintf(json, sizeof(json), "{\"url\":\"http://127.0.0.1:%u/fw-%s.bin\",\"version\":\"harness-%s\"}",
+                 http.port(), mode.c_str(), mode.c_str());
+        const std::string topic = std::string("ota/") + config.node_id;
+        LOGW("[HARNESS] ota -> %s", json);
+        broker.publish(topic.c_str(), (const uint8_t*)json, strlen(json));
+    }
+}
+
+std::string jsonStr(const uint8_t* p, size_t n, const char* key) {
+    const std::string s((const char*)p, n);
+    const size_t at = s.find(key);
+    if (at == std::string::npos) return "";
+    const size_t from = at + strlen(key);
+    return s.substr(from, s.find('"', from) - from);
+}
+
+// The boot command must copy the streamed bin over the sketch, and flash must hold it.
+bool otaImageInFlash() {
+    const eboot_command& c = hal::ebootCmd;
+    if (c.action != ACTION_COPY_RAW || c.args[1] != 0 || c.args[2] != otaBin.size() || c.args[0] != otaUpdate.address() ||
+        c.args[0] < ((hal::sketchSize + ota::SECTOR - 1) & ~(ota::SECTOR - 1)) || c.args[0] + c.args[2] > hal::flashFsStart)
+        return false;
+    std::vector<uint8_t> got((otaBin.size() + 3) & ~(size_t)3);
+    return hal::flashIo(c.args[0], got.data(), got.size(), false) && !memcmp(got.data(), otaBin.data(), otaBin.size());
+}
+
+void otaReply(const uint8_t* p, size_t n) {
+    const uint32_t now = millis();
+    const std::string state = jsonStr(p, n, "\"state\":\""), error = jsonStr(p, n, "\"error\":\"");
+    if (state == "start") { otaCheck.startMs = now; otaCheck.lastPct = 0; return; }
+    if (state == "download") {
+        const long pct = jsonInt(p, n, "\"pct\":");
+        ++otaCheck.progress;
+        if (pct <= (long)otaCheck.lastPct && otaCheck.lastPct) ++otaCheck.outOfOrder;
+        otaCheck.lastPct = (uint32_t)std::max(pct, 0L);
+        return;
+    }
+    if (state != "ok" && state != "failed" && state != "rejected") return;
+    const std::string got = state == "ok" ? state : state + ":" + error;
+    auto want = otaCheck.expect.find(got);
+    if (want == otaCheck.expect.end()) { ++otaCheck.unexpected; LOGW("[HARNESS] ota: unexpected %s", got.c_str()); }
+    else otaCheck.expect.erase(want);
+    ++otaCheck.ended;
+    if (state == "rejected") { ++otaCheck.rejected; return; }
+    otaCheck.longestMs = std::max(otaCheck.longestMs, now - otaCheck.startMs);
+    if (state == "failed") {
+        ++otaCheck.failed;
+        if (hal::ebootWrites) ++otaCheck.earlyCommit;
+        return;
+    }
+    ++otaCheck.ok;
+    otaCheck.okMs = now;
+    hal::AllocPause host;
+    otaCheck.imageOk = hal::ebootWrites == 1 && otaImageInFlash();
+}
+#endif
+
+#if ENABLE_AQI
+// ---- AQI: NowCast and breakpoints redone in double from the firmware's hourly means ----
+struct {
+    uint32_t checks = 0, usMismatch = 0, caqiMismatch = 0, usValid = 0;
+    uint32_t hourS = 0, onUtc = 0, offUtc = 0, firstOffMs = 0, clockSteps = 0;
+    double   maxDnc = 0;
+    uint32_t payloads = 0, usPayloads = 0, caqiPayloads = 0, payloadMax = 0;
+    uint32_t apiCalls = 0, apiBad = 0;
+    uint64_t apiAllocs = 0;
+} aqiCheck;
+
+// {cLo, cHi, iLo, iHi} in µg/m³, as published by the EPA and CITEAIR.
+const double kRefUs25[][4]   = {{0, 9.0, 0, 50}, {9.1, 35.4, 51, 100}, {35.5, 55.4, 101, 150},
+                                {55.5, 125.4, 151, 200}, {125.5, 225.4, 201, 300}, {225.5, 325.4, 301, 500}};
+const double kRefUs10[][4]   = {{0, 54, 0, 50}, {55, 154, 51, 100}, {155, 254, 101, 150},
+                                {255, 354, 151, 200}, {355, 424, 201, 300}, {425, 604, 301, 500}};
+const double kRefCaqi25[][4] = {{0, 15, 0, 25}, {15, 30, 25, 50}, {30, 55, 50, 75}, {55, 110, 75, 100}};
+const double kRefCaqi10[][4] = {{0, 25, 0, 25}, {25, 50, 25, 50}, {50, 90, 50, 75}, {90, 180, 75, 100}};
+
+template<size_t N>
+long refIndex(const double (&t)[N][4], double c, bool extend) {
+    for (size_t i = 0; i < N; ++i) {
+        if (c > t[i][1] && i + 1 < N) continue;
+        if (c > t[i][1] && !extend) return lround(t[i][3]);
+        return (long)floor((t[i][3] - t[i][2]) / (t[i][1] - t[i][0]) * (c - t[i][0]) + t[i][2] + 0.5 + 1e-9);
+    }
+    return 0;
+}
+
+double refNowcast(HourlyPm::Pm p) {
+    std::vector<double> c;
+    for (size_t i = 0; i < HourlyPm::HOURS; ++i) {
+        const uint16_t v = aqiHours.hour(p, i);
+        c.push_back(v == AQI_NONE ? NAN : v / 10.0);
+    }
+    if ((int)!std::isnan(c[0]) + !std::isnan(c[1]) + !std::isnan(c[2]) < 2) return NAN;
+    double lo = 1e9, hi = 0;
+    for (double v : c) if (!std::isnan(v)) { lo = std::min(lo, v); hi = std::max(hi, v); }
+    const double w = hi > 0 ? std::max(lo / hi, 0.5) : 1;
+    double num = 0, den = 0, wi = 1;
+    for (double v : c) { if (!std::isnan(v)) { num += wi * v; den += wi; } wi *= w; }
+    return floor(num / den * 10 + 1e-9) / 10;          // truncated to 0.1
+}
+
+// After each hour closes: NowCast within the Q16 weights' 0.1, and the
+// indices exactly as the tables give them for the firmware's own inputs.
+// Once the clock has taken over, an hour must close within 1 s of its UTC
+// end by the node's clock. After the node stepped its clock, the close may
+// come anywhere in the hour after that end: a forward step moves the
+// boundary away from the timer that waits for it, and closes the hours it
+// skipped at once.
+void aqiObserve() {
+    const bool onWall = aqiCheck.hourS != 0;           // the clock had taken over before this close
+    aqiCheck.hourS = aqiHourS;
+    if (aqiCloses == aqiCheck.checks) return;
+    aqiCheck.checks = aqiCloses;
+    const uint32_t steps = wallClock.steps() + wallClock.backSteps();
+    const bool stepped = steps != aqiCheck.clockSteps;
+    aqiCheck.clockSteps = steps;
+    if (onWall) {
+        const uint64_t t = wallClock.nowMs(millis()), end = (uint64_t)aqiHourS * 1000;
+        if (aqiHourS % 3600 == 0 && t >= end && t - end < (stepped ? 3600000u : 1000u)) {
+            ++aqiCheck.onUtc;
+        } else if (!aqiCheck.offUtc++) {
+            aqiCheck.firstOffMs = millis();
+        }
+    }
+    hal::AllocPause host;
+    const double n25 = refNowcast(HourlyPm::PM25), n10 = refNowcast(HourlyPm::PM10);
+    if (std::isnan(n25) != (g_aqi.nowcast25_x10 == AQI_NONE)) ++aqiCheck.usMismatch;
+    if (!std::isnan(n25)) {
+        ++aqiCheck.usValid;
+        aqiCheck.maxDnc = std::max({aqiCheck.maxDnc, fabs(n25 - g_aqi.nowcast25_x10 / 10.0), fabs(n10 - g_aqi.nowcast10_x10 / 10.0)});
+        const long want = std::max(refIndex(kRefUs25, g_aqi.nowcast25_x10 / 10.0, false),
+                                   refIndex(kRefUs10, floor(g_aqi.nowcast10_x10 / 10.0), false));
+        if (want != g_aqi.us) ++aqiCheck.usMismatch;
+    }
+    const uint16_t h25 = aqiHours.hour(HourlyPm::PM25, 0), h10 = aqiHours.hour(HourlyPm::PM10, 0);
+    const long caqi = h25 == AQI_NONE ? AQI_NONE : std::max(refIndex(kRefCaqi25, h25 / 10.0, true), refIndex(kRefCaqi10, h10 / 10.0, true));
+    if (caqi != g_aqi.caqi) ++aqiCheck.caqiMismatch;
+}
+
+// GET /api as a LAN client would; the handler must not allocate.
+void apiPoll() {
+    if (!server || portalUp) return;
+    const uint64_t a0 = hal::allocCalls;
+    const int code = server->hostRequest(HTTP_GET, "/api", {}, "10.0.0.2");
+    aqiCheck.apiAllocs += hal::allocCalls - a0;
+    ++aqiCheck.apiCalls;
+    hal::AllocPause host;
+    const std::string body = server->lastBody.c_str();
+    const bool ok = code == 200 && body.size() > 2 && body.front() == '{' && body.back() == '}' &&
+                    body.find("\"aqi_detail\":{") != std::string::npos &&
+                    (g_aqi.us == AQI_NONE || body.find("\"us_category\":") != std::string::npos);
+    if (!ok) ++aqiCheck.apiBad;
+}
+#endif
+
+// ---- Aggregates: wall-clock buckets checked frame by frame ----
+// A minute record must hold exactly the frames whose true time (when their
+// last byte arrived) lies in its minute. Frames within AGG_TOL_MS of a
+// boundary (plus the clock error the clock check allows), of the first
+// sync, or spiked (--pms-spikes) may go either way.
+// While the frame counter still fits pm1 (×10, int16: frame 3276) the
+// record must also be those frames' counters: n, sum, min, max and sum of
+// squares. A 15-min or 1-h record must be the exact merge of the records
+// one tier down, when all of those arrived. Every record must arrive after
+// its boundary, within 1 s of it if nothing was scripted to fail, and a
+// repeat must be identical. Skipped around server time steps.
+constexpr uint32_t AGG_TOL_MS = 30;
+
+uint32_t aggTol() { return AGG_TOL_MS + (uint32_t)ceil(clockCheck.maxAllowedMs); }
+
+struct AggRec {
+    uint32_t n[AGG_FIELDS];
+    int64_t  sum[AGG_FIELDS], min[AGG_FIELDS], max[AGG_FIELDS];
+    uint64_t sq[AGG_FIELDS];
+    std::string raw;
+};
+
+struct {
+    uint32_t records[Aggregates::TIERS] = {}, repeats = 0, changed = 0, early = 0, checked = 0, miscounted = 0,
+             exact = 0, wrongFrames = 0, merged = 0, badMerge = 0, inconsistent = 0, unaligned = 0;
+    int64_t  maxLateMs = INT64_MIN;
+    std::map<std::pair<uint32_t, uint64_t>, AggRec> seen;      // (period, ts) -> record
+} aggCheck;
+
+bool aggParse(const std::string& s, AggRec& r) {
+    r = AggRec{};
+    r.raw = s;
+    for (size_t i = 0; i < AGG_FIELDS; ++i) {
+        char key[16];
+        snprintf(key, sizeof(key), "\"%s\":[", kAggNames[i]);
+        const size_t at = s.find(key);
+        if (at == std::string::npos) continue;
+        const char* c = s.c_str() + at + strlen(key);
+        char* e;
+        r.n[i]   = (uint32_t)strtoul(c, &e, 10);     if (*e != ',') return false;
+        r.sum[i] = strtoll(e + 1, &e, 10);             if (*e != ',') return false;
+        r.min[i] = strtoll(e + 1, &e, 10);             if (*e != ',') return false;
+        r.max[i] = strtoll(e + 1, &e, 10);             if (*e != ',') return false;
+        r.sq[i]  = strtoull(e + 1, &e, 10);            if (*e != ']') return false;
+    }
+    return true;
+}
+
+// Wall times [fromMs, toMs) that the node or the true clock passed through while a step settled.
+bool aggUnchecked(uint64_t fromMs, uint64_t toMs) {
+    for (const auto& w : clockCheck.uncheckedWall)
+        if (toMs + 1000 >= w.first && fromMs <= w.second + 1000) return true;
+    return false;
+}
+
+// Frames (by the true time of their last byte) in [startMs, endMs): how many
+// surely are and maybe are, and the first and last frame that surely is.
+// Until the warm-up ends every frame is from before it, and none count.
+void aggFrames(uint64_t startMs, uint64_t endMs, uint32_t& sure, uint32_t& maybe, uint32_t& first, uint32_t& last) {
+    sure = maybe = 0; first = UINT32_MAX; last = 0;
+    const uint32_t tol = aggTol();
+    for (const auto& f : frameDoneMs) {
+        if (!warmCheck.warm || f.first < (uint32_t)warmCheck.warmFrame || !clockCheck.firstSyncMs ||
+            f.second + tol < clockCheck.firstSyncMs) continue;
+        const uint64_t t = (uint64_t)(trueUs(f.second) / 1000);
+        if (t + tol < startMs || t >= endMs + tol) continue;
+        const bool edge = t < startMs + tol || t + tol >= endMs || spikedAt(f.first) ||
+                          (uint32_t)abs((int32_t)(f.second - clockCheck.firstSyncMs)) < tol;
+        if (edge) { ++maybe; continue; }
+        ++sure;
+        first = std::min(first, (uint32_t)f.first);
+        last  = std::max(last, (uint32_t)f.first);
+    }
+}
+
+void aggRecord(const uint8_t* p, size_t n, uint32_t now) {
+    auto& c = aggCheck;
+    const std::string s((const char*)p, n);
+    const size_t at = s.find("\"ts\":");
+    const long period = jsonInt(p, n, "\"period\":");
+    AggRec r;
+    if (at == std::string::npos || !aggParse(s, r)) { ++c.inconsistent; return; }
+    const uint64_t ts = strtoull(s.c_str() + at + 5, nullptr, 10);
+    int tier = -1;
+    for (uint8_t t = 0; t < Aggregates::TIERS; ++t) if ((long)Aggregates::PERIOD_S[t] == period) tier = t;
+    if (tier < 0 || ts % ((uint64_t)period * 1000)) { ++c.unaligned; return; }
+    const auto key = std::make_pair((uint32_t)period, ts);
+    if (c.seen.count(key)) { ++c.repeats; if (c.seen[key].raw != s) ++c.changed; return; }
+    c.seen[key] = r;
+    ++c.records[tier];
+    const uint64_t end = ts + (uint64_t)period * 1000;
+    const int64_t late = (int64_t)(trueUs(now) / 1000) - (int64_t)end;
+    for (size_t i = 0; i < AGG_FIELDS; ++i) {
+        if (!r.n[i]) continue;
+        const __int128 n2 = (__int128)r.n[i] * (__int128)r.sq[i], s2 = (__int128)r.sum[i] * r.sum[i];
+        if (r.min[i] > r.max[i] || r.sum[i] < r.min[i] * r.n[i] || r.sum[i] > r.max[i] * r.n[i] || n2 < s2) ++c.inconsistent;
+    }
+    if (aggUnchecked(ts, end) || clockCheck.settling) return;
+    if (late < -(int64_t)aggTol()) ++c.early;
+    c.maxLateMs = std::max(c.maxLateMs, late);
+    if (tier == 0) {
+        uint32_t sure, maybe, first, last;
+        aggFrames(ts, end, sure, maybe, first, last);
+        ++c.checked;
+        if (r.n[AGG_PM1] < sure || r.n[AGG_PM1] > sure + maybe || r.n[AGG_PM25] != r.n[AGG_PM1]) ++c.miscounted;
+        if (r.n[AGG_PM1] && r.max[AGG_PM1] < 32767 && !opt.pmsSpikeEvery) {
+            const int64_t a = r.min[AGG_PM1] / 10, b = r.max[AGG_PM1] / 10, k = b - a + 1;
+            int64_t sum = 0; uint64_t sq = 0;
+            for (int64_t f = a; f <= b; ++f) { sum += 10 * f; sq += (uint64_t)(100 * f * f); }
+            ++c.exact;
+            if ((uint32_t)k != r.n[AGG_PM1] || sum != r.sum[AGG_PM1] || sq != r.sq[AGG_PM1] ||
+                (sure && (a > (int64_t)first || b < (int64_t)last || k > sure + maybe))) ++c.wrongFrames;
+        }
+        return;
+    }
+    // the merge of the tier below, if every one of its records came
+    const uint32_t sub = Aggregates::PERIOD_S[tier - 1];
+    AggRec m{};
+    bool any = false;
+    for (uint64_t t = ts; t < end; t += (uint64_t)sub * 1000) {
+        auto it = c.seen.find(std::make_pair(sub, t));
+        if (it == c.seen.end()) {
+            // a sub-bucket with no values is not sent: only fine if no frame fell in it
+            uint32_t sure, maybe, first, last;
+            aggFrames(t, t + (uint64_t)sub * 1000, sure, maybe, first, last);
+            if (sure || maybe) return;
+            continue;
+        }
+        for (size_t i = 0; i < AGG_FIELDS; ++i) {
+            const AggRec& q = it->second;
+            if (!q.n[i]) continue;
+            m.min[i] = m.n[i] ? std::min(m.min[i], q.min[i]) : q.min[i];
+            m.max[i] = m.n[i] ? std::max(m.max[i], q.max[i]) : q.max[i];
+            m.n[i] += q.n[i]; m.sum[i] += q.sum[i]; m.sq[i] += q.sq[i];
+            any = true;
+        }
+    }
+    if (!any) return;
+    ++c.merged;
+    for (size_t i = 0; i < AGG_FIELDS; ++i)
+        if (m.n[i] != r.n[i] || (r.n[i] && (m.sum[i] != r.sum[i] || m.sq[i] != r.sq[i] || m.min[i] != r.min[i] || m.max[i] != r.max[i]))) {
+            ++c.badMerge;
+            break;
+        }
+}
+
+// ---- Scheduler: each timer at most once per run() ----
+// A task that returns 0, or re-arms itself for now, must wait for the next
+// run() call instead of running again in this one, or it could keep loop()
+// from the radio. Checked twice: on a small scheduler of its own at start-up,
+// and on the firmware's scheduler after every loop() pass.
+struct {
+    uint32_t selfBad = 0, twice = 0, firstTwiceMs = 0;
+    const char* firstTwice = nullptr;
+    uint32_t runs[Sched::capacity()] = {};
+} schedCheck;
+
+Scheduler<4> selfSched;
+int selfRearm = -1;
+
+void schedSelfTest() {
+    selfSched.add("zero", [](uint32_t) -> uint32_t { return 0; }, 0, 1000);
+    selfRearm = selfSched.add("rearm", [](uint32_t now) -> uint32_t {
+        selfSched.in(selfRearm, now, 0);
+        return 0;
+    }, 0, 1000);
+    selfSched.add("later", [](uint32_t) -> uint32_t { return 5; }, 0, 1000);
+    for (uint32_t call = 1; call <= 3; ++call) {
+        const uint32_t idle = selfSched.run(1000, 20);
+        for (int id = 0; id < 3; ++id)
+            if (selfSched.timer(id).runs != (id == 2 ? 1 : call)) ++schedCheck.selfBad;
+        if (idle != 0 || selfSched.dueIn(0, 1000) != 0 || selfSched.dueIn(2, 1000) != 5) ++schedCheck.selfBad;
+    }
+    selfSched.stop(0);
+    if (selfSched.dueIn(0, 1000) != Scheduler<4>::STOP) ++schedCheck.selfBad;
+}
+
+void schedBefore() {
+    for (size_t i = 0; i < sched.size(); ++i) schedCheck.runs[i] = sched.timer((int)i).runs;
+}
+
+void schedAfter(uint32_t passStartMs) {
+    for (size_t i = 0; i < sched.size(); ++i) {
+        if (sched.timer((int)i).runs - schedCheck.runs[i] <= 1) continue;
+        if (!schedCheck.twice++) { schedCheck.firstTwice = sched.timer((int)i).name; schedCheck.firstTwiceMs = passStartMs; }
+    }
+}
+
+// ---- GET /metrics: OpenMetrics text, parsed and checked ----
+// Every 15 s, as a Prometheus scrape would. The response must be valid
+// OpenMetrics: a # TYPE before each family's samples, no family twice, a
+// # UNIT that the name ends in, sample names that fit the type, cumulative
+// histogram buckets ending in +Inf == _count, and # EOF last. Values must
+// match the firmware's state at that instant, counters must never go down,
+// and the handler must not allocate.
+#if ENABLE_METRICS
+struct {
+    uint32_t scrapes = 0, bad = 0, families = 0, samples = 0, bytesMax = 0;
+    uint64_t allocs = 0;
+    std::string firstBad;
+    std::map<std::string, double> lastCounters;     // series -> value at the previous scrape
+} metricsCheck;
+
+void metricsPoll(uint32_t passes) {
+    if (!server || portalUp) return;
+    auto& c = metricsCheck;
+    const uint64_t a0 = hal::allocCalls;
+    const int code = server->hostRequest(HTTP_GET, "/metrics", {}, "10.0.0.2");
+    c.allocs += hal::allocCalls - a0;
+    ++c.scrapes;
+    hal::AllocPause host;
+    const std::string body = server->lastBody.c_str();
+    c.bytesMax = std::max<uint32_t>(c.bytesMax, (uint32_t)body.size());
+    std::string why;
+    auto fail = [&](const std::string& w) { if (why.empty()) why = w; };
+    if (code != 200) fail("status " + std::to_string(code));
+    if (strcmp(server->lastType.c_str(), om::kContentType)) fail("content type");
+    if (body.size() < 6 || body.compare(body.size() - 6, 6, "# EOF\n")) fail("no # EOF at the end");
+
+    std::map<std::string, std::string> types;          // family -> type
+    std::map<std::string, double> values;              // series -> value
+    std::string fam, famType;
+    double bucketPrev = -1, lePrev = -1, infCount = -1;
+    size_t at = 0;
+    uint32_t families = 0, samples = 0;
+    while (at < body.size()) {
+        const size_t nl = body.find('\n', at);
+        if (nl == std::string::npos) { fail("unterminated line"); break; }
+        const std::string line = body.substr(at, nl - at);
+        at = nl + 1;
+        if (line == "# EOF") { if (at != body.size()) fail("text after # EOF"); break; }
+        if (line.rfind("# ", 0) == 0) {
+            char kw[8] = {}, name[96] = {}, rest[160] = {};
+            if (sscanf(line.c_str(), "# %7s %95s %159[^\n]", kw, name, rest) < 3) { fail("bad comment: " + line); continue; }
+            if (!strcmp(kw, "TYPE")) {
+                if (types.count(name)) fail(std::string("family twice: ") + name);
+                if (strcmp(rest, "gauge") && strcmp(rest, "counter") && strcmp(rest, "histogram")) fail("bad type: " + line);
+                types[name] = rest; fam = name; famType = rest; ++families;
+                bucketPrev = lePrev = infCount = -1;
+            } else if (!strcmp(kw, "UNIT")) {
+                const std::string suf = std::string("_") + rest;
+                if (fam != name || fam.size() <= suf.size() || fam.compare(fam.size() - suf.size(), suf.size(), suf))
+                    fail("unit not in the name: " + line);
+            } else if (strcmp(kw, "HELP") || fam != name) {
+                fail("stray comment: " + line);
+            }
+            continue;
+        }
+        const size_t sp = line.rfind(' ');
+        if (sp == std::string::npos || fam.empty()) { fail("sample outside a family: " + line); continue; }
+        const std::string series = line.substr(0, sp);
+        char* end;
+        const double v = strtod(line.c_str() + sp + 1, &end);
+        if (*end || sp + 1 == line.size()) fail("bad value: " + line);
+        const std::string metric = series.substr(0, series.find('{'));
+        const std::string suffix = metric.compare(0, fam.size(), fam) ? "?" : metric.substr(fam.size());
+        const bool fits = famType == "gauge" ? suffix.empty() : famType == "counter" ? suffix == "_total"
+                        : suffix == "_bucket" || suffix == "_count" || suffix == "_sum";
+        if (!fits) fail("sample does not fit its family: " + line);
+        if (values.count(series)) fail("series twice: " + series);
+        values[series] = v;
+        ++samples;
+        if (suffix == "_bucket") {
+            const size_t le = series.find("le=\"");
+            const std::string bound = le == std::string::npos ? "" : series.substr(le + 4, series.find('"', le + 4) - le - 4);
+            const double b = bound == "+Inf" ? INFINITY : strtod(bound.c_str(), nullptr);
+            if (b <= lePrev || v < bucketPrev) fail("histogram buckets out of order: " + line);
+            lePrev = b; bucketPrev = v;
+            if (bound == "+Inf") infCount = v;
+        }
+        if (suffix == "_count" && v != infCount) fail("histogram +Inf != _count: " + line);
+        if (suffix == "_total" || suffix == "_count") {
+            auto it = c.lastCounters.find(series);
+            if (it != c.lastCounters.end() && v < it->second) fail("counter went down: " + line);
+            c.lastCounters[series] = v;
+        }
+    }
+    c.families = std::max(c.families, families);
+    c.samples = std::max(c.samples, samples);
+
+    auto expect = [&](const char* series, double want) {
+        auto it = values.find(series);
+        if (it == values.end()) fail(std::string("missing ") + series);
+        else if (fabs(it->second - want) > 1e-6) fail(std::string(series) + " = " + std::to_string(it->second) + ", want " + std::to_string(want));
+    };
+    expect("pm_uptime_seconds", millis() / 1000);
+    expect("pm_heap_free_bytes", heap.freeNow);
+    expect("pm_pms_frames_total", pmsParser.frames());
+    expect("pm_pms_frame_errors_total{cause=\"checksum\"}", pmsParser.checksumErrors());
+    expect("pm_loop_busy_seconds_count", passes);
+    expect("pm_loop_interval_seconds_count", passes ? passes - 1 : 0);
+    expect("pm_wifi_connects_total", net.joins);
+    for (size_t i = 0; i < i2c.devices(); ++i) {              // named, or by address if only probed
+        const Bus::Device& d = i2c.dev(i);
+        char series[64];
+        if (d.name) snprintf(series, sizeof(series), "pm_i2c_errors_total{device=\"%s\"}", d.name);
+        else        snprintf(series, sizeof(series), "pm_i2c_errors_total{device=\"0x%02X\"}", d.addr);
+        expect(series, d.errors);
+    }
+#if ENABLE_NETWORK
+    expect("pm_mqtt_connected", mqttClient.connected() ? 1 : 0);
+#endif
+    if (haveSample) {
+        expect("pm_mass_micrograms_per_cubic_meter{size=\"pm2.5\"}", lastSample.pm25_x10 / 10.0);
+#if ENABLE_BME280
+        if (lastSample.env) expect("pm_temperature_celsius", lastSample.t_x10 / 10.0);
+#endif
+    }
+    if (!why.empty()) { if (!c.bad++) c.firstBad = why; }
+}
+#endif
+
+void onPublish(const std::string&, const char* topic, const uint8_t* p, size_t n, uint8_t, bool) {
+    const uint32_t now = millis();
+    if (!strncmp(topic, "telemetry/", 10)) { warmTelemetry(p, n); return; }
+    if (!strncmp(topic, "config/", 7))     { configReply(p, n); return; }
+    if (!strncmp(topic, "aggregates/", 11)) { aggRecord(p, n, now); return; }
+#if ENABLE_OTA
+    if (!strncmp(topic, "ota/", 4))        { otaReply(p, n); return; }
+#endif
+    const double mean = jsonNum(p, n, "\"pm1\":");
+    const long   frames = jsonInt(p, n, "\"n\":");
+    // pm1 carries the frame number, ×10 in a uint16: past frame 6553 it saturates
+    const long   f = mean < 0 || mean >= 6553.5 ? -1 : frames > 0 ? lround(mean + (frames - 1) / 2.0) : lround(mean);
+    auto it = f >= 0 ? frameDoneMs.find((uint16_t)f) : frameDoneMs.end();
+    if (it != frameDoneMs.end()) latencies.push_back(now - it->second);
+    if (f >= 0 && !warmCheck.firstPublished) warmCheck.firstPublished = (uint32_t)lround(mean - (std::max(frames, 1L) - 1) / 2.0);
+    if (jsonNum(p, n, "\"env\":{\"t\":") != -1) ++envPayloads;
+    // sampled entirely under the settings in force now (a queued sample may not be)
+    const long a = f - (std::max(frames, 1L) - 1);
+    auto first = f >= 0 ? frameDoneMs.find((uint16_t)a) : frameDoneMs.end();
+    const bool current = first != frameDoneMs.end() && first->second > cfgCheck.lastChangeMs + 100;
+    if (current) corrObserve(p, n);
+    if (current && frames > 0) calObserve(p, n, a, f);      // QoS1 payloads say how many frames
+    if (jsonInt(p, n, "\"co2\":") > 0) ++co2Payloads;
+#if ENABLE_AQI
+    const std::string ps((const char*)p, n);
+    const size_t aqiAt = ps.find("\"aqi\":{");
+    if (aqiAt != std::string::npos) {                   // "us", "caqi" or both, whichever is known yet
+        const std::string obj = ps.substr(aqiAt, ps.find('}', aqiAt) - aqiAt);
+        ++aqiCheck.payloads;
+        if (obj.find("\"us\":") != std::string::npos)   ++aqiCheck.usPayloads;
+        if (obj.find("\"caqi\":") != std::string::npos) ++aqiCheck.caqiPayloads;
+    }
+    aqiCheck.payloadMax = std::max<uint32_t>(aqiCheck.payloadMax, (uint32_t)n);
+#endif
+    long seq = jsonInt(p, n, "\"seq\":");
+    if (seq > 0) ++seqSeen[(uint32_t)seq];
+    clockPayload(p, n, seq, it != frameDoneMs.end() ? f : -1);
+    if (current && it != frameDoneMs.end()) periodObserve(seq, it->second);
+}
+
+Window parseWindow(const char* v) {
+    Window w{0, 0};
+    double a = 0, b = 0;
+    if (sscanf(v, "%lf:%lf", &a, &b) == 2) w = {(uint32_t)(a * 1000), (uint32_t)(b * 1000)};
+    return w;
+}
+
+void parseArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        auto val = [&](const char* k) -> const char* {
+            size_t n = strlen(k);
+            return strncmp(a, k, n) == 0 ? a + n : nullptr;
+        };
+        if (const char* v = val("--duration="))         opt.durationMs = (uint32_t)(atof(v) * 1000);
+        else if (const char* v = val("--pms-period="))  opt.pmsPeriodMs = (uint32_t)atoi(v);
+        else if (const char* v = val("--pms-spikes="))  opt.pmsSpikeEvery = (uint32_t)atoi(v);
+        else if (const char* v = val("--pms-warmup="))  opt.pmsWarmupMs = (uint32_t)(atof(v) * 1000);
+        else if (const char* v = val("--drop-acks="))   opt.ackDropEvery = (uint32_t)atoi(v);
+        else if (const char* v = val("--broker-down=")) opt.brokerDown.push_back(parseWindow(v));
+        else if (const char* v = val("--ap-down="))     opt.apDown.push_back(parseWindow(v));
+        else if (const char* v = val("--button="))      opt.button.push_back(parseWindow(v));
+        else if (const char* v = val("--sta-event="))   opt.staEvents.push_back((uint32_t)(atof(v) * 1000));
+        else if (const char* v = val("--config=")) {
+            const char* j = strchr(v, ':');
+            if (!j) { fprintf(stderr, "--config=AT_S:JSON\n"); exit(2); }
+            const bool reject = j[1] == '!';
+            opt.configs.push_back({(uint32_t)(atof(v) * 1000), j + 1 + reject, !reject});
+        }
+        else if (const char* v = val("--ota=")) {
+            const char* m = strchr(v, ':');
+            bool known = false;
+#if ENABLE_OTA
+            for (const OtaMode& k : kOtaModes) known |= m && !strcmp(m + 1, k.name);
+#endif
+            if (!known) { fprintf(stderr, "--ota=AT_S:ok|corrupt|badsig|cut|404|notfw|nolength|huge (needs ENABLE_OTA)\n"); exit(2); }
+            opt.otas.push_back({(uint32_t)(atof(v) * 1000), m + 1});
+        }
+        else if (const char* v = val("--ota-rate="))    opt.otaRate = (uint32_t)atoi(v);
+        else if (const char* v = val("--ntp-drift="))   opt.ntpDriftPpm = atof(v);
+        else if (const char* v = val("--ntp-down="))    opt.ntpDown.push_back(parseWindow(v));
+        else if (const char* v = val("--ntp-step=")) {
+            const char* m = strchr(v, ':');
+            if (!m) { fprintf(stderr, "--ntp-step=AT_S:MS\n"); exit(2); }
+            opt.ntpSteps.push_back({(uint32_t)(atof(v) * 1000), (int32_t)atol(m + 1)});
+        }
+        else if (!strcmp(a, "--no-bme"))                opt.bme = false;
+        else if (const char* v = val("--env="))         sscanf(v, "%lf:%lf:%lf", &opt.envT, &opt.envRh, &opt.envHpa);
+        else if (!strcmp(a, "--no-co2"))                opt.co2 = false;
+        else if (const char* v = val("--co2-conv="))    opt.co2ConvMs = (uint32_t)atoi(v);
+        else if (!strcmp(a, "--quiet"))                 hal::quiet = true;
+        else {
+            fprintf(stderr, "usage: %s [--duration=S] [--pms-period=MS] [--pms-spikes=N] [--pms-warmup=S] [--drop-acks=N]\n"
+                            "          [--broker-down=START_S:LEN_S]... [--ap-down=START_S:LEN_S]...\n"
+                            "          [--button=START_S:HOLD_S]... [--sta-event=AT_S]... [--config=AT_S:[!]JSON]...\n"
+                            "          [--ota=AT_S:MODE]... [--ota-rate=B_PER_MS]\n"
+                            "          [--ntp-drift=PPM] [--ntp-step=AT_S:MS]... [--ntp-down=START_S:LEN_S]...\n"
+                            "          [--no-bme] [--env=T_C:RH:HPA] [--no-co2] [--co2-conv=MS] [--quiet]\n", argv[0]);
+            exit(2);
+        }
+    }
+}
+
+void seedConfig() {
+    ESPConfig c;
+    memset(&c, 0, sizeof(c));
+    c.magic = CONFIG_MAGIC;
+    strcpy(c.wifi_ssid, "harness-ap");
+    strcpy(c.wifi_pass, "harness-pass");
+    strcpy(c.node_id, "00000000-0000-0000-0000-0000000000h1");
+    strcpy(c.mqtt_host, "127.0.0.1");
+    c.mqtt_port = broker.port();
+    strcpy(c.mqtt_username, "harness");
+    strcpy(c.mqtt_password, "harness");
+    strcpy(c.first_sensor_id, "00000000-0000-0000-0000-00000000SENS");
+    c.registration_ok = 1;
+    EEPROM.begin(EEPROM_SIZE);
+    EEPROM.put(0, c);
+    NodeSettings s;                                    // defaults, with the SNTP stand-in as server
+    settingsDefaults(s);
+    snprintf(s.ntp_server, sizeof(s.ntp_server), "127.0.0.1:%u", ntp.port());
+    EEPROM.put(SETTINGS_ADDR, s);
+    EEPROM.commit();
+}
+
+// "fn < caller < caller's caller", skipping allocator and container frames.
+// Build with -g to see through functions inlined into their callers.
+std::string describeSite(const hal::AllocSite& s) {
+    Dl_info self{};
+    dladdr((void*)&describeSite, &self);
+    static char exe[512] = "";
+    if (!exe[0]) { ssize_t k = readlink("/proc/self/exe", exe, sizeof(exe) - 1); exe[k > 0 ? k : 0] = 0; }
+    std::vector<std::string> frames;            // innermost first, inlined frames included
+    for (int i = 0; i < hal::kSiteDepth && s.pc[i]; ++i) {
+        Dl_info di{};
+        if (!dladdr(s.pc[i], &di) || !di.dli_fbase) continue;
+        const bool main = di.dli_fbase == self.dli_fbase;
+        char cmd[1100];
+        snprintf(cmd, sizeof(cmd), "addr2line -Cfie '%s' 0x%lx 2>/dev/null", main ? exe : di.dli_fname,
+                 (unsigned long)((uintptr_t)s.pc[i] - 1 - (uintptr_t)di.dli_fbase));
+        if (FILE* f = popen(cmd, "r")) {
+            char line[512];
+            for (int odd = 0; fgets(line, sizeof(line), f); odd ^= 1) {   // function, file:line, ...
+                line[strcspn(line, "(\n")] = 0;
+                if (!odd && line[0] && strcmp(line, "??")) frames.push_back(line);
+            }
+            pclose(f);
+        }
+    }
+    static const char* const skip[] = {"operator new", "std::", "void std::", "__gnu_cxx", "String::", "malloc", "realloc", "__libc"};
+    std::string out;
+    int shown = 0;
+    for (const std::string& fn : frames) {
+        bool boring = false;
+        for (const char* k : skip) boring |= !fn.compare(0, strlen(k), k);
+        if (boring) continue;
+        out += shown++ ? " < " : "";
+        out += fn;
+        if (shown == 3) break;
+    }
+    return out.empty() ? (frames.empty() ? "?" : frames[0]) : out;
+}
+
+uint32_t percentile(std::vector<uint32_t> v, double p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5))];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    parseArgs(argc, argv);
+    std::stable_sort(opt.configs.begin(), opt.configs.end(), [](auto& a, auto& b) { return a.atMs < b.atMs; });
+    std::stable_sort(opt.otas.begin(), opt.otas.end(), [](auto& a, auto& b) { return a.first < b.first; });
+#if ENABLE_OTA
+    if (!opt.otas.empty()) {
+        if (!http.up()) { fprintf(stderr, "HTTP stand-in: bind failed\n"); return 1; }
+        http.bytesPerPoll = opt.otaRate;
+        otaServe();
+    }
+#endif
+    if (!broker.up()) { fprintf(stderr, "broker stand-in: bind failed\n"); return 1; }
+    std::stable_sort(opt.ntpSteps.begin(), opt.ntpSteps.end());
+    if (!ntp.up()) { fprintf(stderr, "SNTP stand-in: bind failed\n"); return 1; }
+    ntp.clockUs = [] { return trueUs(millis()); };
+    broker.ackDropEvery = opt.ackDropEvery;
+    broker.onPublish = onPublish;
+    broker.onConnect = [](const std::string&) {
+        if (waitingReconnect) { recoveredAt.push_back(millis() - brokerBackAt); waitingReconnect = false; }
+    };
+    seedConfig();
+    hal::idleHook = tick;
+    if (opt.bme) { driveEnv(0); hal::i2cAttach(0x77, &fakeBme); }
+    if (opt.co2) {
+        fakeCo2.enPin = SUNRISE_EN_PIN;
+        fakeCo2.nrdyPin = SUNRISE_NRDY_PIN;
+        fakeCo2.convertUs = (uint64_t)opt.co2ConvMs * 1000;
+        hal::i2cAttach(0x68, &fakeCo2);
+    }
+
+    schedSelfTest();
+    hal::heapBegin();
+    setup();
+    uint32_t maxStall = 0, passes = 0, i2cPassMaxUs = 0;
+    uint32_t steadyPasses = 0, steadyAllocPasses = 0, firstSteadyAllocMs = 0;
+    uint64_t steadyAllocs = 0, otherAllocs = 0;
+#if ENABLE_AQI
+    uint32_t nextApiMs = 60000;
+#endif
+#if ENABLE_METRICS
+    uint32_t nextScrapeMs = 15000;
+#endif
+    while (millis() < opt.durationMs) {
+        const uint32_t t0 = millis(), idle0 = idleSleptMs;
+        const bool steady = mqttClient.connected() && !portalUp;
+        const uint64_t a0 = hal::allocCalls, bus0 = hal::i2cStats.busUs;
+        schedBefore();
+        loop();
+        schedAfter(t0);
+        i2cPassMaxUs = std::max<uint32_t>(i2cPassMaxUs, (uint32_t)(hal::i2cStats.busUs - bus0));
+        ++passes;
+        const uint64_t allocs = hal::allocCalls - a0;
+        if (steady && mqttClient.connected() && !portalUp) {
+            ++steadyPasses;
+            if (allocs && !steadyAllocPasses++) firstSteadyAllocMs = t0;
+            steadyAllocs += allocs;
+        } else {
+            otherAllocs += allocs;
+        }
+        maxStall = std::max<uint32_t>(maxStall, millis() - t0 - (idleSleptMs - idle0));
+#if ENABLE_AQI
+        aqiObserve();
+        if ((int32_t)(millis() - nextApiMs) >= 0) { apiPoll(); nextApiMs += 60000; }
+#endif
+#if ENABLE_METRICS
+        if ((int32_t)(millis() - nextScrapeMs) >= 0) { metricsPoll(passes); nextScrapeMs += 15000; }
+#endif
+        hal::advanceMs(1);
+        if (hal::restartFlag) {
+#if ENABLE_OTA
+            otaCheck.restartMs = millis();
+#endif
+            fprintf(stderr, "firmware requested ESP.restart(); stopping.\n");
+            break;
+        }
+    }
+
+    hal::AllocPause report;                     // the summary's own allocations are not the firmware's
+    const double secs = millis() / 1000.0;
+    uint32_t dups = 0, gaps = 0, maxSeq = 0;
+    for (auto& kv : seqSeen) { dups += kv.second - 1; maxSeq = std::max(maxSeq, kv.first); }
+    if (maxSeq) gaps = maxSeq - (uint32_t)seqSeen.size();
+
+    printf("\n=== harness summary (%.0f s virtual) ===\n", secs);
+    printf("frames injected        : %u (SoftwareSerial overflow bytes: %u)\n", frameNo, pmsSerial.overflows);
+    bool spikeBad = false;
+#if PMS_SPIKE_FILTER
+    printf("PMS spike filter       : %u of %u frames dropped, %u more while its window filled; %u spikes injected, "
+           "%u caught, %u missed; %u clean frames dropped, %u while warming up\n",
+           pmsFilter.rejected(), pmsFilter.frames(), pmsFilter.unjudged(), spikeCheck.injected, spikeCheck.caught,
+           spikeCheck.missed, spikeCheck.falseRejects, spikeCheck.warmupDrops);
+    spikeBad = spikeCheck.missed || spikeCheck.falseRejects;
+#endif
+    printf("PMS warm-up            : %s after %u ms at frame %u (noisy until frame %u), first published frame %u; "
+           "telemetry %u reports, %u with warmup_ms, %u wrong\n",
+           !warmCheck.warm ? "not warm" : pmsWarmup.state() == pmsWarmup.STABLE ? "stable" : "timed out",
+           pmsWarmup.durationMs(), warmCheck.warmFrame, lastNoisyFrame, warmCheck.firstPublished,
+           warmCheck.telemetry, warmCheck.telemetryWarm, warmCheck.telemetryWrong);
+    // the ramp settles once the noise stops: the gate must wait for that,
+    // and for PMS_WARMUP_S, and must not let an earlier frame into a payload
+    // (with PMS_WARMUP_S=0 there is no gate, and the first frame is warm).
+    // Noise that outlasts PMS_WARMUP_MAX_MS must end in a time-out instead.
+    const bool timeout = PMS_WARMUP_S && opt.pmsWarmupMs + PMS_STABLE_N * opt.pmsPeriodMs > PMS_WARMUP_MAX_MS;
+    const bool warmBad = !warmCheck.warm ||
+                         pmsWarmup.state() != (timeout ? pmsWarmup.TIMEOUT : pmsWarmup.STABLE) ||
+                         (PMS_WARMUP_S && pmsWarmup.durationMs() < PMS_WARMUP_S * 1000u) ||
+                         (PMS_WARMUP_S && !timeout && warmCheck.warmFrame <= lastNoisyFrame) ||
+                         warmCheck.firstPublished < warmCheck.warmFrame || warmCheck.telemetryWrong ||
+                         (secs > 180 && !warmCheck.telemetryWarm);
+    printf("PUBLISH received       : %llu (%.3f msg/s), QoS1 %llu, DUP %llu\n",
+           (unsigned long long)broker.stats.publishes, broker.stats.publishes / secs,
+           (unsigned long long)broker.stats.qos1, (unsigned long long)broker.stats.dups);
+    printf("PUBACK sent / dropped  : %llu / %llu\n",
+           (unsigned long long)broker.stats.pubacks, (unsigned long long)broker.stats.pubacksDropped);
+    printf("seq unique / dup / gap : %zu / %u / %u\n", seqSeen.size(), dups, gaps);
+    printf("byte->PUBLISH latency  : min %u  p50 %u  p99 %u  max %u ms\n",
+           percentile(latencies, 0), percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 1));
+    printf("MQTT connects          : %llu, sessions ended %llu, STA begin() calls %u\n",
+           (unsigned long long)broker.stats.connects, (unsigned long long)broker.stats.disconnects, hal::staBegins);
+    for (size_t i = 0; i < recoveredAt.size(); ++i)
+        printf("reconnect after outage %zu: %u ms after broker came back\n", i + 1, recoveredAt[i]);
+    if (waitingReconnect) printf("reconnect after last outage: not within run\n");
+    printf("Wi-Fi events           : %u got-IP, %u disconnected; WiFi.status() polls %u\n",
+           hal::gotIpEvents, hal::disconnectedEvents, hal::statusCalls);
+    for (auto& c : portalChanges)
+        printf("setup window %-9s : at %u ms (WiFi mode %s)\n", c.second ? "opened" : "closed", c.first,
+               c.second ? "AP_STA" : "STA");
+    if (portalChanges.empty()) printf("setup window           : never opened\n");
+    printf("loop() passes          : %.1f /s, idle %.1f%% of the time\n", passes / secs, idleSleptMs / 10.0 / secs);
+    for (size_t i = 0; i < sched.size(); ++i)
+        printf("timer %-16s : %u runs, max late %u ms\n", sched.timer((int)i).name, sched.timer((int)i).runs, sched.timer((int)i).maxLateMs);
+    printf("scheduler              : self-test %s, %u passes ran a timer twice",
+           schedCheck.selfBad ? "FAILED" : "ok", schedCheck.twice);
+    if (schedCheck.twice) printf(", first %s at %u ms", schedCheck.firstTwice, schedCheck.firstTwiceMs);
+    printf("\n");
+    printf("longest loop() stall   : %u ms\n", maxStall);
+    printf("heap allocs in loop()  : %llu in %u steady passes, %llu while connecting/in setup\n",
+           (unsigned long long)steadyAllocs, steadyPasses, (unsigned long long)otherAllocs);
+    printf("shadow heap            : %u B total, free %u, low-water %u, largest block %u, fragmentation %u%%\n",
+           hal::heapSize, hal::heapFree(), hal::heapFreeMin(), hal::heapMaxBlock(), hal::heapFragmentation());
+    printf("heap since boot        : %u mallocs, %u reallocs, %u frees, worst loop() pass %u\n",
+           hal::mallocCount, hal::reallocCount, hal::freeCount, heap.passAllocsMax);
+    {
+        uint32_t n = 0;
+        const hal::AllocSite* sites = hal::allocSites(&n);
+        std::vector<const hal::AllocSite*> top;
+        for (uint32_t i = 0; i < n; ++i) top.push_back(&sites[i]);
+        std::sort(top.begin(), top.end(), [](auto* a, auto* b) { return a->calls != b->calls ? a->calls > b->calls : a->bytes > b->bytes; });
+        for (size_t i = 0; i < top.size() && i < 5; ++i)
+            printf("alloc site #%zu          : %u calls, %llu B, %u live (%u B)  %s\n", i + 1, top[i]->calls,
+                   (unsigned long long)top[i]->bytes, top[i]->liveBlocks, top[i]->liveBytes, describeSite(*top[i]).c_str());
+    }
+    printf("I2C bus                : %u transactions, %u bytes, %.1f ms busy, %u address NACKs\n",
+           hal::i2cStats.transactions, hal::i2cStats.bytes, hal::i2cStats.busUs / 1000.0, hal::i2cStats.addrNacks);
+    printf("I2C queue              : max depth %u, %u overflows, longest bus time in one loop() pass %u us\n",
+           i2c.depthMax(), i2c.overflows(), i2cPassMaxUs);
+    for (size_t i = 0; i < i2c.devices(); ++i) {
+        const Bus::Device& d = i2c.dev(i);
+        printf("I2C 0x%02X %-13s : %u txns, %u errors, %u wake-ups; wait avg %u max %u us, bus avg %u max %u us\n",
+               d.addr, d.name ? d.name : "(probed)", d.txns, d.errors, d.wakes,
+               d.txns ? (unsigned)(d.waitUs / d.txns) : 0u, d.waitMaxUs, d.txns ? (unsigned)(d.busUs / d.txns) : 0u, d.busMaxUs);
+    }
+    bool envBad = false, corrBad = false;
+#if ENABLE_BME280
+    if (opt.bme) {
+        printf("BME280                 : %u conversions, %u status polls while busy, %u data reads while busy, driver errors %u\n",
+               fakeBme.conversions, fakeBme.busyPolls, fakeBme.busyDataReads, bme.errors());
+        printf("BME280 vs truth        : %u readings, max |dT| %.3f C, |dRH| %.3f %%, |dP| %.1f Pa; env in %u payloads\n",
+               envCheck.readings, envCheck.maxDt, envCheck.maxDrh, envCheck.maxDp, envPayloads);
+        // integer compensation vs the datasheet's double version, plus output rounding
+        envBad = !envCheck.readings || fakeBme.busyDataReads || envCheck.maxDt > 0.011 ||
+                 envCheck.maxDrh > 0.06 || envCheck.maxDp > 1.0;
+    }
+    if (PM25_RH_CORRECTION && opt.bme) {
+        printf("PM2.5 RH correction    : %s, %u payloads (raw PM2.5 up to %.1f), max |d| %.3f vs double reference, %u with env but no pm25_corr\n",
+               PM25_RH_CORRECTION == 1 ? "kappa-Koehler" : "US EPA", corrCheck.payloads, corrCheck.rawMax,
+               corrCheck.maxDiff, corrCheck.missing);
+        // the firmware rounds to 0.1; the reference sees the same rounded inputs
+        corrBad = !corrCheck.payloads || corrCheck.missing || corrCheck.maxDiff > 0.051;
+    }
+#endif
+    bool co2Bad = false;
+#if ENABLE_SUNRISE
+    if (opt.co2) {
+        printf("Sunrise power          : %u power-ups, on %.2f%% of the time, %u wake-up NACKs, %u NACKs while off/booting\n",
+               fakeCo2.powerOns, fakeCo2.poweredUs / 10000.0 / secs, fakeCo2.wakeNacks, fakeCo2.offNacks);
+        printf("Sunrise measurements   : %u done, %u aborted by EN, %u starts ignored, %u late polls, %u early reads, "
+               "EE writes %u, driver errors %u\n",
+               fakeCo2.conversions, fakeCo2.abortedByPowerOff, fakeCo2.startsIgnored, sunrise.latePolls(),
+               fakeCo2.earlyReads, fakeCo2.eeWrites, sunrise.errors());
+        printf("Sunrise ABC state      : %u restored, %u cold starts, %u mismatches, %u rewinds; ABC time %u h\n",
+               fakeCo2.restores, fakeCo2.coldStarts, fakeCo2.stateMismatches, fakeCo2.abcRewinds, fakeCo2.abcHoursIn);
+        printf("Sunrise vs truth       : %u readings, %u differ from the sensor's last result; co2 in %u payloads\n",
+               co2Check.readings, co2Check.wrong, co2Payloads);
+        // a reading per CO2_MS, and the ABC time must have followed the clock
+        co2Bad = !co2Check.readings || co2Check.wrong || sunrise.errors() || fakeCo2.startsIgnored ||
+                 fakeCo2.coldStarts || fakeCo2.stateMismatches || fakeCo2.abcRewinds || fakeCo2.abortedByPowerOff ||
+                 fakeCo2.eeWrites > 1 || (uint32_t)fakeCo2.abcHoursIn + 1 < (uint32_t)(secs / 3600);
+    }
+#endif
+    bool cfgBad = false;
+    if (!opt.configs.empty()) {
+        printf("remote config          : %u sent, %u replies (%u accepted, %u rejected, %u not as expected), "
+               "%u not persisted or not rolled back, %u reports off\n",
+               cfgCheck.sent, cfgCheck.replies, cfgCheck.accepted, cfgCheck.rejected, cfgCheck.unexpected,
+               cfgCheck.notPersisted, cfgCheck.badReport);
+        printf("settings in force      : publish %u s, log %s, PM2.5 x%u/1000 %+d/10, PM10 x%u/1000 %+d/10, kappa %u/1000; "
+               "%u payloads calibrated as set (max |d| %.3f, %u off), %u sample intervals checked (%u off)\n",
+               settings.publish_s, kLogLevelNames[settings.log_level], settings.pm25_gain_x1000, settings.pm25_offset_x10,
+               settings.pm10_gain_x1000, settings.pm10_offset_x10, settings.kappa_x1000,
+               cfgCheck.calChecked, cfgCheck.calMaxDiff, cfgCheck.calBad, cfgCheck.periodChecked, cfgCheck.periodBad);
+        cfgBad = cfgCheck.replies != cfgCheck.sent || cfgCheck.sent != opt.configs.size() || cfgCheck.unexpected ||
+                 cfgCheck.notPersisted || cfgCheck.badReport || cfgCheck.calBad || cfgCheck.periodBad ||
+                 (MQTT_QOS >= 1 && (!cfgCheck.calChecked || !cfgCheck.periodChecked));
+    }
+    bool aqiBad = false;
+#if ENABLE_AQI
+    printf("AQI                    : %u hours closed (%u on the UTC hour, %u off it), US AQI on %u, "
+           "%u US / %u CAQI mismatches vs double reference, max |dNowCast| %.2f; aqi in %u payloads (%u US, %u CAQI; longest payload %u B)\n",
+           aqiCheck.checks, aqiCheck.onUtc, aqiCheck.offUtc, aqiCheck.usValid, aqiCheck.usMismatch,
+           aqiCheck.caqiMismatch, aqiCheck.maxDnc, aqiCheck.payloads, aqiCheck.usPayloads, aqiCheck.caqiPayloads,
+           aqiCheck.payloadMax);
+    if (aqiCheck.offUtc) printf("AQI hour off UTC       : first at %u ms\n", aqiCheck.firstOffMs);
+    printf("GET /api               : %u requests, %u bad responses, %llu allocations in the handler\n",
+           aqiCheck.apiCalls, aqiCheck.apiBad, (unsigned long long)aqiCheck.apiAllocs);
+    // NowCast weights are Q16: the truncated result may land one 0.1 step off
+    aqiBad = aqiCheck.usMismatch || aqiCheck.caqiMismatch || aqiCheck.maxDnc > 0.11 || aqiCheck.apiBad ||
+             aqiCheck.apiAllocs || aqiCheck.payloadMax >= 255 || aqiCheck.offUtc ||
+             (secs > 3 * 3600 && (!aqiCheck.usValid || !aqiCheck.usPayloads || !aqiCheck.caqiPayloads || !aqiCheck.onUtc));
+#endif
+    bool otaBad = false;
+#if ENABLE_OTA
+    if (!opt.otas.empty()) {
+        printf("firmware update        : %u requested, %u ended (%u ok, %u failed, %u rejected, %u not as expected); "
+               "%u progress reports (%u out of order), longest update %.1f s\n",
+               otaCheck.sent, otaCheck.ended, otaCheck.ok, otaCheck.failed, otaCheck.rejected, otaCheck.unexpected,
+               otaCheck.progress, otaCheck.outOfOrder, otaCheck.longestMs / 1000.0);
+        const size_t full = otaBin.size() + ota::TRAILER;
+        printf("update images          : full %zu B, delta %zu B (%.1f %%), packed %zu B (%.1f %%)\n", full,
+               otaPatchBytes[0], 100.0 * otaPatchBytes[0] / full, otaPatchBytes[1], 100.0 * otaPatchBytes[1] / full);
+        printf("update flash / HTTP    : %u erases, %u writes, %u reads, %u to unerased bits, %u misaligned; "
+               "%llu requests, %llu B served\n",
+               hal::flashStats.erases, hal::flashStats.writes, hal::flashStats.reads, hal::flashStats.unerasedWrites,
+               hal::flashStats.misaligned, (unsigned long long)http.stats.requests, (unsigned long long)http.stats.bytesOut);
+        if (hal::ebootWrites)
+            printf("boot command           : copy %u B from 0x%06X to 0x%06X, %s; restart %u ms after \"ok\"\n",
+                   hal::ebootCmd.args[2], hal::ebootCmd.args[0], hal::ebootCmd.args[1],
+                   otaCheck.imageOk ? "flash holds the image" : "NOT the streamed image", otaCheck.restartMs - otaCheck.okMs);
+        else
+            printf("boot command           : none written\n");
+        // an "ok" must be the last thing the run sees: the reboot stops it
+        otaBad = otaCheck.ended != otaCheck.sent || otaCheck.unexpected || otaCheck.outOfOrder || otaCheck.earlyCommit ||
+                 hal::flashStats.unerasedWrites || hal::flashStats.misaligned || hal::ebootWrites != otaCheck.ok ||
+                 (otaCheck.ok && (!otaCheck.imageOk || !otaCheck.restartMs ||
+                                  otaCheck.restartMs - otaCheck.okMs < OTA_REBOOT_MS));
+    }
+#endif
+    auto& cc = clockCheck;
+    printf("wall clock (SNTP)      : %u syncs, first at %u ms; %u timeouts; %u steps, %u back; "
+           "server answered %llu of %llu requests\n",
+           wallClock.syncs(), cc.firstSyncMs, ntpTimeouts, wallClock.steps(), wallClock.backSteps(),
+           (unsigned long long)ntp.stats.answered, (unsigned long long)ntp.stats.requests);
+    printf("wall clock vs truth    : drift %.2f ppm estimated (true %.2f); max error %.1f ms over %u ms checked, "
+           "%u over the bound (allowed up to %.1f ms)%s; went backwards %u times\n",
+           wallClock.driftPpb() / 1000.0, opt.ntpDriftPpm, cc.maxErrMs, cc.checked, cc.over, cc.maxAllowedMs,
+           cc.over ? (" first " + std::to_string((int)cc.worstErrMs) + " ms at " + std::to_string(cc.worstAt) + " ms").c_str() : "",
+           cc.backwards);
+    printf("payload timestamps     : %u stamped, %u missing, %u out of order or changed on retry, "
+           "%u off the sample time (max %.1f ms)\n",
+           cc.payloads, cc.missing, cc.disorder, cc.off, cc.payloadMaxErrMs);
+    auto& ag = aggCheck;
+    printf("aggregates             : %u / %u / %u records (1 min / 15 min / 1 h), %u repeats (%u changed), "
+           "%u unaligned; arrived %lld ms after the boundary at most, %u before it\n",
+           ag.records[0], ag.records[1], ag.records[2], ag.repeats, ag.changed, ag.unaligned,
+           ag.maxLateMs == INT64_MIN ? 0LL : (long long)ag.maxLateMs, ag.early);
+    printf("aggregate contents     : %u minutes checked, %u miscounted, %u of %u with the wrong frames; "
+           "%u of %u merges off; %u inconsistent\n",
+           ag.checked, ag.miscounted, ag.wrongFrames, ag.exact, ag.badMerge, ag.merged, ag.inconsistent);
+    const bool quietRun = opt.brokerDown.empty() && opt.apDown.empty() && opt.staEvents.empty() && !opt.ackDropEvery;
+    const bool aggBad = ag.changed || ag.unaligned || ag.early || ag.miscounted || ag.wrongFrames || ag.badMerge ||
+                        ag.inconsistent || (quietRun && ag.maxLateMs > 1000) ||
+                        (quietRun && opt.ntpDown.empty() && secs >= 180 && !ag.records[0]);
+    bool metricsBad = false;
+#if ENABLE_METRICS
+    const auto& mc = metricsCheck;
+    printf("GET /metrics           : %u scrapes, %u bad%s%s, %llu allocations in the handler; "
+           "%u families, %u samples, up to %u B\n",
+           mc.scrapes, mc.bad, mc.bad ? ", first: " : "", mc.firstBad.c_str(), (unsigned long long)mc.allocs,
+           mc.families, mc.samples, mc.bytesMax);
+    metricsBad = mc.bad || mc.allocs;
+#endif
+    // a drift estimate needs 10 min of syncs with no time change in them; an
+    // outage long enough to build up 128 ms of offset counts as one
+    uint32_t lastChange = cc.firstSyncMs;
+    for (auto& st : opt.ntpSteps) lastChange = std::max(lastChange, st.first);
+    for (auto& w : opt.ntpDown) lastChange = std::max(lastChange, w.startMs + w.lenMs);
+    const bool driftKnown = cc.firstSyncMs && millis() > lastChange + 900000;
+    const bool clockBad = (!opt.ntpDown.empty() || secs < 30 ? false : !cc.firstSyncMs) || cc.backwards || cc.over ||
+                          cc.missing || cc.disorder || cc.off ||
+                          (driftKnown && fabs(wallClock.driftPpb() / 1000.0 - opt.ntpDriftPpm) > 2) ||
+                          (secs > 60 && !cc.payloads && broker.stats.publishes);
+    if (envBad) {
+        printf("FAIL: BME280 readings missing or off (see above)\n");
+        return 4;
+    }
+    if (corrBad) {
+        printf("FAIL: humidity-corrected PM2.5 missing or off (see above)\n");
+        return 6;
+    }
+    if (spikeBad) {
+        printf("FAIL: PMS spike filter missed a spike or dropped a clean frame (see above)\n");
+        return 8;
+    }
+    if (warmBad) {
+        printf("FAIL: PMS5003 warm-up gate published too early or reported wrongly (see above)\n");
+        return 9;
+    }
+    if (cfgBad) {
+        printf("FAIL: remote configuration not answered, applied or persisted as expected (see above)\n");
+        return 10;
+    }
+    if (otaBad) {
+        printf("FAIL: firmware update ended wrongly or left flash / the boot command wrong (see above)\n");
+        return 11;
+    }
+    if (aqiBad) {
+        printf("FAIL: AQI or /api wrong (see above)\n");
+        return 7;
+    }
+    if (co2Bad) {
+        printf("FAIL: Sunrise state machine misbehaved (see above)\n");
+        return 5;
+    }
+    if (clockBad) {
+        printf("FAIL: wall clock not set, off the true time or not monotonic, or payload stamps wrong (see above)\n");
+        return 12;
+    }
+    if (aggBad) {
+        printf("FAIL: aggregates misaligned, late, miscounted or not merged exactly (see above)\n");
+        return 13;
+    }
+    if (metricsBad) {
+        printf("FAIL: /metrics not valid OpenMetrics, off the firmware's state, or allocating (see above)\n");
+        return 14;
+    }
+    if (schedCheck.selfBad || schedCheck.twice) {
+        printf("FAIL: a scheduler timer ran twice in one run() call (see above)\n");
+        return 15;
+    }
+    if (steadyAllocs) {
+        printf("FAIL: %u steady-state loop() passes allocated, first at %u ms\n", steadyAllocPasses, firstSteadyAllocMs);
+        return 3;
+    }
+    return 0;
+}
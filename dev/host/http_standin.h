@@ -0,0 +1,171 @@
+/*
+ http_standin.h — localhost HTTP/1.0 file server stand-in for host tools
+ ------------------------------------------------------------
+ Serves in-memory files to the firmware's update client: GET only, one
+ request per connection, Content-Length and Connection: close. Anything
+ not registered is a 404.
+
+ It never blocks: poll() services the sockets and returns, like the broker
+ stand-in, so it runs inside the harness's per-millisecond hook.
+ bytesPerPoll caps the bytes sent per poll() on each connection. The
+ harness polls once per virtual millisecond, so 64 means ~64 KB/s, which
+ is what an ESP8266 gets in practice.
+
+ Scripting per file: status (an error page instead of the body), cutAt
+ (close the connection after that many body bytes) and noLength (no
+ Content-Length header).
+ */
+#pragma once
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+class HttpStandin {
+public:
+    struct File {
+        std::string body;
+        int         status   = 200;
+        size_t      cutAt    = std::string::npos;   // body bytes before the server hangs up
+        bool        noLength = false;
+    };
+    struct Stats {
+        uint64_t requests = 0, notFound = 0, cut = 0, bytesOut = 0;
+    };
+
+    explicit HttpStandin(uint16_t port = 0) : port_(port) {}
+    ~HttpStandin() {
+        for (auto& kv : conns_) ::close(kv.first);
+        if (lfd_ >= 0) ::close(lfd_);
+        if (ep_ >= 0) ::close(ep_);
+    }
+
+    bool up() {
+        if (lfd_ >= 0) return true;
+        ep_ = epoll_create1(0);
+        lfd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(lfd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in a{};
+        a.sin_family = AF_INET; a.sin_port = htons(port_); a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(lfd_, (sockaddr*)&a, sizeof(a)) != 0 || ::listen(lfd_, 16) != 0) {
+            ::close(lfd_); lfd_ = -1; return false;
+        }
+        socklen_t al = sizeof(a);
+        getsockname(lfd_, (sockaddr*)&a, &al);
+        port_ = ntohs(a.sin_port);
+        fcntl(lfd_, F_SETFL, fcntl(lfd_, F_GETFL) | O_NONBLOCK);
+        watch(lfd_);
+        return true;
+    }
+
+    uint16_t port() const { return port_; }
+    void serve(const std::string& path, const File& f) { files_[path] = f; }
+
+    void poll() {
+        if (ep_ < 0) return;
+        epoll_event ev[16];
+        const int n = epoll_wait(ep_, ev, 16, 0);
+        for (int i = 0; i < n; ++i) {
+            if (ev[i].data.fd == lfd_) accept();
+            else receive(ev[i].data.fd);
+        }
+        for (auto it = conns_.begin(); it != conns_.end();) {
+            if (send(it->first, it->second)) { ++it; continue; }
+            ::close(it->first);
+            it = conns_.erase(it);
+        }
+    }
+
+    Stats  stats;
+    size_t bytesPerPoll = 0;   // 0 = as fast as the socket takes it
+
+private:
+    struct Conn {
+        std::string in, out;
+        size_t      sent = 0;
+        bool        replied = false;
+    };
+
+    void watch(int fd) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void accept() {
+        for (;;) {
+            const int fd = ::accept(lfd_, nullptr, nullptr);
+            if (fd < 0) return;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            watch(fd);
+            conns_[fd] = Conn();
+        }
+    }
+
+    void receive(int fd) {
+        auto it = conns_.find(fd);
+        if (it == conns_.end()) return;
+        Conn& c = it->second;
+        char buf[1024];
+        const ssize_t r = ::recv(fd, buf, sizeof(buf), 0);
+        if (r <= 0) {
+            if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) { ::close(fd); conns_.erase(it); }
+            return;
+        }
+        if (c.replied) return;
+        c.in.append(buf, (size_t)r);
+        if (c.in.find("\r\n\r\n") == std::string::npos) return;
+        c.replied = true;
+        ++stats.requests;
+        char path[512] = "";
+        sscanf(c.in.c_str(), "GET %511s HTTP/1.", path);
+        auto f = files_.find(path);
+        if (f == files_.end()) {
+            ++stats.notFound;
+            c.out = "HTTP/1.0 404 Not Found\r\nContent-Length: 9\r\nConnection: close\r\n\r\nnot found";
+            return;
+        }
+        const File& file = f->second;
+        if (file.status != 200) {
+            char h[128];
+            snprintf(h, sizeof(h), "HTTP/1.0 %d Error\r\nContent-Length: 5\r\nConnection: close\r\n\r\nerror", file.status);
+            c.out = h;
+            return;
+        }
+        char h[160];
+        if (file.noLength) snprintf(h, sizeof(h), "HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\nConnection: close\r\n\r\n");
+        else snprintf(h, sizeof(h), "HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %zu\r\n"
+                                    "Connection: close\r\n\r\n", file.body.size());
+        c.out = h;
+        if (file.cutAt < file.body.size()) { c.out.append(file.body, 0, file.cutAt); ++stats.cut; }
+        else c.out += file.body;
+    }
+
+    // False once the reply is out: the connection closes.
+    bool send(int fd, Conn& c) {
+        if (!c.replied) return true;
+        size_t n = c.out.size() - c.sent;
+        if (bytesPerPoll && n > bytesPerPoll) n = bytesPerPoll;
+        if (n) {
+            const ssize_t w = ::send(fd, c.out.data() + c.sent, n, MSG_NOSIGNAL);
+            if (w < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+            c.sent += (size_t)w;
+            stats.bytesOut += (uint64_t)w;
+        }
+        return c.sent < c.out.size();
+    }
+
+    uint16_t port_;
+    int      lfd_ = -1, ep_ = -1;
+    std::map<std::string, File> files_;
+    std::map<int, Conn>         conns_;
+};
@@ -0,0 +1,85 @@
+/*
+ ntp_standin.h — localhost SNTP server stand-in for host tools
+ ------------------------------------------------------------
+ Answers client requests (mode 3) with the time clockUs() gives, as a
+ stratum 2 server that answers at once (receive and transmit timestamps
+ are the same). The origin timestamp echoes the client's transmit
+ timestamp, as a real server does.
+
+ It never blocks: poll() answers whatever arrived and returns, like the
+ broker stand-in. While down is set, requests are read and dropped.
+ */
+#pragma once
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <functional>
+
+class NtpStandin {
+public:
+    struct Stats {
+        uint64_t requests = 0, answered = 0, dropped = 0;
+    };
+
+    ~NtpStandin() { if (fd_ >= 0) ::close(fd_); }
+
+    bool up() {
+        if (fd_ >= 0) return true;
+        fd_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in a{};
+        a.sin_family = AF_INET; a.sin_port = 0; a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(fd_, (sockaddr*)&a, sizeof(a)) != 0) { ::close(fd_); fd_ = -1; return false; }
+        socklen_t al = sizeof(a);
+        getsockname(fd_, (sockaddr*)&a, &al);
+        port_ = ntohs(a.sin_port);
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+        return true;
+    }
+
+    uint16_t port() const { return port_; }
+
+    void poll() {
+        if (fd_ < 0) return;
+        for (;;) {
+            uint8_t p[68];
+            sockaddr_in from{};
+            socklen_t fl = sizeof(from);
+            const ssize_t r = ::recvfrom(fd_, p, sizeof(p), 0, (sockaddr*)&from, &fl);
+            if (r < 0) return;
+            ++stats.requests;
+            if (down || r < 48 || (p[0] & 7) != 3) { ++stats.dropped; continue; }
+            uint8_t q[48] = {};
+            q[0] = (p[0] & 0x38) | 4;                  // LI 0, the client's version, mode 4
+            q[1] = 2;                                  // stratum
+            q[2] = p[2];
+            q[3] = (uint8_t)-20;                       // precision ~1 µs
+            memcpy(q + 12, "HARN", 4);                 // reference id
+            memcpy(q + 24, p + 40, 8);                 // origin = the client's transmit timestamp
+            const int64_t now = clockUs();
+            put(q + 16, now - 16000000);               // reference: the last update
+            put(q + 32, now);
+            put(q + 40, now);
+            ::sendto(fd_, q, sizeof(q), 0, (sockaddr*)&from, fl);
+            ++stats.answered;
+        }
+    }
+
+    std::function<int64_t()> clockUs;    // the true time, µs since 1970
+    bool  down = false;
+    Stats stats;
+
+private:
+    static void put(uint8_t* p, int64_t us) {
+        const uint32_t s = (uint32_t)(us / 1000000 + 2208988800LL);
+        const uint32_t f = (uint32_t)(((uint64_t)(us % 1000000) << 32) / 1000000);
+        for (int i = 0; i < 4; ++i) { p[i] = (uint8_t)(s >> (24 - 8 * i)); p[4 + i] = (uint8_t)(f >> (24 - 8 * i)); }
+    }
+
+    int      fd_ = -1;
+    uint16_t port_ = 0;
+};
@@ -0,0 +1,112 @@
+/*
+ ota_delta.cpp — make a compressed or delta OTA image between two builds
+ ------------------------------------------------------------
+ Takes the signed image of the new build (firmware.bin + signature +
+ length, as the node would download it) and, optionally, the bin the nodes
+ run now. It writes a patch for the firmware's update path (pm_delta.h):
+ a delta against the old bin if one is given, otherwise the new bin
+ compressed. The signature stays the new build's own: the node checks it
+ against the image it rebuilt.
+
+ It reports the sizes of the full image, the compressed image and the
+ delta, and what the chosen patch is made of. Before writing, it decodes
+ the patch again with the firmware's own decoder and compares the result
+ with the new image.
+
+ Exit status: 0 = written, 1 = the patch does not decode back to the new
+ image, 2 = bad arguments or input.
+
+ Build & run (see dev/host/README.md):
+   g++ -std=gnu++17 -O2 -Isrc/cpp -Idev/host dev/host/ota_delta.cpp -o ota_delta
+   ./ota_delta --new=firmware.signed.bin --old=running/firmware.bin --out=update.pmd
+ */
+#include "ota_delta.h"
+#include "pm_ota.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+namespace {
+
+bool readFile(const char* path, std::string& out) {
+    FILE* f = fopen(path, "rb");
+    if (!f) { fprintf(stderr, "%s: cannot open\n", path); return false; }
+    char buf[65536];
+    size_t n;
+    out.clear();
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+    fclose(f);
+    return true;
+}
+
+// A signed image ends in the signature length: 256, little-endian.
+bool isSigned(const std::string& img) {
+    return img.size() > ota::TRAILER && delta::le32((const uint8_t*)img.data() + img.size() - 4) == ota::rsa::BYTES;
+}
+
+double pct(size_t part, size_t whole) { return whole ? 100.0 * part / whole : 0; }
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const char *newPath = nullptr, *oldPath = nullptr, *outPath = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!strncmp(argv[i], "--new=", 6))      newPath = argv[i] + 6;
+        else if (!strncmp(argv[i], "--old=", 6)) oldPath = argv[i] + 6;
+        else if (!strncmp(argv[i], "--out=", 6)) outPath = argv[i] + 6;
+        else { newPath = nullptr; break; }
+    }
+    if (!newPath) {
+        fprintf(stderr, "usage: %s --new=NEW.signed.bin [--old=RUNNING.bin] [--out=PATCH]\n", argv[0]);
+        return 2;
+    }
+
+    std::string image, oldBin;
+    if (!readFile(newPath, image)) return 2;
+    if (!isSigned(image)) { fprintf(stderr, "%s: not a signed image (sign it first, see \"Firmware update\")\n", newPath); return 2; }
+    if ((uint8_t)image[0] != ota::IMAGE_MAGIC) { fprintf(stderr, "%s: not an ESP image\n", newPath); return 2; }
+    if (oldPath) {
+        if (!readFile(oldPath, oldBin)) return 2;
+        if (isSigned(oldBin)) oldBin.resize(oldBin.size() - ota::TRAILER);   // the node runs the bin alone
+        if (oldBin.size() <= delta::HEAD_KEEP || (uint8_t)oldBin[0] != ota::IMAGE_MAGIC) {
+            fprintf(stderr, "%s: not an ESP image\n", oldPath);
+            return 2;
+        }
+    }
+    const std::string bin = image.substr(0, image.size() - ota::TRAILER), trailer = image.substr(bin.size());
+
+    const clock_t t0 = clock();
+    delta::Stats cs, ds;
+    const std::string packed = delta::encode("", bin, trailer, &cs);
+    const std::string patch = oldPath ? delta::encode(oldBin, bin, trailer, &ds) : packed;
+    if (!oldPath) ds = cs;
+    const double secs = (double)(clock() - t0) / CLOCKS_PER_SEC;
+
+    std::string back;
+    const bool ok = delta::apply(oldBin, patch, back) && back == image;
+
+    printf("new image              : %zu B bin + %u B signature\n", bin.size(), ota::TRAILER);
+    printf("full download          : %zu B\n", image.size());
+    printf("compressed             : %zu B (%.1f %% of full)\n", packed.size(), pct(packed.size(), image.size()));
+    if (oldPath)
+        printf("delta vs old           : %zu B (%.1f %% of full) against %zu B of old bin\n",
+               patch.size(), pct(patch.size(), image.size()), oldBin.size());
+    printf("%-23s: %zu literal runs (%zu B), %zu copies from the new image (%zu B), %zu from the old (%zu B); %.2f s\n",
+           oldPath ? "delta made of" : "compressed made of", ds.lits, ds.litBytes, ds.news, ds.newBytes,
+           ds.olds, ds.oldBytes, secs);
+    printf("decodes back           : %s\n", ok ? "yes, byte for byte" : "NO");
+    if (!ok) return 1;
+    if (outPath) {
+        FILE* f = fopen(outPath, "wb");
+        if (!f || fwrite(patch.data(), 1, patch.size(), f) != patch.size() || fclose(f)) {
+            fprintf(stderr, "%s: write failed\n", outPath);
+            return 2;
+        }
+        printf("written                : %s (%zu B, saves %zu B)\n", outPath, patch.size(), image.size() - patch.size());
+    }
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ ota_delta.h — patch encoder and reference decoder for pm_delta.h
+ ------------------------------------------------------------
+ Host side only: used by ota_delta.cpp (the release tool) and by the
+ harness, which serves patches to the firmware.
+
+ encode() works through the new bin greedily. At every position it tries
+ three kinds of match and takes the one that saves the most bytes:
+ • OLD at the displacement of the previous OLD copy (code that only
+ moved);
+ • OLD from a 4-byte hash chain over the old bin;
+ • NEW from a hash chain over the new bin so far.
+ What nothing matches goes out as literals. Without an old bin it is plain
+ LZ77 with an unbounded window, because the device's window is the flash.
+
+ apply() rebuilds the image with the device's delta::Decoder and the same
+ bounds checks, so the tool can prove a patch before it ships one.
+ */
+#pragma once
+
+#include "pm_delta.h"
+#include "pm_sha256.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace delta {
+
+struct Stats {
+    size_t lits = 0, litBytes = 0, news = 0, newBytes = 0, olds = 0, oldBytes = 0;
+};
+
+namespace detail {
+constexpr int    HASH_BITS = 16;
+constexpr int    CHAIN_MAX = 256;         // candidates tried per chain and position
+
+inline uint32_t hash4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+inline void put32(std::string& s, uint32_t v) { for (int i = 0; i < 4; ++i) s += (char)(v >> (8 * i)); }
+
+inline void varint(std::string& s, uint32_t v) {
+    for (; v >= 0x80; v >>= 7) s += (char)((v & 0x7F) | 0x80);
+    s += (char)v;
+}
+
+inline size_t varintLen(uint32_t v) { size_t n = 1; for (; v >= 0x80; v >>= 7) ++n; return n; }
+
+inline uint32_t zigzag(int64_t d) { return (uint32_t)(d < 0 ? ((uint64_t)(-d) << 1) - 1 : (uint64_t)d << 1); }
+
+// Tag (+ length varint) for an op of kind k carrying n (= len - bias).
+inline void tag(std::string& s, Kind k, uint32_t n) {
+    s += (char)(k << 6 | (n < 63 ? n : 63));
+    if (n >= 63) varint(s, n - 63);
+}
+
+inline size_t tagLen(uint32_t n) { return n < 63 ? 1 : 1 + varintLen(n - 63); }
+
+// 4-byte hash chains: head[h] is the latest position, prev[pos] the one before.
+struct Chains {
+    std::vector<int32_t> head, prev;
+    explicit Chains(size_t n) : head(1u << HASH_BITS, -1), prev(n, -1) {}
+    void insert(const uint8_t* base, size_t pos) {
+        const uint32_t h = hash4(base + pos);
+        prev[pos] = head[h];
+        head[h] = (int32_t)pos;
+    }
+};
+
+inline size_t matchLen(const uint8_t* a, const uint8_t* b, size_t max) {
+    size_t n = 0;
+    while (n < max && a[n] == b[n]) ++n;
+    return n;
+}
+} // namespace detail
+
+// SHA-256 of the old bin as the device hashes its running image.
+inline void baseHash(const std::string& oldBin, uint8_t out[Sha256::DIGEST]) {
+    Sha256 sha;
+    hashBase(sha, 0, (const uint8_t*)oldBin.data(), oldBin.size());
+    sha.finish(out);
+}
+
+// A patch that rebuilds newBin from oldBin (empty: compression only),
+// followed by trailer (the new image's signature and its length).
+inline std::string encode(const std::string& oldBin, const std::string& newBin, const std::string& trailer,
+                          Stats* stats = nullptr) {
+    using namespace detail;
+    Stats st;
+    std::string out(MAGIC, MAGIC + sizeof(MAGIC));
+    put32(out, (uint32_t)newBin.size());
+    put32(out, (uint32_t)oldBin.size());
+    uint8_t h[Sha256::DIGEST] = {};
+    if (!oldBin.empty()) baseHash(oldBin, h);
+    out.append((const char*)h, sizeof(h));
+
+    const uint8_t* o = (const uint8_t*)oldBin.data();
+    const uint8_t* n = (const uint8_t*)newBin.data();
+    const size_t on = oldBin.size(), nn = newBin.size();
+    Chains oldChains(on), newChains(nn);
+    for (size_t p = HEAD_KEEP; p + 4 <= on; ++p) oldChains.insert(o, p);
+
+    size_t litStart = 0, i = 0;
+    int64_t disp = 0;                               // old offset - new offset of the last OLD copy
+    uint32_t cursor = 0;                            // where the last OLD copy ended, as the decoder sees it
+    auto flushLits = [&](size_t end) {
+        while (litStart < end) {
+            const uint32_t len = (uint32_t)std::min<size_t>(end - litStart, 1u << 20);
+            tag(out, LIT, len - 1);
+            out.append((const char*)n + litStart, len);
+            ++st.lits; st.litBytes += len;
+            litStart += len;
+        }
+    };
+    struct Match { size_t len = 0, gain = 0; Kind kind = LIT; uint32_t from = 0; };
+    // The match at position at that saves the most bytes; the new chains hold positions before it.
+    auto best = [&](size_t at) {
+        Match m;
+        const size_t max = nn - at;
+        auto consider = [&](Kind k, uint32_t from, size_t len) {
+            if (len < MIN_MATCH) return;
+            const uint32_t arg = k == NEW ? from : zigzag((int64_t)from - cursor);
+            const size_t cost = tagLen((uint32_t)(len - MIN_MATCH)) + varintLen(arg);
+            if (len > cost && len - cost > m.gain) m = {len, len - cost, k, from};
+        };
+        if (at < HEAD_KEEP || max < MIN_MATCH) return m;
+        const int64_t j = (int64_t)at + disp;
+        if (on && j >= (int64_t)HEAD_KEEP && j < (int64_t)on)
+            consider(OLD, (uint32_t)j, matchLen(n + at, o + j, std::min(max, on - (size_t)j)));
+        int c = 0;
+        for (int32_t p = on ? oldChains.head[hash4(n + at)] : -1; p >= 0 && c < CHAIN_MAX; p = oldChains.prev[p], ++c)
+            consider(OLD, (uint32_t)p, matchLen(n + at, o + p, std::min(max, on - (size_t)p)));
+        c = 0;
+        for (int32_t p = newChains.head[hash4(n + at)]; p >= 0 && c < CHAIN_MAX; p = newChains.prev[p], ++c)
+            if ((size_t)p < at) consider(NEW, (uint32_t)(at - p), matchLen(n + at, n + p, max));
+        return m;
+    };
+    while (i < nn) {
+        Match m = best(i);
+        if (m.len && i + 1 < nn) {                     // lazy: a literal first may buy a better match
+            if (i + 4 <= nn) newChains.insert(n, i);
+            const Match next = best(i + 1);
+            if (next.gain > m.gain + 1) { ++i; continue; }
+            newChains.head[hash4(n + i)] = newChains.prev[i];   // undo: inserted again below
+        }
+        const size_t bestLen = m.len;
+        const Kind bestKind = m.kind;
+        const uint32_t bestFrom = m.from;
+        if (!bestLen) {
+            if (i + 4 <= nn) newChains.insert(n, i);
+            ++i;
+            continue;
+        }
+        flushLits(i);
+        tag(out, bestKind, (uint32_t)(bestLen - MIN_MATCH));
+        if (bestKind == NEW) {
+            varint(out, bestFrom);
+            ++st.news; st.newBytes += bestLen;
+        } else {
+            varint(out, zigzag((int64_t)bestFrom - cursor));
+            cursor = bestFrom + (uint32_t)bestLen;
+            disp = (int64_t)bestFrom - (int64_t)i;
+            ++st.olds; st.oldBytes += bestLen;
+        }
+        for (size_t e = i + bestLen; i < e; ++i) if (i + 4 <= nn) newChains.insert(n, i);
+        litStart = i;
+    }
+    flushLits(nn);
+    out += trailer;
+    if (stats) *stats = st;
+    return out;
+}
+
+// The image (bin + trailer) a patch rebuilds from oldBin; false if the patch
+// is malformed or was made against another old bin.
+inline bool apply(const std::string& oldBin, const std::string& patch, std::string& image) {
+    Header h;
+    if (patch.size() < HEADER || !readHeader((const uint8_t*)patch.data(), h)) return false;
+    if (h.oldSize != oldBin.size()) return false;
+    if (h.oldSize) {
+        uint8_t got[Sha256::DIGEST];
+        baseHash(oldBin, got);
+        if (memcmp(got, h.oldHash, sizeof(got))) return false;
+    }
+    const uint8_t* in = (const uint8_t*)patch.data();
+    size_t at = HEADER;
+    Decoder dec;
+    dec.reset();
+    image.clear();
+    while (image.size() < h.newSize) {
+        Op op{};
+        size_t used = 0;
+        const bool ready = dec.next(in + at, patch.size() - at, used, op);
+        at += used;
+        if (!ready || op.len > h.newSize - image.size()) return false;
+        if (op.kind == LIT) {
+            if (op.len > patch.size() - at) return false;
+            image.append((const char*)in + at, op.len);
+            at += op.len;
+        } else if (op.kind == NEW) {
+            if (!op.from || op.from > image.size()) return false;
+            for (uint32_t k = 0; k < op.len; ++k) image += image[image.size() - op.from];
+        } else {
+            if (op.from < HEAD_KEEP || op.from > h.oldSize || op.len > h.oldSize - op.from) return false;
+            image.append(oldBin, op.from, op.len);
+        }
+    }
+    image.append(patch, at, std::string::npos);
+    return true;
+}
+
+} // namespace delta
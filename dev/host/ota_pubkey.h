@@ -0,0 +1,36 @@
+/*
+ ota_pubkey.h — TEST release key for the host harness
+ ------------------------------------------------------------
+ The firmware picks up an ota_pubkey.h from its include path; the harness
+ build has dev/host on it, so this one is used there. Its private exponent
+ is in harness.cpp, i.e. public: an image signed with it proves nothing.
+ Never put this file on a device build's include path.
+ */
+#pragma once
+
+#include <stdint.h>
+
+static const uint8_t kOtaPubKey[256] PROGMEM = {
+    0xa4, 0x13, 0x1f, 0x91, 0x93, 0xa8, 0xae, 0xd8, 0x4e, 0xc2, 0x99, 0x52,
+    0x1d, 0x8d, 0xfc, 0x1c, 0xec, 0x38, 0x24, 0x56, 0xf5, 0x27, 0x42, 0x10,
+    0xd5, 0x67, 0x3c, 0x36, 0x35, 0x37, 0xb9, 0x71, 0xe5, 0x46, 0x9a, 0xf8,
+    0xcc, 0x51, 0x87, 0xd2, 0x5e, 0xef, 0xce, 0x12, 0x3f, 0x2e, 0xf9, 0xd0,
+    0x61, 0xe1, 0x23, 0x69, 0x41, 0x89, 0x97, 0x4f, 0x52, 0xb7, 0x1c, 0x14,
+    0x0c, 0x8f, 0xe0, 0xc1, 0x41, 0x37, 0x0b, 0x9b, 0x6c, 0x7a, 0xfd, 0x69,
+    0x79, 0x9f, 0x44, 0x3c, 0x42, 0x0a, 0x30, 0x28, 0xde, 0xb5, 0x90, 0x84,
+    0xed, 0x2f, 0x66, 0xa8, 0xdc, 0xa1, 0x21, 0x9e, 0xab, 0xf3, 0x58, 0xfe,
+    0x25, 0x74, 0xd8, 0x16, 0x5a, 0xc0, 0x54, 0xd8, 0x79, 0xc0, 0x07, 0x50,
+    0xa0, 0x9a, 0xa6, 0x21, 0xf8, 0x30, 0x80, 0x8a, 0x77, 0xca, 0xe0, 0x4c,
+    0x13, 0x94, 0xed, 0x7e, 0x81, 0xc9, 0xf3, 0x8f, 0x59, 0x13, 0x41, 0x31,
+    0xac, 0x4a, 0x17, 0x19, 0xbd, 0x40, 0x89, 0xc5, 0xdd, 0x43, 0x18, 0xbb,
+    0x0f, 0x7b, 0x04, 0x01, 0x7b, 0xac, 0x7a, 0x30, 0xb3, 0xaf, 0xc0, 0xe2,
+    0x9f, 0xc4, 0xb1, 0x36, 0xef, 0x81, 0x73, 0x1a, 0x9b, 0x56, 0x5b, 0xa1,
+    0xb3, 0x9f, 0x52, 0x2d, 0x5f, 0x05, 0x70, 0xb5, 0x18, 0xef, 0x86, 0xb2,
+    0xf9, 0x1b, 0xdc, 0xfa, 0xd5, 0x4f, 0xfc, 0x27, 0x81, 0x8f, 0xcd, 0xd3,
+    0xb8, 0x8d, 0xbc, 0x34, 0x48, 0xc8, 0x26, 0x6e, 0x86, 0x6d, 0x97, 0x3c,
+    0xc2, 0x95, 0xc7, 0xe5, 0xaa, 0xb8, 0x8b, 0x09, 0xb3, 0xe6, 0x4b, 0x43,
+    0x26, 0x0f, 0x9b, 0x90, 0xc5, 0xe9, 0xa7, 0x1d, 0x72, 0x8e, 0xe7, 0x68,
+    0x0e, 0xac, 0x91, 0xd6, 0x80, 0x95, 0xd4, 0x6d, 0x91, 0x1a, 0xa9, 0x1b,
+    0x78, 0x9c, 0x12, 0x1c, 0xd1, 0x5b, 0x49, 0x79, 0xfc, 0x73, 0x96, 0x10,
+    0x16, 0xbf, 0x26, 0x8b,
+};
@@ -4,7 +4,7 @@
  What this is:
  • A teaching-oriented, privacy-safe version of a real firmware.
  • Demonstrates: Access Point (AP) + Captive Portal + Web form (EEPROM-backed),
- optional HTTPS registration (stubbed by default), periodic sensor read (PMS5003),
+ optional HTTPS registration (stubbed by default), periodic sensor read (PMS5003, BME280, Sunrise CO2),
  and MQTT publish flow (stubbed by default).
  
  What this is NOT:
@@ -35,6 +35,60 @@
 #ifndef SHOW_SECRETS
 #define SHOW_SECRETS   0   // 0 = mask secrets in logs; 1 = reveal for debugging only
 #endif
+#ifndef MQTT_QOS
+#define MQTT_QOS       1   // 0 = fire-and-forget publish; 1 = PUBACK-tracked, queued, at-least-once
+#endif
+#ifndef LOOP_IDLE_MAX_MS
+#define LOOP_IDLE_MAX_MS 20  // longest idle per loop(); bounds HTTP/DNS latency, SoftwareSerial holds 128 ms
+#endif
+#ifndef LOOP_LIGHT_SLEEP
+#define LOOP_LIGHT_SLEEP 0   // 1 = light-sleep while idle when STA-only (AP up forces modem on anyway)
+#endif
+#ifndef SETUP_WINDOW_MIN
+#define SETUP_WINDOW_MIN 10  // setup AP + portal lifetime once opened (unprovisioned nodes keep it)
+#endif
+#ifndef SETUP_BUTTON_PIN
+#define SETUP_BUTTON_PIN 0   // hold to reopen the portal; GPIO0 = FLASH on NodeMCU/D1 mini, -1 = none [ADAPT]
+#endif
+#ifndef SETUP_RESET_COUNT
+#define SETUP_RESET_COUNT 3  // this many quick resets in a row reopen the portal; 0 = off
+#endif
+#ifndef ENABLE_BME280
+#define ENABLE_BME280  1   // 1 = read a BME280 on I2C (probed at boot; absent is fine) [ADAPT]
+#endif
+#ifndef ENABLE_SUNRISE
+#define ENABLE_SUNRISE 1   // 1 = Senseair Sunrise CO2 on I2C, single-measurement mode (absent is fine) [ADAPT]
+#endif
+#ifndef PM25_RH_CORRECTION
+#define PM25_RH_CORRECTION 2 // PM2.5 humidity correction from BME280 RH: 0 = off, 1 = kappa-Köhler, 2 = US EPA [ADAPT]
+#endif
+#ifndef PMS_SPIKE_FILTER
+#define PMS_SPIKE_FILTER 1 // 1 = drop PMS5003 frames that pass the checksum but are outliers (Hampel test) [ADAPT]
+#endif
+#ifndef PMS_WARMUP_S
+#define PMS_WARMUP_S   30  // PMS5003 frames count only after this long and once they agree; 0 = from the first frame [ADAPT]
+#endif
+#ifndef ENABLE_AQI
+#define ENABLE_AQI     1   // 1 = US AQI (NowCast) and EU CAQI from hourly PM means, in the payload and on the portal
+#endif
+#ifndef ENABLE_LOCAL_API
+#define ENABLE_LOCAL_API 1 // 1 = read-only JSON at http://<STA IP>/api while the setup portal is closed [ADAPT]
+#endif
+#ifndef ENABLE_METRICS
+#define ENABLE_METRICS 1   // 1 = Prometheus/OpenMetrics text at http://<node>/metrics: health, loop timing, readings [ADAPT]
+#endif
+#ifndef NTP_SERVER
+#define NTP_SERVER     "pool.ntp.org" // SNTP server ("host" or "host:port") unless the ntp setting names one; a local one is better [ADAPT]
+#endif
+#ifndef NTP_POLL_S
+#define NTP_POLL_S     1024 // SNTP poll period once the crystal's drift is known (64 s until then)
+#endif
+#ifndef AGG_PUBLISH
+#define AGG_PUBLISH    7   // wall-clock aggregates sent to aggregates/<node_id>: 1 = 1 min, 2 = 15 min, 4 = 1 h; 0 = none [ADAPT]
+#endif
+#ifndef ENABLE_OTA
+#define ENABLE_OTA     1   // 1 = signed firmware updates over HTTP, started on MQTT ota/<node_id> (needs a release key) [ADAPT]
+#endif
 
 // =============================== Includes =================================
 #include <ESP8266WiFi.h>
@@ -43,16 +97,46 @@
 #include <EEPROM.h>
 #include <ArduinoJson.h>
 #include <SoftwareSerial.h>
+#include <Wire.h>
+#include <memory>
+#include "pm_pms.h"        // streaming PMS5003 frame parser (shared with host tools)
+#include "pm_filter.h"     // Hampel spike filter + slew limiter for PMS5003 frames, O(1) per frame
+#include "pm_warmup.h"     // warm-up gate: minimum time, then a running-variance stability test
+#include "pm_backoff.h"    // jittered exponential reconnect backoff (shared with host tools)
+#include "pm_sched.h"      // cooperative timer scheduler (min-heap of named deadlines)
+#include "pm_fstr.h"       // fixed-capacity strings: topics, payloads and pages without heap
+#include "pm_fixed.h"      // integer mean/variance/EMA and decimal formatting (no soft-float)
+#include "pm_rhcorr.h"     // PM2.5 humidity correction (US EPA, kappa-Köhler), integer only
+#include "pm_i2cbus.h"     // shared I2C bus: transaction queue, per-device wake timing, counters
+#include "pm_bme280.h"     // BME280 forced-mode driver, integer compensation
+#include "pm_sunrise.h"    // Senseair Sunrise CO2: EN power gating, wake-up, ABC state
+#include "pm_sensors.h"    // compile-time sensor list: hooks expand per sensor, no virtual calls
+#include "pm_aqi.h"        // US AQI + NowCast, EU CAQI: breakpoint tables in flash, integer only
+#include "pm_clock.h"      // SNTP packets, millis()-to-epoch mapping with slew and drift correction
+#include "pm_buckets.h"    // count/sum/min/max/sum of squares over 1 min, 15 min, 1 h on Unix time boundaries
+#include "pm_metrics.h"    // OpenMetrics text writer and fixed-bucket µs histograms for GET /metrics
+#if defined(UMM_STATS_FULL)
+#include <umm_malloc/umm_malloc.h>   // umm_get_*_count(): mallocs/frees per loop() pass
+#endif
 #if ENABLE_NETWORK
 #include <ESP8266HTTPClient.h>
 #include <WiFiClientSecureBearSSL.h>
-#include <PubSubClient.h>
+#include <WiFiUdp.h>
+#include "pm_mqtt.h"       // small in-tree MQTT 3.1.1 client (QoS1 + PUBACK tracking)
+#if ENABLE_OTA
+#include <eboot_command.h> // boot loader command: copy the new image over the sketch at the next boot
+#include "pm_ota.h"        // streaming update: HTTP GET into flash, SHA-256, RSA-2048 signature check
+#if __has_include("ota_pubkey.h")
+#include "ota_pubkey.h"    // kOtaPubKey: the release key's modulus [ADAPT] (see "Firmware update")
+#define OTA_HAVE_KEY 1
+#endif
+#endif
 #endif
 
 // ============================ Generic Branding =============================
 // All branding & URLs are deliberately generic.
 // [ADAPT] Replace with your project/org when you restore networking.
-static const char* kProjectName = "YourOrg Device Setup";
+static const char kProjectName[] PROGMEM = "YourOrg Device Setup";
 
 // ============================== AP Settings ================================
 // This AP is only for first-time configuration via a captive portal.
@@ -64,11 +148,17 @@ const IPAddress AP_IP(192, 168, 4, 1);
 const IPAddress AP_GW(192, 168, 4, 1);
 const IPAddress AP_MASK(255, 255, 255, 0);
 
+// The AP only lives inside a setup window (see "Setup Window" below).
+constexpr uint32_t SETUP_WINDOW_MS  = (uint32_t)SETUP_WINDOW_MIN * 60000;
+constexpr uint32_t PORTAL_GRACE_MS  = 10000;   // after a successful save, before teardown
+constexpr uint32_t BUTTON_HOLD_MS   = 3000;
+constexpr uint32_t QUICK_RESET_MS   = 5000;    // a reset within this long of boot counts as "quick"
+
 // ============================== EEPROM Layout ==============================
 // Keep it simple and well-documented. All strings are fixed-size to avoid
 // dynamic allocation pitfalls and to make dumps readable.
 constexpr size_t EEPROM_SIZE    = 2048;
-constexpr uint32_t CONFIG_MAGIC = 0xEDUC0DE1;   // changed magic (privacy-safe)
+constexpr uint32_t CONFIG_MAGIC = 0xEDC0DE01;   // changed magic (privacy-safe)
 constexpr size_t MAX_LEN        = 64;           // 63 + NUL
 constexpr size_t UUID_LEN       = 37;           // 36 + NUL
 
@@ -98,29 +188,141 @@ struct ESPConfig {
 
 ESPConfig config;  // single global config object
 
+// Tunables the backend may change over MQTT (see "Remote configuration").
+// They have their own block and magic after ESPConfig, so a node updated to
+// this firmware keeps its Wi-Fi and registration and starts from defaults.
+// New fields go at the end, under a new magic; loadSettings() keeps the
+// fields of the older layouts.
+constexpr size_t   SETTINGS_ADDR  = 1024;
+constexpr uint32_t SETTINGS_MAGIC = 0x5E770002;
+constexpr uint32_t SETTINGS_MAGIC_V1 = 0x5E770001;   // up to kappa_x1000
+
+struct NodeSettings {
+    uint32_t magic;
+    uint16_t publish_s;                          // sample + publish period
+    uint8_t  log_level;                          // LogLevel
+    uint16_t pm25_gain_x1000, pm10_gain_x1000;   // unit calibration: y = x · gain + offset
+    int16_t  pm25_offset_x10, pm10_offset_x10;
+    uint16_t kappa_x1000;                        // kappa-Köhler hygroscopicity
+    char     ntp_server[MAX_LEN];                // "host" or "host:port"; empty = NTP_SERVER
+};
+static_assert(sizeof(ESPConfig) <= SETTINGS_ADDR && SETTINGS_ADDR + sizeof(NodeSettings) <= EEPROM_SIZE,
+              "EEPROM layout overlaps");
+
+NodeSettings settings;
+
 // ================================ Logging ==================================
 // Minimal, timestamped log helpers that compile down to Serial.printf.
-static inline void logf_(const char* lvl, const char* fmt, ...) {
+// Format strings stay in flash: LOGx wraps the literal in PSTR() and the
+// formatter reads it with vsnprintf_P. logCheck_() is never called; it only
+// lets the compiler type-check the arguments against the literal.
+// Arguments must be RAM strings: a PSTR passed to %s would fault on-device.
+// Lines above logLevel (a remote setting) are skipped before formatting.
+enum LogLevel : uint8_t { LOG_ERROR, LOG_WARN, LOG_INFO, LOG_DEBUG };
+static const char* const kLogLevelNames[] = {"error", "warn", "info", "debug"};
+uint8_t logLevel = LOG_DEBUG;
+
+static void logf_P_(const char* lvl, PGM_P fmt, ...) {
     char buf[256];
     va_list ap; va_start(ap, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, ap);
+    vsnprintf_P(buf, sizeof(buf), fmt, ap);
     va_end(ap);
-    Serial.printf("[+%10lu ms] [%s] %s\n", millis(), lvl, buf);
+    Serial.printf_P(PSTR("[+%10lu ms] [%s] %s\n"), millis(), lvl, buf);
 }
-#define LOGI(...) logf_("INFO ", __VA_ARGS__)
-#define LOGW(...) logf_("WARN ", __VA_ARGS__)
-#define LOGE(...) logf_("ERROR", __VA_ARGS__)
-#define LOGD(...) logf_("DEBUG", __VA_ARGS__)
+__attribute__((format(printf, 1, 2))) static inline int logCheck_(const char*, ...) { return 0; }
+#define LOG_P_(lvl, tag, fmt, ...) ((void)sizeof(logCheck_(fmt, ##__VA_ARGS__)), \
+                                    (lvl) <= logLevel ? logf_P_(tag, PSTR(fmt), ##__VA_ARGS__) : (void)0)
+#define LOGI(fmt, ...) LOG_P_(LOG_INFO,  "INFO ", fmt, ##__VA_ARGS__)
+#define LOGW(fmt, ...) LOG_P_(LOG_WARN,  "WARN ", fmt, ##__VA_ARGS__)
+#define LOGE(fmt, ...) LOG_P_(LOG_ERROR, "ERROR", fmt, ##__VA_ARGS__)
+#define LOGD(fmt, ...) LOG_P_(LOG_DEBUG, "DEBUG", fmt, ##__VA_ARGS__)
 
 // ================================ Servers ==================================
-DNSServer dnsServer;               // captive DNS ("*" → AP_IP)
-ESP8266WebServer server(80);       // tiny configuration UI
+// Only alive while the setup window is open (see "Setup Window"); a
+// provisioned node carries neither the DNS socket nor the portal's routes.
+// With ENABLE_LOCAL_API or ENABLE_METRICS the web server stays, serving
+// only /api and /metrics.
+std::unique_ptr<DNSServer>        dnsServer;   // captive DNS ("*" → AP_IP)
+std::unique_ptr<ESP8266WebServer> server;      // tiny configuration UI (or just /api, /metrics)
+bool portalUp = false;
+
+// ============================== Scheduler ==================================
+// Everything periodic lives here instead of in "now - lastX >= period" pairs
+// scattered through loop(). loop() still polls the servers and the UART every
+// pass, then sleeps until the earliest deadline (at most LOOP_IDLE_MAX_MS).
+constexpr uint32_t LINK_CHECK_MS   = 1000;    // STA / MQTT state poll while nothing is pending
+constexpr uint32_t PUBLISH_MS      = 20000;   // one sample per 20 s, unless settings say otherwise
+constexpr uint32_t HEARTBEAT_MS    = 5000;
+constexpr uint32_t TELEMETRY_MS    = 60000;   // heap health to MQTT
+
+typedef Scheduler<20> Sched;
+Sched sched;
+int      tWifi = -1, tMqtt = -1, tPublish = -1, tHeartbeat = -1;
+int      tPortal = -1, tButton = -1, tBootSettled = -1, tTelemetry = -1, tOta = -1, tNtp = -1, tAgg = -1;
+uint32_t idleSleptMs = 0;          // total time loop() spent idle (host harness reads it)
+
+// ================================== Heap ===================================
+// Slow heap decay only shows up after days, so every node reports it:
+// • each loop() pass: free heap (O(1) in umm_malloc) for the low-water mark,
+// and the mallocs/frees the pass made;
+// • each heartbeat and on demand: largest free block and fragmentation.
+// Both walk the whole heap, so they are not taken every pass.
+// [ADAPT] Per-pass counts need a core built with -DUMM_STATS_FULL; without
+// it they read 0 and only the heap walk is reported.
+struct HeapStats {
+    uint32_t freeNow  = 0, freeMin     = UINT32_MAX;   // bytes; low-water since boot
+    uint32_t maxBlock = 0, maxBlockMin = UINT32_MAX;   // largest free block; its worst value
+    uint8_t  frag     = 0, fragMax     = 0;            // umm_malloc metric, %; 0 = one free block
+    uint32_t allocs = 0, frees = 0;                    // made inside loop() passes since boot
+    uint32_t passAllocsMax = 0;                        // worst single pass
+    uint32_t passesAllocating = 0;
+    uint32_t allocs0 = 0, frees0 = 0;                  // umm counters when this pass began
+} heap;
+
+static void heapPassBegin() {
+#if defined(UMM_STATS_FULL)
+    heap.allocs0 = umm_get_malloc_count() + umm_get_realloc_count();
+    heap.frees0  = umm_get_free_count();
+#endif
+}
+
+static void heapPassEnd() {
+#if defined(UMM_STATS_FULL)
+    const uint32_t a = umm_get_malloc_count() + umm_get_realloc_count() - heap.allocs0;
+    heap.allocs += a;
+    heap.frees  += umm_get_free_count() - heap.frees0;
+    if (a) ++heap.passesAllocating;
+    if (a > heap.passAllocsMax) heap.passAllocsMax = a;
+#endif
+    heap.freeNow = ESP.getFreeHeap();
+    if (heap.freeNow < heap.freeMin) heap.freeMin = heap.freeNow;
+}
+
+static void heapWalk() {
+    uint32_t free; uint16_t maxBlock; uint8_t frag;
+    ESP.getHeapStats(&free, &maxBlock, &frag);
+    heap.freeNow = free;
+    if (free < heap.freeMin) heap.freeMin = free;
+    heap.maxBlock = maxBlock;
+    if (maxBlock < heap.maxBlockMin) heap.maxBlockMin = maxBlock;
+    heap.frag = frag;
+    if (frag > heap.fragMax) heap.fragMax = frag;
+}
+
+// The heap members of the telemetry object (see telemetryJson()).
+static void heapJson(StrBuf& out) {
+    out.appendf_P(PSTR("\"heap\":{\"free\":%u,\"free_min\":%u,\"blk\":%u,\"blk_min\":%u,\"frag\":%u,\"frag_max\":%u,"
+                       "\"allocs\":%u,\"frees\":%u,\"pass_max\":%u},\"up\":%u"),
+                  heap.freeNow, heap.freeMin, heap.maxBlock, heap.maxBlockMin, heap.frag, heap.fragMax,
+                  heap.allocs, heap.frees, heap.passAllocsMax, (unsigned)(millis() / 1000));
+}
 
 // =============================== PMS5003 ===================================
 // We read PMS5003 frames using RX-only SoftwareSerial to save a UART.
 // [ADAPT] Set PMS_RX to an input-capable pin on your board.
 #define PMS_RX 13
 SoftwareSerial pmsSerial; // configured in setup()
+PmsParser      pmsParser; // keeps partial frames between loop() iterations
 
 struct PMSData {
     uint16_t pm1_cf1  = 0;
@@ -134,16 +336,257 @@ struct PMSData {
 };
 PMSData g_pms;
 
+// Frames arrive about once a second; a published sample is the mean of the
+// ATM values since the previous one, in tenths of µg/m³. All integer: the
+// lx106 has no FPU.
+// [ADAPT] PM25_EMA_SHIFT sets the smoothing of the PM2.5 trend shown on
+// /status and in the heartbeat: alpha = 1/2^shift per frame.
+constexpr uint8_t PM25_EMA_SHIFT = 4;
+
+struct PmsWindow { SampleStats pm1, pm25, pm10, pm25cf1; };
+PmsWindow pmsWindow;
+Ema       pm25Ema(PM25_EMA_SHIFT);
+
+// Spike filter (pm_filter.h): a frame with a bit slip that the checksum
+// missed is dropped before it reaches g_pms, the window or the EMA. All six
+// mass channels are tested against the median of their last PMS_HAMPEL_N
+// frames. A real step is believed PMS_HAMPEL_N/2 + 1 frames late.
+// [ADAPT] PMS_HAMPEL: threshold k (× 10) and the floor below which nothing
+// counts as a spike, absolute (µg/m³) and as a share of the median.
+// PMS_SLEW_MAX > 0 also limits each channel to that step per frame. It only
+// helps with a noisy line, and it slows real changes just as much.
+#if PMS_SPIKE_FILTER
+constexpr size_t   PMS_HAMPEL_N = 7;
+constexpr uint16_t PMS_SLEW_MAX = 0;            // µg/m³ per frame; 0 = off
+const HampelParams PMS_HAMPEL   = {30, 10, 25};
+SpikeFilter<6, PMS_HAMPEL_N> pmsFilter(PMS_HAMPEL, PMS_SLEW_MAX);
+#endif
+
+// Warm-up (pm_warmup.h): after power-on the fan and laser need ~30 s, and
+// until then frames read low and jump around. Frames only count once
+// PMS_WARMUP_S has passed and the last PMS_STABLE_N PM2.5 values agree
+// (sd ≤ 2 µg/m³ + 10 % of their mean), or regardless after
+// PMS_WARMUP_MAX_MS. Before that the sensor is not ready, so nothing is
+// published. How long it took goes out with the telemetry.
+// [ADAPT] If you duty-cycle the PMS5003 (SET pin low between samples), call
+// pmsWarmup.restart(millis()) when it is powered back up. The reported
+// warm-up time tells you how early to wake it before a sample.
+constexpr size_t   PMS_STABLE_N      = 10;       // frames, ~10 s
+constexpr uint32_t PMS_WARMUP_MAX_MS = 120000;
+WarmupGate<PMS_STABLE_N> pmsWarmup({PMS_WARMUP_S * 1000u, PMS_WARMUP_S ? PMS_WARMUP_MAX_MS : 0, 20, 10});
+
+// Humidity correction (pm_rhcorr.h): published as "pm25_corr" next to the
+// raw PM2.5 whenever the sample carries a fresh BME280 humidity. The EPA fit
+// takes the CF=1 mean, kappa-Köhler the ATM mean.
+// [ADAPT] PM25_KAPPA_X1000: hygroscopicity of your aerosol, in thousandths;
+// ~0.4 is typical for mixed urban/background PM2.5 seen by a PMS5003. It is
+// the default of the kappa_x1000 setting, which the backend can tune. The
+// BME280 sits in the enclosure and reads a little warm, hence a little dry:
+// mount it in the PMS5003's air path if the correction matters.
+constexpr uint16_t PM25_KAPPA_X1000 = 400;
+
+static uint16_t correctPm25(uint16_t atm_x10, uint16_t cf1_x10, uint16_t rh_x10) {
+#if PM25_RH_CORRECTION == 1
+    (void)cf1_x10;
+    return pm25KappaKohler(atm_x10, rh_x10, settings.kappa_x1000);
+#else
+    (void)atm_x10;
+    return pm25Epa(cf1_x10, rh_x10);
+#endif
+}
+
+// ================================ I2C bus ==================================
+// The BME280 and the Sunrise share one bus. Drivers queue their transfers and
+// loop() runs one per pass (pm_i2cbus.h): a pass blocks for one transaction
+// at most, and the bus sends the Sunrise's wake-up whenever it is due.
+// [ADAPT] I2C pins for your board (Feather HUZZAH / D1 mini: SDA=4, SCL=5).
+#define I2C_SDA 4
+#define I2C_SCL 5
+typedef I2cBus<TwoWire, 4, 4> Bus;   // queue: one transaction per driver, and room
+Bus i2c(Wire, micros);
+
+// =============================== BME280 ====================================
+// Temperature, humidity and pressure from a BME280 on I2C. One forced-mode
+// conversion every BME_MS; it starts right after a PMS frame has been
+// parsed, when the UART is quiet for the better part of a second, and is
+// collected measureMs() later by a one-shot timer.
+constexpr uint32_t BME_MS = 10000;
+
+struct EnvData {
+    int32_t  t_x100 = 0;     // °C × 100
+    uint16_t rh_x10 = 0;     // %RH × 10
+    uint32_t p_pa   = 0;
+    uint32_t ts_ms  = 0;
+    bool     valid  = false;
+};
+EnvData g_env;
+
+// Recent enough to go out with a sample (the PM2.5 correction uses it too).
+static bool envFresh(uint32_t now) { return g_env.valid && now - g_env.ts_ms < 3 * BME_MS; }
+
+#if ENABLE_BME280
+Bme280<Bus> bme(i2c);
+bool     bmeWanted  = false;  // a conversion is due; start it after the next PMS frame
+uint32_t bmeFrameMs = 0;      // ts_ms of the PMS frame before that one
+int      tBmeRead   = -1;
+#endif
+
+// =========================== Senseair Sunrise ==============================
+// CO2 from a Senseair Sunrise at 0x68: one single measurement every CO2_MS,
+// stepped by a one-shot timer through power-up, wake-up and the ~2 s
+// conversion (pm_sunrise.h). EN is low in between, so the sensor draws
+// nothing; its ABC state is kept here and, in RTC memory, across resets.
+// [ADAPT] SUNRISE_EN_PIN: GPIO wired to EN, -1 if EN is tied high. The pin is
+// only pulled low or released (open drain), so the pull-up on EN sets the
+// high level. SUNRISE_NRDY_PIN: GPIO wired to nRDY, -1 to go by timing.
+#ifndef SUNRISE_EN_PIN
+#define SUNRISE_EN_PIN   14
+#endif
+#ifndef SUNRISE_NRDY_PIN
+#define SUNRISE_NRDY_PIN -1
+#endif
+constexpr uint32_t CO2_MS = 60000;
+
+struct Co2Data {
+    uint16_t ppm    = 0;
+    int16_t  t_x100 = 0;     // sensor's own temperature, °C × 100
+    uint16_t status = 0;     // Sunrise ErrorStatus of this reading
+    uint32_t ts_ms  = 0;
+    bool     valid  = false;
+};
+Co2Data g_co2;
+
+#if ENABLE_SUNRISE
+static void sunrisePower(bool on) {
+    if (on) { pinMode(SUNRISE_EN_PIN, INPUT); return; }   // released: the pull-up enables it
+    digitalWrite(SUNRISE_EN_PIN, LOW);                     // level first, no high glitch
+    pinMode(SUNRISE_EN_PIN, OUTPUT);
+}
+static bool sunriseReady() { return digitalRead(SUNRISE_NRDY_PIN) == LOW; }
+
+Sunrise<Bus> sunrise(i2c, SUNRISE_EN_PIN >= 0 ? sunrisePower : nullptr,
+                     SUNRISE_NRDY_PIN >= 0 ? sunriseReady : nullptr);
+int      tCo2Step = -1;
+uint32_t co2ErrorsLogged = 0;
+#endif
+
+// ============================= Sensor registry =============================
+// Each sensor is a type with static hooks (pm_sensors.h), and Sensors lists
+// the ones this image is built with. setup(), loop(), the sample, the payload,
+// the stub log, the portal page and the heartbeat all go through the list.
+// A sensor whose flag is off becomes an empty stand-in: its hooks are never
+// defined, so none of its code is linked in. PmsSensor comes first: it opens
+// the payload with "measurement", and its frame count is the payload's "n".
+// [ADAPT] New sensor: declare it here, define its hooks next to its driver
+// (the "I/O" sections below), and add it to the list behind its build flag.
+struct PmsSensor : SensorBase<PmsSensor> {
+    // Means over the sample window, tenths of µg/m³. Humidity correction
+    // needs a fresh BME280 reading.
+    struct Fields {
+        uint16_t pm1_x10, pm25_x10, pm10_x10;
+        uint16_t pm25c_x10;  // humidity-corrected PM2.5; valid if corr
+        uint16_t frames;     // frames averaged; 0 = window was empty, latest frame repeated
+        bool     corr;
+    };
+    static void begin();
+    static void poll(uint32_t now);
+    static bool ready();
+    static void sample(Fields& s, uint32_t now);
+    static void json(StrBuf& out, const Fields& s);
+    static void text(StrBuf& out, const Fields& s);
+    static void page(StrBuf& out);
+    static void brief(StrBuf& out);
+    static void metrics(om::Writer& w, const Fields& s);
+};
+
+struct BmeSensor : SensorBase<BmeSensor> {
+    struct Fields {
+        int16_t  t_x10;      // °C × 10
+        uint16_t rh_x10;     // %RH × 10
+        uint16_t p_x10;      // hPa × 10
+        bool     env;        // fresh reading; all 0 otherwise
+    };
+    static void begin();
+    static void start(uint32_t now);
+    static void poll(uint32_t now);
+    static void sample(Fields& s, uint32_t now);
+    static void json(StrBuf& out, const Fields& s);
+    static void text(StrBuf& out, const Fields& s);
+    static void page(StrBuf& out);
+    static void brief(StrBuf& out);
+    static void metrics(om::Writer& w, const Fields& s);
+};
+
+struct Co2Sensor : SensorBase<Co2Sensor> {
+    struct Fields {
+        uint16_t co2_ppm;
+        bool     co2;        // fresh reading; 0 otherwise
+    };
+    static void begin();
+    static void start(uint32_t now);
+    static void sample(Fields& s, uint32_t now);
+    static void json(StrBuf& out, const Fields& s);
+    static void text(StrBuf& out, const Fields& s);
+    static void page(StrBuf& out);
+    static void brief(StrBuf& out);
+    static void metrics(om::Writer& w, const Fields& s);
+};
+
+// Not hardware: the air quality indices, derived from the PM history. They
+// reach the payload, the pages and the heartbeat through the same hooks.
+struct AqiSensor : SensorBase<AqiSensor> {
+    struct Fields {
+        uint16_t aqi_us;     // US AQI from NowCast; AQI_NONE until two hours are in
+        uint16_t caqi;       // EU CAQI of the last complete hour; AQI_NONE before it
+    };
+    static void start(uint32_t now);
+    static void sample(Fields& s, uint32_t now);
+    static void json(StrBuf& out, const Fields& s);
+    static void text(StrBuf& out, const Fields& s);
+    static void page(StrBuf& out);
+    static void brief(StrBuf& out);
+    static void metrics(om::Writer& w, const Fields& s);
+};
+
+typedef SensorList<PmsSensor,
+                   SensorIf<ENABLE_BME280, BmeSensor>,
+                   SensorIf<ENABLE_SUNRISE, Co2Sensor>,
+                   SensorIf<ENABLE_AQI, AqiSensor>> Sensors;
+
+// One published sample: the Fields of every listed sensor.
+typedef Sensors::Sample Sample;
+
 // ================================ MQTT =====================================
 #if ENABLE_NETWORK
 WiFiClient mqttNet;
-PubSubClient mqttClient(mqttNet);
-uint32_t lastMqttConnAttempt = 0;
-uint32_t mqttBackoffMs       = 0;
-uint32_t lastMqttPub         = 0;
+mqtt::Client<WiFiClient, 512> mqttClient(mqttNet, millis);   // topic + payload must fit: an hourly aggregate ~470 B
+Backoff  mqttBackoff(2000, 60000, 30000);  // base, cap, "stable after" (ms)
+bool     mqttWasConnected    = false;
+bool     mqttHandshaking     = false;
+uint32_t mqttConnects        = 0;       // sessions since boot
+
+#if MQTT_QOS >= 1
+// Samples wait here until the broker PUBACKs them. Sampling keeps running while
+// offline; a long outage evicts the oldest samples first.
+// [ADAPT] ~48 bytes per slot; size the queue to the outage you want to ride out.
+constexpr size_t   MQTT_QUEUE_LEN      = 32;     // ~10 min at one sample / 20 s
+constexpr size_t   MQTT_INFLIGHT_MAX   = 4;      // unacknowledged PUBLISHes on the wire
+constexpr uint32_t MQTT_ACK_TIMEOUT_MS = 10000;  // first retry; doubles per retry up to 8x
+
+struct QueuedSample {
+    Sample   s;
+    uint32_t seq;        // per-boot sequence number, lets the backend drop duplicates
+    uint32_t ms;         // millis() when taken
+    uint64_t ts;         // Unix time in ms; 0 until the clock is set (see "Wall clock")
+};
+mqtt::PublishQueue<QueuedSample, MQTT_QUEUE_LEN, MQTT_INFLIGHT_MAX> mqttQueue;
+uint32_t mqttSeq = 0;
+#endif
 #endif
 
 // ================================ Helpers ==================================
+static uint16_t clampU16(uint32_t v) { return v > 0xFFFF ? 0xFFFF : (uint16_t)v; }
+
 static bool haveWifiCreds() {
     return config.wifi_ssid[0] != '\0' && config.wifi_pass[0] != '\0';
 }
@@ -157,20 +600,24 @@ static bool haveMqttCreds() {
         config.mqtt_password[0] != '\0';
 }
 
-static void copyString(const String& src, char* dst, size_t dstSize) {
-    size_t n = src.length();
-    if (n >= dstSize) n = dstSize - 1;
-    memcpy(dst, src.c_str(), n);
+static void copyString(const char* src, char* dst, size_t dstSize) {
+    size_t n = strnlen(src, dstSize - 1);
+    memcpy(dst, src, n);
     dst[n] = '\0';
 }
 
-static String mask(const char* s, size_t keep = 2) {
-    if (!s) return "";
-    size_t n = strlen(s);
-    if (n <= keep) return String(s);
-    String out; out.reserve(n);
-    for (size_t i = 0; i < n; ++i) out += (i < keep) ? s[i] : '*';
-    return out;
+#if !ENABLE_NETWORK
+static void copyString_P(PGM_P src, char* dst, size_t dstSize) {
+    strncpy_P(dst, src, dstSize - 1);
+    dst[dstSize - 1] = '\0';
+}
+#endif
+
+static const char* mask(StrBuf& out, const char* s, size_t keep = 2) {
+    out.clear();
+    if (!s) return out.c_str();
+    for (size_t i = 0; s[i]; ++i) out += (i < keep) ? s[i] : '*';
+    return out.c_str();
 }
 
 static void dumpConfig(bool showSecrets) {
@@ -181,14 +628,15 @@ static void dumpConfig(bool showSecrets) {
 #else
     const bool reveal = false;
 #endif
-    LOGI("  PASS='%s'", reveal ? config.wifi_pass : mask(config.wifi_pass).c_str());
+    FixedString<MAX_LEN> masked;
+    LOGI("  PASS='%s'", reveal ? config.wifi_pass : mask(masked, config.wifi_pass));
     LOGI("  USER='%s'", config.user_email);
     LOGI("  NAME='%s'", config.device_name);
-    LOGI("  KEY ='%s'", reveal ? config.one_time_key : mask(config.one_time_key).c_str());
+    LOGI("  KEY ='%s'", reveal ? config.one_time_key : mask(masked, config.one_time_key));
     LOGI("  node_id='%s'", config.node_id);
     LOGI("  mqtt_host='%s' port=%u", config.mqtt_host, config.mqtt_port);
     LOGI("  mqtt_user='%s'", config.mqtt_username);
-    LOGI("  mqtt_pass='%s'", reveal ? config.mqtt_password : mask(config.mqtt_password).c_str());
+    LOGI("  mqtt_pass='%s'", reveal ? config.mqtt_password : mask(masked, config.mqtt_password));
     LOGI("  registration_ok=%u", config.registration_ok);
 }
 
@@ -213,71 +661,336 @@ static void saveConfig() {
     else LOGE("EEPROM commit FAILED.");
 }
 
+// Padding zeroed too: settings are compared with memcmp.
+static void settingsDefaults(NodeSettings& s) {
+    memset(&s, 0, sizeof(s));
+    s.magic = SETTINGS_MAGIC;
+    s.publish_s = PUBLISH_MS / 1000;
+    s.log_level = LOG_DEBUG;
+    s.pm25_gain_x1000 = s.pm10_gain_x1000 = 1000;
+    s.kappa_x1000 = PM25_KAPPA_X1000;
+}
+
+static const char* ntpServer() { return settings.ntp_server[0] ? settings.ntp_server : NTP_SERVER; }
+
+static void logSettings() {
+    LOGI("Settings: publish %u s, log %s, PM2.5 x%u/1000 %+d/10, PM10 x%u/1000 %+d/10, kappa %u/1000, NTP %s",
+         settings.publish_s, kLogLevelNames[settings.log_level], settings.pm25_gain_x1000, settings.pm25_offset_x10,
+         settings.pm10_gain_x1000, settings.pm10_offset_x10, settings.kappa_x1000, ntpServer());
+}
+
+static void loadSettings() {
+    EEPROM.get(SETTINGS_ADDR, settings);
+    if (settings.magic == SETTINGS_MAGIC_V1) {       // before ntp_server: keep the rest
+        const size_t keep = offsetof(NodeSettings, ntp_server);
+        memset((uint8_t*)&settings + keep, 0, sizeof(settings) - keep);
+        settings.magic = SETTINGS_MAGIC;
+    } else if (settings.magic != SETTINGS_MAGIC) {
+        LOGI("Settings: none stored, using defaults.");
+        settingsDefaults(settings);
+    }
+    logLevel = settings.log_level;
+    logSettings();
+}
+
+#if ENABLE_NETWORK
+static void saveSettings() {                         // settings only change over MQTT
+    EEPROM.put(SETTINGS_ADDR, settings);
+    if (EEPROM.commit()) LOGI("Settings saved.");
+    else LOGE("Settings commit FAILED.");
+}
+#endif
+
+static uint32_t publishMs() { return settings.publish_s * 1000u; }
+
 static void clearConfig() {
     LOGW("Clearing full config...");
     memset(&config, 0, sizeof(config));
     EEPROM.put(0, config);
+    EEPROM.put(SETTINGS_ADDR, (uint32_t)0);          // settings: defaults from the next boot
     if (EEPROM.commit()) LOGI("EEPROM cleared.");
     else LOGE("EEPROM clear commit FAILED.");
 }
 
 // ============================ Wi-Fi (AP + STA) =============================
+// STA joins keep the AP only while the setup window is open.
+static WiFiMode_t staMode() { return portalUp ? WIFI_AP_STA : WIFI_STA; }
+
+// Link state as last reported by the SDK, so nothing polls WiFi.status()
+// or formats IPAddress objects on the hot path. The event handlers run in
+// SDK context (between loop() passes): they only write this struct and set
+// `changed`; loop() wakes the reconnect logic when it sees the flag.
+struct NetState {
+    volatile bool changed = false;
+    bool     staUp      = false;      // associated and holding an IP
+    uint8_t  lastReason = 0;          // WiFiDisconnectReason of the last drop
+    int32_t  rssi       = 0;          // refreshed while up, every RSSI_REFRESH_MS
+    uint32_t upSince    = 0;
+    uint32_t joins      = 0;          // got an IP, since boot
+    uint32_t drops      = 0;
+    char     staIp[16]  = "0.0.0.0";
+    char     apIp[16]   = "0.0.0.0";
+};
+NetState net;
+WiFiEventHandler staGotIpHandler, staDisconnectedHandler;   // handlers live as long as these
+constexpr uint32_t RSSI_REFRESH_MS = 30000;
+
+static void formatIp(char (&out)[16], const IPAddress& ip) {
+    snprintf_P(out, sizeof(out), PSTR("%u.%u.%u.%u"), ip[0], ip[1], ip[2], ip[3]);
+}
+
+static void onStaGotIp(const WiFiEventStationModeGotIP& e) {
+    formatIp(net.staIp, e.ip);
+    net.staUp   = true;
+    net.upSince = millis();
+    ++net.joins;
+    net.changed = true;
+}
+
+static void onStaDisconnected(const WiFiEventStationModeDisconnected& e) {
+    if (net.staUp) ++net.drops;
+    net.staUp      = false;
+    net.lastReason = (uint8_t)e.reason;
+    strcpy_P(net.staIp, PSTR("0.0.0.0"));
+    net.changed    = true;
+}
+
 static void setupAP() {
     LOGI("Bringing up AP '%s'...", AP_SSID);
-    WiFi.mode(WIFI_AP);
+    WiFi.mode((WiFiMode_t)(WiFi.getMode() | WIFI_AP));   // keep STA if already joined
     WiFi.softAPConfig(AP_IP, AP_GW, AP_MASK);
-    bool ok = WiFi.softAP(AP_SSID, AP_PASS);
-    delay(200);
-    if (ok) LOGI("AP started on %s", WiFi.softAPIP().toString().c_str());
+    bool ok = WiFi.softAP(AP_SSID, AP_PASS);   // no settle delay: the window also reopens at runtime
+    formatIp(net.apIp, ok ? WiFi.softAPIP() : IPAddress());
+    if (ok) LOGI("AP started on %s", net.apIp);
     else LOGE("AP start FAILED.");
-    dnsServer.start(53, "*", AP_IP); // captive DNS
+    dnsServer.reset(new DNSServer);
+    dnsServer->start(53, "*", AP_IP); // captive DNS
 }
 
 static bool connectSTA(uint32_t timeoutMs = 15000) {
     if (!haveWifiCreds()) { LOGW("STA connect skipped: empty SSID/PASS."); return false; }
     LOGI("Connecting STA to SSID '%s' (timeout %ums)...", config.wifi_ssid, timeoutMs);
-    WiFi.mode(WIFI_AP_STA);
+    WiFi.mode(staMode());
     WiFi.setAutoConnect(true);
     WiFi.setAutoReconnect(true);
     WiFi.persistent(false);
     WiFi.begin(config.wifi_ssid, config.wifi_pass);
     
+    // Boot only: the GotIP handler flips net.staUp from inside delay().
     uint32_t start = millis();
-    wl_status_t st;
     do {
         delay(250);
-        st = WiFi.status();
         Serial.print('.')
-            ; } while (st != WL_CONNECTED && (millis() - start) < timeoutMs);
+            ; } while (!net.staUp && (millis() - start) < timeoutMs);
     Serial.println();
     
-    if (st == WL_CONNECTED) {
-        LOGI("STA connected. IP=%s, RSSI=%d", WiFi.localIP().toString().c_str(), WiFi.RSSI());
+    if (net.staUp) {
+        net.rssi = WiFi.RSSI();
+        LOGI("STA connected. IP=%s, RSSI=%d", net.staIp, (int)net.rssi);
         return true;
     } else {
-        LOGE("STA connect FAILED (status=%d).", (int)st);
+        LOGE("STA connect FAILED (last reason %u).", net.lastReason);
         return false;
     }
 }
 
-static uint32_t lastStaAttempt = 0;
-static uint32_t staBackoffMs   = 0;
+// Jittered exponential backoff (see pm_backoff.h): 2 s, 4 s, 8 s ... 60 s ceilings,
+// actual wait drawn uniformly below the ceiling so a building's nodes spread out.
+// Runs when a Wi-Fi event arrived or the backoff expired, never on a poll.
+static Backoff staBackoff(2000, 60000, 30000);
+static bool    staWasUp = false;
 static void ensureStaConnected() {
-    wl_status_t st = WiFi.status();
-    if (!haveWifiCreds() || st == WL_CONNECTED) return;
     uint32_t now = millis();
-    if (now - lastStaAttempt < staBackoffMs) return;
-    LOGI("STA ensure: not connected (status=%d). Attempting reconnect to '%s'...", (int)st, config.wifi_ssid);
-    WiFi.mode(WIFI_AP_STA);
+    if (net.staUp) {
+        if (!staWasUp) {
+            staWasUp = true; staBackoff.onConnected(now);
+            LOGI("STA up: IP=%s", net.staIp);
+        }
+        return;
+    }
+    if (staWasUp) {
+        staWasUp = false; staBackoff.onDisconnected(now);
+        LOGW("STA down (reason %u).", net.lastReason);
+    }
+    if (!haveWifiCreds() || !staBackoff.ready(now)) return;
+    LOGI("STA ensure: not connected (last reason %u). Attempting reconnect to '%s'...", net.lastReason, config.wifi_ssid);
+    WiFi.mode(staMode());
     WiFi.setAutoConnect(true);
     WiFi.setAutoReconnect(true);
     WiFi.persistent(false);
     WiFi.begin(config.wifi_ssid, config.wifi_pass);
     
-    lastStaAttempt = now;
-    uint32_t next = staBackoffMs + 5000; // 5s,10s,...60s
-    if (next > 60000) next = 60000;
-    staBackoffMs = next;
+    uint32_t wait = staBackoff.onAttempt(now);
+    LOGD("STA: next attempt no sooner than %u ms (ceiling %u ms).", wait, staBackoff.ceiling());
+}
+
+// ================================ Wall clock ===============================
+// Samples carry Unix time in ms ("ts" in the payload), so the backend can
+// place queued samples and line nodes up. millis() still times everything
+// inside the node; pm_clock.h maps it onto the time of an SNTP server: the
+// ntp setting (see "Remote configuration"), else NTP_SERVER.
+// Polls come every 64 s until the crystal's drift has been measured, and
+// again after a time change; then every NTP_POLL_S. Corrections are slewed,
+// so stamps never go backwards; only a clock a minute behind is stepped
+// back. Without answers the clock runs on with the last drift estimate.
+// A sample taken before the first sync is stamped when it is published.
+// This client rather than the core's configTime(): lwIP's SNTP steps the
+// system time at every answer and does not measure drift.
+// [ADAPT] Point nodes at a server on site (router, gateway): pool.ntp.org
+// is tens of ms away, and asks for no more than a query per minute.
+WallClock wallClock;
+
+#if ENABLE_NETWORK
+constexpr uint16_t NTP_LOCAL_PORT = 2390;
+constexpr uint32_t NTP_FAST_MS    = 64000;    // poll period while the drift is unknown
+constexpr uint8_t  NTP_FAST_SYNCS = 12;       // ~13 min of them: one drift measurement
+constexpr uint32_t NTP_TIMEOUT_MS = 2000;
+constexpr uint32_t NTP_RETRY_MS   = 4000;     // after a timeout; doubles up to the poll period
+WiFiUDP  ntpUdp;
+uint8_t  ntpCookie[8];                        // our transmit timestamp: random, echoed by the server
+uint32_t ntpSentMs = 0, ntpTimeouts = 0;
+uint8_t  ntpFast = 0, ntpFails = 0;           // syncs at the fast rate; timeouts in a row
+bool     ntpWaiting = false, ntpBound = false;
+
+static uint32_t ntpPollMs() { return ntpFast < NTP_FAST_SYNCS ? NTP_FAST_MS : (uint32_t)NTP_POLL_S * 1000; }
+
+// Sends a request to ntpServer(); false if it cannot be sent.
+static bool ntpSend(uint32_t now) {
+    char host[MAX_LEN];
+    copyString(ntpServer(), host, sizeof(host));
+    uint16_t port = sntp::PORT;
+    if (char* colon = strchr(host, ':')) { *colon = '\0'; port = (uint16_t)atoi(colon + 1); }
+    if (!ntpBound) ntpBound = ntpUdp.begin(NTP_LOCAL_PORT);
+    while (ntpUdp.parsePacket() > 0) {}            // late answers to earlier requests
+    for (size_t i = 0; i < sizeof(ntpCookie); i += 4) {
+        const uint32_t r = ESP.random();
+        memcpy(ntpCookie + i, &r, 4);
+    }
+    uint8_t p[sntp::PACKET];
+    sntp::request(p, ntpCookie);
+    if (!ntpBound || !ntpUdp.beginPacket(host, port) || ntpUdp.write(p, sizeof(p)) != sizeof(p) || !ntpUdp.endPacket())
+        return false;
+    ntpSentMs = now;
+    ntpWaiting = true;
+    return true;
+}
+
+static uint32_t ntpAnswer(int64_t serverUs, uint32_t now) {
+    const uint32_t rtt = now - ntpSentMs;
+    const WallClock::Sync r = wallClock.sync(serverUs, now);
+    const int64_t off = wallClock.offsetUs();
+    ntpFails = 0;
+    if (r != WallClock::SLEW || off > WallClock::JUMP_US || off < -WallClock::JUMP_US) ntpFast = 0;
+    if (ntpFast < NTP_FAST_SYNCS) ++ntpFast;
+    if (r == WallClock::SET) LOGI("NTP: clock set from %s (rtt %u ms).", ntpServer(), rtt);
+    else if (r == WallClock::SLEW) LOGD("NTP: offset %ld us, drift %ld ppb, rtt %u ms.", (long)off, (long)wallClock.driftPpb(), rtt);
+    else LOGW("NTP: clock stepped %s by %ld ms.", r == WallClock::STEP ? "forward" : "BACK", (long)(off / 1000));
+    return ntpPollMs();
+}
+
+// Restarts the polls: a new server, or the settings changed it.
+static void ntpRestart() {
+    ntpWaiting = false;
+    ntpFast = ntpFails = 0;
+    sched.in(tNtp, millis(), 0);
+}
+
+static uint32_t taskNtp(uint32_t now) {
+    if (ntpWaiting) {
+        while (ntpUdp.parsePacket() > 0) {
+            uint8_t p[sntp::PACKET];
+            const int n = ntpUdp.read(p, sizeof(p));
+            const int64_t t = sntp::reply(p, n > 0 ? (size_t)n : 0, ntpCookie, now - ntpSentMs);
+            if (t) { ntpWaiting = false; return ntpAnswer(t, now); }
+        }
+        if (now - ntpSentMs < NTP_TIMEOUT_MS) return 1;   // the round trip is timed to the ms
+        ntpWaiting = false;
+        ++ntpTimeouts;
+        LOGW("NTP: no answer from %s.", ntpServer());
+    } else {
+        if (!net.staUp) return LINK_CHECK_MS;
+        if (ntpSend(now)) return 1;
+        LOGW("NTP: cannot send to %s.", ntpServer());
+    }
+    if (ntpFails < 8) ++ntpFails;
+    const uint32_t wait = NTP_RETRY_MS << (ntpFails - 1);
+    return wait < ntpPollMs() ? wait : ntpPollMs();
+}
+
+// The clock members of the telemetry object.
+static void clockJson(StrBuf& out) {
+    out.appendf_P(PSTR(",\"clock\":{\"syncs\":%u,\"offset_us\":%ld,\"drift_ppb\":%ld,\"steps\":%u,\"timeouts\":%u}"),
+                  wallClock.syncs(), (long)wallClock.offsetUs(), (long)wallClock.driftPpb(),
+                  wallClock.steps() + wallClock.backSteps(), ntpTimeouts);
+}
+#endif
+
+// Unix time in ms as JSON: seconds and the three digits of the ms.
+static void appendEpochMs(StrBuf& out, uint64_t ms) {
+    out.appendf_P(PSTR("%u%03u"), (unsigned)(ms / 1000), (unsigned)(ms % 1000));
+}
+
+// ================================ Aggregates ===============================
+// Count, sum, min, max and sum of squares per field over 1 min, 15 min and
+// 1 h, on Unix time boundaries (pm_buckets.h). Every node's bins line up,
+// so the backend stores them as they come and can drop raw samples early.
+// Every PMS5003 frame that would go into a sample (warm, past the spike
+// filter, calibrated), every BME280 reading and every CO2 measurement is
+// added at its own time. Nothing is aggregated before the clock is set.
+// taskAgg closes the buckets on the minute. The tiers in AGG_PUBLISH go to
+// aggregates/<node_id>, queued like samples with QoS1:
+//   {"ts":<start, Unix ms>,"period":<s>,"<field>":[n,sum,min,max,sum_sq],...}
+// A field is left out when it had no values. The units are those of
+// kAggNames. A repeat has the same ts and period.
+// [ADAPT] New field: add it to AggField and kAggNames and feed it with
+// aggAdd() where its reading is stored.
+enum AggField : uint8_t { AGG_PM1, AGG_PM25, AGG_PM10, AGG_T, AGG_RH, AGG_P, AGG_CO2, AGG_FIELDS };
+static const char kAggNames[AGG_FIELDS][5] PROGMEM = {
+    "pm1", "pm25", "pm10",     // µg/m³ × 10
+    "t", "rh", "p",            // °C × 10, %RH × 10, hPa × 10
+    "co2",                     // ppm
+};
+typedef AlignedBuckets<AGG_FIELDS> Aggregates;
+typedef FixedString<447> AggPayload;           // every field at its widest: 416 chars
+Aggregates agg;
+
+#if ENABLE_NETWORK && MQTT_QOS >= 1
+// [ADAPT] ~190 bytes per slot. Six hold the records of five minutes offline;
+// publish fewer tiers (AGG_PUBLISH = 6) to ride out longer outages.
+constexpr size_t AGG_QUEUE_LEN = 6;
+struct QueuedAgg {
+    Aggregates::Bucket b;
+    uint8_t            tier;
+};
+mqtt::PublishQueue<QueuedAgg, AGG_QUEUE_LEN, 2> aggQueue;
+#endif
+
+// x (in its field's unit) at local time ms.
+static void aggAdd(AggField f, int32_t x, uint32_t ms) {
+    if (!wallClock.valid()) return;
+    agg.add(f, (int16_t)(x > 32767 ? 32767 : x < -32768 ? -32768 : x), wallClock.nowMs(ms));
+}
+
+// printf on the device has no 64-bit conversions.
+static void appendU64(StrBuf& out, uint64_t v) {
+    if (v >= 1000000000u) out.appendf_P(PSTR("%u%09u"), (unsigned)(v / 1000000000u), (unsigned)(v % 1000000000u));
+    else out.appendf_P(PSTR("%u"), (unsigned)v);
+}
+
+static AggPayload aggJson(const Aggregates::Bucket& b, uint8_t tier) {
+    AggPayload p;
+    p += F("{\"ts\":"); appendEpochMs(p, (uint64_t)b.startS * 1000);
+    p.appendf_P(PSTR(",\"period\":%u"), (unsigned)Aggregates::PERIOD_S[tier]);
+    for (uint8_t i = 0; i < AGG_FIELDS; ++i) {
+        const AggStats& f = b.f[i];
+        if (!f.n) continue;
+        p += F(",\""); p += FPSTR(kAggNames[i]);
+        p.appendf_P(PSTR("\":[%u,%ld,%d,%d,"), f.n, (long)f.sum, f.min, f.max);
+        appendU64(p, f.sq);
+        p += ']';
+    }
+    p += '}';
+    return p;
 }
 
 // ============================= Registration =================================
@@ -286,7 +999,8 @@ static void ensureStaConnected() {
 // networking and replace the stub when moving to your private repo.
 
 #if ENABLE_NETWORK
-static String extractFirstJsonObject(const String& s) {
+// For the real backend's response; the stub below does not parse one.
+__attribute__((unused)) static String extractFirstJsonObject(const String& s) {
     int first = s.indexOf('{');
     int last  = s.lastIndexOf('}');
     if (first >= 0 && last > first) return s.substring(first, last + 1);
@@ -295,7 +1009,7 @@ static String extractFirstJsonObject(const String& s) {
 #endif
 
 static bool performRegistration() {
-    if (String(config.one_time_key).length() == 0) { LOGW("Registration skipped: empty One Time Key."); return false; }
+    if (config.one_time_key[0] == '\0') { LOGW("Registration skipped: empty One Time Key."); return false; }
     
 #if ENABLE_NETWORK
     // [ADAPT] Replace the entire block with your HTTPS POST using a pinned CA or fingerprint.
@@ -306,13 +1020,13 @@ static bool performRegistration() {
 #else
     // ---------- STUB: pretend the backend replied with credentials ----------
     LOGI("[STUB] Simulating successful registration.");
-    copyString("00000000-0000-0000-0000-000000000001", config.node_id, UUID_LEN);
-    copyString("mqtt.example.local", config.mqtt_host, MAX_LEN);
+    copyString_P(PSTR("00000000-0000-0000-0000-000000000001"), config.node_id, UUID_LEN);
+    copyString_P(PSTR("mqtt.example.local"), config.mqtt_host, MAX_LEN);
     config.mqtt_port = 1883;
-    copyString("demo-user", config.mqtt_username, MAX_LEN);
-    copyString("demo-pass", config.mqtt_password, MAX_LEN);
-    copyString("00000000-0000-0000-0000-00000000SENS", config.first_sensor_id, UUID_LEN);
-    copyString("PMS5003-EDU", config.first_sensor_sn, MAX_LEN);
+    copyString_P(PSTR("demo-user"), config.mqtt_username, MAX_LEN);
+    copyString_P(PSTR("demo-pass"), config.mqtt_password, MAX_LEN);
+    copyString_P(PSTR("00000000-0000-0000-0000-00000000SENS"), config.first_sensor_id, UUID_LEN);
+    copyString_P(PSTR("PMS5003-EDU"), config.first_sensor_sn, MAX_LEN);
 #endif
     config.registration_ok = 1;
     saveConfig();
@@ -321,369 +1035,1882 @@ static bool performRegistration() {
     return true;
 }
 
-// ============================== PMS5003 I/O ================================
-static bool pmsReadN(uint8_t* buf, size_t n, uint32_t timeoutMs = 200) {
-    uint32_t start = millis(); size_t got = 0;
-    while (got < n && (millis() - start) < timeoutMs) {
-        while (pmsSerial.available() && got < n) buf[got++] = (uint8_t)pmsSerial.read();
-        if (got < n) delay(2);
+// ============================== BME280 I/O =================================
+#if ENABLE_BME280
+static bool bmeProbe() {
+    if (bme.begin(Bme280<Bus>::ADDR_PRIMARY) || bme.begin(Bme280<Bus>::ADDR_SECONDARY)) {
+        LOGI("BME280 found at 0x%02X.", bme.address());
+        i2c.device(bme.address(), PSTR("bme280"));
+        return true;
     }
-    return got == n;
+    return false;
 }
 
-static bool readPMS5003Frame(PMSData& out) {
-    // Find header 0x42, 0x4D
-    uint32_t start = millis(); int state = 0;
-    while ((millis() - start) < 200) {
-        if (!pmsSerial.available()) { delay(2); continue; }
-        int b = pmsSerial.read(); if (b < 0) continue;
-        if (state == 0 && b == 0x42) state = 1;
-        else if (state == 1 && b == 0x4D) { state = 2; break; }
-        else state = 0;
-    }
-    if (state != 2) return false;
-    
-    uint8_t lenb[2]; if (!pmsReadN(lenb, 2)) return false;
-    uint16_t frameLen = (uint16_t)lenb[0] << 8 | lenb[1];
-    if (frameLen < 28 || frameLen > 64) return false;
-    
-    uint8_t data[64];
-    if (frameLen > sizeof(data)) return false;
-    if (!pmsReadN(data, frameLen)) return false;
-    
-    uint16_t sum = 0x42 + 0x4D + lenb[0] + lenb[1];
-    for (size_t i = 0; i < (size_t)frameLen - 2; ++i) sum += data[i];
-    uint16_t chk = ((uint16_t)data[frameLen - 2] << 8) | data[frameLen - 1];
-    if (sum != chk) { LOGW("PMS checksum mismatch: calc=%u, frame=%u", sum, chk); return false; }
-    
-    auto wordAt = [&](int idx)->uint16_t { int i = idx * 2; return (uint16_t)data[i] << 8 | data[i+1]; };
-    
-    out.pm1_cf1  = wordAt(0);
-    out.pm25_cf1 = wordAt(1);
-    out.pm10_cf1 = wordAt(2);
-    out.pm1_atm  = wordAt(3);
-    out.pm25_atm = wordAt(4);
-    out.pm10_atm = wordAt(5);
-    out.ts_ms    = millis();
-    out.valid    = true;
-    return true;
+// Triggers a conversion; taskBmeRead collects it.
+static void bmeStart(uint32_t now) {
+    if (bme.start()) sched.in(tBmeRead, now, bme.measureMs());
+    else LOGW("BME280: start failed (%u errors).", bme.errors());
 }
 
-static void pollPMS5003() {
-    PMSData tmp;
-    if (readPMS5003Frame(tmp)) {
-        g_pms = tmp;
-        LOGI("PMS ok: CF1[%u/%u/%u] ATM[%u/%u/%u] µg/m³",
-             g_pms.pm1_cf1, g_pms.pm25_cf1, g_pms.pm10_cf1,
-             g_pms.pm1_atm, g_pms.pm25_atm, g_pms.pm10_atm);
+// Every BME_MS. While PMS frames arrive, defer the start to the next frame
+// gap; without them (sensor missing or asleep) start right away.
+static uint32_t taskBme(uint32_t now) {
+    if (!bme.present() && !bmeProbe()) return Sched::PERIOD;   // hot-plug: probe again next period
+    if (bme.measuring()) return Sched::PERIOD;                 // previous one still pending
+    if (g_pms.valid && now - g_pms.ts_ms < 2000) { bmeWanted = true; bmeFrameMs = g_pms.ts_ms; }
+    else bmeStart(now);
+    return Sched::PERIOD;
+}
+
+static uint32_t taskBmeRead(uint32_t now) {
+    switch (bme.poll()) {
+        case Bme280<Bus>::BUSY:
+            return 2;
+        case Bme280<Bus>::READY: {
+            const Bme280<Bus>::Reading& r = bme.reading();
+            g_env.t_x100 = r.t_x100;
+            g_env.rh_x10 = r.rh_x10();
+            g_env.p_pa   = r.p_pa;
+            g_env.ts_ms  = now;
+            g_env.valid  = true;
+            aggAdd(AGG_T,  (r.t_x100 + (r.t_x100 < 0 ? -5 : 5)) / 10, now);
+            aggAdd(AGG_RH, g_env.rh_x10, now);
+            aggAdd(AGG_P,  (int32_t)((r.p_pa + 5) / 10), now);
+            return Sched::STOP;
+        }
+        default:
+            LOGW("BME280: read failed (%u errors).", bme.errors());
+            return Sched::STOP;
     }
 }
 
-// ============================== MQTT (stub) ================================
-#if ENABLE_NETWORK
-static String mqttTopic() {
-    String t = "measurements/"; t += config.node_id; t += "/"; t += config.first_sensor_id; return t;
+void BmeSensor::begin() {
+    if (!bmeProbe()) LOGW("BME280 not found on SDA=%d SCL=%d (probing again every %u s).", I2C_SDA, I2C_SCL, (unsigned)(BME_MS / 1000));
 }
 
-static String makeMeasurementPayload(float pm1, float pm25, float pm10) {
-    char buf[128];
-    snprintf(buf, sizeof(buf),
-             "{\"measurement\":{\"pm1\":%.1f,\"pm25\":%.1f,\"pm10\":%.1f}}",
-             pm1, pm25, pm10);
-    return String(buf);
+void BmeSensor::start(uint32_t now) {
+    sched.add(PSTR("bme"), taskBme, BME_MS, now, 1000);
+    tBmeRead = sched.add(PSTR("bme-read"), taskBmeRead, 0, now);
+    sched.stop(tBmeRead);                              // armed by bmeStart()
 }
 
-static void mqttEnsureConnected() {
-    if (!haveMqttCreds()) return;
-    if (mqttClient.connected()) return;
-    uint32_t now = millis();
-    if (now - lastMqttConnAttempt < mqttBackoffMs) return;
-    mqttClient.setServer(config.mqtt_host, config.mqtt_port);
-    LOGI("MQTT: connecting to %s:%u as '%s'...", config.mqtt_host, config.mqtt_port, config.node_id);
-    bool ok = mqttClient.connect(config.node_id, config.mqtt_username, config.mqtt_password);
-    if (ok) { LOGI("MQTT: connected."); mqttBackoffMs = 0; }
-    else { LOGE("MQTT: connect failed (rc=%d).", mqttClient.state()); mqttBackoffMs = min<uint32_t>(mqttBackoffMs + 5000, 60000); }
-    lastMqttConnAttempt = now;
-}
-
-static void mqttMaybePublish() {
-    if (!haveMqttCreds() || !mqttClient.connected() || !g_pms.valid) return;
-    static uint32_t lastMqttPub = 0; uint32_t now = millis();
-    if (now - lastMqttPub < 20000) return; // ~20s
-    lastMqttPub = now;
-    String topic   = mqttTopic();
-    String payload = makeMeasurementPayload(g_pms.pm1_atm, g_pms.pm25_atm, g_pms.pm10_atm);
-    LOGI("MQTT PUB -> topic='%s' payload=%s", topic.c_str(), payload.c_str());
-    if (!mqttClient.publish(topic.c_str(), payload.c_str(), true)) LOGE("MQTT publish failed (rc=%d).", mqttClient.state());
+// The deferred start, right after the PMS frame has been parsed (PmsSensor
+// polls first).
+void BmeSensor::poll(uint32_t now) {
+    if (bmeWanted && g_pms.ts_ms != bmeFrameMs) { bmeWanted = false; bmeStart(now); }
 }
-#else
-static void mqttEnsureConnected() { /* stub: no-op in educational build */ }
-static void mqttMaybePublish()   { /* stub: print instead of publish */
-    if (!g_pms.valid || !config.registration_ok) return;
-    LOGI("[STUB MQTT] Would publish ATM: pm1=%u pm25=%u pm10=%u",
-         g_pms.pm1_atm, g_pms.pm25_atm, g_pms.pm10_atm);
+
+void BmeSensor::sample(Fields& s, uint32_t now) {
+    s.env    = envFresh(now);
+    s.t_x10  = s.env ? (int16_t)((g_env.t_x100 + (g_env.t_x100 < 0 ? -5 : 5)) / 10) : 0;
+    s.rh_x10 = s.env ? g_env.rh_x10 : 0;
+    s.p_x10  = s.env ? clampU16((g_env.p_pa + 5) / 10) : 0;
 }
-#endif
 
-// ============================== HTML & Pages ===============================
-static String htmlHeader(const String& title) {
-    String h;
-    h += "<!DOCTYPE html><html lang='en'><head><meta charset='utf-8'>";
-    h += "<meta name='viewport' content='width=device-width, initial-scale=1'>";
-    h += "<title>" + title + "</title>";
-    h += "<style>body{font-family:system-ui,-apple-system,Segoe UI,Roboto,Ubuntu,Noto Sans,Arial,sans-serif;max-width:800px;margin:24px auto;padding:0 16px}";
-    h += "h1{font-size:1.6rem;margin:.2rem 0}.subtitle{margin:0 0 1rem;color:#444}";
-    h += "h2{font-size:1.2rem;margin-top:1.2rem}label{display:block;margin:.6rem 0 .2rem}";
-    h += "input[type=text],input[type=password],input[type=email]{width:100%;padding:.6rem;border:1px solid #ccc;border-radius:8px}";
-    h += "button, input[type=submit]{padding:.6rem 1rem;border:0;border-radius:8px;margin-top:1rem;cursor:pointer}";
-    h += "nav a{margin-right:1rem}footer{margin-top:2rem;color:#666;font-size:.9rem}";
-    h += ".pm{border-radius:12px;padding:12px 16px;background:#f4f6fb;border:1px solid #e1e5f2;margin:8px 0 16px}";
-    h += ".ok{color:#0a7a2f}.warn{color:#a66a00}.err{color:#b00020}";
-    h += "code{background:#f6f8fa;padding:0 .25rem;border-radius:4px}";
-    h += "</style></head><body>";
-    h += "<header class='pm'><h1>" + String(kProjectName) + "</h1>";
-    h += "<p class='subtitle'>This is an educational, non-production configuration portal.</p></header>";
-    h += "<nav><a href='/'>&#x1F3E0; Home</a><a href='/clear'>Clear</a><a href='/reboot'>Reboot</a><a href='/status'>Status</a></nav>";
-    return h;
-}
-
-static String htmlFooter() {
-    String f;
-    f += "<footer>Setup portal · AP " + WiFi.softAPIP().toString() + "</footer>";
-    f += "</body></html>";
-    return f;
-}
-
-static String renderFormPage() {
-    String page = htmlHeader("Device Setup");
-    page += "<h2>Configure Wi‑Fi & Registration</h2>";
-    page += "<form method='POST' action='/save'>";
-    page += "<label>Wi‑Fi SSID</label><input name='wifi_ssid' type='text' placeholder='MyHomeWiFi' value='" + String(config.wifi_ssid) + "' maxlength='" + String(MAX_LEN - 1) + "'>";
-    page += "<label>Wi‑Fi password</label><input name='wifi_pass' type='password' placeholder='••••••••' value='" + String(config.wifi_pass) + "' maxlength='" + String(MAX_LEN - 1) + "'>";
-    page += "<label>User Email</label><input name='user_email' type='email' placeholder='you@example.com' value='" + String(config.user_email) + "' maxlength='" + String(MAX_LEN - 1) + "'>";
-    page += "<label>Device Name</label><input name='device_name' type='text' placeholder='Node‑Kitchen' value='" + String(config.device_name) + "' maxlength='" + String(MAX_LEN - 1) + "'>";
-    page += "<label>One‑Time Key</label><input name='one_time_key' type='text' placeholder='Paste code' value='" + String(config.one_time_key) + "' maxlength='" + String(MAX_LEN - 1) + "'>";
-    page += "<input type='submit' value='Save'>";
-    page += "</form>";
-    
-    page += "<h2>Registration Status</h2>";
-    if (config.registration_ok) {
-        page += "<p class='ok'>Registered ✔</p><ul>";
-        page += "<li>node_id: <code>" + String(config.node_id) + "</code></li>";
-        page += "<li>mqtt_host: <code>" + String(config.mqtt_host) + "</code></li>";
-        page += "<li>mqtt_port: <code>" + String(config.mqtt_port) + "</code></li>";
-        page += "<li>mqtt_username: <code>" + String(config.mqtt_username) + "</code></li>";
-        page += "</ul>";
+void BmeSensor::json(StrBuf& p, const Fields& s) {
+    if (!s.env) return;
+    p += F(",\"env\":{\"t\":");          appendFixed(p, s.t_x10, 1);
+    p += F(",\"rh\":");                  appendFixed(p, s.rh_x10, 1);
+    p += F(",\"p\":");                   appendFixed(p, s.p_x10, 1);
+    p += '}';
+}
+
+void BmeSensor::text(StrBuf& v, const Fields& s) {
+    if (!s.env) return;
+    v += F(" t=");  appendFixed(v, s.t_x10, 1);
+    v += F(" rh="); appendFixed(v, s.rh_x10, 1);
+    v += F(" p=");  appendFixed(v, s.p_x10, 1);
+}
+
+void BmeSensor::metrics(om::Writer& w, const Fields& s) {
+    if (!s.env) return;
+    w.family(PSTR("pm_temperature_celsius"), om::GAUGE, PSTR("celsius"), PSTR("BME280 temperature, last sample."));
+    w.gauge(s.t_x10, 1);
+    w.family(PSTR("pm_relative_humidity_percent"), om::GAUGE, PSTR("percent"), PSTR("BME280 relative humidity, last sample."));
+    w.gauge(s.rh_x10, 1);
+    w.family(PSTR("pm_pressure_hectopascals"), om::GAUGE, PSTR("hectopascals"), PSTR("BME280 pressure, last sample."));
+    w.gauge(s.p_x10, 1);
+}
+
+void BmeSensor::page(StrBuf& page) {
+    page += F("<h2>BME280</h2>");
+    if (g_env.valid) {
+        page += F("<ul><li>Temperature: <code>"); appendFixed(page, g_env.t_x100, 2);
+        page += F("</code> °C</li><li>Humidity: <code>"); appendFixed(page, g_env.rh_x10, 1);
+        page += F("</code> %RH</li><li>Pressure: <code>"); appendFixed(page, g_env.p_pa, 2);
+        page.appendf_P(PSTR("</code> hPa</li><li>Updated: <code>+%u ms</code> ago</li></ul>"), (unsigned)(millis() - g_env.ts_ms));
     } else {
-        page += "<p class='warn'>Not registered yet.</p>";
+        page += F("<p class='warn'>No BME280 reading (not fitted, or first conversion pending).</p>");
     }
-    
-    page += "<h2>PMS5003 (latest)</h2>";
-    if (g_pms.valid) {
-        page += "<ul>";
-        page += "<li>CF=1: PM1=<code>" + String(g_pms.pm1_cf1) + "</code>, PM2.5=<code>" + String(g_pms.pm25_cf1) + "</code>, PM10=<code>" + String(g_pms.pm10_cf1) + "</code> µg/m³</li>";
-        page += "<li>ATM : PM1=<code>" + String(g_pms.pm1_atm) + "</code>, PM2.5=<code>" + String(g_pms.pm25_atm) + "</code>, PM10=<code>" + String(g_pms.pm10_atm) + "</code> µg/m³</li>";
-        page += "<li>Updated: <code>+" + String((uint32_t)(millis() - g_pms.ts_ms)) + " ms</code> ago</li>";
-        page += "</ul>";
-    } else {
-        page += "<p class='warn'>No valid PMS frame yet (warming up or not connected).</p>";
+}
+
+void BmeSensor::brief(StrBuf& b) {
+    if (!g_env.valid) return;
+    b += F(" | T="); appendFixed(b, g_env.t_x100, 2);
+    b += F("C RH="); appendFixed(b, g_env.rh_x10, 1);
+    b += F("% P=");  appendFixed(b, g_env.p_pa, 2);
+    b += F("hPa");
+}
+#endif
+
+// ============================= Sunrise I/O =================================
+#if ENABLE_SUNRISE
+// The ABC state in RTC memory, after the reset tally (blocks 0-1). It
+// survives a reset or a crash, not a power cut.
+struct SunriseRtc {
+    uint32_t magic;
+    uint8_t  state[Sunrise<Bus>::STATE_LEN];
+};
+constexpr uint32_t SUNRISE_RTC_MAGIC = 0x5C02ABC0;
+constexpr uint32_t SUNRISE_RTC_BLOCK = 2;
+
+static void sunriseLoadState() {
+    SunriseRtc r;
+    if (ESP.rtcUserMemoryRead(SUNRISE_RTC_BLOCK, (uint32_t*)&r, sizeof(r)) && r.magic == SUNRISE_RTC_MAGIC) {
+        sunrise.restoreState(r.state, millis());
+        LOGI("Sunrise: ABC state restored from RTC memory (ABC time %u h).", sunrise.abcHours());
     }
-    
-    page += htmlFooter();
-    return page;
 }
 
-static String renderSavedPage(bool regOk, const String& regMsg) {
-    String page = htmlHeader("Saved");
-    page += "<h2>Saved!</h2><p>Your values have been stored in non‑volatile memory.</p>";
-    page += "<h2>Registration</h2>";
-    if (regOk) {
-        page += "<p class='ok'>Registration successful ✔</p>";
-    } else {
-        page += "<p class='err'>Registration failed ✖</p><p><small>" + regMsg + "</small></p>";
-    }
-    page += "<p><a href='/'>Go back</a> or <a href='/reboot'>Reboot now</a>.</p>";
-    page += htmlFooter();
-    return page;
-}
-
-static String renderStatusPage() {
-    String page = htmlHeader("Status");
-    page += "<h2>Runtime Status</h2><ul>";
-    page += "<li>AP IP: <code>" + WiFi.softAPIP().toString() + "</code></li>";
-    page += "<li>STA status: <code>" + String((int)WiFi.status()) + "</code></li>";
-    page += "<li>STA IP: <code>" + WiFi.localIP().toString() + "</code></li>";
-    page += "<li>RSSI: <code>" + String(WiFi.RSSI()) + " dBm</code></li>";
-    page += "<li>Free heap: <code>" + String(ESP.getFreeHeap()) + "</code></li>";
-    page += "</ul>";
-    page += "<h2>Registration</h2><ul>";
-    page += "<li>registration_ok: <code>" + String(config.registration_ok) + "</code></li>";
-    page += "<li>node_id: <code>" + String(config.node_id) + "</code></li>";
-    page += "<li>mqtt_host: <code>" + String(config.mqtt_host) + "</code></li>";
-    page += "<li>mqtt_port: <code>" + String(config.mqtt_port) + "</code></li>";
-    page += "<li>mqtt_username: <code>" + String(config.mqtt_username) + "</code></li>";
-    page += "</ul>";
-    page += htmlFooter();
-    return page;
+static void sunriseSaveState() {
+    SunriseRtc r;
+    r.magic = SUNRISE_RTC_MAGIC;
+    memcpy(r.state, sunrise.state(), sizeof(r.state));
+    ESP.rtcUserMemoryWrite(SUNRISE_RTC_BLOCK, (uint32_t*)&r, sizeof(r));
 }
 
-// =============================== HTTP Routes ===============================
-static void handleRoot()   { server.send(200, "text/html", renderFormPage()); }
+// Every CO2_MS: power the Sunrise up and start a measurement; taskCo2Step
+// takes it from there, one bus transfer per run. While a transfer is queued
+// the step timer is off; the bus's notify (see setup()) re-arms it.
+static uint32_t taskCo2(uint32_t now) {
+    if (sunrise.measure(now)) sched.in(tCo2Step, now, sunrise.waitMs());
+    return Sched::PERIOD;
+}
 
-static void handleSave() {
-    if (server.method() != HTTP_POST) { server.send(405, "text/plain", "Method Not Allowed"); return; }
-    if (server.hasArg("wifi_ssid"))    copyString(server.arg("wifi_ssid"),    config.wifi_ssid,   MAX_LEN);
-    if (server.hasArg("wifi_pass"))    copyString(server.arg("wifi_pass"),    config.wifi_pass,   MAX_LEN);
-    if (server.hasArg("user_email"))   copyString(server.arg("user_email"),   config.user_email,  MAX_LEN);
-    if (server.hasArg("device_name"))  copyString(server.arg("device_name"),  config.device_name, MAX_LEN);
-    if (server.hasArg("one_time_key")) copyString(server.arg("one_time_key"), config.one_time_key,MAX_LEN);
-    
-    // Reset registration-derived fields so the flow restarts cleanly
-    config.registration_ok = 0;
-    config.node_id[0] = '\0';
-    config.mqtt_host[0] = '\0';
-    config.mqtt_username[0] = '\0';
-    config.mqtt_password[0] = '\0';
-    config.mqtt_port = 0;
-    config.first_sensor_id[0] = '\0';
-    config.first_sensor_sn[0] = '\0';
-    saveConfig();
-    
-    // Attempt registration right away (stubbed by default)
-    lastStaAttempt = 0; staBackoffMs = 0; WiFi.disconnect();
-    ensureStaConnected();
-    bool regOk = performRegistration();
-    String regMsg = regOk ? "OK" : "See serial logs for diagnostics.";
-    server.send(200, "text/html", renderSavedPage(regOk, regMsg));
+static uint32_t taskCo2Step(uint32_t now) {
+    switch (sunrise.step()) {
+        case Sunrise<Bus>::WAIT:
+            return sunrise.waitMs();
+        case Sunrise<Bus>::BUS:
+            return Sched::STOP;
+        case Sunrise<Bus>::READY: {
+            const Sunrise<Bus>::Reading& r = sunrise.reading();
+            g_co2.ppm    = r.co2_ppm;
+            g_co2.t_x100 = r.t_x100;
+            g_co2.status = r.status;
+            g_co2.ts_ms  = now;
+            g_co2.valid  = true;
+            aggAdd(AGG_CO2, r.co2_ppm, now);
+            sunriseSaveState();
+            if (sunrise.conversions() == 1)
+                LOGI("Sunrise: first reading %u ppm (single-measurement mode%s).", r.co2_ppm,
+                     sunrise.eeWrites() ? ", switched from continuous" : "");
+            if (r.status) LOGW("Sunrise: status 0x%04X with %u ppm.", r.status, r.co2_ppm);
+            return Sched::STOP;
+        }
+        default:
+            if (sunrise.errors() != co2ErrorsLogged) {         // an absent sensor is not an error
+                co2ErrorsLogged = sunrise.errors();
+                LOGW("Sunrise: measurement failed (%u errors).", sunrise.errors());
+            }
+            return Sched::STOP;
+    }
 }
 
-static void handleClear() {
-    clearConfig(); loadConfig();
-    String page = htmlHeader("Cleared");
-    page += "<h2>Configuration cleared</h2><p>EEPROM config has been cleared.</p><p><a href='/'>Return home</a></p>";
-    page += htmlFooter();
-    server.send(200, "text/html", page);
+// EN low until the first measurement. The bus's notify re-arms the step
+// timer whenever one of the Sunrise's transfers has run.
+void Co2Sensor::begin() {
+    if (SUNRISE_EN_PIN >= 0) sunrisePower(false);
+    if (SUNRISE_NRDY_PIN >= 0) pinMode(SUNRISE_NRDY_PIN, INPUT);
+    i2c.device(Sunrise<Bus>::ADDR, PSTR("sunrise"), Sunrise<Bus>::WAKE_WINDOW_US,
+               [] { sched.in(tCo2Step, millis(), 0); });
+    sunriseLoadState();
 }
 
-static void handleReboot() {
-    String page = htmlHeader("Rebooting");
-    page += "<h2>Rebooting...</h2><p>The device will restart in a few seconds.</p>";
-    page += htmlFooter();
-    server.send(200, "text/html", page);
-    delay(500);
-    ESP.restart();
+void Co2Sensor::start(uint32_t now) {
+    sched.add(PSTR("co2"), taskCo2, CO2_MS, now, 2000);
+    tCo2Step = sched.add(PSTR("co2-step"), taskCo2Step, 0, now);
+    sched.stop(tCo2Step);                              // armed by taskCo2()
+}
+
+void Co2Sensor::sample(Fields& s, uint32_t now) {
+    s.co2     = g_co2.valid && now - g_co2.ts_ms < 2 * CO2_MS;
+    s.co2_ppm = s.co2 ? g_co2.ppm : 0;
 }
 
-static void handleStatus() { server.send(200, "text/html", renderStatusPage()); }
+void Co2Sensor::json(StrBuf& p, const Fields& s) {
+    if (s.co2) p.appendf_P(PSTR(",\"co2\":%u"), s.co2_ppm);
+}
 
-static void handleNotFound() {
-    if (server.hostHeader() != AP_IP.toString()) {
-        server.sendHeader("Location", String("http://") + AP_IP.toString(), true);
-        server.send(302, "text/plain", "");
+void Co2Sensor::text(StrBuf& v, const Fields& s) {
+    if (s.co2) v.appendf_P(PSTR(" co2=%u"), s.co2_ppm);
+}
+
+void Co2Sensor::metrics(om::Writer& w, const Fields& s) {
+    if (!s.co2) return;
+    w.family(PSTR("pm_co2_ppm"), om::GAUGE, PSTR("ppm"), PSTR("Sunrise CO2, last sample."));
+    w.gauge(s.co2_ppm);
+}
+
+void Co2Sensor::page(StrBuf& page) {
+    page += F("<h2>CO2 (Senseair Sunrise)</h2>");
+    if (g_co2.valid) {
+        page.appendf_P(PSTR("<ul><li>CO2: <code>%u</code> ppm</li><li>Sensor temperature: <code>"), g_co2.ppm);
+        appendFixed(page, g_co2.t_x100, 2);
+        page.appendf_P(PSTR("</code> °C</li><li>Status: <code>0x%04X</code></li><li>Updated: <code>+%u ms</code> ago</li></ul>"),
+                       g_co2.status, (unsigned)(millis() - g_co2.ts_ms));
     } else {
-        server.send(404, "text/plain", "Not Found");
+        page += F("<p class='warn'>No CO2 reading (not fitted, or first measurement pending).</p>");
     }
 }
 
-static void handleCaptiveProbes() {
-    server.on("/generate_204", HTTP_ANY, [](){ server.send(200, "text/html", "<html><body>Open portal: <a href='/' >Home</a></body></html>"); });
-    server.on("/hotspot-detect.html", HTTP_ANY, [](){ server.send(200, "text/html", "<html><body><b>Success</b> — <a href='/' >Open portal</a></body></html>"); });
-    server.on("/ncsi.txt", HTTP_ANY, [](){ server.send(200, "text/plain", "Microsoft NCSI"); });
+void Co2Sensor::brief(StrBuf& b) {
+    if (g_co2.valid) b.appendf_P(PSTR(" | CO2=%uppm"), g_co2.ppm);
 }
+#endif
 
-static void setupWeb() {
-    server.on("/", HTTP_GET, handleRoot);
-    server.on("/save", HTTP_POST, handleSave);
-    server.on("/clear", HTTP_GET, handleClear);
-    server.on("/reboot", HTTP_GET, handleReboot);
-    server.on("/status", HTTP_GET, handleStatus);
-    handleCaptiveProbes();
-    server.onNotFound(handleNotFound);
-    server.begin();
-    LOGI("HTTP server started on http://%s", WiFi.softAPIP().toString().c_str());
+// ============================== PMS5003 I/O ================================
+// Drains whatever SoftwareSerial has buffered into the streaming parser and
+// returns as soon as a frame completes. Never waits for missing bytes: at
+// 9600 baud a frame takes ~33 ms, which used to be spent inside delay().
+static bool readPMS5003Frame(PMSData& out) {
+    while (pmsSerial.available()) {
+        int b = pmsSerial.read(); if (b < 0) break;
+        switch (pmsParser.feed((uint8_t)b)) {
+            case PmsParser::FRAME: {
+                const PmsReading& r = pmsParser.reading();
+                out.pm1_cf1  = r.pm1_cf1;
+                out.pm25_cf1 = r.pm25_cf1;
+                out.pm10_cf1 = r.pm10_cf1;
+                out.pm1_atm  = r.pm1_atm;
+                out.pm25_atm = r.pm25_atm;
+                out.pm10_atm = r.pm10_atm;
+                out.ts_ms    = millis();
+                out.valid    = true;
+                return true;
+            }
+            case PmsParser::BAD_CHECKSUM:
+                LOGW("PMS checksum mismatch: calc=%u, frame=%u", pmsParser.calcSum(), pmsParser.frameSum());
+                break;
+            default:
+                break;
+        }
+    }
+    return false;
 }
 
-// ================================ Arduino ==================================
-static uint32_t lastHeartbeat = 0;
-
-void setup() {
-    Serial.begin(115200);
-    delay(50);
-    Serial.println();
-    LOGI("Booting educational build (SYNC skeleton)...");
-    LOGI("Build: " __DATE__ " " __TIME__ " | Core: ESP8266 Arduino | Free heap at boot: %u", ESP.getFreeHeap());
-    
-    loadConfig();
-    setupAP();
-    setupWeb();
-    
-    // PMS5003 UART (small buffer saves RAM)
+// RX only, small buffer (saves RAM).
+void PmsSensor::begin() {
     pmsSerial.begin(9600, SWSERIAL_8N1, PMS_RX, -1, false, 128);
     if (!pmsSerial) LOGE("PMS SoftwareSerial config invalid (pin unsupported?)");
     pinMode(PMS_RX, INPUT_PULLUP);
     pmsSerial.listen();
+    pmsWarmup.restart(millis());           // powered with the board
     LOGI("PMS5003 serial started on RX=%d @9600", PMS_RX);
-    
-    // WiFi auto (STA)
-    WiFi.setAutoConnect(true);
-    WiFi.setAutoReconnect(true);
-    WiFi.persistent(false);
-    if (haveWifiCreds()) {
-        LOGI("Boot: attempting STA join to '%s'...", config.wifi_ssid);
-        connectSTA(8000);
-        lastStaAttempt = 0; staBackoffMs = 0;
-    } else {
-        LOGW("Boot: no WiFi credentials saved, staying AP‑only.");
+}
+
+// False if the spike filter drops the frame; may slew-limit it in place.
+static bool filterPMS5003Frame(PMSData& f) {
+#if PMS_SPIKE_FILTER
+    uint16_t v[6] = {f.pm1_cf1, f.pm25_cf1, f.pm10_cf1, f.pm1_atm, f.pm25_atm, f.pm10_atm};
+    const uint32_t unjudged = pmsFilter.unjudged();
+    if (!pmsFilter.accept(v)) {
+        if (pmsFilter.unjudged() != unjudged) { LOGD("PMS frame dropped: spike filter window still filling."); return false; }
+        LOGW("PMS frame dropped as a spike: CF1[%u/%u/%u] ATM[%u/%u/%u] (%u of %u so far)",
+             f.pm1_cf1, f.pm25_cf1, f.pm10_cf1, f.pm1_atm, f.pm25_atm, f.pm10_atm,
+             pmsFilter.rejected(), pmsFilter.frames());
+        return false;
     }
-    
+    f.pm1_cf1 = v[0]; f.pm25_cf1 = v[1]; f.pm10_cf1 = v[2];
+    f.pm1_atm = v[3]; f.pm25_atm = v[4]; f.pm10_atm = v[5];
+#else
+    (void)f;
+#endif
+    return true;
+}
+
+// Unit calibration from the settings (identity by default): x · gain/1000 +
+// offset, in tenths of µg/m³, never below 0. It applies to the PM2.5 and
+// PM10 means before the humidity correction, and to each frame that goes
+// into the aggregates; PM1 has no reference to fit.
+static uint16_t calibrate(uint16_t x_x10, uint16_t gain_x1000, int16_t offset_x10) {
+    const int32_t y = (int32_t)(((uint32_t)x_x10 * gain_x1000 + 500) / 1000) + offset_x10;
+    return y < 0 ? 0 : clampU16((uint32_t)y);
+}
+
+void PmsSensor::poll(uint32_t) {
+    PMSData tmp;
+    if (readPMS5003Frame(tmp) && filterPMS5003Frame(tmp)) {
+        g_pms = tmp;
+        LOGI("PMS ok: CF1[%u/%u/%u] ATM[%u/%u/%u] µg/m³",
+             g_pms.pm1_cf1, g_pms.pm25_cf1, g_pms.pm10_cf1,
+             g_pms.pm1_atm, g_pms.pm25_atm, g_pms.pm10_atm);
+        if (!pmsWarmup.warm()) {
+            if (!pmsWarmup.add(tmp.pm25_atm, tmp.ts_ms)) return;
+            LOGI("PMS5003 warm after %u ms (%s)", pmsWarmup.durationMs(),
+                 pmsWarmup.state() == pmsWarmup.STABLE ? "readings stable" : "timed out, readings still unsettled");
+        }
+        pmsWindow.pm1.add(tmp.pm1_atm);
+        pmsWindow.pm25.add(tmp.pm25_atm);
+        pmsWindow.pm10.add(tmp.pm10_atm);
+        pmsWindow.pm25cf1.add(tmp.pm25_cf1);
+        pm25Ema.add(tmp.pm25_atm);
+        aggAdd(AGG_PM1,  clampU16(tmp.pm1_atm * 10u), tmp.ts_ms);
+        aggAdd(AGG_PM25, calibrate(clampU16(tmp.pm25_atm * 10u), settings.pm25_gain_x1000, settings.pm25_offset_x10), tmp.ts_ms);
+        aggAdd(AGG_PM10, calibrate(clampU16(tmp.pm10_atm * 10u), settings.pm10_gain_x1000, settings.pm10_offset_x10), tmp.ts_ms);
+    }
+}
+
+// Nothing to publish before the sensor has warmed up.
+bool PmsSensor::ready() { return g_pms.valid && pmsWarmup.warm(); }
+
+// Telemetry: "pms":{"warmup_ms":N,"stable":true|false} once warm (false: it
+// timed out), "pms":{"warming_ms":N} before.
+static void pmsTelemetryJson(StrBuf& out) {
+    if (pmsWarmup.warm())
+        out.appendf_P(PSTR(",\"pms\":{\"warmup_ms\":%u,\"stable\":%s}"), pmsWarmup.durationMs(),
+                      pmsWarmup.state() == pmsWarmup.STABLE ? "true" : "false");
+    else
+        out.appendf_P(PSTR(",\"pms\":{\"warming_ms\":%u}"), pmsWarmup.elapsedMs(millis()));
+}
+
+// Closes the current averaging window. Called once per publish period whether
+// or not the sample can be sent, so the window never spans more than one period.
+void PmsSensor::sample(Fields& s, uint32_t now) {
+    uint16_t cf1_x10;
+    s.frames = clampU16(pmsWindow.pm25.count());
+    if (s.frames) {
+        s.pm1_x10  = clampU16(pmsWindow.pm1.mean(10));
+        s.pm25_x10 = clampU16(pmsWindow.pm25.mean(10));
+        s.pm10_x10 = clampU16(pmsWindow.pm10.mean(10));
+        cf1_x10    = clampU16(pmsWindow.pm25cf1.mean(10));
+        LOGD("PMS window: %u frames, PM2.5 mean %u sd %u (x0.1) range %u..%u",
+             s.frames, s.pm25_x10, (unsigned)pmsWindow.pm25.stddev(10),
+             pmsWindow.pm25.min(), pmsWindow.pm25.max());
+    } else {
+        s.pm1_x10  = clampU16(g_pms.pm1_atm * 10u);
+        s.pm25_x10 = clampU16(g_pms.pm25_atm * 10u);
+        s.pm10_x10 = clampU16(g_pms.pm10_atm * 10u);
+        cf1_x10    = clampU16(g_pms.pm25_cf1 * 10u);
+    }
+    pmsWindow = PmsWindow();
+    s.pm25_x10 = calibrate(s.pm25_x10, settings.pm25_gain_x1000, settings.pm25_offset_x10);
+    cf1_x10    = calibrate(cf1_x10,    settings.pm25_gain_x1000, settings.pm25_offset_x10);
+    s.pm10_x10 = calibrate(s.pm10_x10, settings.pm10_gain_x1000, settings.pm10_offset_x10);
+    s.corr = PM25_RH_CORRECTION && envFresh(now);
+    s.pm25c_x10 = s.corr ? correctPm25(s.pm25_x10, cf1_x10, g_env.rh_x10) : 0;
+}
+
+// Values print with one decimal, as %.1f did, but without going through float.
+void PmsSensor::json(StrBuf& p, const Fields& s) {
+    p += F("\"measurement\":{\"pm1\":"); appendFixed(p, s.pm1_x10, 1);
+    p += F(",\"pm25\":");                  appendFixed(p, s.pm25_x10, 1);
+    p += F(",\"pm10\":");                  appendFixed(p, s.pm10_x10, 1);
+    if (s.corr) { p += F(",\"pm25_corr\":"); appendFixed(p, s.pm25c_x10, 1); }
+    p += '}';
+}
+
+void PmsSensor::text(StrBuf& v, const Fields& s) {
+    v += F("pm1=");   appendFixed(v, s.pm1_x10, 1);
+    v += F(" pm25="); appendFixed(v, s.pm25_x10, 1);
+    v += F(" pm10="); appendFixed(v, s.pm10_x10, 1);
+    if (s.corr) { v += F(" pm25_corr="); appendFixed(v, s.pm25c_x10, 1); }
+}
+
+void PmsSensor::metrics(om::Writer& w, const Fields& s) {
+    w.family(PSTR("pm_mass_micrograms_per_cubic_meter"), om::GAUGE, PSTR("micrograms_per_cubic_meter"),
+             PSTR("PM mass concentration (ATM), mean over the last sample."));
+    w.gauge(s.pm1_x10,  1, PSTR("size"), PSTR("pm1"));
+    w.gauge(s.pm25_x10, 1, PSTR("size"), PSTR("pm2.5"));
+    w.gauge(s.pm10_x10, 1, PSTR("size"), PSTR("pm10"));
+    if (!s.corr) return;
+    w.family(PSTR("pm_mass_rh_corrected_micrograms_per_cubic_meter"), om::GAUGE, PSTR("micrograms_per_cubic_meter"),
+             PSTR("PM2.5 corrected for humidity, last sample."));
+    w.gauge(s.pm25c_x10, 1, PSTR("size"), PSTR("pm2.5"));
+}
+
+void PmsSensor::page(StrBuf& page) {
+    page += F("<h2>PMS5003 (latest)</h2>");
+    if (g_pms.valid) {
+        page.appendf_P(PSTR("<ul><li>CF=1: PM1=<code>%u</code>, PM2.5=<code>%u</code>, PM10=<code>%u</code> µg/m³</li>"),
+                       g_pms.pm1_cf1, g_pms.pm25_cf1, g_pms.pm10_cf1);
+        page.appendf_P(PSTR("<li>ATM : PM1=<code>%u</code>, PM2.5=<code>%u</code>, PM10=<code>%u</code> µg/m³</li>"),
+                       g_pms.pm1_atm, g_pms.pm25_atm, g_pms.pm10_atm);
+        page += F("<li>PM2.5 trend (EMA): <code>");
+        appendFixed(page, pm25Ema.value(10), 1);
+        page += F("</code> µg/m³</li>");
+#if PM25_RH_CORRECTION
+        if (g_env.valid) {
+#if PM25_RH_CORRECTION == 1
+            page += F("<li>PM2.5 RH-corrected (kappa-Köhler): <code>");
+#else
+            page += F("<li>PM2.5 RH-corrected (US EPA): <code>");
+#endif
+            appendFixed(page, correctPm25(g_pms.pm25_atm * 10u, g_pms.pm25_cf1 * 10u, g_env.rh_x10), 1);
+            page += F("</code> µg/m³ at <code>");
+            appendFixed(page, g_env.rh_x10, 1);
+            page += F("</code> %RH</li>");
+        }
+#endif
+#if PMS_SPIKE_FILTER
+        page.appendf_P(PSTR("<li>Spike filter: <code>%u</code> of %u frames dropped"), pmsFilter.rejected(), pmsFilter.frames());
+        if (PMS_SLEW_MAX) page.appendf_P(PSTR(", <code>%u</code> slew-limited"), pmsFilter.limited());
+        page += F("</li>");
+#endif
+        if (pmsWarmup.warm()) {
+            page.appendf_P(PSTR("<li>Warm-up: <code>%u s</code>"), pmsWarmup.durationMs() / 1000);
+            if (pmsWarmup.state() == pmsWarmup.TIMEOUT) page += F(" (timed out, not stable)");
+            page += F("</li>");
+        } else
+            page.appendf_P(PSTR("<li class='warn'>Warming up: <code>%u s</code>, not published yet</li>"),
+                           pmsWarmup.elapsedMs(millis()) / 1000);
+        page.appendf_P(PSTR("<li>Updated: <code>+%u ms</code> ago</li></ul>"), (unsigned)(millis() - g_pms.ts_ms));
+    } else {
+        page += F("<p class='warn'>No valid PMS frame yet (warming up or not connected).</p>");
+    }
+}
+
+void PmsSensor::brief(StrBuf& b) {
+    if (!g_pms.valid) { b += F(" | PMS waiting..."); return; }
+    char ema[FIXED_TEXT_MAX];
+    formatFixed(ema, pm25Ema.value(10), 1);
+    b.appendf_P(PSTR(" | PMS CF1[%u/%u/%u] ATM[%u/%u/%u] EMA2.5=%s"),
+                g_pms.pm1_cf1, g_pms.pm25_cf1, g_pms.pm10_cf1,
+                g_pms.pm1_atm, g_pms.pm25_atm, g_pms.pm10_atm, ema);
+    if (!pmsWarmup.warm()) b += F(" (warming up)");
+}
+
+// ============================ Air quality index ============================
+// US AQI and EU CAQI (pm_aqi.h), computed once an hour from hourly PM means.
+// Every sample adds to the running hour; taskAqiHour closes it and
+// recomputes both indices, which every sample then carries until the next
+// hour. Both are defined on averages (US: 24 h, approximated by NowCast;
+// CAQI: 1 h), so an index from a single 20 s mean would not be either.
+// PM2.5 is the humidity-corrected value when the sample has one: the EPA fit
+// was made for exactly this use (AirNow's Fire and Smoke Map).
+// Until the wall clock is set, hours count from boot. From then on they are
+// UTC hours: taskAgg closes them on the boundary, with the 1-h aggregate, so
+// every node's NowCast and CAQI cover the same hours as its aggregates.
+#if ENABLE_AQI
+constexpr uint32_t AQI_HOUR_MS    = 3600000;
+
+// EPA: 75 % of the hour, at the publish period in force when the hour closes.
+static uint32_t aqiHourMinSamples() { return AQI_HOUR_MS / publishMs() * 3 / 4; }
+
+struct AqiState {
+    uint16_t nowcast25_x10 = AQI_NONE, nowcast10_x10 = AQI_NONE;   // µg/m³ × 10
+    uint16_t us = AQI_NONE;           // larger of the two sub-indices
+    bool     usPm10 = false;          // PM10 gives it
+    uint16_t caqi = AQI_NONE;
+};
+HourlyPm aqiHours;
+AqiState g_aqi;
+int      tAqiHour = -1;
+uint32_t aqiCloses = 0;              // hours closed since boot
+uint32_t aqiHourStartMs = 0;         // millis() when the running hour began
+uint32_t aqiHourS = 0;               // Unix start of the running UTC hour; 0: on the boot clock
+
+static const __FlashStringHelper* usAqiName(uint8_t cat) {
+    switch (cat) {
+        case 0:  return F("Good");
+        case 1:  return F("Moderate");
+        case 2:  return F("Unhealthy for Sensitive Groups");
+        case 3:  return F("Unhealthy");
+        case 4:  return F("Very Unhealthy");
+        default: return F("Hazardous");
+    }
+}
+
+static const __FlashStringHelper* caqiName(uint8_t cat) {
+    switch (cat) {
+        case 0:  return F("Very low");
+        case 1:  return F("Low");
+        case 2:  return F("Medium");
+        case 3:  return F("High");
+        default: return F("Very high");
+    }
+}
+
+static void aqiAdd(const Sample& s) { aqiHours.add(s.corr ? s.pm25c_x10 : s.pm25_x10, s.pm10_x10); }
+
+static void aqiUpdate() {
+    AqiState a;
+    a.nowcast25_x10 = aqiHours.nowcast(HourlyPm::PM25);
+    a.nowcast10_x10 = aqiHours.nowcast(HourlyPm::PM10);
+    const uint16_t i25 = a.nowcast25_x10 != AQI_NONE ? usAqiPm25(a.nowcast25_x10) : 0;
+    const uint16_t i10 = a.nowcast10_x10 != AQI_NONE ? usAqiPm10(a.nowcast10_x10) : 0;
+    if (a.nowcast25_x10 != AQI_NONE || a.nowcast10_x10 != AQI_NONE) {
+        a.usPm10 = i10 > i25;
+        a.us = a.usPm10 ? i10 : i25;
+    }
+    const uint16_t h25 = aqiHours.hour(HourlyPm::PM25, 0), h10 = aqiHours.hour(HourlyPm::PM10, 0);
+    if (h25 != AQI_NONE && h10 != AQI_NONE) {
+        const uint16_t c25 = caqiPm25(h25), c10 = caqiPm10(h10);
+        a.caqi = c25 > c10 ? c25 : c10;
+    }
+    g_aqi = a;
+}
+
+static void aqiCloseHour(uint32_t now) {
+    const uint32_t n = aqiHours.samples(), minN = aqiHourMinSamples();
+    aqiHours.closeHour(minN);
+    aqiHourStartMs = now;
+    ++aqiCloses;
+    aqiUpdate();
+    LOGI("AQI: hour closed with %u samples%s; US AQI %d, CAQI %d (%u h of history)",
+         n, n < minN ? " (too few, gap)" : "",
+         g_aqi.us == AQI_NONE ? -1 : (int)g_aqi.us, g_aqi.caqi == AQI_NONE ? -1 : (int)g_aqi.caqi,
+         (unsigned)aqiHours.hours());
+}
+
+// Hours on the boot clock, until the wall clock takes over.
+static uint32_t taskAqiHour(uint32_t now) {
+    aqiCloseHour(now);
+    return Sched::PERIOD;
+}
+
+// From taskAgg, every minute once the clock is set; t is Unix ms. On the
+// first call the boot clock hands over: a running hour that began before
+// this UTC hour did is closed now (the 75 % rule makes it a gap if short),
+// any other becomes this UTC hour. A forward step closes the hours it
+// skipped, as gaps; after a back step the running hour waits for its end.
+static void aqiWallHour(uint32_t now, uint64_t t) {
+    const uint32_t h = (uint32_t)(t / AQI_HOUR_MS) * (AQI_HOUR_MS / 1000);
+    if (!aqiHourS) {
+        sched.stop(tAqiHour);
+        if (now - aqiHourStartMs > (uint32_t)(t % AQI_HOUR_MS)) aqiCloseHour(now);
+        aqiHourS = h;
+        return;
+    }
+    for (size_t i = 0; i <= HourlyPm::HOURS && (int32_t)(h - aqiHourS) > 0; ++i) {
+        aqiCloseHour(now);
+        aqiHourS += AQI_HOUR_MS / 1000;
+    }
+    if ((int32_t)(h - aqiHourS) > 0) aqiHourS = h;    // the whole history is gaps by now
+}
+
+void AqiSensor::start(uint32_t now) {
+    aqiHourStartMs = now;
+    tAqiHour = sched.add(PSTR("aqi-hour"), taskAqiHour, AQI_HOUR_MS, now, AQI_HOUR_MS);
+}
+
+void AqiSensor::sample(Fields& s, uint32_t) {
+    s.aqi_us = g_aqi.us;
+    s.caqi   = g_aqi.caqi;
+}
+
+void AqiSensor::json(StrBuf& p, const Fields& s) {
+    if (s.aqi_us == AQI_NONE && s.caqi == AQI_NONE) return;
+    p += F(",\"aqi\":{");
+    if (s.aqi_us != AQI_NONE) p.appendf_P(PSTR("\"us\":%u"), s.aqi_us);
+    if (s.caqi != AQI_NONE)   p.appendf_P(PSTR("%s\"caqi\":%u"), s.aqi_us != AQI_NONE ? "," : "", s.caqi);
+    p += '}';
+}
+
+void AqiSensor::text(StrBuf& v, const Fields& s) {
+    if (s.aqi_us != AQI_NONE) v.appendf_P(PSTR(" aqi=%u"), s.aqi_us);
+    if (s.caqi != AQI_NONE)   v.appendf_P(PSTR(" caqi=%u"), s.caqi);
+}
+
+void AqiSensor::metrics(om::Writer& w, const Fields& s) {
+    if (s.aqi_us != AQI_NONE) {
+        w.family(PSTR("pm_aqi_us"), om::GAUGE, nullptr, PSTR("US AQI from the PM NowCast."));
+        w.gauge(s.aqi_us);
+    }
+    if (s.caqi != AQI_NONE) {
+        w.family(PSTR("pm_caqi"), om::GAUGE, nullptr, PSTR("EU CAQI of the last complete hour."));
+        w.gauge(s.caqi);
+    }
+}
+
+// "<li>label: <code>12.3</code> µg/m³</li>", or "collecting" without a value.
+static void aqiConcItem(StrBuf& page, const __FlashStringHelper* label, uint16_t c_x10) {
+    page += F("<li>"); page += label; page += F(": ");
+    if (c_x10 == AQI_NONE) { page += F("collecting</li>"); return; }
+    page += F("<code>"); appendFixed(page, c_x10, 1); page += F("</code> µg/m³</li>");
+}
+
+void AqiSensor::page(StrBuf& page) {
+    page += F("<h2>Air quality index</h2><ul>");
+    if (g_aqi.us != AQI_NONE) {
+        page.appendf_P(PSTR("<li>US AQI: <code>%u</code> "), g_aqi.us);
+        page += usAqiName(usAqiCategory(g_aqi.us));
+        page += g_aqi.usPm10 ? F(" (PM10)</li>") : F(" (PM2.5)</li>");
+    }
+    aqiConcItem(page, F("NowCast PM2.5"), g_aqi.nowcast25_x10);
+    aqiConcItem(page, F("NowCast PM10"), g_aqi.nowcast10_x10);
+    if (g_aqi.caqi != AQI_NONE) {
+        page.appendf_P(PSTR("<li>CAQI (last hour): <code>%u</code> "), g_aqi.caqi);
+        page += caqiName(caqiCategory(g_aqi.caqi));
+        page += F("</li>");
+    }
+    page.appendf_P(PSTR("<li>History: <code>%u</code> of %u h, <code>%u</code> samples this hour</li></ul>"),
+                   (unsigned)aqiHours.hours(), (unsigned)HourlyPm::HOURS, aqiHours.samples());
+}
+
+void AqiSensor::brief(StrBuf& b) {
+    if (g_aqi.us == AQI_NONE && g_aqi.caqi == AQI_NONE) { b.appendf_P(PSTR(" | AQI collecting (%u h)"), (unsigned)aqiHours.hours()); return; }
+    if (g_aqi.us != AQI_NONE)   b.appendf_P(PSTR(" | AQI=%u"), g_aqi.us);
+    if (g_aqi.caqi != AQI_NONE) b.appendf_P(PSTR(" CAQI=%u"), g_aqi.caqi);
+}
+
+// Colour bands at the top of the home page; dark text on the light categories.
+static void aqiBand(StrBuf& page, const __FlashStringHelper* label, uint16_t value, uint32_t rgb, bool darkBg,
+                    const __FlashStringHelper* name) {
+    page.appendf_P(PSTR("<div class='aqi' style='background:#%06x%s'>"), (unsigned)rgb, darkBg ? ";color:#fff" : "");
+    page += label;
+    page.appendf_P(PSTR(" <b>%u</b> "), value);
+    page += name;
+    page += F("</div>");
+}
+
+static void aqiBands(StrBuf& page) {
+    if (g_aqi.us != AQI_NONE) {
+        const uint8_t c = usAqiCategory(g_aqi.us);
+        aqiBand(page, F("US AQI"), g_aqi.us, usAqiRgb(c), c >= 3, usAqiName(c));
+    }
+    if (g_aqi.caqi != AQI_NONE) {
+        const uint8_t c = caqiCategory(g_aqi.caqi);
+        aqiBand(page, F("CAQI"), g_aqi.caqi, caqiRgb(c), c >= 4, caqiName(c));
+    }
+}
+
+// The parts of the index that are not in the payload, for /api.
+static void aqiApiJson(StrBuf& out) {
+    out.appendf_P(PSTR(",\"aqi_detail\":{\"hours\":%u"), (unsigned)aqiHours.hours());
+    if (g_aqi.nowcast25_x10 != AQI_NONE) { out += F(",\"nowcast_pm25\":"); appendFixed(out, g_aqi.nowcast25_x10, 1); }
+    if (g_aqi.nowcast10_x10 != AQI_NONE) { out += F(",\"nowcast_pm10\":"); appendFixed(out, g_aqi.nowcast10_x10, 1); }
+    if (g_aqi.us != AQI_NONE) {
+        const uint8_t c = usAqiCategory(g_aqi.us);
+        out += F(",\"us_category\":\""); out += usAqiName(c);
+        out.appendf_P(PSTR("\",\"us_pollutant\":\"%s\",\"us_color\":\"#%06x\""),
+                      g_aqi.usPm10 ? "pm10" : "pm25", (unsigned)usAqiRgb(c));
+    }
+    if (g_aqi.caqi != AQI_NONE) {
+        const uint8_t c = caqiCategory(g_aqi.caqi);
+        out += F(",\"caqi_category\":\""); out += caqiName(c);
+        out.appendf_P(PSTR("\",\"caqi_color\":\"#%06x\""), (unsigned)caqiRgb(c));
+    }
+    out += '}';
+}
+#endif
+
+// Latest sample, for /api.
+Sample   lastSample{};
+uint32_t lastSampleMs = 0;
+uint64_t lastSampleTs = 0;     // Unix time in ms, 0 while the clock is not set
+bool     haveSample = false;
+
+// Closes every sensor's window.
+static Sample takeSample() {
+    Sample s;
+    Sensors::sample(s, millis());
+#if ENABLE_AQI
+    aqiAdd(s);
+#endif
+    lastSample = s; lastSampleMs = millis(); haveSample = true;
+    lastSampleTs = wallClock.nowMs(lastSampleMs);
+    return s;
+}
+
+// ========================== Remote configuration ===========================
+// The backend tunes a node by publishing a JSON object to config/<node_id>.
+// The node subscribes (QoS1) on every connect. All keys are optional:
+//   publish_s        5..3600     sample and publish period, in seconds
+//   log              "error" | "warn" | "info" | "debug"
+//   pm25_gain_x1000  500..2000   unit calibration against a co-located
+//   pm25_offset_x10  -200..200   reference: y = x · gain/1000 + offset/10
+//   pm10_gain_x1000, pm10_offset_x10   the same for PM10
+//   kappa_x1000      0..1000     hygroscopicity for kappa-Köhler
+//   ntp              "host" or "host:port" of the SNTP server; "" = NTP_SERVER
+//   defaults         true        start from the built-in values
+// A message is applied whole or not at all: bad JSON, an unknown key, a
+// wrong type or a value out of range rejects it. An accepted change is
+// written to EEPROM (only when something changed) and takes effect at once,
+// without a reboot. The node answers on config/<node_id>/state with "ok",
+// the error if any, and the settings now in force. It also reports them
+// there after every connect.
+// The document is a StaticJsonDocument on the stack: no heap, and a
+// message too big for it fails as NoMemory.
+// [ADAPT] Let only the backend publish to config/+ in the broker ACL: anyone
+// who can publish there can re-tune the node.
 #if ENABLE_NETWORK
-    // MQTT client sizing if enabled
-    LOGI("Networking ENABLED — ensure you configured CA pinning and private URLs.");
+constexpr size_t CONFIG_DOC_SIZE = 384;    // ~16 B per key + the strings
+typedef FixedString<10 + UUID_LEN> ConfigTopic;   // "config/<node>/state"
+
+static ConfigTopic configTopic(bool state) {
+    ConfigTopic t;
+    t += F("config/"); t += config.node_id;
+    if (state) t += F("/state");
+    return t;
+}
+
+static bool settingInRange(JsonVariantConst v, int32_t lo, int32_t hi) {
+    return v.is<int32_t>() && v.as<int32_t>() >= lo && v.as<int32_t>() <= hi;
+}
+
+// A host name or IPv4 address, optionally with ":port".
+static bool ntpServerValid(const char* h) {
+    const size_t n = strlen(h);
+    if (n >= MAX_LEN) return false;
+    const char* colon = strchr(h, ':');
+    for (const char* c = h; c < (colon ? colon : h + n); ++c)
+        if (!isalnum((uint8_t)*c) && *c != '.' && *c != '-') return false;
+    if (!colon) return true;
+    if (colon == h || !colon[1] || strlen(colon + 1) > 5) return false;
+    for (const char* c = colon + 1; *c; ++c) if (!isdigit((uint8_t)*c)) return false;
+    const long port = atol(colon + 1);
+    return port >= 1 && port <= 65535;
+}
+
+static int8_t logLevelByName(const char* name) {
+    for (uint8_t i = 0; name && i < 4; ++i) if (!strcmp(name, kLogLevelNames[i])) return (int8_t)i;
+    return -1;
+}
+
+// Merges one message into s. False, with the reason in err, if any part is bad.
+static bool settingsMerge(const uint8_t* json, size_t len, NodeSettings& s, StrBuf& err) {
+    StaticJsonDocument<CONFIG_DOC_SIZE> doc;
+    const DeserializationError e = deserializeJson(doc, (const char*)json, len);
+    if (e) { err.appendf_P(PSTR("bad JSON (%s)"), e.c_str()); return false; }
+    const JsonObjectConst obj = doc.as<JsonObjectConst>();
+    if (obj.isNull()) { err += F("not a JSON object"); return false; }
+    if (obj["defaults"].as<bool>()) settingsDefaults(s);
+    for (JsonPairConst kv : obj) {
+        const char* k = kv.key().c_str();
+        const JsonVariantConst v = kv.value();
+        if (!strcmp_P(k, PSTR("defaults"))) {
+            if (v.is<bool>()) continue;
+        } else if (!strcmp_P(k, PSTR("log"))) {
+            const int8_t l = logLevelByName(v.as<const char*>());
+            if (l >= 0) { s.log_level = (uint8_t)l; continue; }
+        } else if (!strcmp_P(k, PSTR("publish_s"))) {
+            if (settingInRange(v, 5, 3600)) { s.publish_s = v.as<uint16_t>(); continue; }
+        } else if (!strcmp_P(k, PSTR("pm25_gain_x1000"))) {
+            if (settingInRange(v, 500, 2000)) { s.pm25_gain_x1000 = v.as<uint16_t>(); continue; }
+        } else if (!strcmp_P(k, PSTR("pm25_offset_x10"))) {
+            if (settingInRange(v, -200, 200)) { s.pm25_offset_x10 = v.as<int16_t>(); continue; }
+        } else if (!strcmp_P(k, PSTR("pm10_gain_x1000"))) {
+            if (settingInRange(v, 500, 2000)) { s.pm10_gain_x1000 = v.as<uint16_t>(); continue; }
+        } else if (!strcmp_P(k, PSTR("pm10_offset_x10"))) {
+            if (settingInRange(v, -200, 200)) { s.pm10_offset_x10 = v.as<int16_t>(); continue; }
+        } else if (!strcmp_P(k, PSTR("kappa_x1000"))) {
+            if (settingInRange(v, 0, 1000)) { s.kappa_x1000 = v.as<uint16_t>(); continue; }
+        } else if (!strcmp_P(k, PSTR("ntp"))) {
+            const char* h = v.as<const char*>();
+            if (h && ntpServerValid(h)) {
+                memset(s.ntp_server, 0, sizeof(s.ntp_server));   // compared with memcmp
+                copyString(h, s.ntp_server, sizeof(s.ntp_server));
+                continue;
+            }
+        } else {
+            err.appendf_P(PSTR("unknown key '%s'"), k);
+            return false;
+        }
+        err.appendf_P(PSTR("bad value for '%s'"), k);
+        return false;
+    }
+    return true;
+}
+
+// Takes effect now: the publish timer restarts on the new period.
+static void settingsApply(const NodeSettings& n) {
+    const bool period = n.publish_s != settings.publish_s;
+    const bool ntp = strcmp(n.ntp_server, settings.ntp_server) != 0;
+    settings = n;
+    logLevel = n.log_level;
+    if (period) sched.setPeriod(tPublish, publishMs(), millis());
+    if (ntp) ntpRestart();
+    logSettings();
+}
+
+// {"ok":..,"changed":..,"error":..,"settings":{..}}; after a connect only the settings.
+static void configReport(const bool* ok, bool changed, const char* err) {
+    FixedString<383> p;
+    p += '{';
+    if (ok) {
+        p.appendf_P(PSTR("\"ok\":%s,\"changed\":%s,"), *ok ? "true" : "false", changed ? "true" : "false");
+        if (err) {
+            p += F("\"error\":\"");
+            for (const char* c = err; *c; ++c) if (*c != '"' && *c != '\\' && (uint8_t)*c >= 0x20) p += *c;
+            p += F("\",");
+        }
+    }
+    p.appendf_P(PSTR("\"settings\":{\"publish_s\":%u,\"log\":\"%s\",\"pm25_gain_x1000\":%u,\"pm25_offset_x10\":%d,"
+                     "\"pm10_gain_x1000\":%u,\"pm10_offset_x10\":%d,\"kappa_x1000\":%u,\"ntp\":\"%s\"}}"),
+                settings.publish_s, kLogLevelNames[settings.log_level], settings.pm25_gain_x1000, settings.pm25_offset_x10,
+                settings.pm10_gain_x1000, settings.pm10_offset_x10, settings.kappa_x1000, settings.ntp_server);
+    const ConfigTopic topic = configTopic(true);
+    if (!mqttClient.publish(topic.c_str(), p.c_str(), false)) LOGE("MQTT config report failed (rc=%d).", mqttClient.state());
+}
+
+static void configSubscribe() {
+    const ConfigTopic topic = configTopic(false);
+    if (!mqttClient.subscribe(topic.c_str(), 1)) LOGE("MQTT: subscribe to %s failed.", topic.c_str());
+    configReport(nullptr, false, nullptr);
+}
+
+static void configMessage(const uint8_t* payload, size_t len) {
+    NodeSettings next = settings;
+    FixedString<63> err;
+    const bool ok = settingsMerge(payload, len, next, err);
+    const bool changed = ok && memcmp(&next, &settings, sizeof(next)) != 0;
+    if (!ok) LOGW("Config rejected: %s", err.c_str());
+    else if (changed) { settingsApply(next); saveSettings(); }
+    else LOGI("Config: no change.");
+    configReport(&ok, changed, ok ? nullptr : err.c_str());
+}
+#endif
+
+// ============================= Firmware update =============================
+// The backend starts an update by publishing {"url":"http://host/fw.bin"}
+// (and optionally "version", echoed back) to ota/<node_id>. The image
+// streams from that URL into the free flash behind the sketch, a chunk per
+// loop() pass, while the node keeps sampling and publishing (pm_ota.h).
+// Nothing changes until the whole image has been written, read back and
+// its signature checked against the release key. Only then is the boot
+// loader told to copy it over the sketch, and the node reboots
+// OTA_REBOOT_MS later. After any failure the running firmware stays.
+// Progress goes to ota/<node_id>/state: "start", "download" every 10 %
+// (bytes, size, pct), "verify", then "ok" or "failed" with the error.
+// "rejected" answers a request that started nothing (busy, no url, no key).
+// The URL may also serve a patch (pm_delta.h): the image compressed, or a
+// delta against the build this node runs, made by dev/host/ota_delta. The
+// node rebuilds the image in flash and checks the same signature. A delta
+// for another build fails with "wrong base" before anything is written.
+// [ADAPT] The release key's modulus goes in ota_pubkey.h, next to this file,
+// as kOtaPubKey (256 bytes, big-endian, e = 65537). Without it every update
+// is refused. From the key the core's signing.py made (or openssl genrsa 2048):
+//   openssl rsa -in private.key -noout -modulus | cut -d= -f2 | xxd -r -p | xxd -i
+// Sign a build (the layout the core's signed updates use):
+//   openssl dgst -sha256 -sign private.key -out fw.sig firmware.bin
+//   cat firmware.bin fw.sig <(printf '\x00\x01\x00\x00') > firmware.signed.bin
+// Keep private.key off the build machines and out of the repository.
+#if ENABLE_NETWORK && ENABLE_OTA
+constexpr uint32_t OTA_POLL_MS   = 5;        // socket empty: look again after this long
+constexpr uint32_t OTA_REBOOT_MS = 2000;     // lets the final report leave before the reset
+typedef FixedString<10 + UUID_LEN> OtaTopic; // "ota/<node>/state"
+
+// The update area as the core's Updater picks it: the end of the free space
+// between the sketch and the file system.
+struct EspFlash {
+    static uint32_t region(uint32_t size) {
+        const uint32_t used = (ESP.getSketchSize() + ota::SECTOR - 1) & ~(ota::SECTOR - 1);
+        const uint32_t free = ESP.getFreeSketchSpace();
+        const uint32_t need = (size + ota::SECTOR - 1) & ~(ota::SECTOR - 1);
+        return need <= free ? used + free - need : 0;
+    }
+    static bool erase(uint32_t sector)                         { return ESP.flashEraseSector(sector); }
+    static bool write(uint32_t a, const uint32_t* p, size_t n) { return ESP.flashWrite(a, const_cast<uint32_t*>(p), n); }
+    static bool read(uint32_t a, uint32_t* p, size_t n)        { return ESP.flashRead(a, p, n); }
+    static bool commit(uint32_t addr, uint32_t size) {
+        eboot_command cmd;
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.action  = ACTION_COPY_RAW;
+        cmd.args[0] = addr;
+        cmd.args[1] = 0x00000;
+        cmd.args[2] = size;
+        eboot_command_write(&cmd);
+        return true;
+    }
+};
+
+static bool otaVerify(const uint8_t* sig, const uint8_t* digest) {
+#ifdef OTA_HAVE_KEY
+    uint8_t n[ota::rsa::BYTES];
+    memcpy_P(n, kOtaPubKey, sizeof(n));
+    return ota::rsa::verifySha256(n, sig, digest);
+#else
+    (void)sig; (void)digest;
+    return false;
+#endif
+}
+
+WiFiClient otaNet;
+ota::Updater<WiFiClient, EspFlash> otaUpdate(otaNet, otaVerify);
+ota::State otaReported  = ota::IDLE;        // last state sent to ota/<node>/state
+uint8_t    otaPctNext   = 0;                // next "download" report at this percentage
+FixedString<23> otaVersion;
+
+static const char* const kOtaErrors[] = {
+    "", "busy", "bad url", "connect", "http status", "no content-length", "no space", "not firmware",
+    "stalled", "truncated", "flash", "read-back mismatch", "signature", "bad patch", "wrong base",
+};
+
+static OtaTopic otaTopic(bool state) {
+    OtaTopic t;
+    t += F("ota/"); t += config.node_id;
+    if (state) t += F("/state");
+    return t;
+}
+
+static uint8_t otaPct() {
+    return otaUpdate.size() ? (uint8_t)((uint64_t)otaUpdate.received() * 100 / otaUpdate.size()) : 0;
+}
+
+// {"state":..,"version":..,"bytes":..,"size":..,"pct":..,"error":..}; version and progress only for a request that was taken.
+static void otaReport(const char* state, const char* err, bool progress = true) {
+    FixedString<191> p;
+    p += F("{\"state\":\""); p += state; p += '"';
+    if (progress && otaVersion.length()) { p += F(",\"version\":\""); p += otaVersion.c_str(); p += '"'; }
+    if (progress) p.appendf_P(PSTR(",\"bytes\":%u,\"size\":%u,\"pct\":%u"), otaUpdate.received(), otaUpdate.size(), otaPct());
+    if (progress && otaUpdate.patch()) p.appendf_P(PSTR(",\"image\":%u,\"base\":%u"), otaUpdate.binSize(), otaUpdate.baseSize());
+    if (progress && otaUpdate.error() == ota::HTTP_STATUS) p.appendf_P(PSTR(",\"http\":%d"), otaUpdate.httpStatus());
+    if (err) { p += F(",\"error\":\""); p += err; p += '"'; }
+    p += '}';
+    LOGI("OTA: %s", p.c_str());
+    const OtaTopic topic = otaTopic(true);
+    if (!mqttClient.publish(topic.c_str(), p.c_str(), false)) LOGE("MQTT OTA report failed (rc=%d).", mqttClient.state());
+}
+
+static void otaSubscribe() {
+    const OtaTopic topic = otaTopic(false);
+    if (!mqttClient.subscribe(topic.c_str(), 1)) LOGE("MQTT: subscribe to %s failed.", topic.c_str());
+}
+
+static void otaMessage(const uint8_t* json, size_t len) {
+    if (otaUpdate.busy()) { otaReport("rejected", kOtaErrors[ota::BUSY], false); return; }
+    otaVersion.clear();
+#ifndef OTA_HAVE_KEY
+    otaReport("rejected", "no release key", false);
+    return;
+#endif
+    StaticJsonDocument<CONFIG_DOC_SIZE> doc;
+    const DeserializationError e = deserializeJson(doc, (const char*)json, len);
+    const char* url = e ? nullptr : doc["url"].as<const char*>();
+    if (!url) { otaReport("rejected", "no url", false); return; }
+    for (const char* v = doc["version"].as<const char*>(); v && *v; ++v)
+        if (*v != '"' && *v != '\\' && (uint8_t)*v >= 0x20) otaVersion += *v;
+    LOGW("OTA: fetching %s", url);
+    const ota::Error err = otaUpdate.begin(url, millis());
+    otaReported = otaUpdate.state();
+    otaPctNext = 10;
+    if (err) { otaReport("failed", kOtaErrors[err]); return; }
+    otaReport("start", nullptr);
+    sched.in(tOta, millis(), 0);
+}
+
+// A chunk per pass while data is flowing; the reboot once the image is in.
+static uint32_t taskOta(uint32_t now) {
+    if (otaReported == ota::DONE) {
+        LOGW("OTA: rebooting into the new firmware.");
+        mqttClient.disconnect();
+        ESP.restart();
+        return Sched::STOP;
+    }
+    const uint32_t erased = otaUpdate.erasedTo();
+    const bool more = otaUpdate.poll(now);
+    const ota::State st = otaUpdate.state();
+    const bool changed = st != otaReported;
+    otaReported = st;
+    switch (st) {
+        case ota::BODY:
+            if (otaPct() >= otaPctNext) { otaPctNext = otaPct() / 10 * 10 + 10; otaReport("download", nullptr); }
+            break;
+        case ota::VERIFY:
+            if (changed) otaReport("verify", nullptr);
+            break;
+        case ota::DONE:
+            otaReport("ok", nullptr);
+            return OTA_REBOOT_MS;
+        case ota::FAILED:
+            otaReport("failed", kOtaErrors[otaUpdate.error()]);
+            return Sched::STOP;
+        default:
+            break;
+    }
+    // A sector erase stalls for ~30 ms: give loop() a pass before the next one.
+    if (otaUpdate.erasedTo() != erased) return 1;
+    // 0 is the next loop() pass, not this one: run() calls a timer at most once,
+    // so the UART, the web server and MQTT are serviced between any two chunks.
+    return more ? 0 : OTA_POLL_MS;
+}
+#endif
+
+// ============================== MQTT (stub) ================================
+// The telemetry object: heap health and uptime, the PMS5003 warm-up, then
+// the SNTP clock.
+typedef FixedString<319> TelemetryPayload;
+
+static TelemetryPayload telemetryJson() {
+    TelemetryPayload p;
+    p += '{'; heapJson(p); pmsTelemetryJson(p);
+#if ENABLE_NETWORK
+    clockJson(p);
+#endif
+    p += '}';
+    return p;
+}
+
+#if ENABLE_NETWORK
+// Topic and payload are built on the stack: publishing never touches the heap.
+typedef FixedString<16 + 2 * UUID_LEN> MqttTopic;      // "measurements/<node>/<sensor>"
+typedef FixedString<255>               MqttPayload;
+
+static MqttTopic mqttTopic() {
+    MqttTopic t;
+    t += F("measurements/"); t += config.node_id; t += '/'; t += config.first_sensor_id;
+    return t;
+}
+
+static MqttTopic aggTopic() {
+    MqttTopic t;
+    t += F("aggregates/"); t += config.node_id;
+    return t;
+}
+
+// seq = 0 keeps the historical payload shape (QoS0 path); QoS1 adds the
+// sequence number and how many frames the means cover. ts (Unix ms) is
+// left out while the clock is not set.
+static MqttPayload makeMeasurementPayload(const Sample& s, uint64_t ts, uint32_t seq = 0) {
+    MqttPayload p;
+    p += '{';
+    Sensors::json(p, s);
+    if (ts) { p += F(",\"ts\":"); appendEpochMs(p, ts); }
+    if (seq) p.appendf_P(PSTR(",\"seq\":%u,\"n\":%u"), seq, s.frames);
+    p += '}';
+    return p;
+}
+
+// Runs inside mqttClient.loop(). Subscribed on every connect: config/<node_id>,
+// and ota/<node_id> with ENABLE_OTA.
+static void onMqttMessage(char* topic, uint8_t* payload, unsigned int len) {
+    if (!strcmp(topic, configTopic(false).c_str())) configMessage(payload, len);
+#if ENABLE_OTA
+    else if (!strcmp(topic, otaTopic(false).c_str())) otaMessage(payload, len);
+#endif
+}
+
+static void mqttSubscribe() {
+    configSubscribe();
+#if ENABLE_OTA
+    otaSubscribe();
+#endif
+}
+
+// Non-blocking: connect() only sends CONNECT, the CONNACK is picked up by
+// mqttClient.loop(). Every attempt draws the next jittered wait; the attempt
+// counter resets once a session has stayed up for 30 s.
+static void mqttEnsureConnected() {
+    if (!haveMqttCreds()) return;
+    uint32_t now = millis();
+    if (mqttClient.connected()) {
+        if (!mqttWasConnected) { LOGI("MQTT: connected."); mqttBackoff.onConnected(now); mqttSubscribe(); ++mqttConnects; }
+        mqttWasConnected = true; mqttHandshaking = false;
+        return;
+    }
+    if (mqttWasConnected) {
+        mqttWasConnected = false;
+        uint32_t wait = mqttBackoff.onDisconnected(now);
+        LOGW("MQTT: connection lost (rc=%d), reconnect in %u ms.", mqttClient.state(), wait);
+#if MQTT_QOS >= 1
+        mqttQueue.requeueInFlight();
+        aggQueue.requeueInFlight();
+#endif
+    }
+    if (mqttClient.connecting()) return;
+    if (mqttHandshaking) { mqttHandshaking = false; LOGE("MQTT: connect failed (rc=%d).", mqttClient.state()); }
+    if (!mqttBackoff.ready(now)) return;
+    mqttClient.setServer(config.mqtt_host, config.mqtt_port);
+    LOGI("MQTT: connecting to %s:%u as '%s'...", config.mqtt_host, config.mqtt_port, config.node_id);
+    mqttHandshaking = mqttClient.connect(config.node_id, config.mqtt_username, config.mqtt_password);
+    uint32_t wait = mqttBackoff.onAttempt(now);
+    if (!mqttHandshaking) LOGE("MQTT: connect failed (rc=%d), retry in %u ms.", mqttClient.state(), wait);
+}
+
+#if MQTT_QOS >= 1
+static void onMqttPuback(uint16_t packetId) {
+    if (!mqttQueue.ack(packetId) && !aggQueue.ack(packetId)) LOGD("MQTT PUBACK id=%u matches nothing in flight.", packetId);
+}
+
+// Feed the in-flight window from the queue: first transmissions and overdue
+// retries (same packet id, DUP set). Never waits for an ack.
+static void mqttDrainQueue(uint32_t now) {
+    if (!mqttClient.connected()) return;
+    while (auto* e = mqttQueue.due(now, MQTT_ACK_TIMEOUT_MS)) {
+        const bool dup = e->packetId != 0;
+        const uint16_t id = dup ? e->packetId : mqttClient.nextPacketId();
+        if (!e->item.ts) e->item.ts = wallClock.atMs(e->item.ms);   // taken before the first sync
+        const MqttTopic   topic   = mqttTopic();
+        const MqttPayload payload = makeMeasurementPayload(e->item.s, e->item.ts, e->item.seq);
+        if (!mqttClient.publish(topic.c_str(), (const uint8_t*)payload.c_str(), payload.length(), 1, true, dup, id)) {
+            LOGE("MQTT publish failed (rc=%d), %u queued.", mqttClient.state(), (unsigned)mqttQueue.size());
+            return;
+        }
+        mqttQueue.markSent(e, id, now);
+        LOGI("MQTT PUB%s q1 id=%u -> topic='%s' payload=%s", dup ? " (retry)" : "", id, topic.c_str(), payload.c_str());
+    }
+    while (auto* e = aggQueue.due(now, MQTT_ACK_TIMEOUT_MS)) {
+        const bool dup = e->packetId != 0;
+        const uint16_t id = dup ? e->packetId : mqttClient.nextPacketId();
+        const MqttTopic  topic   = aggTopic();
+        const AggPayload payload = aggJson(e->item.b, e->item.tier);
+        if (!mqttClient.publish(topic.c_str(), (const uint8_t*)payload.c_str(), payload.length(), 1, false, dup, id)) {
+            LOGE("MQTT aggregate publish failed (rc=%d), %u queued.", mqttClient.state(), (unsigned)aggQueue.size());
+            return;
+        }
+        aggQueue.markSent(e, id, now);
+        LOGD("MQTT PUB%s q1 id=%u -> topic='%s' payload=%s", dup ? " (retry)" : "", id, topic.c_str(), payload.c_str());
+    }
+}
+
+// Every publish period, offline too: the queue bridges outages.
+static void mqttSample() {
+    if (!Sensors::ready()) return;
+    const Sample s = takeSample();
+    if (!haveMqttCreds()) return;
+    if (!mqttQueue.push(QueuedSample{s, ++mqttSeq, lastSampleMs, lastSampleTs}))
+        LOGW("MQTT queue full: dropped oldest sample (%u dropped so far).", mqttQueue.dropped());
+    mqttDrainQueue(millis());
+}
+
+// A closed bucket, queued like a sample.
+static void mqttAggregate(const Aggregates::Bucket& b, uint8_t tier) {
+    if (!haveMqttCreds()) return;
+    if (!aggQueue.push(QueuedAgg{b, tier}))
+        LOGW("MQTT aggregate queue full: dropped the oldest (%u dropped so far).", aggQueue.dropped());
+    mqttDrainQueue(millis());
+}
+
+// Every loop() pass: socket I/O, then PUBACK-freed window slots and due retries.
+static void mqttService() {
+    mqttClient.loop();
+    mqttDrainQueue(millis());
+}
+#else
+static void mqttSample() {
+    if (!Sensors::ready()) return;
+    const Sample s = takeSample();
+    if (!haveMqttCreds() || !mqttClient.connected()) return;
+    const MqttTopic   topic   = mqttTopic();
+    const MqttPayload payload = makeMeasurementPayload(s, lastSampleTs);
+    LOGI("MQTT PUB -> topic='%s' payload=%s", topic.c_str(), payload.c_str());
+    if (!mqttClient.publish(topic.c_str(), payload.c_str(), true)) LOGE("MQTT publish failed (rc=%d).", mqttClient.state());
+}
+
+static void mqttAggregate(const Aggregates::Bucket& b, uint8_t tier) {
+    if (!haveMqttCreds() || !mqttClient.connected()) return;
+    const MqttTopic  topic   = aggTopic();
+    const AggPayload payload = aggJson(b, tier);
+    LOGD("MQTT PUB -> topic='%s' payload=%s", topic.c_str(), payload.c_str());
+    if (!mqttClient.publish(topic.c_str(), payload.c_str(), false)) LOGE("MQTT aggregate publish failed (rc=%d).", mqttClient.state());
+}
+
+static void mqttService() { mqttClient.loop(); }
+#endif
+
+// Best effort (QoS0, not queued): a missed report is replaced a minute later.
+static void mqttTelemetry() {
+    if (!haveMqttCreds() || !mqttClient.connected()) return;
+    FixedString<16 + UUID_LEN> topic;
+    topic += F("telemetry/"); topic += config.node_id;
+    const TelemetryPayload payload = telemetryJson();
+    if (!mqttClient.publish(topic.c_str(), payload.c_str(), false)) LOGE("MQTT telemetry failed (rc=%d).", mqttClient.state());
+}
+#else
+static void mqttEnsureConnected() { /* stub: no-op in educational build */ }
+static void mqttService()         { /* stub: nothing on the wire */ }
+static void mqttSample()          { /* stub: print instead of publish */
+    if (!Sensors::ready()) return;
+    const Sample s = takeSample();
+    if (!config.registration_ok) return;
+    FixedString<127> v;
+    Sensors::text(v, s);
+    LOGI("[STUB MQTT] Would publish ATM (mean of %u frames): %s", s.frames, v.c_str());
+}
+static void mqttTelemetry() {
+    const TelemetryPayload payload = telemetryJson();
+    LOGI("[STUB MQTT] Would publish telemetry: %s", payload.c_str());
+}
+static void mqttAggregate(const Aggregates::Bucket& b, uint8_t tier) {
+    const AggPayload payload = aggJson(b, tier);
+    LOGI("[STUB MQTT] Would publish aggregate: %s", payload.c_str());
+}
+#endif
+
+// ============================== HTML & Pages ===============================
+// Every constant byte of markup lives in flash: the stylesheet and MIME types
+// as PROGMEM arrays, everything else through F(). Pages are never assembled
+// whole: they are written into a HTML_CHUNK-byte window on the stack, which
+// is sent as an HTTP chunk each time it fills (see pm_fstr.h).
+static const char kMimeHtml[] PROGMEM = "text/html";
+static const char kMimeText[] PROGMEM = "text/plain";
+static const char kMimeJson[] PROGMEM = "application/json";
+static const char kCss[] PROGMEM =
+    "body{font-family:system-ui,-apple-system,Segoe UI,Roboto,Ubuntu,Noto Sans,Arial,sans-serif;max-width:800px;margin:24px auto;padding:0 16px}"
+    "h1{font-size:1.6rem;margin:.2rem 0}.subtitle{margin:0 0 1rem;color:#444}"
+    "h2{font-size:1.2rem;margin-top:1.2rem}label{display:block;margin:.6rem 0 .2rem}"
+    "input[type=text],input[type=password],input[type=email]{width:100%;padding:.6rem;border:1px solid #ccc;border-radius:8px}"
+    "button, input[type=submit]{padding:.6rem 1rem;border:0;border-radius:8px;margin-top:1rem;cursor:pointer}"
+    "nav a{margin-right:1rem}footer{margin-top:2rem;color:#666;font-size:.9rem}"
+    ".pm{border-radius:12px;padding:12px 16px;background:#f4f6fb;border:1px solid #e1e5f2;margin:8px 0 16px}"
+    ".ok{color:#0a7a2f}.warn{color:#a66a00}.err{color:#b00020}"
+    ".aqi{border-radius:12px;padding:8px 16px;margin:8px 0;font-size:1.1rem}"
+    "code{background:#f6f8fa;padding:0 .25rem;border-radius:4px}";
+
+constexpr size_t HTML_CHUNK = 512;      // fits one TCP segment; lives on the loop() stack
+typedef FixedString<HTML_CHUNK> HtmlPage;
+
+static void htmlSink(void*, const char* data, size_t len) { server->sendContent(data, len); }
+
+// <li>label: <code>value unit</code></li>
+static void htmlItem(StrBuf& page, const __FlashStringHelper* label, const char* value,
+                     const __FlashStringHelper* unit = nullptr) {
+    page += F("<li>"); page += label; page += F(": <code>"); page += value;
+    if (unit) page += unit;
+    page += F("</code></li>");
+}
+
+static void htmlItem(StrBuf& page, const __FlashStringHelper* label, long value,
+                     const __FlashStringHelper* unit = nullptr) {
+    char num[12]; snprintf_P(num, sizeof(num), PSTR("%ld"), value);
+    htmlItem(page, label, num, unit);
+}
+
+// <label>…</label><input name=… type=… placeholder=… value=… maxlength=…>
+static void htmlInput(StrBuf& page, const __FlashStringHelper* label, const __FlashStringHelper* name,
+                      const __FlashStringHelper* type, const __FlashStringHelper* placeholder, const char* value) {
+    page += F("<label>"); page += label; page += F("</label><input name='"); page += name;
+    page += F("' type='"); page += type; page += F("' placeholder='"); page += placeholder;
+    page += F("' value='"); page += value;
+    page.appendf_P(PSTR("' maxlength='%u'>"), (unsigned)(MAX_LEN - 1));
+}
+
+// Sends the status line and headers; the body follows in chunks through out.
+static void httpStreamBegin(StrBuf& out, PGM_P mime) {
+    server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server->send(200, mime, emptyString);
+    out.setSink(htmlSink, nullptr);
+}
+
+static void httpStreamEnd(StrBuf& out) {
+    out.flush();
+    server->sendContent("", 0);         // zero-length chunk: end of response
+}
+
+// Sends the headers, then the page head.
+static void htmlBegin(StrBuf& page, const __FlashStringHelper* title) {
+    httpStreamBegin(page, kMimeHtml);
+    page += F("<!DOCTYPE html><html lang='en'><head><meta charset='utf-8'>"
+              "<meta name='viewport' content='width=device-width, initial-scale=1'><title>");
+    page += title;
+    page += F("</title><style>");
+    page += FPSTR(kCss);
+    page += F("</style></head><body><header class='pm'><h1>");
+    page += FPSTR(kProjectName);
+    page += F("</h1><p class='subtitle'>This is an educational, non-production configuration portal.</p></header>"
+              "<nav><a href='/'>&#x1F3E0; Home</a><a href='/clear'>Clear</a><a href='/reboot'>Reboot</a><a href='/status'>Status</a><a href='/api'>API</a></nav>");
+}
+
+static void htmlEnd(StrBuf& page) {
+    page += F("<footer>Setup portal · AP ");
+    page += net.apIp;
+    page += F("</footer></body></html>");
+    httpStreamEnd(page);
+}
+
+static void renderFormPage(StrBuf& page) {
+    htmlBegin(page, F("Device Setup"));
+#if ENABLE_AQI
+    aqiBands(page);
 #endif
+    page += F("<h2>Configure Wi‑Fi & Registration</h2><form method='POST' action='/save'>");
+    htmlInput(page, F("Wi‑Fi SSID"),     F("wifi_ssid"),    F("text"),     F("MyHomeWiFi"),      config.wifi_ssid);
+    htmlInput(page, F("Wi‑Fi password"), F("wifi_pass"),    F("password"), F("••••••••"),        config.wifi_pass);
+    htmlInput(page, F("User Email"),     F("user_email"),   F("email"),    F("you@example.com"), config.user_email);
+    htmlInput(page, F("Device Name"),    F("device_name"),  F("text"),     F("Node‑Kitchen"),    config.device_name);
+    htmlInput(page, F("One‑Time Key"),   F("one_time_key"), F("text"),     F("Paste code"),      config.one_time_key);
+    page += F("<input type='submit' value='Save'></form>");
     
-    dumpConfig(false);
+    page += F("<h2>Registration Status</h2>");
+    if (config.registration_ok) {
+        page += F("<p class='ok'>Registered ✔</p><ul>");
+        htmlItem(page, F("node_id"),       config.node_id);
+        htmlItem(page, F("mqtt_host"),     config.mqtt_host);
+        htmlItem(page, F("mqtt_port"),     (long)config.mqtt_port);
+        htmlItem(page, F("mqtt_username"), config.mqtt_username);
+        page += F("</ul>");
+    } else {
+        page += F("<p class='warn'>Not registered yet.</p>");
+    }
+    
+    Sensors::page(page);
+    htmlEnd(page);
 }
 
-void loop() {
-    dnsServer.processNextRequest();
-    server.handleClient();
+static void renderSavedPage(StrBuf& page, bool regOk, const __FlashStringHelper* regMsg) {
+    htmlBegin(page, F("Saved"));
+    page += F("<h2>Saved!</h2><p>Your values have been stored in non‑volatile memory.</p><h2>Registration</h2>");
+    if (regOk) {
+        page += F("<p class='ok'>Registration successful ✔</p>");
+    } else {
+        page += F("<p class='err'>Registration failed ✖</p><p><small>"); page += regMsg; page += F("</small></p>");
+    }
+    page += F("<p><a href='/'>Go back</a> or <a href='/reboot'>Reboot now</a>.</p>");
+    htmlEnd(page);
+}
+
+static void renderStatusPage(StrBuf& page) {
+    htmlBegin(page, F("Status"));
+    char buf[48];
+    page += F("<h2>Runtime Status</h2><ul>");
+    htmlItem(page, F("AP IP"), net.apIp);
+    snprintf_P(buf, sizeof(buf), PSTR("%s, %u drops, last reason %u"), net.staUp ? "up" : "down", net.drops, net.lastReason);
+    htmlItem(page, F("STA"), buf);
+    htmlItem(page, F("STA IP"), net.staIp);
+    htmlItem(page, F("RSSI"), (long)net.rssi, F(" dBm"));
+    htmlItem(page, F("Setup window closes in"), (long)(sched.dueIn(tPortal, millis()) / 1000), F(" s"));
+    htmlItem(page, F("Idle"), millis() ? (long)((uint64_t)idleSleptMs * 100 / millis()) : 0L, F(" %"));
+    heapWalk();
+    page += F("</ul><h2>Heap</h2><ul>");
+    snprintf_P(buf, sizeof(buf), PSTR("%u B, low-water %u B"), heap.freeNow, heap.freeMin);
+    htmlItem(page, F("Free"), buf);
+    snprintf_P(buf, sizeof(buf), PSTR("%u B, worst %u B"), heap.maxBlock, heap.maxBlockMin);
+    htmlItem(page, F("Largest free block"), buf);
+    snprintf_P(buf, sizeof(buf), PSTR("%u %%, worst %u %%"), heap.frag, heap.fragMax);
+    htmlItem(page, F("Fragmentation"), buf);
+    snprintf_P(buf, sizeof(buf), PSTR("%u / %u, worst pass %u"), heap.allocs, heap.frees, heap.passAllocsMax);
+    htmlItem(page, F("loop() mallocs / frees"), buf);
+    page += F("</ul><h2>Timers</h2><ul>");
+    for (size_t i = 0; i < sched.size(); ++i) {
+        const auto& t = sched.timer((int)i);
+        snprintf_P(buf, sizeof(buf), PSTR("%u runs, max late %u ms"), t.runs, t.maxLateMs);
+        htmlItem(page, FPSTR(t.name), buf);
+    }
+    page += F("</ul><h2>I2C bus</h2><ul>");
+    for (size_t i = 0; i < i2c.devices(); ++i) {
+        const Bus::Device& d = i2c.dev(i);
+        snprintf_P(buf, sizeof(buf), PSTR("0x%02X: %u txns, %u errors, %u wake-ups"), d.addr, d.txns, d.errors, d.wakes);
+        htmlItem(page, d.name ? FPSTR(d.name) : F("(probed)"), buf);
+        snprintf_P(buf, sizeof(buf), PSTR("avg %u / max %u us"), d.txns ? (unsigned)(d.waitUs / d.txns) : 0u, d.waitMaxUs);
+        htmlItem(page, F("&nbsp; queue wait"), buf);
+        snprintf_P(buf, sizeof(buf), PSTR("avg %u / max %u us"), d.txns ? (unsigned)(d.busUs / d.txns) : 0u, d.busMaxUs);
+        htmlItem(page, F("&nbsp; on the bus"), buf);
+    }
+    snprintf_P(buf, sizeof(buf), PSTR("max %u, %u overflows"), i2c.depthMax(), i2c.overflows());
+    htmlItem(page, F("Queue depth"), buf);
+    page += F("</ul><h2>Registration</h2><ul>");
+    htmlItem(page, F("registration_ok"), (long)config.registration_ok);
+    htmlItem(page, F("node_id"),         config.node_id);
+    htmlItem(page, F("mqtt_host"),       config.mqtt_host);
+    htmlItem(page, F("mqtt_port"),       (long)config.mqtt_port);
+    htmlItem(page, F("mqtt_username"),   config.mqtt_username);
+    page += F("</ul>");
+    htmlEnd(page);
+}
+
+// ================================ Metrics ==================================
+// GET /metrics: node health and the latest sample in the OpenMetrics text
+// format (pm_metrics.h), for Prometheus. kMetrics is the registry: each entry
+// writes one or more families from state the firmware keeps anyway, and
+// the sensors add theirs through the registry hook. A scrape walks the table
+// once and streams ~6 KB through the HTML_CHUNK window. It neither
+// allocates nor walks the heap: the largest block and fragmentation are the
+// heartbeat's, at most HEARTBEAT_MS old. So a 15 s scrape interval costs
+// the node next to nothing.
+// [ADAPT] New metric: write an emitter below and add it to kMetrics. Keep
+// label values to fixed strings; Writer does not escape them.
+#if ENABLE_METRICS
+// Loop timing: the work of one loop() pass (idle excluded), and the time
+// from one pass to the next (idle included), which is how long the UART,
+// the web server and the Wi-Fi events may wait.
+constexpr size_t LOOP_BUCKETS = 8;
+static const uint32_t kLoopBucketsUs[LOOP_BUCKETS] PROGMEM = {100, 500, 1000, 5000, 10000, 50000, 100000, 500000};
+om::UsHistogram<LOOP_BUCKETS> loopBusy(kLoopBucketsUs), loopInterval(kLoopBucketsUs);
+uint32_t loopPassUs = 0;           // micros() when this pass began
+bool     loopTimed  = false;       // a previous pass to measure from
+
+static void loopTimeBegin() {
+    const uint32_t now = micros();
+    if (loopTimed) loopInterval.observe(now - loopPassUs);
+    loopPassUs = now; loopTimed = true;
+}
+
+static void loopTimeEnd() { loopBusy.observe(micros() - loopPassUs); }
+
+static void metricsUptime(om::Writer& w) {
+    w.family(PSTR("pm_uptime_seconds"), om::GAUGE, PSTR("seconds"), PSTR("Time since boot."));
+    w.gauge((int32_t)(millis() / 1000));
+}
+
+static void metricsHeap(om::Writer& w) {
+    w.family(PSTR("pm_heap_free_bytes"), om::GAUGE, PSTR("bytes"), PSTR("Free heap at the end of the last loop() pass."));
+    w.gauge((int32_t)heap.freeNow);
+    w.family(PSTR("pm_heap_free_min_bytes"), om::GAUGE, PSTR("bytes"), PSTR("Lowest free heap since boot."));
+    w.gauge((int32_t)heap.freeMin);
+    w.family(PSTR("pm_heap_max_block_bytes"), om::GAUGE, PSTR("bytes"), PSTR("Largest free block at the last heap walk."));
+    w.gauge((int32_t)heap.maxBlock);
+    w.family(PSTR("pm_heap_fragmentation_percent"), om::GAUGE, PSTR("percent"), PSTR("umm_malloc fragmentation at the last heap walk."));
+    w.gauge(heap.frag);
+}
+
+static void metricsLoop(om::Writer& w) {
+    w.family(PSTR("pm_loop_busy_seconds"), om::HISTOGRAM, PSTR("seconds"), PSTR("Work done in one loop() pass, idle excluded."));
+    w.histogram(loopBusy);
+    w.family(PSTR("pm_loop_interval_seconds"), om::HISTOGRAM, PSTR("seconds"), PSTR("Time from one loop() pass to the next."));
+    w.histogram(loopInterval);
+    w.family(PSTR("pm_timer_late_max_seconds"), om::GAUGE, PSTR("seconds"), PSTR("Worst start delay of each timer since boot."));
+    for (size_t i = 0; i < sched.size(); ++i) w.gauge((int32_t)sched.timer((int)i).maxLateMs, 3, PSTR("timer"), sched.timer((int)i).name);
+}
+
+static void metricsWifi(om::Writer& w) {
+    if (net.staUp) {
+        w.family(PSTR("pm_wifi_rssi_dbm"), om::GAUGE, PSTR("dbm"), PSTR("STA signal strength."));
+        w.gauge(net.rssi);
+    }
+    w.family(PSTR("pm_wifi_connects"), om::COUNTER, nullptr, PSTR("STA connections (got an IP) since boot."));
+    w.counter(net.joins);
+    w.family(PSTR("pm_wifi_drops"), om::COUNTER, nullptr, PSTR("STA connections lost since boot."));
+    w.counter(net.drops);
+}
+
+static void metricsPms(om::Writer& w) {
+    w.family(PSTR("pm_pms_frames"), om::COUNTER, nullptr, PSTR("PMS5003 frames with a good checksum."));
+    w.counter(pmsParser.frames());
+    w.family(PSTR("pm_pms_frame_errors"), om::COUNTER, nullptr, PSTR("PMS5003 frames thrown away, by cause."));
+    w.counter(pmsParser.checksumErrors(), PSTR("cause"), PSTR("checksum"));
+    w.counter(pmsParser.lengthErrors(), PSTR("cause"), PSTR("length"));
+#if PMS_SPIKE_FILTER
+    w.counter(pmsFilter.rejected(), PSTR("cause"), PSTR("spike"));
+    w.counter(pmsFilter.unjudged(), PSTR("cause"), PSTR("unjudged"));   // before the filter's window had 3 frames
+#endif
+}
+
+static void metricsI2c(om::Writer& w) {
+    if (!i2c.devices()) return;
+    w.family(PSTR("pm_i2c_errors"), om::COUNTER, nullptr, PSTR("Failed I2C transactions, by device."));
+    for (size_t i = 0; i < i2c.devices(); ++i) {
+        const Bus::Device& d = i2c.dev(i);
+        if (d.name) w.counter(d.errors, PSTR("device"), d.name);
+        else        w.counterHex(d.errors, PSTR("device"), d.addr);   // probed, never registered
+    }
+}
+
+#if ENABLE_NETWORK
+static void metricsMqtt(om::Writer& w) {
+    w.family(PSTR("pm_mqtt_connected"), om::GAUGE, nullptr, PSTR("1 while the MQTT session is up."));
+    w.gauge(mqttClient.connected() ? 1 : 0);
+    w.family(PSTR("pm_mqtt_connects"), om::COUNTER, nullptr, PSTR("MQTT sessions since boot."));
+    w.counter(mqttConnects);
+#if MQTT_QOS >= 1
+    w.family(PSTR("pm_mqtt_queue_dropped"), om::COUNTER, nullptr, PSTR("QoS1 messages evicted from a full queue."));
+    w.counter(mqttQueue.dropped(), PSTR("queue"), PSTR("samples"));
+    w.counter(aggQueue.dropped(), PSTR("queue"), PSTR("aggregates"));
+#endif
+}
+#endif
+
+static void metricsSample(om::Writer& w) {
+    if (!haveSample) return;
+    w.family(PSTR("pm_sample_age_seconds"), om::GAUGE, PSTR("seconds"), PSTR("Time since the last sample was taken."));
+    w.gauge((int32_t)((millis() - lastSampleMs) / 1000));
+    Sensors::metrics(w, lastSample);
+}
+
+typedef void (*MetricsFn)(om::Writer&);
+static const MetricsFn kMetrics[] PROGMEM = {
+    metricsUptime, metricsHeap, metricsLoop, metricsWifi, metricsPms, metricsI2c,
+#if ENABLE_NETWORK
+    metricsMqtt,
+#endif
+    metricsSample,
+};
+#else
+static void loopTimeBegin() {}
+static void loopTimeEnd() {}
+#endif
+
+// =============================== HTTP Routes ===============================
+static void handleRoot()   { HtmlPage page; renderFormPage(page); }
+
+static void handleSave() {
+    if (server->method() != HTTP_POST) { server->send_P(405, kMimeText, PSTR("Method Not Allowed")); return; }
+    if (server->hasArg(F("wifi_ssid")))    copyString(server->arg(F("wifi_ssid")).c_str(),    config.wifi_ssid,   MAX_LEN);
+    if (server->hasArg(F("wifi_pass")))    copyString(server->arg(F("wifi_pass")).c_str(),    config.wifi_pass,   MAX_LEN);
+    if (server->hasArg(F("user_email")))   copyString(server->arg(F("user_email")).c_str(),   config.user_email,  MAX_LEN);
+    if (server->hasArg(F("device_name")))  copyString(server->arg(F("device_name")).c_str(),  config.device_name, MAX_LEN);
+    if (server->hasArg(F("one_time_key"))) copyString(server->arg(F("one_time_key")).c_str(), config.one_time_key,MAX_LEN);
     
-    // PMS poll (non-blocking)
-    pollPMS5003();
+    // Reset registration-derived fields so the flow restarts cleanly
+    config.registration_ok = 0;
+    config.node_id[0] = '\0';
+    config.mqtt_host[0] = '\0';
+    config.mqtt_username[0] = '\0';
+    config.mqtt_password[0] = '\0';
+    config.mqtt_port = 0;
+    config.first_sensor_id[0] = '\0';
+    config.first_sensor_sn[0] = '\0';
+    saveConfig();
     
-    // Keep STA connected
+    // Attempt registration right away (stubbed by default)
+    staBackoff.reset(); staWasUp = false; WiFi.disconnect();
     ensureStaConnected();
-    
-    // MQTT keepalive + publish
+    sched.in(tWifi, millis(), 0);
+    bool regOk = performRegistration();
+    if (regOk) sched.in(tPortal, millis(), PORTAL_GRACE_MS);   // let the browser load this page first
+    HtmlPage page;
+    renderSavedPage(page, regOk, regOk ? F("OK") : F("See serial logs for diagnostics."));
+}
+
+static void handleClear() {
+    clearConfig(); loadConfig();
+    HtmlPage page;
+    htmlBegin(page, F("Cleared"));
+    page += F("<h2>Configuration cleared</h2><p>EEPROM config has been cleared.</p><p><a href='/'>Return home</a></p>");
+    htmlEnd(page);
+}
+
+static void handleReboot() {
+    {
+        HtmlPage page;
+        htmlBegin(page, F("Rebooting"));
+        page += F("<h2>Rebooting...</h2><p>The device will restart in a few seconds.</p>");
+        htmlEnd(page);
+    }
+    delay(500);
+    ESP.restart();
+}
+
+static void handleStatus() { HtmlPage page; renderStatusPage(page); }
+
+// Read-only JSON for dashboards on the LAN: the latest sample as published,
+// plus what the payload leaves out. No secrets, no side effects.
+static void handleApi() {
+    HtmlPage out;
+    httpStreamBegin(out, kMimeJson);
+    out.appendf_P(PSTR("{\"uptime_s\":%u"), (unsigned)(millis() / 1000));
+    if (wallClock.valid()) { out += F(",\"time\":"); appendEpochMs(out, wallClock.nowMs(millis())); }
+    if (haveSample) {
+        out.appendf_P(PSTR(",\"age_s\":%u,"), (unsigned)((millis() - lastSampleMs) / 1000));
+        Sensors::json(out, lastSample);
+        const uint64_t ts = lastSampleTs ? lastSampleTs : wallClock.atMs(lastSampleMs);
+        if (ts) { out += F(",\"ts\":"); appendEpochMs(out, ts); }
+    }
+#if ENABLE_AQI
+    aqiApiJson(out);
+#endif
+    out += '}';
+    httpStreamEnd(out);
+}
+
+#if ENABLE_METRICS
+static void handleMetrics() {
+    HtmlPage out;
+    httpStreamBegin(out, om::kContentType);
+    om::Writer w(out);
+    for (const MetricsFn& fn : kMetrics) reinterpret_cast<MetricsFn>(pgm_read_ptr(&fn))(w);
+    w.eof();
+    httpStreamEnd(out);
+}
+#endif
+
+static void handleNotFound() {
+    if (server->hostHeader() != net.apIp) {
+        FixedString<24> url; url += F("http://"); url += net.apIp;
+        server->sendHeader(F("Location"), url.c_str(), true);
+        server->send_P(302, kMimeText, PSTR(""));
+    } else {
+        server->send_P(404, kMimeText, PSTR("Not Found"));
+    }
+}
+
+static void handleCaptiveProbes() {
+    server->on(F("/generate_204"), HTTP_ANY, [](){ server->send_P(200, kMimeHtml, PSTR("<html><body>Open portal: <a href='/' >Home</a></body></html>")); });
+    server->on(F("/hotspot-detect.html"), HTTP_ANY, [](){ server->send_P(200, kMimeHtml, PSTR("<html><body><b>Success</b> — <a href='/' >Open portal</a></body></html>")); });
+    server->on(F("/ncsi.txt"), HTTP_ANY, [](){ server->send_P(200, kMimeText, PSTR("Microsoft NCSI")); });
+}
+
+// portal: the whole configuration UI on the AP. Otherwise only /api and
+// /metrics, for ENABLE_LOCAL_API / ENABLE_METRICS on the STA address.
+static void setupWeb(bool portal) {
+    server.reset(new ESP8266WebServer(80));
+    if (portal || ENABLE_LOCAL_API) server->on(F("/api"), HTTP_GET, handleApi);
+#if ENABLE_METRICS
+    server->on(F("/metrics"), HTTP_GET, handleMetrics);
+#endif
+    if (portal) {
+        server->on(F("/"), HTTP_GET, handleRoot);
+        server->on(F("/save"), HTTP_POST, handleSave);
+        server->on(F("/clear"), HTTP_GET, handleClear);
+        server->on(F("/reboot"), HTTP_GET, handleReboot);
+        server->on(F("/status"), HTTP_GET, handleStatus);
+        handleCaptiveProbes();
+        server->onNotFound(handleNotFound);
+    } else {
+        server->onNotFound([](){ server->send_P(404, kMimeText, PSTR("Not Found")); });
+    }
+    server->begin();
+    if (portal) LOGI("HTTP server started on http://%s", net.apIp);
+    else        LOGI("HTTP server started on port 80 of the STA address, serving%s%s",
+                     ENABLE_LOCAL_API ? " /api" : "", ENABLE_METRICS ? " /metrics" : "");
+}
+
+// ============================== Setup Window ===============================
+// AP + captive DNS + portal cost RAM (DNS socket, route table, AP beacons)
+// and pin the radio in AP_STA, so they are up only while a node needs them:
+//  • boot, not registered → open; with no Wi-Fi credentials it stays open
+//    (nothing else to do), otherwise it closes after SETUP_WINDOW_MIN;
+//  • boot, registered     → STA only, never opened;
+//  • registration OK      → closes PORTAL_GRACE_MS after the "Saved" page;
+//  • button held BUTTON_HOLD_MS, or SETUP_RESET_COUNT quick resets in a row
+//    → reopens for SETUP_WINDOW_MIN.
+static void portalOpen(const char* why) {
+    if (!portalUp) {
+        LOGI("Setup window OPEN (%s) for %u min.", why, (unsigned)SETUP_WINDOW_MIN);
+        setupAP();
+        setupWeb(true);
+        portalUp = true;
+    }
+    sched.in(tPortal, millis(), SETUP_WINDOW_MS);
+}
+
+static void portalClose(const char* why) {
+    if (!portalUp) return;
+    server->stop();    server.reset();
+    dnsServer->stop(); dnsServer.reset();
+    WiFi.softAPdisconnect(true);
+    strcpy_P(net.apIp, PSTR("0.0.0.0"));
+    portalUp = false;
+    WiFi.mode(staMode());
+    sched.stop(tPortal);
+#if ENABLE_LOCAL_API || ENABLE_METRICS
+    setupWeb(false);
+#endif
+    LOGI("Setup window CLOSED (%s), STA only. Free heap: %u", why, ESP.getFreeHeap());
+}
+
+static uint32_t taskPortal(uint32_t) {
+    if (!haveWifiCreds()) return SETUP_WINDOW_MS;   // unprovisioned: the portal is the only way in
+    portalClose(config.registration_ok ? "registered" : "timeout");
+    return Sched::STOP;
+}
+
+#if SETUP_BUTTON_PIN >= 0
+static uint32_t btnDownSince = 0;
+static bool     btnDown = false, btnFired = false;
+
+static uint32_t taskButton(uint32_t now) {
+    if (digitalRead(SETUP_BUTTON_PIN) != LOW) { btnDown = false; return 50; }
+    if (!btnDown) { btnDown = true; btnFired = false; btnDownSince = now; }
+    else if (!btnFired && now - btnDownSince >= BUTTON_HOLD_MS) { btnFired = true; portalOpen("button"); }
+    return 50;
+}
+#endif
+
+// Quick-reset tally in RTC user memory: survives the RST button and
+// ESP.restart(), not a power cut. Cleared once a boot has lasted QUICK_RESET_MS.
+struct ResetTally { uint32_t magic; uint32_t count; };
+constexpr uint32_t RESET_TALLY_MAGIC = 0x5E70B007;
+
+static bool countQuickReset() {
+#if SETUP_RESET_COUNT > 0
+    ResetTally t;
+    if (!ESP.rtcUserMemoryRead(0, (uint32_t*)&t, sizeof(t)) || t.magic != RESET_TALLY_MAGIC) t = {RESET_TALLY_MAGIC, 0};
+    const bool hit = ++t.count >= SETUP_RESET_COUNT;
+    if (hit) t.count = 0;
+    ESP.rtcUserMemoryWrite(0, (uint32_t*)&t, sizeof(t));
+    if (t.count > 1) LOGI("Quick reset %u of %u.", t.count, (unsigned)SETUP_RESET_COUNT);
+    return hit;
+#else
+    return false;
+#endif
+}
+
+static uint32_t taskBootSettled(uint32_t) {
+    ResetTally t = {RESET_TALLY_MAGIC, 0};
+    ESP.rtcUserMemoryWrite(0, (uint32_t*)&t, sizeof(t));
+    return Sched::STOP;
+}
+
+// ============================== Timer Tasks ================================
+// Each returns when it wants to run next (see pm_sched.h).
+// Up: only an RSSI refresh until the next event. Down: wake when the backoff
+// expires (an event may come sooner).
+static uint32_t taskWifi(uint32_t now) {
+    ensureStaConnected();
+    if (net.staUp) { net.rssi = WiFi.RSSI(); return RSSI_REFRESH_MS; }
+    if (!haveWifiCreds()) return Sched::STOP;       // handleSave() re-arms
+    uint32_t wait = staBackoff.remaining(now);
+    return wait && wait < LINK_CHECK_MS ? wait : LINK_CHECK_MS;
+}
+
+static uint32_t taskMqtt(uint32_t now) {
     mqttEnsureConnected();
 #if ENABLE_NETWORK
-    extern PubSubClient mqttClient; // already declared above when enabled
-    mqttClient.loop();
+    if (mqttClient.connecting()) return 100;   // pick up the CONNACK promptly
+    uint32_t wait = mqttBackoff.remaining(now);
+    return wait && wait < LINK_CHECK_MS ? wait : LINK_CHECK_MS;
+#else
+    (void)now;
+    return Sched::STOP;
+#endif
+}
+
+static uint32_t taskPublish(uint32_t) {
+    mqttSample();
+    return Sched::PERIOD;
+}
+
+// Concise summary every HEARTBEAT_MS.
+static uint32_t taskHeartbeat(uint32_t) {
+    heapWalk();
+    FixedString<159> sensors;
+    Sensors::brief(sensors);
+    LOGI("HB: STA=%s AP=%s STA_IP=%s RSSI=%d Heap=%u (min %u, blk %u, frag %u%%)%s",
+         net.staUp ? "up" : "down",
+         net.apIp,
+         net.staIp,
+         (int)net.rssi,
+         heap.freeNow, heap.freeMin, heap.maxBlock, heap.frag, sensors.c_str());
+    return Sched::PERIOD;
+}
+
+static uint32_t taskTelemetry(uint32_t) {
+    heapWalk();
+    mqttTelemetry();
+    return Sched::PERIOD;
+}
+
+// On the minute, by the wall clock: closes the buckets a frame has not
+// closed already, and sends the closed ones; on the hour, the AQI hour too.
+// Slewing can wake it a little early; it then comes back at the boundary.
+static uint32_t taskAgg(uint32_t now) {
+    if (!wallClock.valid()) return LINK_CHECK_MS;
+    const uint64_t t = wallClock.nowMs(now);
+    agg.advance(t);
+#if ENABLE_AQI
+    aqiWallHour(now, t);
 #endif
-    mqttMaybePublish();
+    for (uint8_t tier = 0; tier < Aggregates::TIERS; ++tier) {
+        if (!(agg.ready() & (1u << tier))) continue;
+        if (AGG_PUBLISH & (1u << tier)) mqttAggregate(agg.closed(tier), tier);
+        agg.release(tier);
+    }
+    return Aggregates::msToNext(t);
+}
+
+// Gives the rest of the pass back to the SDK. delay() (unlike a busy loop)
+// lets the Wi-Fi stack run and, with LOOP_LIGHT_SLEEP in STA-only mode,
+// lets it light-sleep between DTIM beacons.
+static void idleFor(uint32_t ms) {
+    if (!ms) { yield(); return; }
+#if LOOP_LIGHT_SLEEP
+    if (WiFi.getMode() == WIFI_STA && WiFi.getSleepMode() != WIFI_LIGHT_SLEEP) WiFi.setSleepMode(WIFI_LIGHT_SLEEP);
+#endif
+    delay(ms);
+    idleSleptMs += ms;
+}
+
+// ================================ Arduino ==================================
+void setup() {
+    Serial.begin(115200);
+    delay(50);
+    Serial.println();
+    LOGI("Booting educational build (SYNC skeleton)...");
+    LOGI("Build: " __DATE__ " " __TIME__ " | Core: ESP8266 Arduino | Free heap at boot: %u", ESP.getFreeHeap());
     
-    // Heartbeat every ~5s with a concise summary
+    loadConfig();
+    loadSettings();
+    const bool resetSequence = countQuickReset();
+    
+    // Per-device jitter: nodes that fail together must not retry together.
+    staBackoff.seed(ESP.getChipId() * 2654435761u);
+#if ENABLE_NETWORK
+    mqttBackoff.seed(ESP.getChipId() * 2246822519u + 1);
+#endif
+    
+#if ENABLE_BME280 || ENABLE_SUNRISE
+    Wire.begin(I2C_SDA, I2C_SCL);
+    Wire.setClock(100000);
+#endif
+    Sensors::begin();                                  // UART, pins, probes
+    
+    // WiFi auto (STA); link changes arrive as events from here on
+    staGotIpHandler        = WiFi.onStationModeGotIP(onStaGotIp);
+    staDisconnectedHandler = WiFi.onStationModeDisconnected(onStaDisconnected);
+    WiFi.setAutoConnect(true);
+    WiFi.setAutoReconnect(true);
+    WiFi.persistent(false);
+    if (haveWifiCreds()) {
+        LOGI("Boot: attempting STA join to '%s'...", config.wifi_ssid);
+        connectSTA(8000);
+        staBackoff.reset();
+    } else {
+        LOGW("Boot: no WiFi credentials saved, staying AP‑only.");
+    }
+    WiFi.mode(staMode());
+    
+#if ENABLE_NETWORK
+    // MQTT client sizing if enabled
+    LOGI("Networking ENABLED — ensure you configured CA pinning and private URLs.");
+    mqttClient.setCallback(onMqttMessage);             // config/<node_id>, ota/<node_id>
+#if MQTT_QOS >= 1
+    mqttClient.setAckCallback(onMqttPuback);
+    LOGI("MQTT QoS1: queue=%u in-flight=%u ack-timeout=%ums",
+         (unsigned)MQTT_QUEUE_LEN, (unsigned)MQTT_INFLIGHT_MAX, MQTT_ACK_TIMEOUT_MS);
+#endif
+#endif
+    
+    // Timers: link checks first, first sample and heartbeat one period in.
     uint32_t now = millis();
-    if (now - lastHeartbeat >= 5000) {
-        lastHeartbeat = now;
-        if (g_pms.valid) {
-            LOGI("HB: WiFi.status=%d AP=%s STA_IP=%s RSSI=%d Heap=%u | PMS CF1[%u/%u/%u] ATM[%u/%u/%u]",
-                 (int)WiFi.status(),
-                 WiFi.softAPIP().toString().c_str(),
-                 WiFi.localIP().toString().c_str(),
-                 WiFi.RSSI(),
-                 ESP.getFreeHeap(),
-                 g_pms.pm1_cf1, g_pms.pm25_cf1, g_pms.pm10_cf1,
-                 g_pms.pm1_atm, g_pms.pm25_atm, g_pms.pm10_atm);
-        } else {
-            LOGI("HB: WiFi.status=%d AP=%s STA_IP=%s RSSI=%d Heap=%u | PMS waiting...",
-                 (int)WiFi.status(),
-                 WiFi.softAPIP().toString().c_str(),
-                 WiFi.localIP().toString().c_str(),
-                 WiFi.RSSI(),
-                 ESP.getFreeHeap());
-        }
+    tWifi      = sched.add(PSTR("wifi"),      taskWifi,      LINK_CHECK_MS, now);
+    tMqtt      = sched.add(PSTR("mqtt"),      taskMqtt,      LINK_CHECK_MS, now);
+    tPublish   = sched.add(PSTR("publish"),   taskPublish,   publishMs(),   now, publishMs());
+    tHeartbeat = sched.add(PSTR("heartbeat"), taskHeartbeat, HEARTBEAT_MS,  now, HEARTBEAT_MS);
+    tTelemetry = sched.add(PSTR("telemetry"), taskTelemetry, TELEMETRY_MS,  now, TELEMETRY_MS);
+    tPortal    = sched.add(PSTR("portal"),    taskPortal,    SETUP_WINDOW_MS, now, SETUP_WINDOW_MS);
+    sched.stop(tPortal);                               // armed by portalOpen()
+    tBootSettled = sched.add(PSTR("boot-settled"), taskBootSettled, 0, now, QUICK_RESET_MS);
+    tAgg       = sched.add(PSTR("agg"),       taskAgg,       LINK_CHECK_MS, now);   // on the minute once the clock is set
+#if ENABLE_NETWORK
+    tNtp       = sched.add(PSTR("ntp"),       taskNtp,       0, now);   // first request once STA is up
+#endif
+#if ENABLE_NETWORK && ENABLE_OTA
+    tOta       = sched.add(PSTR("ota"),       taskOta,       0, now);
+    sched.stop(tOta);                                  // armed by an ota/<node_id> request
+#endif
+    Sensors::start(now);                               // sensor timers
+#if SETUP_BUTTON_PIN >= 0
+    pinMode(SETUP_BUTTON_PIN, INPUT_PULLUP);
+    tButton    = sched.add(PSTR("button"),    taskButton,    50, now);
+#endif
+    
+    // Setup window: AP + portal only when this node needs provisioning
+    if (!config.registration_ok) portalOpen("not registered");
+    else if (resetSequence)      portalOpen("reset sequence");
+    else LOGI("Registered: setup portal off (hold button %u s or %u quick resets to open).",
+              (unsigned)(BUTTON_HOLD_MS / 1000), (unsigned)SETUP_RESET_COUNT);
+#if ENABLE_LOCAL_API || ENABLE_METRICS
+    if (!portalUp) setupWeb(false);
+#endif
+    
+    dumpConfig(false);
+}
+
+void loop() {
+    heapPassBegin();
+    loopTimeBegin();
+    
+    // Pollers: cheap, and must not wait for a timer
+    if (portalUp) dnsServer->processNextRequest();
+    if (server) server->handleClient();               // portal, or the local API
+    Sensors::poll(millis());                           // PMS5003 bytes, deferred sensor starts
+    mqttService();
+    i2c.service();                                     // one queued I2C transaction, if any
+    
+    // Wi-Fi events: STA and MQTT react now instead of on their next check
+    if (net.changed) {
+        net.changed = false;
+        sched.in(tWifi, millis(), 0);
+        sched.in(tMqtt, millis(), 0);
     }
+    
+    // Timers, then idle until the next deadline (SDK work while idle is not this pass's)
+    uint32_t idle = sched.run(millis(), LOOP_IDLE_MAX_MS);
+    if (i2c.pending()) idle = 0;                       // next transaction on the next pass
+    heapPassEnd();
+    loopTimeEnd();
+    idleFor(idle);
 }
 
 /*
@@ -692,30 +2919,127 @@ void loop() {
  - Define your backend endpoint and TLS root CA. Example pattern:
  std::unique_ptr<BearSSL::WiFiClientSecure> ssl(new BearSSL::WiFiClientSecure);
  ssl->setTrustAnchors(&your_ca_store);  // avoid setInsecure()
- HTTPClient http; http.begin(*ssl, host, port, path, /* https= */ true);
+ HTTPClient http; http.begin(*ssl, host, port, path, true); // https
  http.addHeader("Content-Type", "application/json");
  http.POST("{\"registration_code\":\"...\"}");
  deserializeJson(...) into config fields; saveConfig();
  
  2) MQTT (private repo):
  - Set clean topic layout and retained payload policy.
- - Increase PubSubClient buffer if your payload grows.
+ - Increase the mqtt::Client buffer (2nd template argument) if your payload grows.
+ - MQTT_QOS=1 gives at-least-once delivery; dedupe server-side on "seq".
  - Consider TLS for MQTT as well (WiFiClientSecure + certificate pinning).
  
  3) Security:
  - Never ship setInsecure() in production.
  - Never commit keys/tokens/URLs. Use build-time secrets or a private header.
- - Consider a setup window (AP auto-disables after N minutes / first success).
+ - The setup AP/portal closes after registration or SETUP_WINDOW_MIN; production
+ nodes run STA-only. Reopen with the button or SETUP_RESET_COUNT quick resets.
+ - Quick resets are counted in RTC memory, which a power cut clears; count in
+ flash instead if your users power-cycle rather than press RST.
+ - ENABLE_LOCAL_API leaves port 80 open on the STA address for GET /api. It
+ is read-only and carries no credentials, but anyone on the LAN can read
+ it; set it to 0 on networks you do not trust.
+ - ENABLE_METRICS keeps port 80 open as well, for GET /metrics. Set both
+ to 0 to close it; otherwise scrape through a firewall or VLAN that only
+ lets the Prometheus server reach the nodes.
+ - config/<node_id> changes what the node publishes and how it calibrates.
+ Give each node's broker user read-only access to its own config topic and
+ write access to config/<node_id>/state only; the backend alone may write
+ config/#.
+ - OTA images must be signed with the release key (ota_pubkey.h holds its
+ modulus). dev/host/ota_pubkey.h is a test key whose private half is public:
+ keep dev/host off device include paths. Give nodes read access to
+ ota/<node_id> and write access to ota/<node_id>/state only.
+ - SNTP is unauthenticated. The random cookie stops off-path replies, but
+ anyone on the path can set the node's time (stepped at most once per poll;
+ within 60 s back it is only slewed). Point NTP_SERVER or the "ntp" setting
+ at a server on your own network where you can.
  
  4) Resilience:
- - Exponential backoff for STA & MQTT reconnects is shown here.
+ - Jittered exponential backoff for STA & MQTT reconnects is shown here (pm_backoff.h).
+ - New periodic work: add a timer in setup() (pm_sched.h), not a millis() check in loop().
+ - LOOP_IDLE_MAX_MS trades power for portal/UART latency; keep it well under 128 ms.
  - Consider a watchdog strategy if registration gets stuck.
+ - An OTA erase blocks ~30 ms per 4 KB sector (one per 4 KB written, at most
+ one per loop() pass). Keep OTA_POLL_MS short; SoftwareSerial's buffer
+ covers the stalls at 9600 baud. A failed update leaves the running image;
+ just publish the request again.
+ - The wall clock polls NTP_SERVER every NTP_POLL_S (every 64 s for the
+ first syncs and after a time change). Without a server the samples simply
+ go out without "ts"; queued ones are stamped once the clock is set. A
+ local server (e.g. the gateway's) keeps working when the uplink is down.
+ - Aggregates start when the clock is set and follow it: a forward step
+ closes the open buckets early, and after a back step the values until
+ the end of the last reported minute are dropped. The backend sees a short
+ bucket, never the same one twice.
+ - Deltas: keep every released firmware.bin, and make a patch per build that
+ is still in the field. Nodes on other builds answer "wrong base"; send them
+ the full image. A patch against a build flashed with other esptool flash
+ settings still applies (bytes 2-3 are not hashed).
  
  5) Memory:
  - SoftwareSerial uses small buffers here; adjust for noisy lines.
  - Prefer STA-only mode during TLS if RAM is tight.
+ - Keep new literals in flash: F("...") for String/print, PSTR + the *_P
+ functions for formatting, LOGx already does this. Never hand a PROGMEM
+ pointer to a RAM API (%s, strcmp, WiFi.softAP): flash needs aligned reads.
+ - dev/host/dram_report.sh shows the .rodata/PROGMEM split before committing.
+ - Build text in FixedString/StrBuf (pm_fstr.h), not String: loop() must not
+ allocate once connected (the host harness fails the run if it does). Pages
+ stream through a HTML_CHUNK window; large pages cost no extra RAM.
+ - Watch telemetry/<node_id>: a falling "blk_min" or a rising "frag_max" across
+ the fleet is the early sign of fragmentation. Build the core with
+ -DUMM_STATS_FULL to get "allocs"/"frees"/"pass_max" as well.
+ - No float in the sample path: aggregate with SampleStats/Ema and print with
+ appendFixed() (pm_fixed.h). One %f in any format string links the float
+ half of printf back in.
+ - Aggregates cost ~1 KB of RAM for the open and closed buckets, plus ~185 B
+ per AGG_QUEUE_LEN slot with QoS1. An hourly record is ~430 B, which is
+ why the MQTT buffer is 512 B; more fields need a bigger one.
+ 
+ 6) Sensors:
+ - Sensors are types in the Sensors list ("Sensor registry"). A hardware
+ variant without one is a build flag (ENABLE_BME280=0 ...), not an edit:
+ its hooks expand to nothing and its driver is not linked. A new sensor
+ needs no change to loop(), the payload or the pages; keep its hooks
+ non-blocking like the others.
+ - I2C devices share GPIO4/5. Start a conversion, arm a timer for its
+ conversion time and collect it there; never wait in a driver.
+ - Queue transfers on the bus (i2c.submit) rather than calling Wire: one
+ runs per loop() pass. Keep each under ~30 bytes (the Wire buffer), and
+ register sleepy devices with their wake window (i2c.device).
+ - The BME280 is probed at 0x77, then 0x76 (SDO low). A BMP280 (chip id 0x58,
+ no humidity) is not accepted.
+ - PMS5003 frames go through a Hampel spike test (PMS_SPIKE_FILTER) before
+ they count. The floors keep ±1 µg/m³ noise at low levels from tripping it.
+ If the portal shows a steady trickle of drops on clean air, raise k or the
+ floors rather than turning the filter off: bit slips grow with cable
+ length and with the Wi-Fi load on SoftwareSerial's interrupts.
+ dev/host/filter_bench.cpp replays a recorded serial log through it.
+ - Nothing from the PMS5003 is published until it has warmed up
+ (PMS_WARMUP_S, then PMS_STABLE_N frames that agree). Telemetry reports
+ how long that took ("pms":{"warmup_ms"}); "stable":false means it gave up
+ after PMS_WARMUP_MAX_MS, which on clean air points at a failing fan.
+ - PM2.5 is published raw ("pm25") and, with a fresh BME280 reading,
+ humidity-corrected ("pm25_corr", PM25_RH_CORRECTION). The EPA fit was
+ made on hourly and longer averages against reference monitors in the US;
+ elsewhere, kappa-Köhler with a locally fitted κ may track better.
+ - Per-node calibration (gain/offset against a co-located reference) and κ
+ are settings, not build flags: send them to config/<node_id> and they
+ survive reboots and firmware updates.
+ - "aqi" in the payload is the US AQI from NowCast (after two hours of
+ data) and the EU CAQI of the last complete hour. Both come from hourly
+ means kept on the node (pm_aqi.h), so they start over after a reboot.
+ Other national scales are one more breakpoint table each.
+ - The Sunrise is switched to single-measurement mode on first contact. That
+ is an EE write and sticks: to go back to continuous mode (EN tied high,
+ no host), write 0 to register 0x95 and reset the sensor.
+ - Its ABC state survives a reset in RTC memory but not a power cut. A node
+ that loses power often restarts the ABC period (8 days by default) each
+ time; keep the state in flash (once a day is plenty) if that matters.
  
- 6) UX:
+ 7) UX:
  - Keep the form minimal; validate inputs client-side if desired.
  - Add a QR code with the AP URL/IP if helpful.
  ============================================================================
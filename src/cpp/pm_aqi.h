@@ -0,0 +1,162 @@
+/*
+ pm_aqi.h — US EPA AQI with NowCast, and EU CAQI, from PM2.5 / PM10
+ ------------------------------------------------------------
+ Why: every consumer of the measurements was mapping raw PM2.5/PM10 to an
+ air quality index on its own, each with its own averaging and rounding.
+ The node has the history, so it publishes the index itself, computed one
+ way.
+
+ • US AQI (EPA, PM2.5 breakpoints as revised in 2024): the index is a
+ piecewise-linear map of a concentration through a breakpoint table.
+ PM2.5 is truncated to 0.1 µg/m³ and PM10 to 1 µg/m³, the index is
+ rounded, and the overall AQI is the larger sub-index. Above the top
+ breakpoint ("beyond the AQI") it stays at 500.
+ • NowCast: the EPA's real-time stand-in for the 24-hour mean that the AQI
+ is defined on. It is a weighted mean of the last 12 hourly means, newest
+ first, with weight w^(i-1). w = min/max of those hours, at least 0.5, so
+ the faster the air changes the more the recent hours count. It is only
+ valid when two of the three most recent hours are.
+ • EU CAQI (hourly grid): the same interpolation over the CAQI grid, with
+ continuous class limits. It is computed from the last complete hourly
+ mean. Above 100 it extends the top class's slope.
+
+ HourlyPm keeps the 12 hourly means. Breakpoint tables, category limits and
+ colours live in flash (PROGMEM on the device). All arithmetic is integer;
+ NowCast weights are Q16.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_word
+#define pgm_read_word(p)  (*(const uint16_t*)(p))
+#endif
+#ifndef pgm_read_dword
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#endif
+
+// One row: concentrations in tenths of µg/m³, and the index at either end.
+struct AqiBreak { uint16_t cLo, cHi, iLo, iHi; };
+
+static const AqiBreak kUsAqiPm25[] PROGMEM = {
+    {0, 90, 0, 50}, {91, 354, 51, 100}, {355, 554, 101, 150},
+    {555, 1254, 151, 200}, {1255, 2254, 201, 300}, {2255, 3254, 301, 500},
+};
+static const AqiBreak kUsAqiPm10[] PROGMEM = {
+    {0, 540, 0, 50}, {550, 1540, 51, 100}, {1550, 2540, 101, 150},
+    {2550, 3540, 151, 200}, {3550, 4240, 201, 300}, {4250, 6040, 301, 500},
+};
+static const AqiBreak kCaqiPm25[] PROGMEM = {
+    {0, 150, 0, 25}, {150, 300, 25, 50}, {300, 550, 50, 75}, {550, 1100, 75, 100},
+};
+static const AqiBreak kCaqiPm10[] PROGMEM = {
+    {0, 250, 0, 25}, {250, 500, 25, 50}, {500, 900, 50, 75}, {900, 1800, 75, 100},
+};
+
+// Categories: highest index in each, and its colour (0xRRGGBB).
+// US: Good, Moderate, Unhealthy for Sensitive Groups, Unhealthy, Very Unhealthy, Hazardous.
+static const uint16_t kUsAqiTop[] PROGMEM = {50, 100, 150, 200, 300, 0xFFFF};
+static const uint32_t kUsAqiRgb[] PROGMEM = {0x00E400, 0xFFFF00, 0xFF7E00, 0xFF0000, 0x8F3F97, 0x7E0023};
+// CAQI: Very low, Low, Medium, High, Very high.
+static const uint16_t kCaqiTop[] PROGMEM = {25, 50, 75, 100, 0xFFFF};
+static const uint32_t kCaqiRgb[] PROGMEM = {0x79BC6A, 0xBBCF4C, 0xEEC20B, 0xF29305, 0xE8416F};
+
+constexpr uint16_t AQI_NONE = 0xFFFF;     // not enough data
+
+template<size_t N>
+inline uint16_t aqiInterpolate(const AqiBreak (&t)[N], uint16_t c_x10, bool extend) {
+    for (size_t i = 0; i < N; ++i) {
+        const uint32_t cLo = pgm_read_word(&t[i].cLo), cHi = pgm_read_word(&t[i].cHi);
+        if (c_x10 > cHi && i + 1 < N) continue;
+        const uint32_t iLo = pgm_read_word(&t[i].iLo), iHi = pgm_read_word(&t[i].iHi);
+        if (c_x10 > cHi && !extend) return (uint16_t)iHi;
+        const uint32_t v = iLo + ((iHi - iLo) * (c_x10 - cLo) * 2 + (cHi - cLo)) / (2 * (cHi - cLo));
+        return v > 0xFFFE ? 0xFFFE : (uint16_t)v;
+    }
+    return 0;
+}
+
+inline uint16_t usAqiPm25(uint16_t c_x10) { return aqiInterpolate(kUsAqiPm25, c_x10, false); }
+inline uint16_t usAqiPm10(uint16_t c_x10) { return aqiInterpolate(kUsAqiPm10, (uint16_t)(c_x10 / 10 * 10), false); }
+inline uint16_t caqiPm25(uint16_t c_x10)  { return aqiInterpolate(kCaqiPm25, c_x10, true); }
+inline uint16_t caqiPm10(uint16_t c_x10)  { return aqiInterpolate(kCaqiPm10, c_x10, true); }
+
+template<size_t N>
+inline uint8_t aqiCategory(const uint16_t (&top)[N], uint16_t index) {
+    size_t c = 0;
+    while (c + 1 < N && index > pgm_read_word(&top[c])) ++c;
+    return (uint8_t)c;
+}
+
+inline uint8_t  usAqiCategory(uint16_t aqi) { return aqiCategory(kUsAqiTop, aqi); }
+inline uint8_t  caqiCategory(uint16_t caqi) { return aqiCategory(kCaqiTop, caqi); }
+inline uint32_t usAqiRgb(uint8_t cat)       { return pgm_read_dword(&kUsAqiRgb[cat < 6 ? cat : 5]); }
+inline uint32_t caqiRgb(uint8_t cat)        { return pgm_read_dword(&kCaqiRgb[cat < 5 ? cat : 4]); }
+
+// The last HOURS hourly means of PM2.5 and PM10, tenths of µg/m³.
+class HourlyPm {
+public:
+    static constexpr size_t HOURS = 12;
+    enum Pm : uint8_t { PM25, PM10 };
+
+    void add(uint16_t pm25_x10, uint16_t pm10_x10) {
+        sum_[PM25] += pm25_x10;
+        sum_[PM10] += pm10_x10;
+        ++n_;
+    }
+
+    // Ends the running hour: its mean, or a gap (AQI_NONE) if it has fewer
+    // than minSamples samples.
+    void closeHour(uint32_t minSamples) {
+        head_ = (uint8_t)((head_ + 1) % HOURS);
+        for (uint8_t p = PM25; p <= PM10; ++p) {
+            h_[p][head_] = n_ && n_ >= minSamples ? (uint16_t)((sum_[p] + n_ / 2) / n_) : AQI_NONE;
+            sum_[p] = 0;
+        }
+        n_ = 0;
+        if (filled_ < HOURS) ++filled_;
+    }
+
+    // Mean of the hour that ended `ago` hours before the latest one (0 = latest).
+    uint16_t hour(Pm p, size_t ago) const {
+        return ago < filled_ ? h_[p][(head_ + HOURS - ago) % HOURS] : AQI_NONE;
+    }
+    size_t   hours() const   { return filled_; }
+    uint32_t samples() const { return n_; }             // in the running hour
+
+    // EPA NowCast, truncated to tenths of µg/m³; AQI_NONE without two of the
+    // three most recent hours.
+    uint16_t nowcast(Pm p) const {
+        uint8_t recent = 0;
+        uint32_t cMin = 0xFFFF, cMax = 0;
+        for (size_t i = 0; i < HOURS; ++i) {
+            const uint16_t c = hour(p, i);
+            if (c == AQI_NONE) continue;
+            if (i < 3) ++recent;
+            if (c < cMin) cMin = c;
+            if (c > cMax) cMax = c;
+        }
+        if (recent < 2) return AQI_NONE;
+        if (!cMax) return 0;
+        uint32_t w = (cMin << 16) / cMax;                // Q16
+        if (w < 0x8000) w = 0x8000;
+        uint64_t num = 0, den = 0;
+        uint32_t wi = 0x10000;                           // w^i, Q16
+        for (size_t i = 0; i < HOURS; ++i) {
+            const uint16_t c = hour(p, i);
+            if (c != AQI_NONE) { num += (uint64_t)wi * c; den += wi; }
+            wi = (uint32_t)(((uint64_t)wi * w) >> 16);
+        }
+        return (uint16_t)(num / den);
+    }
+
+private:
+    uint16_t h_[2][HOURS] = {};
+    uint32_t sum_[2] = {};
+    uint32_t n_ = 0;
+    uint8_t  head_ = 0, filled_ = 0;
+};
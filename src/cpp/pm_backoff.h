@@ -0,0 +1,84 @@
+/*
+ pm_backoff.h — exponential reconnect backoff with full jitter
+ ------------------------------------------------------------
+ Why: with a fixed +5 s step, every node that lost the same AP or broker
+ retries at the same instants, and the broker sees the whole building
+ reconnect in the same second after each outage.
+
+ Policy:
+ • wait = random(0 .. min(cap, base * 2^attempt)) — "full jitter";
+ • the random stream is seeded per device (chip id), so two nodes that
+ fail together draw different delays;
+ • the attempt counter only resets once a connection stayed up for
+ stableMs, so a link that flaps right after connecting keeps backing off.
+
+ All arithmetic is "now - since >= delay" on uint32_t, i.e. safe across
+ the 49.7-day millis() wrap. fleet_sim.cpp runs the same policy for its
+ virtual nodes.
+ */
+#pragma once
+
+#include <stdint.h>
+
+class Backoff {
+public:
+    Backoff(uint32_t baseMs, uint32_t capMs, uint32_t stableMs)
+        : base_(baseMs), cap_(capMs), stable_(stableMs) {}
+
+    void seed(uint32_t s) { rng_ = s ? s : 0x9E3779B9u; }
+    void reset()          { attempt_ = 0; waiting_ = false; up_ = false; }
+
+    // True when the next attempt may start.
+    bool ready(uint32_t now) const { return !waiting_ || now - since_ >= delay_; }
+
+    // Milliseconds until ready (0 if ready now); lets a scheduler sleep.
+    uint32_t remaining(uint32_t now) const {
+        if (ready(now)) return 0;
+        return delay_ - (now - since_);
+    }
+
+    // An attempt starts now; returns the wait drawn for the one after it.
+    uint32_t onAttempt(uint32_t now) {
+        arm(now);
+        if (attempt_ < 31) ++attempt_;
+        return delay_;
+    }
+
+    void onConnected(uint32_t now) { up_ = true; upSince_ = now; waiting_ = false; }
+
+    // Link dropped: jitter the first retry too, otherwise a broker restart
+    // makes every node hit it in the same millisecond.
+    uint32_t onDisconnected(uint32_t now) {
+        if (up_ && now - upSince_ >= stable_) attempt_ = 0;
+        up_ = false;
+        arm(now);
+        return delay_;
+    }
+
+    uint32_t ceiling() const {
+        uint32_t c = attempt_ >= 16 ? cap_ : base_ << attempt_;
+        return c > cap_ ? cap_ : c;
+    }
+    uint8_t attempts() const { return attempt_; }
+
+private:
+    void arm(uint32_t now) {
+        delay_ = next() % (ceiling() + 1);
+        since_ = now;
+        waiting_ = true;
+    }
+
+    uint32_t next() {                   // xorshift32: tiny, good enough for jitter
+        rng_ ^= rng_ << 13; rng_ ^= rng_ >> 17; rng_ ^= rng_ << 5;
+        return rng_;
+    }
+
+    uint32_t base_, cap_, stable_;
+    uint32_t rng_ = 0x9E3779B9u;
+    uint32_t since_ = 0;
+    uint32_t delay_ = 0;
+    uint32_t upSince_ = 0;
+    uint8_t  attempt_ = 0;
+    bool     waiting_ = false;
+    bool     up_ = false;
+};
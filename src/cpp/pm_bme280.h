@@ -0,0 +1,194 @@
+/*
+ pm_bme280.h — BME280 temperature / humidity / pressure, forced mode
+ ------------------------------------------------------------
+ Why: the BME280 on the I2C bus (GPIO4/5) was wired but never read, and
+ humidity is what the PM readings need most for context.
+
+ Forced mode: the sensor sleeps, start() triggers one conversion, poll()
+ collects it. Nothing here waits for the conversion (~10 ms at x1
+ oversampling); the caller comes back after measureMs(). Both queue one
+ transfer on the shared bus (pm_i2cbus.h): start() a single burst write of
+ both control registers, poll() one 12-byte read of status and data, so
+ poll() answers BUSY until its read has run. begin() reads the id and
+ calibration synchronously (boot and hot-plug probes only).
+
+ Compensation is the datasheet's integer code (BST-BME280-DS002 §4.2.3):
+ temperature in 0.01 °C, pressure in Q24.8 Pa, humidity in Q22.10 %RH. No
+ float. Pressure uses the 64-bit variant: the 32-bit one is off by up to
+ ~5 Pa, half a published 0.1 hPa step, and the one 64-bit division it costs
+ per conversion is nothing at one conversion every few seconds.
+
+ Bus is an I2cBus over the core's Wire on the device and over a
+ register-level fake on the host.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pm_i2cbus.h"
+
+template<typename Bus>
+class Bme280 {
+public:
+    static constexpr uint8_t ADDR_PRIMARY   = 0x77;   // SDO high (Adafruit breakout default)
+    static constexpr uint8_t ADDR_SECONDARY = 0x76;   // SDO low
+    static constexpr uint8_t CHIP_ID        = 0x60;   // BMP280 answers 0x58 and has no humidity
+
+    enum Poll : uint8_t { BUSY, READY, FAILED };
+
+    struct Reading {
+        int32_t  t_x100;     // °C × 100
+        uint32_t p_pa;       // Pa
+        uint32_t rh_q10;     // %RH × 1024
+        uint16_t rh_x10() const { return (uint16_t)((rh_q10 * 10 + 512) >> 10); }
+    };
+
+    explicit Bme280(Bus& bus) : bus_(bus) {}
+
+    // Checks the chip id at addr and loads the calibration. Leaves the sensor
+    // asleep, filter off, x1 oversampling for all three channels.
+    bool begin(uint8_t addr) {
+        if (txn_.busy()) return false;
+        addr_ = addr; present_ = false; measuring_ = false;
+        uint8_t id = 0;
+        if (!readNow(REG_ID, &id, 1) || id != CHIP_ID) return false;
+        uint8_t a[26], b[7];
+        if (!readNow(REG_CALIB_A, a, sizeof(a)) || !readNow(REG_CALIB_B, b, sizeof(b))) return false;
+        c_.T1 = u16(a + 0);  c_.T2 = s16(a + 2);  c_.T3 = s16(a + 4);
+        c_.P1 = u16(a + 6);  c_.P2 = s16(a + 8);  c_.P3 = s16(a + 10);
+        c_.P4 = s16(a + 12); c_.P5 = s16(a + 14); c_.P6 = s16(a + 16);
+        c_.P7 = s16(a + 18); c_.P8 = s16(a + 20); c_.P9 = s16(a + 22);
+        c_.H1 = a[25];
+        c_.H2 = s16(b + 0);
+        c_.H3 = b[2];
+        c_.H4 = (int16_t)((int16_t)(int8_t)b[3] * 16 | (b[4] & 0x0F));
+        c_.H5 = (int16_t)((int16_t)(int8_t)b[5] * 16 | (b[4] >> 4));
+        c_.H6 = (int8_t)b[6];
+        const uint8_t cfg[2] = {REG_CONFIG, 0x00};
+        txn_.write(addr_, cfg, sizeof(cfg));
+        if (!bus_.runNow(txn_)) return false;
+        present_ = true;
+        return true;
+    }
+
+    // Queues the trigger: ctrl_hum, then ctrl_meas, which latches it, as
+    // register/value pairs in one burst write.
+    bool start() {
+        if (!present_ || txn_.busy()) return false;
+        const uint8_t w[4] = {REG_CTRL_HUM, OS_X1, REG_CTRL_MEAS, OS_X1 << 5 | OS_X1 << 2 | MODE_FORCED};
+        txn_.write(addr_, w, sizeof(w));
+        if (!bus_.submit(txn_)) { ++errors_; return false; }
+        measuring_ = true;
+        reading_ = false;
+        return true;
+    }
+
+    // Datasheet t_measure,max for x1/x1/x1, rounded up: 1.25 + 2.3 + 2.875 + 2.875 ms.
+    static constexpr uint32_t measureMs() { return 10; }
+
+    // BUSY until the conversion is done and read, then READY once with a new reading().
+    Poll poll() {
+        if (!measuring_) return FAILED;
+        if (txn_.busy()) return BUSY;                                    // still queued
+        if (txn_.state == I2cTxn::FAILED) return fail();                 // the trigger or the read
+        if (!reading_ || (txn_.buf[0] & STATUS_MEASURING)) {
+            if (reading_) ++busyPolls_;
+            txn_.read(addr_, REG_STATUS, 12);                            // status .. hum_lsb
+            if (!bus_.submit(txn_)) return fail();
+            reading_ = true;
+            return BUSY;
+        }
+        const uint8_t* d = txn_.buf + (REG_DATA - REG_STATUS);
+        measuring_ = false;
+        const int32_t adcP = (int32_t)((uint32_t)d[0] << 12 | (uint32_t)d[1] << 4 | d[2] >> 4);
+        const int32_t adcT = (int32_t)((uint32_t)d[3] << 12 | (uint32_t)d[4] << 4 | d[5] >> 4);
+        const int32_t adcH = (int32_t)((uint32_t)d[6] << 8 | d[7]);
+        if (adcT == SKIPPED || adcP == SKIPPED) { ++errors_; return FAILED; }   // still the reset value
+        r_.t_x100 = compensateT(adcT);
+        r_.p_pa   = compensateP(adcP);
+        r_.rh_q10 = compensateH(adcH);
+        ++conversions_;
+        return READY;
+    }
+
+    bool           present() const     { return present_; }
+    bool           measuring() const   { return measuring_; }
+    uint8_t        address() const     { return addr_; }
+    const Reading& reading() const     { return r_; }
+    uint32_t       conversions() const { return conversions_; }
+    uint32_t       errors() const      { return errors_; }
+    uint32_t       busyPolls() const   { return busyPolls_; }
+
+private:
+    enum : uint8_t {
+        REG_CALIB_A = 0x88, REG_ID = 0xD0, REG_CALIB_B = 0xE1, REG_CTRL_HUM = 0xF2,
+        REG_STATUS = 0xF3, REG_CTRL_MEAS = 0xF4, REG_CONFIG = 0xF5, REG_DATA = 0xF7,
+        OS_X1 = 1, MODE_FORCED = 1, STATUS_MEASURING = 0x08,
+    };
+    static constexpr int32_t SKIPPED = 0x80000;
+
+    struct Calib {
+        uint16_t T1; int16_t T2, T3;
+        uint16_t P1; int16_t P2, P3, P4, P5, P6, P7, P8, P9;
+        uint8_t  H1, H3; int16_t H2, H4, H5; int8_t H6;
+    };
+
+    static uint16_t u16(const uint8_t* p) { return (uint16_t)(p[0] | p[1] << 8); }
+    static int16_t  s16(const uint8_t* p) { return (int16_t)u16(p); }
+
+    Poll fail() { measuring_ = false; ++errors_; return FAILED; }
+
+    bool readNow(uint8_t reg, uint8_t* out, size_t n) {
+        txn_.read(addr_, reg, n);
+        if (!bus_.runNow(txn_)) return false;
+        for (size_t i = 0; i < n; ++i) out[i] = txn_.buf[i];
+        return true;
+    }
+
+    int32_t compensateT(int32_t adc) {
+        const int32_t v1 = ((((adc >> 3) - ((int32_t)c_.T1 << 1))) * (int32_t)c_.T2) >> 11;
+        const int32_t d  = (adc >> 4) - (int32_t)c_.T1;
+        const int32_t v2 = (((d * d) >> 12) * (int32_t)c_.T3) >> 14;
+        tFine_ = v1 + v2;
+        return (tFine_ * 5 + 128) >> 8;
+    }
+
+    // Pa, rounded from the datasheet's Q24.8 result.
+    uint32_t compensateP(int32_t adc) const {
+        int64_t v1 = (int64_t)tFine_ - 128000;
+        int64_t v2 = v1 * v1 * c_.P6;
+        v2 = v2 + ((v1 * c_.P5) * 131072);
+        v2 = v2 + ((int64_t)c_.P4 * 34359738368LL);
+        v1 = ((v1 * v1 * c_.P3) / 256) + ((v1 * c_.P2) * 4096);
+        v1 = ((0x800000000000LL + v1) * c_.P1) >> 33;
+        if (v1 == 0) return 0;                              // avoid division by zero
+        int64_t p = 1048576 - adc;
+        p = (((p * 2147483648LL) - v2) * 3125) / v1;
+        v1 = ((int64_t)c_.P9 * (p >> 13) * (p >> 13)) >> 25;
+        v2 = ((int64_t)c_.P8 * p) >> 19;
+        p = ((p + v1 + v2) >> 8) + ((int64_t)c_.P7 << 4);
+        return (uint32_t)((p + 128) >> 8);
+    }
+
+    uint32_t compensateH(int32_t adc) const {
+        int32_t v = tFine_ - 76800;
+        v = (((adc << 14) - ((int32_t)c_.H4 << 20) - ((int32_t)c_.H5 * v) + 16384) >> 15) *
+            (((((((v * (int32_t)c_.H6) >> 10) * (((v * (int32_t)c_.H3) >> 11) + 32768)) >> 10) + 2097152) *
+              (int32_t)c_.H2 + 8192) >> 14);
+        v = v - (((((v >> 15) * (v >> 15)) >> 7) * (int32_t)c_.H1) >> 4);
+        v = v < 0 ? 0 : v > 419430400 ? 419430400 : v;
+        return (uint32_t)(v >> 12);
+    }
+
+    Bus&     bus_;
+    I2cTxn   txn_;
+    Calib    c_{};
+    Reading  r_{};
+    int32_t  tFine_ = 0;
+    uint8_t  addr_ = ADDR_PRIMARY;
+    bool     present_ = false;
+    bool     measuring_ = false;
+    bool     reading_ = false;     // txn_ holds the data read, not the trigger
+    uint32_t conversions_ = 0, errors_ = 0, busyPolls_ = 0;
+};
@@ -0,0 +1,132 @@
+/*
+ pm_buckets.h — aggregates over 1 min, 15 min and 1 h on Unix time boundaries
+ ------------------------------------------------------------
+ Why: a published sample is the mean over the publish period before it,
+ and that period starts wherever millis() happened to be at boot. No two
+ nodes' samples cover the same interval, so the backend re-binned every
+ stream before it could compare nodes or thin out old data.
+
+ AlignedBuckets keeps count, sum, min, max and sum of squares per field,
+ over buckets that start and end on multiples of their period in Unix time
+ (UTC): 1 min, 15 min and 1 h. A value goes to the bucket its own time
+ falls in, so a bucket closes exactly on its boundary, whether the first
+ value after it or the timer that calls advance() gets there first. Only
+ the minute takes values; a closed minute is merged into its quarter hour
+ and a closed quarter into its hour, which is exact because the
+ boundaries nest.
+
+ A closed bucket waits in closed(tier) until release(tier). Buckets with
+ no values are not reported, and neither are the fields without values in
+ a bucket. A forward clock step closes the open buckets at once. After a
+ back step, values from before the end of the last closed minute are
+ dropped (dropped() counts them), so no bucket is reported twice. The
+ first buckets after boot cover only the time since the clock was set.
+
+ Values are int16 in the field's own unit (tenths, ppm). They are signed
+ because of temperature. A bucket counts up to 65535 values; the sums are
+ exact up to there. Integer only.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct AggStats {
+    uint64_t sq  = 0;          // sum of squares
+    int32_t  sum = 0;
+    uint16_t n   = 0;
+    int16_t  min = 0, max = 0;
+
+    void add(int16_t x) {
+        if (n == 0xFFFF) return;
+        if (!n || x < min) min = x;
+        if (!n || x > max) max = x;
+        ++n;
+        sum += x;
+        sq  += (uint32_t)((int32_t)x * x);
+    }
+
+    void merge(const AggStats& o) {
+        if (!o.n || (uint32_t)n + o.n > 0xFFFF) return;
+        if (!n || o.min < min) min = o.min;
+        if (!n || o.max > max) max = o.max;
+        n   += o.n;
+        sum += o.sum;
+        sq  += o.sq;
+    }
+};
+
+template<size_t NF>
+struct AggBucket {
+    uint32_t startS = 0;       // Unix time of the start, s; 0 = not open
+    AggStats f[NF];
+
+    bool empty() const {
+        for (const AggStats& s : f) if (s.n) return false;
+        return true;
+    }
+};
+
+template<size_t NF>
+class AlignedBuckets {
+public:
+    typedef AggBucket<NF> Bucket;
+    static constexpr uint8_t  TIERS = 3;
+    static constexpr uint32_t PERIOD_S[TIERS] = {60, 900, 3600};
+
+    // Adds x to field f at Unix time ms (0: the clock is not set; dropped).
+    void add(size_t f, int16_t x, uint64_t ms) {
+        if (!ms || f >= NF) return;
+        if (ms / 1000 < floorS_) { ++dropped_; return; }
+        advance(ms);
+        Bucket& b = open_[0];
+        if (!b.startS) b.startS = startOf((uint32_t)(ms / 1000), 0);
+        b.f[f].add(x);
+    }
+
+    // Closes every open bucket that Unix time ms is not in.
+    void advance(uint64_t ms) {
+        if (!ms || ms / 1000 < floorS_) return;
+        const uint32_t s = (uint32_t)(ms / 1000);
+        for (uint8_t t = 0; t < TIERS; ++t) {
+            Bucket& b = open_[t];
+            if (!b.startS || startOf(s, t) == b.startS) continue;
+            if (!b.empty()) {
+                if (t + 1 < TIERS) {
+                    Bucket& up = open_[t + 1];
+                    if (!up.startS) up.startS = startOf(b.startS, t + 1);
+                    for (size_t i = 0; i < NF; ++i) up.f[i].merge(b.f[i]);
+                }
+                if (!t) floorS_ = b.startS + PERIOD_S[0];
+                if (ready_ & (1u << t)) ++lost_;
+                closed_[t] = b;
+                ready_ |= (uint8_t)(1u << t);
+            }
+            b = Bucket();
+        }
+    }
+
+    // Tiers with a closed bucket waiting, as a bit mask (bit 0 = 1 min).
+    uint8_t ready() const { return ready_; }
+    const Bucket& closed(uint8_t tier) const { return closed_[tier]; }
+    void release(uint8_t tier) { ready_ &= (uint8_t)~(1u << tier); }
+
+    // Closed buckets replaced before they were released.
+    uint32_t lost() const { return lost_; }
+    // Values dropped because their minute had been reported already.
+    uint32_t dropped() const { return dropped_; }
+
+    // ms from Unix time ms to the next minute boundary, at least 1.
+    static uint32_t msToNext(uint64_t ms) {
+        const uint32_t p = PERIOD_S[0] * 1000;
+        return p - (uint32_t)(ms % p);
+    }
+
+private:
+    static uint32_t startOf(uint32_t s, uint8_t tier) { return s - s % PERIOD_S[tier]; }
+
+    Bucket   open_[TIERS], closed_[TIERS];
+    uint32_t floorS_ = 0;      // end of the last closed minute
+    uint8_t  ready_ = 0;
+    uint32_t lost_ = 0, dropped_ = 0;
+};
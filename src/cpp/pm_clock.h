@@ -0,0 +1,170 @@
+/*
+ pm_clock.h — SNTP packets and a millis()-to-epoch clock with drift correction
+ ------------------------------------------------------------
+ Why: samples were stamped with millis(), which restarts at every boot and
+ means nothing on another node. The backend could not place queued or
+ batched samples in time, nor line up two nodes.
+
+ WallClock maps the local millis() onto Unix time in µs. Every sync moves
+ the mapping toward the server's time:
+ • the first sync sets it;
+ • a correction of up to 1 s forward or 60 s back is slewed: the clock
+ runs up to 1/16 faster or slower until the offset is gone;
+ • a larger one is stepped. Forward steps keep the clock monotonic. A
+ backward step does not, so it is rare and counted (backSteps());
+ • the crystal's drift is measured against the server over at least 10
+ minutes and taken out of the mapping, up to ±500 ppm. An offset above
+ 128 ms is a time change, not drift: it starts a new measurement.
+ nowMs() never returns less than it returned before, backward steps
+ aside.
+
+ Local times are compared as (int32_t)(a - b), so the mapping is
+ re-anchored at least every ~12 days to stay clear of the millis() wrap.
+
+ The sntp:: helpers build a client request and check a reply: mode,
+ leap indicator, stratum and the echoed transmit timestamp, which is a
+ random cookie rather than our time, so an off-path reply cannot match.
+ Integer only.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace sntp {
+
+constexpr size_t   PACKET      = 48;
+constexpr uint16_t PORT        = 123;
+constexpr uint32_t UNIX_OFFSET = 2208988800u;     // 1900-01-01 to 1970-01-01, s
+
+inline uint32_t be32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// An NTP timestamp as µs since 1970. Era 1 (from 2036) is taken for seconds
+// below 1970's, so this holds until 2104.
+inline int64_t toUs(const uint8_t* p) {
+    const uint32_t s = be32(p), f = be32(p + 4);
+    const int64_t sec = s >= UNIX_OFFSET ? (int64_t)(s - UNIX_OFFSET) : (int64_t)s + 4294967296LL - UNIX_OFFSET;
+    return sec * 1000000 + (int64_t)(((uint64_t)f * 1000000) >> 32);
+}
+
+// Client request (version 4, mode 3) carrying cookie as transmit timestamp.
+inline void request(uint8_t p[PACKET], const uint8_t cookie[8]) {
+    memset(p, 0, PACKET);
+    p[0] = 4 << 3 | 3;
+    memcpy(p + 40, cookie, 8);
+}
+
+// The server's time when the reply reached us, in µs since 1970, from a
+// reply received rttMs after the request; 0 if p is not a usable answer
+// to the request that carried cookie.
+inline int64_t reply(const uint8_t* p, size_t n, const uint8_t cookie[8], uint32_t rttMs) {
+    if (n < PACKET) return 0;
+    const uint8_t li = p[0] >> 6, mode = p[0] & 7, stratum = p[1];
+    if (mode != 4 || li == 3 || stratum == 0 || stratum > 15) return 0;   // 0: kiss-o'-death
+    if (memcmp(p + 24, cookie, 8)) return 0;
+    if (!be32(p + 40)) return 0;
+    const int64_t rx = toUs(p + 32), tx = toUs(p + 40);
+    int64_t held = tx - rx;                                // time the server sat on it
+    if (held < 0) held = 0;
+    const int64_t trip = (int64_t)rttMs * 1000 - held;
+    return tx + (trip > 0 ? trip / 2 : 0);
+}
+
+} // namespace sntp
+
+class WallClock {
+public:
+    enum Sync : uint8_t { SET, SLEW, STEP, STEP_BACK };
+
+    static constexpr int64_t  STEP_US      = 1000000;      // forward offsets above this are stepped
+    static constexpr int64_t  BACK_STEP_US = 60000000;     // backward ones only above this
+    static constexpr int64_t  JUMP_US      = 128000;       // above this an offset is not drift
+    static constexpr uint32_t SLEW_DIV     = 16;           // slew at most 1/16 of the elapsed time
+    static constexpr uint32_t FREQ_SPAN_MS = 600000;       // shortest drift measurement
+    static constexpr uint32_t FREQ_RENEW_MS = 86400000;    // then a new one starts every day
+    static constexpr int32_t  MAX_PPB      = 500000;
+    static constexpr int32_t  ANCHOR_MS    = 1 << 30;      // ~12 days
+
+    bool valid() const { return valid_; }
+
+    // The server's time was serverUs at local time ms.
+    Sync sync(int64_t serverUs, uint32_t ms) {
+        ++syncs_;
+        if (!valid_) { step(serverUs, ms); valid_ = true; return SET; }
+        const int64_t off = serverUs - predict(ms);
+        offset_ = off;
+        if (off > STEP_US || off < -BACK_STEP_US) {
+            step(serverUs, ms);
+            if (off > 0) { ++steps_; return STEP; }
+            ++backSteps_; last_ = 0;
+            return STEP_BACK;
+        }
+        anchor(ms);                                            // before the drift changes
+        if (off > JUMP_US || off < -JUMP_US) {
+            refUs_ = serverUs; refMs_ = ms;                    // a time change: measure drift anew
+        } else if (ms - refMs_ >= FREQ_SPAN_MS) {
+            const uint32_t span = ms - refMs_;
+            int64_t ppb = ((serverUs - refUs_) - (int64_t)span * 1000) * 1000000 / span;
+            if (ppb > MAX_PPB) ppb = MAX_PPB;
+            if (ppb < -MAX_PPB) ppb = -MAX_PPB;
+            ppb_ = (int32_t)ppb;
+            if (span >= FREQ_RENEW_MS) { refUs_ = serverUs; refMs_ = ms; }
+        }
+        pending_ = serverUs - base_;
+        return SLEW;
+    }
+
+    // Unix time in ms at local time ms; never less than the last result.
+    uint64_t nowMs(uint32_t ms) {
+        if (!valid_) return 0;
+        if ((int32_t)(ms - at_) >= ANCHOR_MS) anchor(ms);
+        uint64_t t = (uint64_t)(predict(ms) / 1000);
+        if (t < last_) t = last_;
+        last_ = t;
+        return t;
+    }
+
+    // Unix time in ms that the mapping gives an earlier local time, e.g. a
+    // sample taken before the first sync; not clamped, 0 if unknown.
+    uint64_t atMs(uint32_t ms) const { return valid_ ? (uint64_t)(predict(ms) / 1000) : 0; }
+
+    int32_t  driftPpb() const  { return ppb_; }
+    int64_t  offsetUs() const  { return offset_; }      // at the last sync, before correction
+    int64_t  slewingUs() const { return pending_; }     // left to slew at the last sync
+    uint32_t syncs() const     { return syncs_; }
+    uint32_t steps() const     { return steps_; }
+    uint32_t backSteps() const { return backSteps_; }
+
+private:
+    int64_t predict(uint32_t ms) const {
+        const int32_t e = (int32_t)(ms - at_);
+        int64_t t = base_ + (int64_t)e * 1000 + (int64_t)e * ppb_ / 1000000;
+        if (e > 0 && pending_) {
+            const int64_t s = (int64_t)e * 1000 / SLEW_DIV;
+            t += pending_ > 0 ? (s < pending_ ? s : pending_) : (s < -pending_ ? -s : pending_);
+        }
+        return t;
+    }
+
+    // Moves the anchor to ms without changing the time it maps to.
+    void anchor(uint32_t ms) {
+        const int64_t t = predict(ms);
+        pending_ -= t - (base_ + (int64_t)(int32_t)(ms - at_) * 1000 + (int64_t)(int32_t)(ms - at_) * ppb_ / 1000000);
+        base_ = t; at_ = ms;
+    }
+
+    void step(int64_t serverUs, uint32_t ms) {
+        base_ = serverUs; at_ = ms; pending_ = 0;
+        refUs_ = serverUs; refMs_ = ms;
+    }
+
+    bool     valid_ = false;
+    uint32_t at_ = 0, refMs_ = 0;
+    int64_t  base_ = 0, pending_ = 0, refUs_ = 0, offset_ = 0;
+    int32_t  ppb_ = 0;
+    uint64_t last_ = 0;
+    uint32_t syncs_ = 0, steps_ = 0, backSteps_ = 0;
+};
@@ -0,0 +1,160 @@
+/*
+ pm_delta.h — compressed and delta firmware images: format and op decoder
+ ------------------------------------------------------------
+ Why: a full image is ~400 KB over building Wi-Fi that is often congested,
+ and two builds differ in far fewer bytes than that. A patch rebuilds the
+ new image from the running one and from itself, so only what is really
+ new crosses the network.
+
+ Format (all integers little-endian):
+   "PMD\x01", new size (u32), old size (u32), SHA-256 of the old image
+   then ops, until new size bytes have been produced
+   then the new image's signature trailer, as in a full image (pm_ota.h)
+ An op is a tag byte: kind = tag >> 6, n = tag & 63; n == 63 is followed
+ by a varint (LEB128) that is added to it.
+ • LIT (0): n + 1 bytes follow and are copied out.
+ • NEW (1): n + 4 bytes from earlier in the new image; a varint gives the
+ distance back (1 = the previous byte). The copy may overlap its own
+ output, which makes runs.
+ • OLD (2): n + 4 bytes from the running image; a zigzag varint gives the
+ offset relative to where the previous OLD copy ended. Code that only
+ moved is then a string of short, cheap copies.
+ Old size 0 means no base: a compressed image.
+
+ The window is the flash itself. The new image is written as it is made
+ and read back for NEW copies, and OLD copies read the running sketch. So
+ the decoder needs no history in RAM, whatever the distance. It holds a few
+ words of state; pm_ota.h's Updater does the copying.
+
+ The old image is hashed with bytes 2 and 3 (flash mode and size) as 0:
+ esptool rewrites them when it flashes a board, and the patch tool does
+ not know them. Patches never copy those bytes. The signature covers the
+ new image, so a patch that decodes wrongly cannot boot.
+ */
+#pragma once
+
+#include "pm_sha256.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace delta {
+
+constexpr uint8_t  MAGIC[4]  = {'P', 'M', 'D', 0x01};
+constexpr size_t   HEADER    = 4 + 4 + 4 + Sha256::DIGEST;
+constexpr uint32_t MIN_MATCH = 4;
+constexpr uint32_t HEAD_KEEP = 4;          // image bytes never copied from the old image
+
+enum Kind : uint8_t { LIT, NEW, OLD, BAD };
+
+struct Header {
+    uint32_t newSize, oldSize;
+    uint8_t  oldHash[Sha256::DIGEST];
+};
+
+inline uint32_t le32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// False if p (HEADER bytes) is not a patch header.
+inline bool readHeader(const uint8_t* p, Header& h) {
+    if (memcmp(p, MAGIC, sizeof(MAGIC))) return false;
+    h.newSize = le32(p + 4);
+    h.oldSize = le32(p + 8);
+    memcpy(h.oldHash, p + 12, sizeof(h.oldHash));
+    return true;
+}
+
+// Hashes n bytes found at offset at of the old image, bytes 2 and 3 as 0.
+inline void hashBase(Sha256& sha, uint32_t at, const uint8_t* p, size_t n) {
+    for (uint32_t i = 2; i < 4; ++i) {
+        if (i < at || i >= at + n) continue;
+        const size_t k = i - at;
+        static const uint8_t zero = 0;
+        sha.update(p, k);
+        sha.update(&zero, 1);
+        p += k + 1; n -= k + 1; at = i + 1;
+    }
+    sha.update(p, n);
+}
+
+// One op, as parsed: from is the distance back for NEW, the old offset for OLD.
+struct Op {
+    Kind     kind;
+    uint32_t len, from;
+};
+
+// Parses op headers from a byte stream that arrives in pieces of any size.
+class Decoder {
+public:
+    void reset() { stage_ = TAG; cursor_ = 0; bad_ = false; }
+
+    // Consumes bytes of in[0..n) (used) until an op's header is complete;
+    // then true, with op filled in. A LIT's bytes are left for the caller.
+    bool next(const uint8_t* in, size_t n, size_t& used, Op& op) {
+        used = 0;
+        while (used < n && !bad_) {
+            const uint8_t b = in[used++];
+            switch (stage_) {
+                case TAG:
+                    kind_ = (Kind)(b >> 6);
+                    len_ = b & 63;
+                    if (kind_ == BAD) { bad_ = true; return false; }
+                    if (len_ == 63) { stage_ = LEN; var_ = 0; shift_ = 0; break; }
+                    if (arg()) return done(op);
+                    break;
+                case LEN:
+                    if (!varint(b)) break;
+                    len_ += var_;
+                    if (arg()) return done(op);
+                    break;
+                case ARG:
+                    if (!varint(b)) break;
+                    return done(op);
+            }
+        }
+        return false;
+    }
+
+    bool bad() const { return bad_; }
+
+private:
+    enum Stage : uint8_t { TAG, LEN, ARG };
+
+    // True if the op has no argument; otherwise starts reading it.
+    bool arg() {
+        if (kind_ == LIT) return true;
+        stage_ = ARG; var_ = 0; shift_ = 0;
+        return false;
+    }
+
+    // True once the varint is complete.
+    bool varint(uint8_t b) {
+        if (shift_ > 28 || (shift_ == 28 && b > 0x0F)) { bad_ = true; return false; }
+        var_ |= (uint32_t)(b & 0x7F) << shift_;
+        shift_ += 7;
+        return !(b & 0x80);
+    }
+
+    bool done(Op& op) {
+        stage_ = TAG;
+        op.kind = kind_;
+        op.len = kind_ == LIT ? len_ + 1 : len_ + MIN_MATCH;
+        if (op.len < len_) { bad_ = true; return false; }               // wrapped
+        if (kind_ == NEW) op.from = var_;
+        if (kind_ == OLD) {
+            op.from = cursor_ + (uint32_t)((var_ >> 1) ^ (0u - (var_ & 1)));
+            cursor_ = op.from + op.len;
+        }
+        return true;
+    }
+
+    Stage    stage_ = TAG;
+    Kind     kind_ = LIT;
+    uint8_t  shift_ = 0;
+    bool     bad_ = false;
+    uint32_t len_ = 0, var_ = 0, cursor_ = 0;
+};
+
+} // namespace delta
@@ -0,0 +1,159 @@
+/*
+ pm_filter.h — streaming spike filter for PMS5003 frames (Hampel + slew limit)
+ ------------------------------------------------------------
+ Why: a checksummed frame is not necessarily a correct one. SoftwareSerial
+ at 9600 baud occasionally slips a bit, and a 16-bit additive checksum
+ misses two slips that cancel out (or one that lands in the checksum and
+ one in a value). Such a frame reads, for example, PM2.5 = 4107 between
+ two 11s. One of them in a 20-frame window adds ~200 µg/m³ to the published
+ mean.
+
+ • HampelFilter<N>: x is an outlier if it lies more than
+ k·1.4826·MAD + floor from the median of the previous N values, or of
+ the ones so far while the window fills, from the third on (MAD =
+ median absolute deviation, 1.4826·MAD ≈ σ for Gaussian noise). The floor
+ (an absolute part plus a share of the median) keeps a flat or near-zero
+ signal, where MAD is 0, from rejecting ordinary ±1 noise. The window takes
+ x whether or not it is rejected, so a real step gets through once it
+ fills half the window. A step's first N/2 + 1 frames are dropped (4 s at N = 7).
+ • SlewLimiter: clamps each step to ±maxStep. Optional: it also slows real
+ changes, so a one-frame spike costs (spike / maxStep) frames of error.
+ • SpikeFilter<CH, N>: one Hampel per channel of a frame. The frame is
+ rejected if any channel is an outlier: a bit slip does not corrupt one
+ number in a way that leaves its neighbours trustworthy. The first
+ MIN_JUDGE frames cannot be judged and are dropped (unjudged()), so
+ a spike right after power-on never reaches a sample, warm-up gate or not.
+
+ Cost: the window is kept sorted, so each value takes one O(N) delete and
+ insert, and the MAD is an O(N) walk outwards from the median; nothing is
+ ever sorted from scratch. N is small and fixed, so this is O(1) per frame:
+ a few dozen compares and moves per channel, in integers.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+struct HampelParams {
+    uint16_t k_x10    = 30;   // threshold in robust sigmas, × 10
+    uint16_t floorAbs = 10;   // plus this much, in the values' unit
+    uint8_t  floorPct = 25;   // plus this share of the median
+};
+
+template<size_t N>
+class HampelFilter {
+    static_assert(N % 2 == 1 && N >= 3, "the window needs an odd length for a median");
+public:
+    static constexpr size_t MIN_JUDGE = 3;   // values needed for a median that one spike cannot move
+
+    // True if x is an outlier against the previous N values, or against all
+    // so far once there are MIN_JUDGE of them. x then joins the window either way.
+    bool outlier(uint16_t x, const HampelParams& p) {
+        bool out = false;
+        if (n_ >= MIN_JUDGE) {
+            const uint32_t med = sorted_[(n_ - 1) / 2];
+            const uint32_t dev = x > med ? x - med : med - x;
+            const uint64_t thr = (uint64_t)p.k_x10 * 14826u * mad() / 100000u + p.floorAbs + med * p.floorPct / 100u;
+            out = dev > thr;
+        }
+        if (n_ == N) remove(ring_[head_]);
+        insert(x);
+        ring_[head_] = x;
+        head_ = (head_ + 1) % N;
+        return out;
+    }
+
+    uint16_t median() const  { return n_ ? sorted_[(n_ - 1) / 2] : 0; }
+    bool     full() const    { return n_ == N; }
+    bool     judging() const { return n_ >= MIN_JUDGE; }
+
+    // Median absolute deviation of the window so far: the (n/2+1)-th smallest
+    // |v - median|, by walking outwards from the median through both halves.
+    uint16_t mad() const {
+        const uint16_t med = sorted_[(n_ - 1) / 2];
+        size_t lo = (n_ - 1) / 2, hi = lo + 1;  // next candidates: sorted_[lo - 1], sorted_[hi]
+        uint16_t d = 0;                        // the median itself is the first, at distance 0
+        for (size_t k = 0; k < n_ / 2; ++k) {
+            const uint16_t dl = lo > 0 ? (uint16_t)(med - sorted_[lo - 1]) : 0xFFFF;
+            const uint16_t dh = hi < n_ ? (uint16_t)(sorted_[hi] - med) : 0xFFFF;
+            if (dl <= dh) { d = dl; --lo; } else { d = dh; ++hi; }
+        }
+        return d;
+    }
+
+private:
+    void remove(uint16_t v) {
+        size_t i = 0;
+        while (i < n_ && sorted_[i] != v) ++i;
+        memmove(&sorted_[i], &sorted_[i + 1], (n_ - i - 1) * sizeof(uint16_t));
+        --n_;
+    }
+    void insert(uint16_t v) {
+        size_t i = n_;
+        while (i > 0 && sorted_[i - 1] > v) { sorted_[i] = sorted_[i - 1]; --i; }
+        sorted_[i] = v;
+        ++n_;
+    }
+
+    uint16_t ring_[N] = {};
+    uint16_t sorted_[N] = {};
+    size_t   head_ = 0, n_ = 0;
+};
+
+// Clamps each step to ±maxStep (0 = off). True if it clamped.
+class SlewLimiter {
+public:
+    explicit SlewLimiter(uint16_t maxStep = 0) : max_(maxStep) {}
+    bool apply(uint16_t& x) {
+        if (!max_ || !has_) { last_ = x; has_ = true; return false; }
+        bool hit = false;
+        if (x > last_ && x - last_ > max_)      { x = (uint16_t)(last_ + max_); hit = true; }
+        else if (last_ > x && last_ - x > max_) { x = (uint16_t)(last_ - max_); hit = true; }
+        last_ = x;
+        return hit;
+    }
+private:
+    uint16_t max_;
+    uint16_t last_ = 0;
+    bool     has_ = false;
+};
+
+template<size_t CH, size_t N>
+class SpikeFilter {
+public:
+    explicit SpikeFilter(const HampelParams& p = HampelParams(), uint16_t slewMax = 0) : p_(p) {
+        for (size_t c = 0; c < CH; ++c) slew_[c] = SlewLimiter(slewMax);
+    }
+
+    // False: reject the frame. Otherwise v may have been slew-limited in place.
+    bool accept(uint16_t (&v)[CH]) {
+        ++frames_;
+        if (!hampel_[0].judging()) {           // nothing to judge against yet: fill, and drop
+            for (size_t c = 0; c < CH; ++c) hampel_[c].outlier(v[c], p_);
+            ++unjudged_;
+            return false;
+        }
+        bool out = false;
+        for (size_t c = 0; c < CH; ++c)
+            if (hampel_[c].outlier(v[c], p_)) { out = true; ++perChannel_[c]; }
+        if (out) { ++rejected_; return false; }
+        bool hit = false;
+        for (size_t c = 0; c < CH; ++c) hit |= slew_[c].apply(v[c]);
+        if (hit) ++limited_;
+        return true;
+    }
+
+    uint32_t frames() const             { return frames_; }
+    uint32_t rejected() const           { return rejected_; }
+    uint32_t unjudged() const           { return unjudged_; }
+    uint32_t limited() const            { return limited_; }
+    uint32_t rejectedBy(size_t c) const { return perChannel_[c]; }
+
+private:
+    HampelParams    p_;
+    HampelFilter<N> hampel_[CH];
+    SlewLimiter     slew_[CH];
+    uint32_t        frames_ = 0, rejected_ = 0, unjudged_ = 0, limited_ = 0;
+    uint32_t        perChannel_[CH] = {};
+};
@@ -0,0 +1,151 @@
+/*
+ pm_fixed.h — integer aggregates and decimal formatting
+ ------------------------------------------------------------
+ Why: the ESP8266 has no FPU. Promoting the PMS readings to float and
+ printing them with %.1f ran every sample through soft-float arithmetic and
+ the float branch of printf, which is the slowest path in the formatter and
+ one we don't otherwise need.
+
+ Everything here is integer-only:
+ • SampleStats — count, min, max, sum and sum of squares; mean, variance and
+ standard deviation come out scaled (scale 10 = tenths). The sums are exact,
+ so the one-pass variance formula has none of the cancellation it has in
+ floating point;
+ • Ema — exponential moving average with alpha = 2^-shift, kept in Q8;
+ • formatFixed() / appendFixed() — a scaled integer as decimal text,
+ formatFixed(123, 1) == "12.3", without printf.
+
+ Range: SampleStats is exact while count * sum(x²) * scale² stays below 2^64,
+ e.g. 3600 full-scale (65535) samples at scale 10.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pm_fstr.h"
+
+constexpr size_t FIXED_TEXT_MAX = 22;   // "-4294967295" with up to 9 decimals, plus NUL
+
+// x / 10 for the digit loop. Below 81920 it is a multiply and a shift, which
+// the lx106 does in a few cycles; a real division calls __udivsi3.
+inline uint32_t fixedDiv10(uint32_t x) {
+    return x < 81920u ? (x * 0xCCCDu) >> 19 : x / 10u;
+}
+
+// Writes v / 10^decimals as text ("-12.5", "0.0", "7") and returns its length.
+// out needs FIXED_TEXT_MAX bytes; decimals above 9 are clamped to 9.
+inline size_t formatFixed(char* out, int32_t v, uint8_t decimals) {
+    if (decimals > 9) decimals = 9;
+    char tmp[FIXED_TEXT_MAX];
+    size_t n = 0;
+    uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+    for (uint8_t i = 0; i < decimals; ++i) {
+        const uint32_t q = fixedDiv10(u);
+        tmp[n++] = (char)('0' + (u - q * 10u));
+        u = q;
+    }
+    if (decimals) tmp[n++] = '.';
+    do {
+        const uint32_t q = fixedDiv10(u);
+        tmp[n++] = (char)('0' + (u - q * 10u));
+        u = q;
+    } while (u);
+    if (v < 0) tmp[n++] = '-';
+    for (size_t i = 0; i < n; ++i) out[i] = tmp[n - 1 - i];
+    out[n] = '\0';
+    return n;
+}
+
+inline StrBuf& appendFixed(StrBuf& s, int32_t v, uint8_t decimals) {
+    char t[FIXED_TEXT_MAX];
+    return s.append(t, formatFixed(t, v, decimals));
+}
+
+// Integer square root, rounded down.
+inline uint32_t isqrt64(uint64_t x) {
+    uint64_t r = 0, bit = 1ull << 62;
+    while (bit > x) bit >>= 2;
+    while (bit) {
+        if (x >= r + bit) { x -= r + bit; r = (r >> 1) + bit; }
+        else r >>= 1;
+        bit >>= 2;
+    }
+    return (uint32_t)r;
+}
+
+class SampleStats {
+public:
+    void reset() { *this = SampleStats(); }
+
+    void add(uint16_t x) {
+        ++n_;
+        sum_ += x;
+        sq_  += (uint32_t)x * x;
+        if (x < min_) min_ = x;
+        if (x > max_) max_ = x;
+    }
+
+    uint32_t count() const { return n_; }
+    uint16_t min() const   { return n_ ? min_ : 0; }
+    uint16_t max() const   { return max_; }
+
+    // Mean * scale, rounded to nearest; 0 when empty.
+    uint32_t mean(uint32_t scale = 1) const {
+        return n_ ? (uint32_t)(((uint64_t)sum_ * scale + n_ / 2) / n_) : 0;
+    }
+
+    // Population variance * scale, rounded to nearest: (nΣx² − (Σx)²) / n².
+    // Saturates at 0xFFFFFFFF (full-scale noise at scale 10 exceeds 32 bits).
+    uint32_t variance(uint32_t scale = 1) const {
+        const uint64_t v = variance64(scale);
+        return v > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)v;
+    }
+
+    // Standard deviation * scale, rounded to nearest.
+    uint32_t stddev(uint32_t scale = 1) const {
+        const uint64_t v = variance64((uint64_t)scale * scale);
+        const uint32_t r = isqrt64(v);
+        return v - (uint64_t)r * r > r ? r + 1 : r;   // (r + ½)² = r² + r + ¼
+    }
+
+private:
+    uint64_t variance64(uint64_t scale) const {
+        if (n_ < 2) return 0;
+        const uint64_t n2  = (uint64_t)n_ * n_;
+        const uint64_t num = (uint64_t)n_ * sq_ - (uint64_t)sum_ * sum_;
+        return (num * scale + n2 / 2) / n2;
+    }
+
+    uint32_t n_   = 0;
+    uint32_t sum_ = 0;
+    uint64_t sq_  = 0;
+    uint16_t min_ = 0xFFFF;
+    uint16_t max_ = 0;
+};
+
+// s += (x − s) · 2^-shift. shift 4 (alpha 1/16) settles to 63% in 16 samples.
+class Ema {
+public:
+    static constexpr uint8_t FRAC = 8;   // Q8: a 1-unit step still moves the average
+
+    explicit Ema(uint8_t shift) : shift_(shift) {}
+
+    void add(uint16_t x) {
+        const int32_t q = (int32_t)x << FRAC;
+        if (!primed_) { acc_ = q; primed_ = true; return; }   // start at the first sample, not at 0
+        const int32_t half = shift_ ? 1 << (shift_ - 1) : 0;
+        acc_ += (q - acc_ + half) >> shift_;                     // arithmetic shift, rounded
+    }
+
+    bool     primed() const { return primed_; }
+    // Average * scale, rounded to nearest.
+    uint32_t value(uint32_t scale = 1) const {
+        return (uint32_t)(((uint64_t)acc_ * scale + (1u << (FRAC - 1))) >> FRAC);
+    }
+
+private:
+    int32_t acc_    = 0;
+    uint8_t shift_;
+    bool    primed_ = false;
+};
@@ -0,0 +1,156 @@
+/*
+ pm_fstr.h — fixed-capacity strings and a streaming text builder
+ ------------------------------------------------------------
+ Why: every topic, payload and portal page used to be assembled in an
+ Arduino String. Each += may realloc, a 2 KB page needs 2 KB of contiguous
+ heap, and after a few days of publishing the heap is fragmented enough
+ that the first page request after a reconnect fails to allocate.
+
+ Two pieces:
+ • StrBuf — a view over a caller-owned char buffer: bounded append,
+ printf-into, no allocation. Helpers take StrBuf&, so they are compiled
+ once, not once per capacity.
+ • FixedString<N> — a StrBuf that owns N chars (+ terminator), for locals
+ and members.
+
+ Overflow policy: without a sink, text past the capacity is dropped and
+ truncated() stays set; the result is always NUL-terminated. With a sink
+ (setSink), a full buffer is handed to the sink and reused, so a page of
+ any length streams out through a window of N bytes.
+
+ The *_P overloads exist only when <pgmspace.h> was included first (PGM_P
+ is defined, as in the firmware and the host HAL); they read PSTR()/F()
+ strings from flash. Without it StrBuf takes RAM strings only.
+ */
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+class StrBuf {
+public:
+    typedef void (*Sink)(void* ctx, const char* data, size_t len);
+
+    // cap includes the terminator.
+    StrBuf(char* buf, size_t cap) : buf_(buf), cap_(cap) { buf_[0] = '\0'; }
+    StrBuf(const StrBuf&) = delete;
+    StrBuf& operator=(const StrBuf&) = delete;
+
+    const char* c_str() const     { return buf_; }
+    size_t      length() const    { return len_; }
+    size_t      capacity() const  { return cap_ - 1; }
+    bool        empty() const     { return len_ == 0; }
+    bool        truncated() const { return truncated_; }
+    void        clear()           { len_ = 0; buf_[0] = '\0'; truncated_ = false; }
+
+    StrBuf& append(const char* s, size_t n) {
+        while (n) {
+            size_t k = room();
+            if (!k && !drain()) { truncated_ = true; break; }
+            k = room();
+            if (k > n) k = n;
+            memcpy(buf_ + len_, s, k);
+            len_ += k; s += k; n -= k;
+        }
+        buf_[len_] = '\0';
+        return *this;
+    }
+    StrBuf& append(const char* s) { return s ? append(s, strlen(s)) : *this; }
+    StrBuf& append(char c)        { return append(&c, 1); }
+    StrBuf& append(const StrBuf& o) { return append(o.buf_, o.len_); }
+
+    StrBuf& vappendf(const char* fmt, va_list ap) {
+        va_list again; va_copy(again, ap);
+        const int n = vsnprintf(buf_ + len_, cap_ - len_, fmt, ap);
+        if (n >= 0 && (size_t)n >= cap_ - len_ && sink_ && len_) {
+            flush();                                  // retry into an empty window
+            vsnprintf(buf_, cap_, fmt, again);
+        }
+        va_end(again);
+        commit(n);
+        return *this;
+    }
+    StrBuf& appendf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        va_list ap; va_start(ap, fmt); vappendf(fmt, ap); va_end(ap);
+        return *this;
+    }
+
+    StrBuf& operator+=(const char* s)    { return append(s); }
+    StrBuf& operator+=(char c)           { return append(c); }
+    StrBuf& operator+=(const StrBuf& o)  { return append(o); }
+
+#ifdef PGM_P
+    StrBuf& append_P(PGM_P s, size_t n) {
+        while (n) {
+            size_t k = room();
+            if (!k && !drain()) { truncated_ = true; break; }
+            k = room();
+            if (k > n) k = n;
+            memcpy_P(buf_ + len_, s, k);
+            len_ += k; s += k; n -= k;
+        }
+        buf_[len_] = '\0';
+        return *this;
+    }
+    StrBuf& append_P(PGM_P s) { return s ? append_P(s, strlen_P(s)) : *this; }
+
+    StrBuf& appendf_P(PGM_P fmt, ...) {
+        va_list ap, again; va_start(ap, fmt); va_copy(again, ap);
+        const int n = vsnprintf_P(buf_ + len_, cap_ - len_, fmt, ap);
+        if (n >= 0 && (size_t)n >= cap_ - len_ && sink_ && len_) {
+            flush();
+            vsnprintf_P(buf_, cap_, fmt, again);
+        }
+        va_end(again); va_end(ap);
+        commit(n);
+        return *this;
+    }
+
+    StrBuf& append(const __FlashStringHelper* s)     { return append_P(reinterpret_cast<PGM_P>(s)); }
+    StrBuf& operator+=(const __FlashStringHelper* s) { return append(s); }
+#endif
+
+    // Streaming mode: full buffers go to fn(ctx, data, len) instead of being cut off.
+    void setSink(Sink fn, void* ctx) { sink_ = fn; ctx_ = ctx; }
+
+    // Hands whatever is buffered to the sink. No-op without one.
+    void flush() {
+        if (!sink_ || !len_) return;
+        sink_(ctx_, buf_, len_);
+        len_ = 0; buf_[0] = '\0';
+    }
+
+private:
+    size_t room() const { return cap_ - 1 - len_; }
+    bool   drain()      { if (!sink_) return false; flush(); return true; }
+
+    // n = what vsnprintf wanted to write; whatever did not fit is dropped.
+    void commit(int n) {
+        if (n < 0) { buf_[len_] = '\0'; return; }
+        if (len_ + (size_t)n > cap_ - 1) { truncated_ = true; len_ = cap_ - 1; }
+        else len_ += (size_t)n;
+    }
+
+    char*  buf_;
+    size_t cap_;
+    size_t len_ = 0;
+    bool   truncated_ = false;
+    Sink   sink_ = nullptr;
+    void*  ctx_  = nullptr;
+};
+
+template<size_t N>
+class FixedString : public StrBuf {
+public:
+    FixedString() : StrBuf(data_, N + 1) {}
+    explicit FixedString(const char* s) : FixedString() { append(s); }
+    FixedString(const FixedString& o) : FixedString() { append(o); }
+    FixedString& operator=(const FixedString& o) { if (this != &o) { clear(); append(o); } return *this; }
+    FixedString& operator=(const char* s) { clear(); append(s); return *this; }
+
+private:
+    char data_[N + 1];
+};
@@ -0,0 +1,191 @@
+/*
+ pm_i2cbus.h — shared I2C bus: transaction queue with per-device timing
+ ------------------------------------------------------------
+ Why: the BME280 and the Sunrise share SDA/SCL, and the core's Wire blocks
+ for every transfer (it bit-bangs). A driver that runs its transfers back to
+ back holds loop() for their sum, and two drivers whose timers fall in the
+ same pass add up. Here drivers queue transactions instead; loop() runs at
+ most one per pass, so the UART and the sockets are polled between any two
+ transfers and a pass blocks for one transaction at worst (~2.6 ms for the
+ Sunrise's 26-byte start command at 100 kHz).
+
+ • A transaction is one write, optionally followed by a repeated START and
+ a read: enough for "set register pointer, read n" and for burst writes.
+ The caller owns the I2cTxn (one per driver) and sees its state go
+ QUEUED → DONE / FAILED.
+ • Devices that sleep between transactions (Sunrise: NACKs its address
+ once to wake, then answers for 15 ms) are registered with their wake
+ window. The bus sends the wake-up itself whenever the window has lapsed,
+ immediately before the transfer, so the 15 ms can never be missed however
+ the queue is interleaved.
+ • A device's notify callback runs when one of its transactions completes,
+ so the driver's timer can be re-armed instead of polling.
+ • Per device: transactions, errors, wake-ups, queue wait and bus time
+ (total and worst), in µs.
+
+ runNow() executes a transaction synchronously, for probes at boot. Fixed
+ capacity. Wire is any TwoWire-like class: the core's on the device, the
+ HAL's fake bus on the host.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+struct I2cTxn {
+    enum State : uint8_t { IDLE, QUEUED, DONE, FAILED };
+    static constexpr size_t MAX = 32;   // the core's Wire buffer
+
+    uint8_t  addr  = 0;
+    uint8_t  wlen  = 0;       // bytes of buf to write
+    uint8_t  rlen  = 0;       // then bytes to read back into buf (0 = write only)
+    State    state = IDLE;
+    uint8_t  buf[MAX];
+    uint32_t queuedUs = 0;
+
+    bool busy() const { return state == QUEUED; }
+
+    // Register read: write reg, repeated START, read n bytes into buf.
+    void read(uint8_t a, uint8_t reg, size_t n) {
+        addr = a; buf[0] = reg; wlen = 1; rlen = (uint8_t)(n > MAX ? MAX : n);
+    }
+    // Plain write of n bytes (register address first).
+    void write(uint8_t a, const uint8_t* p, size_t n) {
+        addr = a; wlen = (uint8_t)(n > MAX ? MAX : n); rlen = 0;
+        memcpy(buf, p, wlen);
+    }
+};
+
+template<typename Wire, size_t QUEUE = 4, size_t DEVICES = 4>
+class I2cBus {
+public:
+    typedef unsigned long (*Clock)();   // micros()-compatible
+    typedef void (*Notify)();
+
+    struct Device {
+        const char* name;         // may be a PSTR(); read it with the *_P functions
+        uint8_t     addr;
+        uint32_t    wakeWindowUs; // 0 = always awake
+        Notify      notify;
+        uint32_t    txns, errors, wakes;
+        uint64_t    waitUs, busUs;
+        uint32_t    waitMaxUs, busMaxUs;
+        uint32_t    lastUs;       // end of the last transfer
+        bool        talked;       // lastUs is valid
+    };
+
+    // Margin kept inside a device's wake window: clock granularity and the
+    // time between the window check and the first address byte.
+    static constexpr uint32_t WAKE_MARGIN_US = 2000;
+
+    I2cBus(Wire& wire, Clock micros) : w_(wire), micros_(micros) {}
+
+    // Registers (or updates) a device. Unregistered addresses work too and get
+    // an anonymous entry while there is room.
+    void device(uint8_t addr, const char* name, uint32_t wakeWindowUs = 0, Notify notify = nullptr) {
+        Device* d = find(addr, true);
+        if (!d) return;
+        d->name = name;
+        d->wakeWindowUs = wakeWindowUs;
+        d->notify = notify;
+    }
+
+    // Queues t. False if it is already queued or the queue is full.
+    bool submit(I2cTxn& t) {
+        if (t.busy()) return false;
+        if (n_ >= QUEUE) { ++overflows_; return false; }
+        t.state = I2cTxn::QUEUED;
+        t.queuedUs = (uint32_t)micros_();
+        q_[(head_ + n_++) % QUEUE] = &t;
+        if (n_ > depthMax_) depthMax_ = (uint8_t)n_;
+        return true;
+    }
+
+    // Runs the oldest queued transaction, if any. Call once per loop() pass.
+    bool service() {
+        if (!n_) return false;
+        I2cTxn& t = *q_[head_];
+        head_ = (head_ + 1) % QUEUE;
+        --n_;
+        exec(t);
+        Device* d = find(t.addr, false);
+        if (d && d->notify) d->notify();
+        return true;
+    }
+
+    // Synchronous, bypassing the queue (probes and setup only).
+    bool runNow(I2cTxn& t) {
+        t.queuedUs = (uint32_t)micros_();
+        exec(t);
+        return t.state == I2cTxn::DONE;
+    }
+
+    bool          pending() const         { return n_ != 0; }
+    size_t        devices() const         { return nDev_; }
+    const Device& dev(size_t i) const     { return dev_[i]; }
+    uint32_t      overflows() const       { return overflows_; }
+    uint8_t       depthMax() const        { return depthMax_; }
+
+private:
+    Device* find(uint8_t addr, bool create) {
+        for (size_t i = 0; i < nDev_; ++i) if (dev_[i].addr == addr) return &dev_[i];
+        if (!create || nDev_ >= DEVICES) return nullptr;
+        Device& d = dev_[nDev_++];
+        d = Device{};
+        d.name = nullptr;
+        d.addr = addr;
+        return &d;
+    }
+
+    bool awake(const Device& d, uint32_t now) const {
+        return !d.wakeWindowUs || (d.talked && now - d.lastUs + WAKE_MARGIN_US < d.wakeWindowUs);
+    }
+
+    // START + address + STOP; a sleeping device NACKs it and wakes up.
+    void wake(Device& d) {
+        w_.beginTransmission(d.addr);
+        w_.endTransmission();
+        ++d.wakes;
+    }
+
+    bool transfer(I2cTxn& t) {
+        w_.beginTransmission(t.addr);
+        w_.write(t.buf, t.wlen);
+        if (!t.rlen) return w_.endTransmission() == 0;
+        if (w_.endTransmission(false) != 0) return false;                 // repeated START
+        if (w_.requestFrom(t.addr, t.rlen) != t.rlen) return false;
+        for (size_t i = 0; i < t.rlen; ++i) t.buf[i] = (uint8_t)w_.read();
+        return true;
+    }
+
+    void exec(I2cTxn& t) {
+        Device* d = find(t.addr, true);
+        const uint32_t start = (uint32_t)micros_();
+        bool woke = false;
+        if (d && !awake(*d, start)) { wake(*d); woke = true; }
+        bool ok = transfer(t);
+        if (!ok && d && d->wakeWindowUs && !woke) { wake(*d); ok = transfer(t); }   // it slept early: once more
+        const uint32_t end = (uint32_t)micros_();
+        t.state = ok ? I2cTxn::DONE : I2cTxn::FAILED;
+        if (!d) return;
+        const uint32_t wait = start - t.queuedUs, bus = end - start;
+        ++d->txns;
+        if (!ok) ++d->errors;
+        d->waitUs += wait;
+        d->busUs  += bus;
+        if (wait > d->waitMaxUs) d->waitMaxUs = wait;
+        if (bus > d->busMaxUs)   d->busMaxUs = bus;
+        d->lastUs = end;
+        d->talked = ok;
+    }
+
+    Wire&    w_;
+    Clock    micros_;
+    I2cTxn*  q_[QUEUE] = {};
+    size_t   head_ = 0, n_ = 0;
+    Device   dev_[DEVICES] = {};
+    size_t   nDev_ = 0;
+    uint32_t overflows_ = 0;
+    uint8_t  depthMax_ = 0;
+};
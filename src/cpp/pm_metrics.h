@@ -0,0 +1,187 @@
+/*
+ pm_metrics.h — OpenMetrics text exposition and fixed-bucket histograms
+ ------------------------------------------------------------
+ Why: node health (heap, RSSI, loop timing, frame errors, reconnects) was
+ only on the /status page and in the serial log. Neither can be scraped,
+ so the monitoring stack saw a node only when its samples stopped.
+
+ Two pieces:
+ • om::Writer writes metric families into a StrBuf in the OpenMetrics 1.0
+ text format: "# TYPE", "# UNIT" and "# HELP", one line per sample, and
+ "# EOF" at the end. Names, units, help texts and labels are flash
+ strings (PSTR() at the call site), so a family costs no RAM. Label
+ values are written as they are, so they must not need escaping.
+ • UsHistogram<N> counts durations in µs into N buckets, plus +Inf, with
+ a count and a sum. The bounds live in flash; observe() is a short scan,
+ cheap enough for every loop() pass.
+
+ Numbers go out without printf or float: a scaled integer (tenths, µs)
+ is written as a decimal. With a sink on the StrBuf a scrape streams out
+ through its window and allocates nothing, however many families there
+ are. On the device the flash strings need <pgmspace.h>, included before
+ this header; without it (host tools) PROGMEM and pgm_read_dword fall back
+ to plain arrays and reads.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pm_fstr.h"
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_dword
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#endif
+
+namespace om {
+
+enum Type : uint8_t { GAUGE, COUNTER, HISTOGRAM };
+
+// OpenMetrics content type for the HTTP response.
+static const char kContentType[] PROGMEM = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+// The fixed text, as named arrays: PSTR() cannot be used in inline functions.
+static const char kType[] PROGMEM      = "# TYPE ";
+static const char kUnit[] PROGMEM      = "# UNIT ";
+static const char kHelp[] PROGMEM      = "# HELP ";
+static const char kGauge[] PROGMEM     = "gauge\n";
+static const char kCounter[] PROGMEM   = "counter\n";
+static const char kHistogram[] PROGMEM = "histogram\n";
+static const char kTotal[] PROGMEM     = "_total";
+static const char kBucket[] PROGMEM    = "_bucket{le=\"";
+static const char kInf[] PROGMEM       = "+Inf";
+static const char kCount[] PROGMEM     = "_count ";
+static const char kSum[] PROGMEM       = "_sum ";
+static const char kLabelEq[] PROGMEM   = "=\"";
+static const char kLabelEnd[] PROGMEM  = "\"} ";
+static const char kEof[] PROGMEM       = "# EOF\n";
+
+template<size_t N>
+class UsHistogram {
+public:
+    // bounds: N ascending upper bounds in µs, in flash.
+    explicit UsHistogram(const uint32_t* bounds) : bounds_(bounds) {}
+
+    void observe(uint32_t us) {
+        size_t i = 0;
+        while (i < N && us > pgm_read_dword(bounds_ + i)) ++i;
+        ++counts_[i];
+        ++count_;
+        sumUs_ += us;
+    }
+
+    static constexpr size_t buckets() { return N; }
+    uint32_t bound(size_t i) const    { return pgm_read_dword(bounds_ + i); }
+    uint32_t inBucket(size_t i) const { return counts_[i]; }      // i == N: above the last bound
+    uint32_t count() const            { return count_; }
+    uint64_t sumUs() const            { return sumUs_; }
+
+private:
+    const uint32_t* bounds_;
+    uint32_t counts_[N + 1] = {};
+    uint32_t count_ = 0;
+    uint64_t sumUs_ = 0;
+};
+
+// v / 10^decimals as a decimal; with trim, trailing zeros after the point go
+// (down to one: "0.5", "1.0").
+inline void appendScaled(StrBuf& out, uint64_t v, uint8_t decimals, bool trim = false) {
+    char t[32];
+    size_t n = 0;
+    for (uint8_t i = 0; i < decimals; ++i) {
+        const char d = (char)('0' + v % 10);
+        v /= 10;
+        if (trim && n == 0 && d == '0' && i + 1 < decimals) continue;
+        t[n++] = d;
+    }
+    if (decimals) t[n++] = '.';
+    do { t[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+    while (n) out += t[--n];
+}
+
+inline void appendScaled(StrBuf& out, int32_t v, uint8_t decimals) {
+    if (v < 0) out += '-';
+    appendScaled(out, (uint64_t)(v < 0 ? 0u - (uint32_t)v : (uint32_t)v), decimals);
+}
+
+class Writer {
+public:
+    explicit Writer(StrBuf& out) : out_(out) {}
+
+    // Starts a family. name, unit (nullptr: none; else name ends in _<unit>)
+    // and help are flash strings.
+    void family(const char* name, Type type, const char* unit, const char* help) {
+        name_ = name;
+        text(kType); text(name); out_ += ' ';
+        text(type == GAUGE ? kGauge : type == COUNTER ? kCounter : kHistogram);
+        if (unit) { text(kUnit); text(name); out_ += ' '; text(unit); out_ += '\n'; }
+        text(kHelp); text(name); out_ += ' '; text(help); out_ += '\n';
+    }
+
+    // A gauge sample: v / 10^decimals, with an optional label (flash strings).
+    void gauge(int32_t v, uint8_t decimals = 0, const char* label = nullptr, const char* value = nullptr) {
+        begin(nullptr, label, value);
+        appendScaled(out_, v, decimals);
+        out_ += '\n';
+    }
+
+    // A counter sample (name_total).
+    void counter(uint32_t v, const char* label = nullptr, const char* value = nullptr) {
+        begin(kTotal, label, value);
+        appendScaled(out_, (uint64_t)v, 0);
+        out_ += '\n';
+    }
+
+    // A counter sample labelled with a byte in hex ("0x76"), for I2C addresses.
+    void counterHex(uint32_t v, const char* label, uint8_t value) {
+        text(name_); text(kTotal);
+        out_ += '{'; text(label); text(kLabelEq);
+        out_ += '0'; out_ += 'x'; out_ += hexDigit(value >> 4); out_ += hexDigit(value & 0xF);
+        text(kLabelEnd);
+        appendScaled(out_, (uint64_t)v, 0);
+        out_ += '\n';
+    }
+
+    // The bucket, count and sum lines of a histogram in seconds.
+    template<size_t N>
+    void histogram(const UsHistogram<N>& h) {
+        uint32_t cum = 0;
+        for (size_t i = 0; i <= N; ++i) {
+            cum += h.inBucket(i);
+            text(name_); text(kBucket);
+            if (i < N) appendScaled(out_, (uint64_t)h.bound(i), 6, true);
+            else       text(kInf);
+            text(kLabelEnd);
+            appendScaled(out_, (uint64_t)cum, 0);
+            out_ += '\n';
+        }
+        text(name_); text(kCount); appendScaled(out_, (uint64_t)h.count(), 0); out_ += '\n';
+        text(name_); text(kSum);   appendScaled(out_, h.sumUs(), 6, true);      out_ += '\n';
+    }
+
+    void eof() { text(kEof); }
+
+private:
+    void begin(const char* suffix, const char* label, const char* value) {
+        text(name_);
+        if (suffix) text(suffix);
+        if (label) { out_ += '{'; text(label); text(kLabelEq); text(value); text(kLabelEnd); }
+        else out_ += ' ';
+    }
+
+    static char hexDigit(uint8_t d) { return (char)(d < 10 ? '0' + d : 'A' + d - 10); }
+
+#ifdef PGM_P
+    void text(const char* s) { out_.append_P(s); }
+#else
+    void text(const char* s) { out_.append(s); }
+#endif
+
+    StrBuf&     out_;
+    const char* name_ = nullptr;
+};
+
+} // namespace om
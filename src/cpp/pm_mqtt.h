@@ -0,0 +1,451 @@
+/*
+ pm_mqtt.h — minimal MQTT 3.1.1 client + at-least-once publish queue
+ ------------------------------------------------------------
+ Why this exists:
+ • PubSubClient only publishes QoS0 and silently discards PUBACKs, so the
+ firmware could never tell whether a measurement reached the broker.
+ • Its connect() blocks for up to 15 s waiting for CONNACK; here the
+ handshake completes inside loop() like everything else.
+
+ Design notes:
+ • The transport is a template parameter (anything with WiFiClient's
+ connect/write/read/available/connected/stop) and time comes from an
+ injected clock, so the same code runs in host tools.
+ • Separate RX/TX buffers: a message callback may publish while the
+ incoming packet is still being looked at.
+ • Clean sessions only. After a reconnect the queue simply re-sends
+ everything that was not acknowledged (at-least-once, not exactly-once).
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace mqtt {
+
+// Fixed header packet types (upper nibble).
+enum : uint8_t {
+    CONNECT    = 0x10,
+    CONNACK    = 0x20,
+    PUBLISH    = 0x30,
+    PUBACK     = 0x40,
+    SUBSCRIBE  = 0x80,
+    SUBACK     = 0x90,
+    PINGREQ    = 0xC0,
+    PINGRESP   = 0xD0,
+    DISCONNECT = 0xE0
+};
+
+// Same numbering as PubSubClient::state() so existing "rc=%d" logs keep their meaning.
+// Positive values 1..5 are CONNACK refusal codes straight from the broker.
+enum : int {
+    CONNECTION_TIMEOUT = -4,
+    CONNECTION_LOST    = -3,
+    CONNECT_FAILED     = -2,
+    DISCONNECTED       = -1,
+    CONNECTED          = 0
+};
+
+// ------------------------------- Encoding ----------------------------------
+inline size_t remLenSize(uint32_t len) {
+    return len < 128u ? 1 : len < 16384u ? 2 : len < 2097152u ? 3 : 4;
+}
+
+inline size_t putRemLen(uint8_t* p, uint32_t len) {
+    size_t n = 0;
+    do {
+        uint8_t d = len % 128; len /= 128;
+        if (len) d |= 0x80;
+        p[n++] = d;
+    } while (len && n < 4);
+    return n;
+}
+
+inline size_t putU16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; return 2; }
+
+inline size_t putStr(uint8_t* p, const char* s, size_t n) {
+    putU16(p, (uint16_t)n);
+    memcpy(p + 2, s, n);
+    return n + 2;
+}
+
+// Every encoder returns the packet length, or 0 if it does not fit in `cap`.
+inline size_t encodeConnect(uint8_t* buf, size_t cap, const char* id,
+                            const char* user, const char* pass, uint16_t keepAliveS) {
+    const size_t idLen = strlen(id);
+    const size_t uLen  = (user && *user) ? strlen(user) : 0;
+    const size_t pLen  = (uLen && pass && *pass) ? strlen(pass) : 0; // 3.1.1: no password without user
+    uint8_t flags = 0x02;                                           // clean session
+    uint32_t rem = 10 + 2 + idLen;
+    if (uLen) { flags |= 0x80; rem += 2 + uLen; }
+    if (pLen) { flags |= 0x40; rem += 2 + pLen; }
+    if (1 + remLenSize(rem) + rem > cap) return 0;
+
+    size_t n = 0;
+    buf[n++] = CONNECT;
+    n += putRemLen(buf + n, rem);
+    n += putStr(buf + n, "MQTT", 4);
+    buf[n++] = 4;                       // protocol level 3.1.1
+    buf[n++] = flags;
+    n += putU16(buf + n, keepAliveS);
+    n += putStr(buf + n, id, idLen);
+    if (uLen) n += putStr(buf + n, user, uLen);
+    if (pLen) n += putStr(buf + n, pass, pLen);
+    return n;
+}
+
+inline size_t encodePublish(uint8_t* buf, size_t cap, const char* topic,
+                            const uint8_t* payload, size_t plen,
+                            uint8_t qos, bool retain, bool dup, uint16_t packetId) {
+    const size_t tLen = strlen(topic);
+    const uint32_t rem = 2 + tLen + (qos ? 2 : 0) + plen;
+    if (1 + remLenSize(rem) + rem > cap) return 0;
+
+    size_t n = 0;
+    buf[n++] = PUBLISH | (dup ? 0x08 : 0) | (uint8_t)((qos & 0x03) << 1) | (retain ? 0x01 : 0);
+    n += putRemLen(buf + n, rem);
+    n += putStr(buf + n, topic, tLen);
+    if (qos) n += putU16(buf + n, packetId);
+    if (plen) memcpy(buf + n, payload, plen);
+    return n + plen;
+}
+
+inline size_t encodeSubscribe(uint8_t* buf, size_t cap, uint16_t packetId,
+                              const char* topic, uint8_t qos) {
+    const size_t tLen = strlen(topic);
+    const uint32_t rem = 2 + 2 + tLen + 1;
+    if (1 + remLenSize(rem) + rem > cap) return 0;
+
+    size_t n = 0;
+    buf[n++] = SUBSCRIBE | 0x02;        // reserved bits are mandatory here
+    n += putRemLen(buf + n, rem);
+    n += putU16(buf + n, packetId);
+    n += putStr(buf + n, topic, tLen);
+    buf[n++] = qos & 0x03;
+    return n;
+}
+
+// Two-byte acknowledgements (PUBACK, CONNACK payload is built by brokers only).
+inline size_t encodeAck(uint8_t* buf, uint8_t type, uint16_t packetId) {
+    buf[0] = type; buf[1] = 2;
+    putU16(buf + 2, packetId);
+    return 4;
+}
+
+inline size_t encodeEmpty(uint8_t* buf, uint8_t type) { buf[0] = type; buf[1] = 0; return 2; }
+
+// ------------------------------- Decoding ----------------------------------
+// Incremental packet assembler: feed bytes as they arrive, it reports when a
+// complete packet is buffered. Oversized packets are consumed and flagged as
+// truncated rather than overflowing the buffer.
+class PacketReader {
+public:
+    PacketReader(uint8_t* buf, size_t cap) : buf_(buf), cap_(cap) {}
+
+    void reset() { stage_ = 0; }
+
+    bool feed(uint8_t b) {
+        switch (stage_) {
+            case 0:
+                header_ = b; remLen_ = 0; mult_ = 1; got_ = 0; lenBytes_ = 0;
+                stage_ = 1;
+                return false;
+            case 1:
+                remLen_ += (uint32_t)(b & 0x7F) * mult_;
+                mult_ *= 128;
+                if (b & 0x80) {
+                    if (++lenBytes_ >= 4) stage_ = 0; // malformed length, resync on next byte
+                    return false;
+                }
+                if (remLen_ == 0) { stage_ = 0; return true; }
+                stage_ = 2;
+                return false;
+            default:
+                if (got_ < cap_) buf_[got_] = b;
+                if (++got_ == remLen_) { stage_ = 0; return true; }
+                return false;
+        }
+    }
+
+    uint8_t  header() const    { return header_; }
+    uint8_t  type() const      { return header_ & 0xF0; }
+    uint32_t length() const    { return remLen_; }
+    bool     truncated() const { return remLen_ > cap_; }
+    uint8_t* data() const      { return buf_; }
+
+private:
+    uint8_t* buf_;
+    size_t   cap_;
+    uint8_t  stage_    = 0;
+    uint8_t  header_   = 0;
+    uint8_t  lenBytes_ = 0;
+    uint32_t remLen_   = 0;
+    uint32_t mult_     = 1;
+    uint32_t got_      = 0;
+};
+
+inline uint16_t getU16(const uint8_t* p) { return (uint16_t)p[0] << 8 | p[1]; }
+
+// -------------------------------- Client -----------------------------------
+// PubSubClient-shaped API (setServer/connect/connected/loop/publish/subscribe/
+// state/setCallback) plus QoS1 publish and a PUBACK hook.
+template <class Net, size_t BufSize = 256>
+class Client {
+public:
+    typedef void     (*MessageCallback)(char* topic, uint8_t* payload, unsigned int length);
+    typedef void     (*AckCallback)(uint16_t packetId);
+    typedef unsigned long (*Clock)();   // millis()-compatible
+
+    Client(Net& net, Clock clock) : net_(net), clock_(clock), reader_(rx_, sizeof(rx_)) {}
+
+    void setServer(const char* host, uint16_t port) { host_ = host; port_ = port; }
+    void setKeepAlive(uint16_t seconds)             { keepAliveS_ = seconds; }
+    void setCallback(MessageCallback cb)            { onMessage_ = cb; }
+    void setAckCallback(AckCallback cb)             { onAck_ = cb; }
+
+    // Opens the socket and sends CONNECT. Returns false only if that failed;
+    // the session is usable once connected() turns true after CONNACK.
+    bool connect(const char* id, const char* user, const char* pass) {
+        if (net_.connected()) net_.stop();
+        connected_ = connecting_ = pingOutstanding_ = false;
+        reader_.reset();
+        if (!host_ || !net_.connect(host_, port_)) { state_ = CONNECT_FAILED; return false; }
+        size_t n = encodeConnect(tx_, sizeof(tx_), id, user, pass, keepAliveS_);
+        if (!n || !send(n)) { net_.stop(); state_ = CONNECT_FAILED; return false; }
+        lastIn_ = lastOut_;
+        connecting_ = true;
+        state_ = DISCONNECTED;
+        return true;
+    }
+
+    bool connected() {
+        if (connected_ && !net_.connected()) drop(CONNECTION_LOST);
+        return connected_;
+    }
+    bool connecting() const { return connecting_; }
+    int  state() const { return state_; }
+
+    void disconnect() {
+        if (connected_) send(encodeEmpty(tx_, DISCONNECT));
+        net_.stop();
+        connected_ = connecting_ = false;
+        state_ = DISCONNECTED;
+    }
+
+    // Drains the socket, dispatches complete packets and keeps the session alive.
+    // Returns true while the session is up.
+    bool loop() {
+        if (!connected_ && !connecting_) return false;
+        if (!net_.connected()) { drop(CONNECTION_LOST); return false; }
+
+        while (net_.available() > 0) {
+            int b = net_.read();
+            if (b < 0) break;
+            if (reader_.feed((uint8_t)b)) dispatch();
+            if (!connected_ && !connecting_) return false; // refused or dropped mid-read
+        }
+
+        const uint32_t now   = clock_();
+        const uint32_t kaMs  = (uint32_t)keepAliveS_ * 1000u;
+        if (connecting_) {
+            if (now - lastOut_ >= kHandshakeTimeoutMs) drop(CONNECTION_TIMEOUT);
+        } else if (now - lastIn_ >= kaMs + kaMs / 2) {
+            drop(CONNECTION_TIMEOUT);                  // broker went silent
+        } else if (!pingOutstanding_ && (now - lastOut_ >= kaMs || now - lastIn_ >= kaMs)) {
+            pingOutstanding_ = send(encodeEmpty(tx_, PINGREQ));
+        }
+        return connected_;
+    }
+
+    // QoS0, PubSubClient-compatible.
+    bool publish(const char* topic, const char* payload, bool retained = false) {
+        return publish(topic, (const uint8_t*)payload, strlen(payload), 0, retained, false, 0);
+    }
+
+    // QoS0/1. For QoS1 the caller owns the packet id and the retry policy
+    // (see PublishQueue); a retransmission reuses the id with dup = true.
+    bool publish(const char* topic, const uint8_t* payload, size_t len,
+                 uint8_t qos, bool retained, bool dup, uint16_t packetId) {
+        if (!connected()) return false;
+        size_t n = encodePublish(tx_, sizeof(tx_), topic, payload, len, qos, retained, dup, packetId);
+        return n && send(n);
+    }
+
+    bool subscribe(const char* topic, uint8_t qos = 0) {
+        if (!connected()) return false;
+        size_t n = encodeSubscribe(tx_, sizeof(tx_), nextPacketId(), topic, qos);
+        return n && send(n);
+    }
+
+    uint16_t nextPacketId() {
+        if (++packetId_ == 0) packetId_ = 1; // 0 is not a valid packet id
+        return packetId_;
+    }
+
+private:
+    static constexpr uint32_t kHandshakeTimeoutMs = 10000;
+
+    bool send(size_t n) {
+        lastOut_ = clock_();
+        return net_.write(tx_, n) == n;
+    }
+
+    void drop(int why) {
+        net_.stop();
+        connected_ = connecting_ = pingOutstanding_ = false;
+        state_ = why;
+    }
+
+    void dispatch() {
+        lastIn_ = clock_();
+        if (reader_.truncated()) return;   // larger than BufSize: skip, keep the session
+        const uint8_t* d = reader_.data();
+        const uint32_t len = reader_.length();
+        switch (reader_.type()) {
+            case CONNACK:
+                if (!connecting_ || len < 2) return;
+                connecting_ = false;
+                if (d[1] == 0) { connected_ = true; state_ = CONNECTED; }
+                else { net_.stop(); state_ = d[1]; }
+                return;
+            case PUBACK:
+                if (len >= 2 && onAck_) onAck_(getU16(d));
+                return;
+            case PINGRESP:
+                pingOutstanding_ = false;
+                return;
+            case PUBLISH: {
+                if (len < 2) return;
+                const uint8_t qos = (reader_.header() >> 1) & 0x03;
+                uint16_t tLen = getU16(d);
+                size_t off = 2 + tLen + (qos ? 2 : 0);
+                if (off > len) return;
+                if (qos == 1) {
+                    uint8_t ack[4];
+                    encodeAck(ack, PUBACK, getU16(d + 2 + tLen));
+                    lastOut_ = clock_();
+                    net_.write(ack, sizeof(ack));
+                }
+                // Shift the topic left over its length prefix to NUL-terminate it in place.
+                memmove(reader_.data(), d + 2, tLen);
+                reader_.data()[tLen] = '\0';
+                if (onMessage_) onMessage_((char*)reader_.data(), reader_.data() + off, len - off);
+                return;
+            }
+            default:
+                return;                    // SUBACK and friends: nothing to track
+        }
+    }
+
+    Net&            net_;
+    Clock           clock_;
+    const char*     host_ = nullptr;
+    uint16_t        port_ = 1883;
+    uint16_t        keepAliveS_ = 15;
+    uint16_t        packetId_ = 0;
+    int             state_ = DISCONNECTED;
+    bool            connected_ = false;
+    bool            connecting_ = false;
+    bool            pingOutstanding_ = false;
+    uint32_t        lastIn_ = 0;
+    uint32_t        lastOut_ = 0;
+    MessageCallback onMessage_ = nullptr;
+    AckCallback     onAck_ = nullptr;
+    uint8_t         rx_[BufSize];
+    uint8_t         tx_[BufSize];
+    PacketReader    reader_;
+};
+
+// ----------------------------- Publish queue -------------------------------
+// Fixed-capacity FIFO of records waiting for a PUBACK. The oldest `Window`
+// entries are "on the wire"; the rest wait offline. When full, the oldest
+// record is dropped so a long outage keeps the most recent data.
+template <class T, size_t Cap, size_t Window>
+class PublishQueue {
+    static_assert(Window >= 1 && Window <= Cap, "window must fit in the queue");
+public:
+    struct Entry {
+        T        item;
+        uint16_t packetId;   // 0 = not sent on the current connection
+        uint8_t  tries;
+        bool     acked;
+        uint32_t sentMs;
+    };
+
+    // Returns false if an old record had to be evicted to make room.
+    bool push(const T& item) {
+        bool evicted = false;
+        if (count_ == Cap) { pop(); ++dropped_; evicted = true; }
+        Entry& e = ring_[(head_ + count_) % Cap];
+        e.item = item; e.packetId = 0; e.tries = 0; e.acked = false; e.sentMs = 0;
+        ++count_;
+        return !evicted;
+    }
+
+    // Next entry inside the window that should go out now: never sent, or
+    // unacknowledged for longer than ackTimeoutMs doubled per previous try.
+    Entry* due(uint32_t now, uint32_t ackTimeoutMs) {
+        const size_t n = count_ < Window ? count_ : Window;
+        for (size_t i = 0; i < n; ++i) {
+            Entry& e = at(i);
+            if (e.acked) continue;
+            if (e.packetId == 0) return &e;
+            uint8_t shift = e.tries > 4 ? 3 : (uint8_t)(e.tries - 1);
+            if (now - e.sentMs >= (ackTimeoutMs << shift)) return &e;
+        }
+        return nullptr;
+    }
+
+    void markSent(Entry* e, uint16_t packetId, uint32_t now) {
+        if (e->packetId != 0) ++retries_;
+        e->packetId = packetId;
+        if (e->tries < 255) ++e->tries;
+        e->sentMs = now;
+    }
+
+    // Marks the matching in-flight entry delivered and releases every
+    // delivered entry at the head. Unknown ids (e.g. evicted) are ignored.
+    bool ack(uint16_t packetId) {
+        const size_t n = count_ < Window ? count_ : Window;
+        for (size_t i = 0; i < n; ++i) {
+            Entry& e = at(i);
+            if (e.packetId == packetId && !e.acked) {
+                e.acked = true;
+                while (count_ && at(0).acked) pop();
+                ++delivered_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Connection lost: the clean session forgot our ids, send everything again.
+    void requeueInFlight() {
+        for (size_t i = 0; i < count_; ++i) if (!at(i).acked) at(i).packetId = 0;
+    }
+
+    size_t size() const { return count_; }
+    size_t inFlight() const {
+        size_t n = 0, w = count_ < Window ? count_ : Window;
+        for (size_t i = 0; i < w; ++i) if (at(i).packetId && !at(i).acked) ++n;
+        return n;
+    }
+    uint32_t dropped() const   { return dropped_; }
+    uint32_t retries() const   { return retries_; }
+    uint32_t delivered() const { return delivered_; }
+
+private:
+    Entry&       at(size_t i)       { return ring_[(head_ + i) % Cap]; }
+    const Entry& at(size_t i) const { return ring_[(head_ + i) % Cap]; }
+    void pop() { head_ = (head_ + 1) % Cap; --count_; }
+
+    Entry    ring_[Cap];
+    size_t   head_ = 0;
+    size_t   count_ = 0;
+    uint32_t dropped_ = 0;
+    uint32_t retries_ = 0;
+    uint32_t delivered_ = 0;
+};
+
+} // namespace mqtt
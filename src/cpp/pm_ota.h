@@ -0,0 +1,538 @@
+/*
+ pm_ota.h — streaming firmware update: HTTP GET into flash, hash, RSA check
+ ------------------------------------------------------------
+ Why: the only way to update a node was USB. An image is ~400 KB and the
+ node has ~40 KB of heap, so it has to go from the socket to flash a
+ chunk at a time, and the node must not boot anything it cannot prove came
+ from the release key.
+
+ Image: the core's signed-update format. It is firmware.bin, then an
+ RSA-2048 PKCS#1 v1.5 signature of the bin's SHA-256, then the signature
+ length (uint32, little-endian, 256). The core's tools/signing.py or
+ openssl dgst -sha256 -sign make it. Instead of the bin, the body may be a
+ patch (pm_delta.h): the bin compressed, or rebuilt from the running image.
+ It is decoded as it arrives, so flash ends up the same either way.
+
+ ota::Updater<Client, Flash>, one step per poll():
+ • begin(url): connects, sends an HTTP/1.0 GET and returns. Only http://
+ is handled; the signature makes the transport's integrity irrelevant.
+ • headers: status 200 and a Content-Length are required. The image must
+ fit in the free space behind the sketch (Flash::region).
+ • base (patches against a running image only): the running image is
+ hashed, CHUNK bytes per poll(), and must be the one the patch names.
+ • body: up to CHUNK bytes per poll() come from the socket, and up to CHUNK
+ bytes of image go through SHA-256 into flash: copied from a full image,
+ decoded from a patch. A sector is erased when the writes reach it. The
+ image must start with the ESP image magic (0xE9), so a 404 page never
+ gets far.
+ • verify: the bin is read back from flash and hashed again, CHUNK bytes
+ per poll(). Then the signature is read from flash and checked against
+ the streamed digest (the Verify hook). Only then does Flash::commit()
+ tell the boot loader to copy the image over the sketch at the next boot.
+ Any failure leaves the running firmware untouched.
+ Progress is received()/size(). A socket that stays quiet for stallMs fails.
+
+ RSA: verification only, e = 65537, Montgomery multiplication on 32-bit
+ limbs. It takes ~1.5 KB of stack for a few ms, once per update. The
+ encoded message is rebuilt and compared whole, so no padding is parsed.
+
+ Transport and flash are template parameters (WiFiClient and the ESP
+ flash calls on the device, sockets and a file on the host). RAM: two
+ CHUNK buffers in the object (socket in, image out).
+ */
+#pragma once
+
+#include "pm_delta.h"
+#include "pm_sha256.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+namespace ota {
+
+// ------------------------------- RSA-2048 ----------------------------------
+namespace rsa {
+constexpr size_t BYTES = 256;
+constexpr size_t LIMBS = BYTES / 4;
+
+typedef uint32_t Num[LIMBS];               // little-endian limbs
+
+inline void load(Num x, const uint8_t* be) {
+    for (size_t i = 0; i < LIMBS; ++i) {
+        const uint8_t* p = be + BYTES - 4 * (i + 1);
+        x[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+}
+
+inline void store(uint8_t* be, const Num x) {
+    for (size_t i = 0; i < LIMBS; ++i)
+        for (int j = 0; j < 4; ++j) be[BYTES - 4 * i - 1 - j] = (uint8_t)(x[i] >> (8 * j));
+}
+
+inline bool geq(const Num a, const Num b) {
+    for (size_t i = LIMBS; i-- > 0;) if (a[i] != b[i]) return a[i] > b[i];
+    return true;
+}
+
+inline uint32_t sub(Num a, const Num b) {  // a -= b, returns the borrow
+    uint64_t borrow = 0;
+    for (size_t i = 0; i < LIMBS; ++i) {
+        const uint64_t d = (uint64_t)a[i] - b[i] - borrow;
+        a[i] = (uint32_t)d;
+        borrow = (d >> 32) & 1;
+    }
+    return (uint32_t)borrow;
+}
+
+// r = a·b·R⁻¹ mod n (CIOS), with n0 = -n⁻¹ mod 2³². r may alias a or b.
+inline void montMul(Num r, const Num a, const Num b, const Num n, uint32_t n0) {
+    uint32_t t[LIMBS + 2] = {};
+    for (size_t i = 0; i < LIMBS; ++i) {
+        uint64_t c = 0;
+        for (size_t j = 0; j < LIMBS; ++j) {
+            c += (uint64_t)a[j] * b[i] + t[j];
+            t[j] = (uint32_t)c; c >>= 32;
+        }
+        c += t[LIMBS];
+        t[LIMBS] = (uint32_t)c; t[LIMBS + 1] = (uint32_t)(c >> 32);
+        const uint32_t m = t[0] * n0;
+        c = ((uint64_t)m * n[0] + t[0]) >> 32;
+        for (size_t j = 1; j < LIMBS; ++j) {
+            c += (uint64_t)m * n[j] + t[j];
+            t[j - 1] = (uint32_t)c; c >>= 32;
+        }
+        c += t[LIMBS];
+        t[LIMBS - 1] = (uint32_t)c;
+        t[LIMBS] = t[LIMBS + 1] + (uint32_t)(c >> 32);
+    }
+    if (t[LIMBS] || geq(t, n)) sub(t, n);
+    memcpy(r, t, sizeof(Num));
+}
+
+// out = base^exp mod n, all big-endian; exp is expLen bytes. base < n, n odd.
+inline void modPow(uint8_t* out, const uint8_t* base, const uint8_t* exp, size_t expLen, const uint8_t* modulus) {
+    Num n, x, acc, one = {1};
+    load(n, modulus);
+    uint32_t inv = 1;                                   // Newton: n[0]⁻¹ mod 2³²
+    for (int i = 0; i < 5; ++i) inv *= 2 - n[0] * inv;
+    const uint32_t n0 = 0u - inv;
+    memset(acc, 0, sizeof(acc));                        // R² mod n, by doubling 1
+    acc[0] = 1;
+    for (size_t i = 0; i < 2 * 32 * LIMBS; ++i) {
+        uint32_t carry = 0;
+        for (size_t j = 0; j < LIMBS; ++j) { const uint32_t v = acc[j]; acc[j] = v << 1 | carry; carry = v >> 31; }
+        if (carry || geq(acc, n)) sub(acc, n);
+    }
+    load(x, base);
+    montMul(x, x, acc, n, n0);                          // x·R
+    montMul(acc, acc, one, n, n0);                      // 1·R
+    for (size_t i = 0; i < expLen; ++i)
+        for (int bit = 7; bit >= 0; --bit) {
+            montMul(acc, acc, acc, n, n0);
+            if (exp[i] >> bit & 1) montMul(acc, acc, x, n, n0);
+        }
+    montMul(acc, acc, one, n, n0);
+    store(out, acc);
+}
+
+// sig^65537 mod n must be 00 01 FF..FF 00 DigestInfo(SHA-256) digest.
+inline bool verifySha256(const uint8_t* modulus, const uint8_t* sig, const uint8_t* digest) {
+    static const uint8_t kE[] = {0x01, 0x00, 0x01};
+    static const uint8_t kDigestInfo[19] = {0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+                                            0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20};
+    Num s, n;
+    load(s, sig); load(n, modulus);
+    if (!(n[0] & 1) || geq(s, n)) return false;
+    uint8_t em[BYTES];
+    modPow(em, sig, kE, sizeof(kE), modulus);
+    uint8_t want[BYTES];
+    const size_t ps = BYTES - 3 - sizeof(kDigestInfo) - Sha256::DIGEST;
+    want[0] = 0x00; want[1] = 0x01;
+    memset(want + 2, 0xFF, ps);
+    want[2 + ps] = 0x00;
+    memcpy(want + 3 + ps, kDigestInfo, sizeof(kDigestInfo));
+    memcpy(want + BYTES - Sha256::DIGEST, digest, Sha256::DIGEST);
+    return !memcmp(em, want, BYTES);
+}
+} // namespace rsa
+
+// -------------------------------- Updater ----------------------------------
+constexpr uint32_t SECTOR     = 4096;
+constexpr uint32_t TRAILER    = rsa::BYTES + 4;    // signature + its length
+constexpr uint8_t  IMAGE_MAGIC = 0xE9;
+
+enum State : uint8_t { IDLE, HEADERS, BASE, BODY, VERIFY, DONE, FAILED };
+enum Error : uint8_t {
+    OK, BUSY, BAD_URL, CONNECT, HTTP_STATUS, NO_LENGTH, NO_SPACE, NOT_FIRMWARE,
+    STALLED, TRUNCATED, FLASH, READBACK, SIGNATURE, BAD_PATCH, WRONG_BASE
+};
+
+// Flash: static uint32_t region(uint32_t size)  start of a free area that
+//          fits size bytes, sector-aligned; 0 if there is none
+//        static bool erase(uint32_t sector)
+//        static bool write(uint32_t addr, const uint32_t* p, size_t n)  n % 4 == 0
+//        static bool read(uint32_t addr, uint32_t* p, size_t n)         n % 4 == 0
+//        static bool commit(uint32_t addr, uint32_t size)   boot this image next
+// The running image is read at flash address 0 (patches copy from it).
+template <class Client, class Flash, size_t CHUNK = 512>
+class Updater {
+    static_assert(CHUNK % 4 == 0 && CHUNK >= 64, "chunks are whole flash words");
+public:
+    typedef bool (*Verify)(const uint8_t* sig, const uint8_t* digest);
+
+    Updater(Client& net, Verify verify, uint32_t stallMs = 10000) : net_(net), verify_(verify), stallMs_(stallMs) {}
+
+    // Connects and sends the request; the rest happens in poll().
+    Error begin(const char* url, uint32_t now) {
+        if (busy()) return BUSY;
+        reset();
+        char host[64], path[160];
+        uint16_t port = 80;
+        if (!parseUrl(url, host, sizeof(host), port, path, sizeof(path))) return fail(BAD_URL);
+        if (!net_.connect(host, port)) return fail(CONNECT);
+        char req[sizeof(host) + sizeof(path) + 64];
+        size_t n = 0;
+        auto put = [&](const char* s) { const size_t k = strlen(s); memcpy(req + n, s, k); n += k; };
+        put("GET "); put(path); put(" HTTP/1.0\r\nHost: "); put(host);
+        put("\r\nUser-Agent: pm-ota\r\nConnection: close\r\n\r\n");
+        if (net_.write((const uint8_t*)req, n) != n) { net_.stop(); return fail(CONNECT); }
+        state_ = HEADERS;
+        lastRx_ = now;
+        return OK;
+    }
+
+    // One bounded step. Returns true if there may be more to do right away.
+    bool poll(uint32_t now) {
+        switch (state_) {
+            case HEADERS: return headers(now);
+            case BASE:    return base(now);
+            case BODY:    return body(now);
+            case VERIFY:  return readBack();
+            default:      return false;
+        }
+    }
+
+    bool     busy() const       { return state_ >= HEADERS && state_ <= VERIFY; }
+    State    state() const      { return state_; }
+    Error    error() const      { return err_; }
+    uint32_t size() const       { return total_; }       // 0 until the headers are in
+    uint32_t received() const   { return got_; }
+    bool     patch() const      { return patch_; }       // a patch, not a full image
+    uint32_t baseSize() const   { return oldSize_; }     // the running image it patches; 0 = compressed only
+    uint32_t verified() const   { return checked_; }     // read back so far
+    uint32_t address() const    { return start_; }
+    uint32_t erasedTo() const   { return erased_; }       // end of the erased flash
+    uint32_t binSize() const    { return bin_; }
+    int      httpStatus() const { return status_; }
+    const uint8_t* digest() const { return digest_; }
+
+private:
+    void reset() {
+        state_ = IDLE; err_ = OK; status_ = 0;
+        total_ = bin_ = image_ = got_ = checked_ = start_ = erased_ = 0;
+        lineLen_ = 0; firstLine_ = true;
+        inPos_ = inLen_ = outN_ = headN_ = 0;
+        outAt_ = oldSize_ = based_ = 0;
+        patch_ = false;
+        op_.len = 0;
+        dec_.reset();
+        sha_.reset();
+    }
+
+    Error fail(Error e) { state_ = FAILED; err_ = e; return e; }
+
+    static bool parseUrl(const char* url, char* host, size_t hostCap, uint16_t& port, char* path, size_t pathCap) {
+        if (strncasecmp(url, "http://", 7)) return false;
+        const char* h = url + 7;
+        const char* slash = strchr(h, '/');
+        const char* hostEnd = slash ? slash : h + strlen(h);
+        const char* colon = (const char*)memchr(h, ':', hostEnd - h);
+        const size_t hl = (colon ? colon : hostEnd) - h;
+        if (!hl || hl >= hostCap) return false;
+        memcpy(host, h, hl); host[hl] = 0;
+        if (colon) {
+            unsigned long p = 0;
+            for (const char* c = colon + 1; c < hostEnd; ++c) {
+                if (*c < '0' || *c > '9') return false;
+                p = p * 10 + (*c - '0');
+                if (p > 65535) return false;
+            }
+            if (!p) return false;
+            port = (uint16_t)p;
+        }
+        const char* p = slash ? slash : "/";
+        const size_t pl = strlen(p);
+        if (pl >= pathCap) return false;
+        for (size_t i = 0; i < pl; ++i) if ((uint8_t)p[i] <= ' ') return false;   // no header injection
+        memcpy(path, p, pl + 1);
+        return true;
+    }
+
+    bool quiet(uint32_t now) {
+        if (net_.available() > 0) return false;
+        if (!net_.connected()) { fail(got_ || state_ == BODY ? TRUNCATED : CONNECT); net_.stop(); return true; }
+        if (now - lastRx_ >= stallMs_) { fail(STALLED); net_.stop(); return true; }
+        return true;
+    }
+
+    // Status line and headers, a line at a time; long lines are cut short (only two matter).
+    bool headers(uint32_t now) {
+        if (quiet(now)) return false;
+        lastRx_ = now;
+        for (int k = 0; k < (int)CHUNK && net_.available() > 0; ++k) {
+            const int c = net_.read();
+            if (c < 0) break;
+            if (c == '\r') continue;
+            if (c != '\n') { if (lineLen_ < sizeof(line_) - 1) line_[lineLen_++] = (char)c; continue; }
+            line_[lineLen_] = 0;
+            const size_t len = lineLen_;
+            lineLen_ = 0;
+            if (firstLine_) {
+                firstLine_ = false;
+                const char* sp = strchr(line_, ' ');
+                if (strncmp(line_, "HTTP/1.", 7) || !sp) { net_.stop(); fail(HTTP_STATUS); return false; }
+                status_ = atoi3(sp + 1);
+                continue;
+            }
+            if (len) {
+                if (!strncasecmp(line_, "Content-Length:", 15)) {
+                    const char* v = line_ + 15;
+                    while (*v == ' ') ++v;
+                    total_ = 0;
+                    for (; *v >= '0' && *v <= '9' && total_ < 0x10000000u; ++v) total_ = total_ * 10 + (*v - '0');
+                }
+                continue;
+            }
+            // blank line: the body starts
+            Error e = OK;
+            if (status_ != 200)              e = HTTP_STATUS;
+            else if (!total_)                e = NO_LENGTH;
+            else if (total_ <= TRAILER + 16) e = NOT_FIRMWARE;
+            if (e) { net_.stop(); fail(e); return false; }
+            state_ = BODY;
+            return true;
+        }
+        return true;
+    }
+
+    static int atoi3(const char* s) {
+        int v = 0;
+        for (int i = 0; i < 3 && s[i] >= '0' && s[i] <= '9'; ++i) v = v * 10 + (s[i] - '0');
+        return v;
+    }
+
+    // Writes n bytes (a multiple of 4) at the next flash address, erasing ahead.
+    bool program(const uint32_t* p, size_t n, uint32_t at) {
+        while (at + n > erased_) {
+            if (!Flash::erase(erased_ / SECTOR)) return false;
+            erased_ += SECTOR;
+        }
+        return Flash::write(at, p, n);
+    }
+
+    // The first body bytes: a full image, or a patch header (collected in out_).
+    bool open() {
+        const uint8_t* in = inBytes() + inPos_;
+        if (!headN_ && in[0] == IMAGE_MAGIC) return area(total_);
+        if (!headN_ && in[0] != delta::MAGIC[0]) { fail(NOT_FIRMWARE); return false; }
+        const size_t k = delta::HEADER - headN_ < (size_t)(inLen_ - inPos_) ? delta::HEADER - headN_ : inLen_ - inPos_;
+        memcpy(outBytes() + headN_, in, k);
+        headN_ += (uint8_t)k;
+        inPos_ += (uint16_t)k;
+        if (headN_ < delta::HEADER) return false;
+        delta::Header h;
+        if (!delta::readHeader(outBytes(), h)) { fail(NOT_FIRMWARE); return false; }
+        if (h.newSize < 16 || h.newSize > 0x1000000) { fail(BAD_PATCH); return false; }
+        patch_ = true;
+        oldSize_ = h.oldSize;
+        memcpy(digest_, h.oldHash, sizeof(digest_));        // compared once the base is hashed
+        if (!area(h.newSize + TRAILER)) return false;
+        if (oldSize_ > start_) { fail(WRONG_BASE); return false; }  // the update area would overlap it
+        if (oldSize_) state_ = BASE;
+        return true;
+    }
+
+    // Where an image of n bytes (bin + trailer) goes.
+    bool area(uint32_t n) {
+        image_ = n;
+        bin_ = n - TRAILER;
+        if (!(start_ = Flash::region(n))) { fail(NO_SPACE); return false; }
+        erased_ = start_;
+        return true;
+    }
+
+    // The running image must be the one the patch was made against.
+    bool base(uint32_t now) {
+        lastRx_ = now;                                       // the socket waits meanwhile
+        const uint32_t k = oldSize_ - based_ < CHUNK ? oldSize_ - based_ : CHUNK;
+        if (!Flash::read(based_, out_, (k + 3) & ~3u)) { net_.stop(); fail(FLASH); return false; }
+        delta::hashBase(sha_, based_, outBytes(), k);
+        based_ += k;
+        if (based_ < oldSize_) return true;
+        uint8_t h[Sha256::DIGEST];
+        sha_.finish(h);
+        if (memcmp(h, digest_, sizeof(h))) { net_.stop(); fail(WRONG_BASE); return false; }
+        state_ = BODY;
+        return true;
+    }
+
+    // Up to CHUNK bytes from the socket into in_, and up to CHUNK bytes of
+    // image out of it into out_: copied for a full image, decoded for a
+    // patch. A full out_ goes to flash.
+    bool body(uint32_t now) {
+        if (inPos_ == inLen_ && !(patch_ && op_.len && op_.kind != delta::LIT)) {
+            if (got_ == total_) { net_.stop(); fail(BAD_PATCH); return false; }   // ops want more than was sent
+            if (quiet(now)) return false;
+            const size_t want = total_ - got_ < CHUNK ? total_ - got_ : CHUNK;
+            const int n = net_.read(inBytes(), want);
+            if (n <= 0) return false;
+            got_ += (uint32_t)n;
+            inPos_ = 0;
+            inLen_ = (uint16_t)n;
+        }
+        lastRx_ = now;
+        if (!image_ && !open()) { if (state_ == FAILED) net_.stop(); return state_ != FAILED; }
+        if (state_ == BASE) return true;
+        const Error e = produce();
+        if (e || ((outN_ == CHUNK || made() == image_) && !flush())) {
+            net_.stop();
+            if (e) fail(e);
+            return false;
+        }
+        if (made() < image_) return true;
+        net_.stop();
+        if (inPos_ != inLen_ || got_ != total_) { fail(BAD_PATCH); return false; }   // bytes after the trailer
+        sha_.finish(digest_);
+        state_ = VERIFY;
+        return true;
+    }
+
+    uint32_t made() const { return outAt_ + outN_; }
+    uint8_t* inBytes()    { return (uint8_t*)in_; }
+    uint8_t* outBytes()   { return (uint8_t*)out_; }
+
+    // Fills out_ from in_ and, for a patch, from flash.
+    Error produce() {
+        uint8_t* out = outBytes();
+        const uint8_t* in = inBytes();
+        while (outN_ < CHUNK && made() < image_) {
+            const size_t room = CHUNK - outN_;
+            if (!patch_ || made() >= bin_) {                 // a full image, or a patch's trailer: as is
+                size_t k = inLen_ - inPos_;
+                if (k > room) k = room;
+                if (k > image_ - made()) k = image_ - made();
+                if (!k) break;
+                memcpy(out + outN_, in + inPos_, k);
+                inPos_ += (uint16_t)k;
+                outN_ += (uint16_t)k;
+                continue;
+            }
+            if (!op_.len) {
+                size_t used = 0;
+                const bool ready = dec_.next(in + inPos_, inLen_ - inPos_, used, op_);
+                inPos_ += (uint16_t)used;
+                if (dec_.bad()) return BAD_PATCH;
+                if (!ready) break;                           // the rest of the op is in the next read
+                if (op_.len > bin_ - made()) return BAD_PATCH;
+                if (op_.kind == delta::NEW && (!op_.from || op_.from > made())) return BAD_PATCH;
+                if (op_.kind == delta::OLD && (op_.from < delta::HEAD_KEEP || op_.from > oldSize_ ||
+                                               op_.len > oldSize_ - op_.from)) return BAD_PATCH;
+            }
+            size_t k = op_.len < room ? op_.len : room;
+            if (op_.kind == delta::LIT) {
+                if (k > (size_t)(inLen_ - inPos_)) k = inLen_ - inPos_;
+                if (!k) break;
+                memcpy(out + outN_, in + inPos_, k);
+                inPos_ += (uint16_t)k;
+            } else if (op_.kind == delta::NEW) {
+                const uint32_t src = made() - op_.from;
+                if (k > op_.from) k = op_.from;              // overlapping: only what exists yet
+                if (src >= outAt_) memcpy(out + outN_, out + (src - outAt_), k);
+                else {
+                    if (k > outAt_ - src) k = outAt_ - src;
+                    if (!readBytes(start_ + src, out + outN_, k)) return FLASH;
+                }
+            } else {
+                if (!readBytes(op_.from, out + outN_, k)) return FLASH;
+                op_.from += (uint32_t)k;
+            }
+            outN_ += (uint16_t)k;
+            op_.len -= (uint32_t)k;
+        }
+        return OK;
+    }
+
+    // Hashes the bin's part of out_ and writes it all, the final word padded.
+    bool flush() {
+        uint8_t* out = outBytes();
+        if (!outAt_ && out[0] != IMAGE_MAGIC) { fail(NOT_FIRMWARE); return false; }
+        if (outAt_ < bin_) sha_.update(out, outN_ < bin_ - outAt_ ? outN_ : bin_ - outAt_);
+        size_t len = outN_;
+        while (len % 4) out[len++] = 0xFF;
+        if (!program(out_, len, start_ + outAt_)) { fail(FLASH); return false; }
+        outAt_ += outN_;
+        outN_ = 0;
+        return true;
+    }
+
+    // Reads n bytes at any address through word-aligned reads.
+    static bool readBytes(uint32_t addr, uint8_t* dst, size_t n) {
+        uint32_t w[16];
+        while (n) {
+            const uint32_t base = addr & ~3u, skip = addr - base;
+            const size_t k = n < sizeof(w) - skip ? n : sizeof(w) - skip;
+            if (!Flash::read(base, w, (skip + k + 3) & ~(size_t)3)) return false;
+            memcpy(dst, (uint8_t*)w + skip, k);
+            addr += (uint32_t)k; dst += k; n -= k;
+        }
+        return true;
+    }
+
+    bool readBack() {
+        const uint32_t k = bin_ - checked_ < CHUNK ? bin_ - checked_ : CHUNK;
+        if (!Flash::read(start_ + checked_, out_, (k + 3) & ~3u)) { fail(FLASH); return false; }
+        sha_.update(out_, k);
+        checked_ += k;
+        if (checked_ < bin_) return true;
+        uint8_t again[Sha256::DIGEST];
+        sha_.finish(again);
+        if (memcmp(again, digest_, sizeof(again))) { fail(READBACK); return false; }
+        uint8_t sig[rsa::BYTES];
+        uint8_t len[4];
+        if (!readBytes(start_ + bin_, sig, sizeof(sig)) || !readBytes(start_ + bin_ + rsa::BYTES, len, 4)) {
+            fail(FLASH); return false;
+        }
+        const uint32_t sigLen = (uint32_t)len[0] | (uint32_t)len[1] << 8 | (uint32_t)len[2] << 16 | (uint32_t)len[3] << 24;
+        if (sigLen != rsa::BYTES || !verify_ || !verify_(sig, digest_)) { fail(SIGNATURE); return false; }
+        if (!Flash::commit(start_, bin_)) { fail(FLASH); return false; }
+        state_ = DONE;
+        return false;
+    }
+
+    Client&  net_;
+    Verify   verify_;
+    uint32_t stallMs_;
+    State    state_ = IDLE;
+    Error    err_ = OK;
+    int      status_ = 0;
+    uint32_t total_ = 0, bin_ = 0, image_ = 0, got_ = 0, checked_ = 0;
+    uint32_t start_ = 0, erased_ = 0, lastRx_ = 0;
+    char     line_[48];
+    uint8_t  lineLen_ = 0;
+    bool     firstLine_ = true;
+    uint32_t in_[CHUNK / 4];                 // from the socket, not yet used
+    uint32_t out_[CHUNK / 4];                // image bytes on their way to flash
+    uint16_t inPos_ = 0, inLen_ = 0, outN_ = 0;
+    uint32_t outAt_ = 0;                     // image offset of out_[0]
+    bool     patch_ = false;
+    uint8_t  headN_ = 0;
+    uint32_t oldSize_ = 0, based_ = 0;
+    delta::Decoder dec_;
+    delta::Op      op_{};
+    Sha256   sha_;
+    uint8_t  digest_[Sha256::DIGEST];
+};
+
+} // namespace ota
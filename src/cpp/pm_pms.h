@@ -0,0 +1,107 @@
+/*
+ pm_pms.h — streaming PMS5003 frame parser
+ ------------------------------------------------------------
+ Byte-at-a-time state machine: feed whatever the UART has buffered and it
+ reports when a complete, checksummed frame went by. Nothing here waits for
+ the rest of a frame, so the caller never blocks, and the same parser runs
+ on the ESP8266 and in the host tools (harness, fleet simulator).
+
+ Frame layout (datasheet): 0x42 0x4D, 16-bit length, data words, 16-bit sum
+ of every preceding byte. Word 0..2 = PM1/2.5/10 CF=1, word 3..5 = ATM.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct PmsReading {
+    uint16_t pm1_cf1;
+    uint16_t pm25_cf1;
+    uint16_t pm10_cf1;
+    uint16_t pm1_atm;
+    uint16_t pm25_atm;
+    uint16_t pm10_atm;
+};
+
+class PmsParser {
+public:
+    enum Result : uint8_t { NONE, FRAME, BAD_LENGTH, BAD_CHECKSUM };
+
+    Result feed(uint8_t b) {
+        switch (state_) {
+            case 0:
+                if (b == 0x42) state_ = 1;
+                return NONE;
+            case 1:
+                state_ = b == 0x4D ? 2 : b == 0x42 ? 1 : 0;
+                return NONE;
+            case 2:
+                len_ = (uint16_t)b << 8;
+                state_ = 3;
+                return NONE;
+            case 3:
+                len_ |= b;
+                if (len_ < 28 || len_ > sizeof(data_)) { state_ = 0; ++lengthErrors_; return BAD_LENGTH; }
+                got_ = 0;
+                state_ = 4;
+                return NONE;
+            default:
+                data_[got_++] = b;
+                if (got_ < len_) return NONE;
+                state_ = 0;
+                return finish();
+        }
+    }
+
+    void reset() { state_ = 0; }
+
+    const PmsReading& reading() const { return reading_; }
+    uint16_t calcSum() const          { return calc_; }   // valid after BAD_CHECKSUM
+    uint16_t frameSum() const         { return chk_; }
+    uint32_t frames() const           { return frames_; }
+    uint32_t checksumErrors() const   { return checksumErrors_; }
+    uint32_t lengthErrors() const     { return lengthErrors_; }
+
+private:
+    Result finish() {
+        uint16_t sum = 0x42 + 0x4D + (len_ >> 8) + (len_ & 0xFF);
+        for (size_t i = 0; i < (size_t)len_ - 2; ++i) sum += data_[i];
+        calc_ = sum;
+        chk_  = (uint16_t)data_[len_ - 2] << 8 | data_[len_ - 1];
+        if (calc_ != chk_) { ++checksumErrors_; return BAD_CHECKSUM; }
+
+        reading_.pm1_cf1  = word(0);
+        reading_.pm25_cf1 = word(1);
+        reading_.pm10_cf1 = word(2);
+        reading_.pm1_atm  = word(3);
+        reading_.pm25_atm = word(4);
+        reading_.pm10_atm = word(5);
+        ++frames_;
+        return FRAME;
+    }
+
+    uint16_t word(int idx) const { return (uint16_t)data_[idx * 2] << 8 | data_[idx * 2 + 1]; }
+
+    uint8_t    data_[64];
+    uint8_t    state_ = 0;
+    uint8_t    got_ = 0;
+    uint16_t   len_ = 0;
+    uint16_t   calc_ = 0;
+    uint16_t   chk_ = 0;
+    PmsReading reading_ = {};
+    uint32_t   frames_ = 0;
+    uint32_t   checksumErrors_ = 0;
+    uint32_t   lengthErrors_ = 0;
+};
+
+// Builds a valid 32-byte active-mode frame; used by host tools to synthesise sensor traffic.
+inline size_t pmsEncodeFrame(uint8_t* out, const PmsReading& r) {
+    const uint16_t w[13] = {r.pm1_cf1, r.pm25_cf1, r.pm10_cf1, r.pm1_atm, r.pm25_atm, r.pm10_atm,
+                            0, 0, 0, 0, 0, 0, 0};
+    out[0] = 0x42; out[1] = 0x4D; out[2] = 0; out[3] = 28;
+    for (int i = 0; i < 13; ++i) { out[4 + 2 * i] = (uint8_t)(w[i] >> 8); out[5 + 2 * i] = (uint8_t)w[i]; }
+    uint16_t sum = 0;
+    for (int i = 0; i < 30; ++i) sum += out[i];
+    out[30] = (uint8_t)(sum >> 8); out[31] = (uint8_t)sum;
+    return 32;
+}
@@ -0,0 +1,166 @@
+/*
+ pm_sched.h — tiny cooperative scheduler with named timers
+ ------------------------------------------------------------
+ Why: loop() used to poll a handful of "now - lastX >= period" pairs every
+ pass and then spin straight back round, keeping the CPU at 100% just to
+ find out that nothing was due. Here every timer has one deadline, the
+ deadlines sit in a binary min-heap, and run() tells the caller how long it
+ may idle before the earliest one.
+
+ Rules:
+ • a task returns when it wants to run next: a delay in ms, PERIOD (stay on
+ the fixed cadence, skipping missed beats instead of bursting), or STOP;
+ • a task may re-arm any timer, itself included, with in();
+ • each timer runs at most once per run() call, so a task returning 0
+ cannot starve loop().
+
+ Deadlines are compared as (int32_t)(a - b), which orders them correctly
+ across the 49.7-day millis() wrap as long as no deadline is more than
+ ~24 days ahead. Fixed capacity: N timers, set at compile time.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+template<size_t N>
+class Scheduler {
+public:
+    typedef uint32_t (*Task)(uint32_t now);
+
+    static constexpr uint32_t PERIOD = 0xFFFFFFFEu;   // next beat of the fixed period
+    static constexpr uint32_t STOP   = 0xFFFFFFFFu;   // disarmed until in() is called
+
+    struct Timer {
+        const char* name;          // may be a PSTR(); read it with the *_P functions
+        Task        fn;
+        uint32_t    period;
+        uint32_t    due;
+        uint32_t    runs;
+        uint32_t    maxLateMs;     // worst start delay seen, for diagnostics
+        bool        armed;
+    };
+
+    // Registers a timer whose first run is firstInMs from now. Returns its id, or -1 when full.
+    int add(const char* name, Task fn, uint32_t periodMs, uint32_t now, uint32_t firstInMs = 0) {
+        if (count_ >= N) return -1;
+        const int id = (int)count_++;
+        t_[id] = Timer{name, fn, periodMs, 0, 0, 0, false};
+        ran_[id] = held_[id] = false;
+        in(id, now, firstInMs);
+        return id;
+    }
+
+    // (Re)arms a timer to fire ms from now, replacing any pending deadline.
+    void in(int id, uint32_t now, uint32_t ms) {
+        if (id < 0 || (size_t)id >= count_) return;
+        if (t_[id].armed) remove(id);
+        held_[id] = false;
+        t_[id].due = now + ms;
+        insert(id);
+    }
+
+    // New period; an armed timer's next run moves to one new period from now.
+    void setPeriod(int id, uint32_t periodMs, uint32_t now) {
+        if (id < 0 || (size_t)id >= count_) return;
+        t_[id].period = periodMs;
+        if (t_[id].armed || held_[id]) in(id, now, periodMs);
+    }
+
+    void stop(int id) {
+        if (id < 0 || (size_t)id >= count_) return;
+        held_[id] = false;
+        if (t_[id].armed) remove(id);
+    }
+
+    // Runs every timer that was due when run() was called, each at most once,
+    // and returns how long the caller may idle before the next deadline,
+    // capped at maxIdleMs. A timer that comes due again while run() is still
+    // going (returned 0, or re-armed with in(id, now, 0)) is held back and
+    // goes back into the heap afterwards, due now: it runs on the next call.
+    uint32_t run(uint32_t now, uint32_t maxIdleMs) {
+        for (size_t i = 0; i < count_; ++i) ran_[i] = false;
+        while (size_ && late(heap_[0], now)) {
+            const int id = heap_[0];
+            Timer& t = t_[id];
+            remove(id);
+            if (ran_[id]) { held_[id] = true; continue; }
+            ran_[id] = true;
+            const uint32_t l = now - t.due;
+            if (l > t.maxLateMs) t.maxLateMs = l;
+            ++t.runs;
+            const uint32_t prevDue = t.due;
+            const uint32_t next = t.fn(now);
+            if (t.armed || next == STOP) continue;          // task re-armed itself, or is done
+            if (next == PERIOD) {
+                t.due = prevDue + t.period;
+                if (late(id, now)) t.due = now + t.period;  // overran: skip, don't burst
+            } else {
+                t.due = now + next;
+            }
+            insert(id);
+        }
+        for (size_t i = 0; i < count_; ++i)
+            if (held_[i]) { held_[i] = false; insert((int)i); }
+        if (!size_) return maxIdleMs;
+        const int32_t d = (int32_t)(t_[heap_[0]].due - now);
+        if (d <= 0) return 0;
+        return (uint32_t)d < maxIdleMs ? (uint32_t)d : maxIdleMs;
+    }
+
+    static constexpr size_t capacity()  { return N; }
+    size_t       size() const           { return count_; }
+    const Timer& timer(int id) const    { return t_[id]; }
+    uint32_t     dueIn(int id, uint32_t now) const {
+        const int32_t d = (int32_t)(t_[id].due - now);
+        return held_[id] ? 0 : !t_[id].armed ? STOP : d > 0 ? (uint32_t)d : 0;
+    }
+
+private:
+    bool late(int id, uint32_t now) const { return (int32_t)(now - t_[id].due) >= 0; }
+    bool before(int a, int b) const       { return (int32_t)(t_[a].due - t_[b].due) < 0; }
+
+    void place(size_t i, int id) { heap_[i] = (uint8_t)id; pos_[id] = (uint8_t)i; }
+
+    void siftUp(size_t i) {
+        const int id = heap_[i];
+        while (i > 0 && before(id, heap_[(i - 1) / 2])) { place(i, heap_[(i - 1) / 2]); i = (i - 1) / 2; }
+        place(i, id);
+    }
+
+    void siftDown(size_t i) {
+        const int id = heap_[i];
+        for (;;) {
+            size_t c = 2 * i + 1;
+            if (c >= size_) break;
+            if (c + 1 < size_ && before(heap_[c + 1], heap_[c])) ++c;
+            if (!before(heap_[c], id)) break;
+            place(i, heap_[c]); i = c;
+        }
+        place(i, id);
+    }
+
+    void insert(int id) {
+        t_[id].armed = true;
+        place(size_, id);
+        siftUp(size_++);
+    }
+
+    void remove(int id) {
+        t_[id].armed = false;
+        const size_t i = pos_[id];
+        const int last = heap_[--size_];
+        if (i == size_) return;
+        place(i, last);
+        siftDown(i);
+        siftUp(pos_[last]);
+    }
+
+    Timer   t_[N];
+    uint8_t heap_[N];
+    uint8_t pos_[N];
+    bool    ran_[N];               // ran in the current run() call
+    bool    held_[N];              // came due again during it; re-inserted at its end
+    size_t  count_ = 0;
+    size_t  size_  = 0;
+};
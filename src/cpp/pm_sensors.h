@@ -0,0 +1,92 @@
+/*
+ pm_sensors.h — compile-time sensor registry
+ ------------------------------------------------------------
+ Why: every sensor used to be wired into the firmware by hand: its globals,
+ its poll in loop(), its part of the sample, the payload, the stub log, the
+ portal page and the heartbeat, each behind its own #if. Adding a sensor
+ meant touching all of them, and a hardware variant without one had to get
+ every #if right.
+
+ A sensor is now a type with static hooks, and the image's sensors are a
+ type list:
+
+   typedef SensorList<PmsSensor, SensorIf<ENABLE_BME280, BmeSensor>, ...> Sensors;
+
+ Each SensorList hook expands, at compile time, into a call to that hook on
+ every listed sensor in list order. It is a C++17 fold: there are no virtual
+ calls and no function-pointer tables. Empty defaults inline to nothing.
+
+ SensorIf<false, T> puts an empty stand-in in T's place. T's hooks are
+ declared but never called, so they need no definition. Its driver, tasks
+ and strings can stay behind the build flag and are not in the image.
+
+ Hooks (all static; derive from SensorBase<Self> and define only the ones
+ you need):
+ • Fields: the sensor's part of a published sample. Sample inherits the
+ Fields of every listed sensor;
+ • begin(): hardware, early in setup(): pins, UART, probes;
+ • start(now): timers, once setup() is done with its blocking parts;
+ • poll(now): every loop() pass; must not wait;
+ • ready(): a sample can be taken (all listed sensors must agree);
+ • sample(f, now): fill Fields when a sample is taken;
+ • json(out, f) / text(out, f): the sample in the payload and the stub log;
+ • page(out): the latest reading on the portal page;
+ • brief(out): the latest reading in the heartbeat line;
+ • metrics(w, f): the sample as metric families for GET /metrics. w is
+ any writer type (the firmware passes an om::Writer).
+ */
+#pragma once
+
+#include <stdint.h>
+#include <type_traits>
+
+#include "pm_fstr.h"
+
+template<typename Self>
+struct SensorBase {
+    struct Fields {};                                   // distinct per sensor
+
+    static void begin() {}
+    static void start(uint32_t) {}
+    static void poll(uint32_t) {}
+    static bool ready() { return true; }
+    template<typename F> static void sample(F&, uint32_t) {}
+    template<typename F> static void json(StrBuf&, const F&) {}
+    template<typename F> static void text(StrBuf&, const F&) {}
+    static void page(StrBuf&) {}
+    static void brief(StrBuf&) {}
+    template<typename W, typename F> static void metrics(W&, const F&) {}
+};
+
+// Stand-in for a sensor that is not built in.
+template<typename T>
+struct SensorOff : SensorBase<SensorOff<T>> {};
+
+template<bool On, typename T>
+using SensorIf = typename std::conditional<On, T, SensorOff<T>>::type;
+
+template<typename... S>
+struct SensorList {
+    struct Sample : S::Fields... {};
+
+    static void begin()             { (S::begin(), ...); }
+    static void start(uint32_t now) { (S::start(now), ...); }
+    static void poll(uint32_t now)  { (S::poll(now), ...); }
+    static bool ready()             { return (S::ready() && ...); }
+
+    static void sample(Sample& s, uint32_t now) {
+        (S::sample(static_cast<typename S::Fields&>(s), now), ...);
+    }
+    static void json(StrBuf& out, const Sample& s) {
+        (S::json(out, static_cast<const typename S::Fields&>(s)), ...);
+    }
+    static void text(StrBuf& out, const Sample& s) {
+        (S::text(out, static_cast<const typename S::Fields&>(s)), ...);
+    }
+    static void page(StrBuf& out)  { (S::page(out), ...); }
+    static void brief(StrBuf& out) { (S::brief(out), ...); }
+    template<typename W>
+    static void metrics(W& w, const Sample& s) {
+        (S::metrics(w, static_cast<const typename S::Fields&>(s)), ...);
+    }
+};
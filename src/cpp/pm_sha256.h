@@ -0,0 +1,107 @@
+/*
+ pm_sha256.h — incremental SHA-256 (FIPS 180-4)
+ ------------------------------------------------------------
+ Why: a firmware image arrives in pieces of a few hundred bytes and must be
+ hashed as it streams past; it is never in RAM as a whole. The core's
+ BearSSL has SHA-256, but not on the host, and the harness must hash
+ exactly what the device hashes.
+
+ update() takes any number of bytes at a time and finish() pads and writes
+ the 32-byte digest, after which the object starts over. 104 bytes of
+ state; the round constants live in flash (PROGMEM on the device).
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_dword
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#endif
+
+static const uint32_t kSha256K[64] PROGMEM = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+class Sha256 {
+public:
+    static constexpr size_t DIGEST = 32;
+
+    Sha256() { reset(); }
+
+    void reset() {
+        static const uint32_t h0[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                       0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(h_, h0, sizeof(h_));
+        len_ = 0;
+        fill_ = 0;
+    }
+
+    void update(const void* data, size_t n) {
+        const uint8_t* p = (const uint8_t*)data;
+        len_ += n;
+        if (fill_) {
+            const size_t k = n < 64 - fill_ ? n : 64 - fill_;
+            memcpy(buf_ + fill_, p, k);
+            fill_ += k; p += k; n -= k;
+            if (fill_ < 64) return;
+            block(buf_);
+            fill_ = 0;
+        }
+        for (; n >= 64; p += 64, n -= 64) block(p);
+        memcpy(buf_, p, n);
+        fill_ = n;
+    }
+
+    void finish(uint8_t out[DIGEST]) {
+        const uint64_t bits = len_ * 8;
+        buf_[fill_++] = 0x80;
+        if (fill_ > 56) { memset(buf_ + fill_, 0, 64 - fill_); block(buf_); fill_ = 0; }
+        memset(buf_ + fill_, 0, 56 - fill_);
+        for (int i = 0; i < 8; ++i) buf_[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+        block(buf_);
+        for (int i = 0; i < 8; ++i)
+            for (int j = 0; j < 4; ++j) out[4 * i + j] = (uint8_t)(h_[i] >> (24 - 8 * j));
+        reset();
+    }
+
+    uint64_t length() const { return len_; }   // bytes hashed since reset()
+
+private:
+    static uint32_t ror(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void block(const uint8_t* p) {
+        uint32_t w[16];
+        for (int i = 0; i < 16; ++i)
+            w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+        uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+        for (int i = 0; i < 64; ++i) {
+            if (i >= 16) {                     // message schedule, 16 words rolling
+                const uint32_t w15 = w[(i + 1) & 15], w2 = w[(i + 14) & 15];
+                w[i & 15] += (ror(w15, 7) ^ ror(w15, 18) ^ (w15 >> 3)) + w[(i + 9) & 15] +
+                             (ror(w2, 17) ^ ror(w2, 19) ^ (w2 >> 10));
+            }
+            const uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) +
+                                pgm_read_dword(&kSha256K[i]) + w[i & 15];
+            const uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d; h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+    }
+
+    uint32_t h_[8];
+    uint64_t len_;
+    uint8_t  buf_[64];
+    size_t   fill_;
+};
@@ -0,0 +1,242 @@
+/*
+ pm_sunrise.h — Senseair Sunrise CO2, single-measurement mode
+ ------------------------------------------------------------
+ Why: the Sunrise shares the I2C bus with the BME280 (wiring doc) but had no
+ driver. Left in its factory continuous mode it measures every 16 s whether
+ anyone reads it or not; in single-measurement mode with EN switched off
+ between readings it only draws current for the ~2 s of each measurement.
+
+ One measurement, as a sequence of short steps (step() never waits):
+ 1. power on (EN released), give the sensor BOOT_MS to start;
+ 2. first time only: make sure the EE measurement mode is "single", else set
+ it and soft-reset (an EE write, so once per sensor, not per boot);
+ 3. write the start command together with the sensor state saved last time;
+ 4. wait CONVERT_MS, or for nRDY to go low when it is wired;
+ 5. read error status, CO2 and temperature, then the sensor state; EN off.
+
+ Sensor state: registers 0xC4..0xDB hold the ABC (automatic baseline
+ correction) history and filter state. They live in RAM and are lost when EN
+ goes low, so the host keeps them and writes them back with every start
+ command. The sensor has no clock while off: the host adds one to the ABC
+ time (the first state word, hours) for every hour that passes.
+
+ Transfers go through the shared bus queue (pm_i2cbus.h), one per step:
+ step() returns BUS after queueing one and wants to run again when it has
+ completed (the bus's notify callback). The Sunrise sleeps between
+ transactions and NACKs its address once to wake; register it with the bus
+ with WAKE_WINDOW_US and the bus sends that wake-up whenever it is due.
+
+ Registers are big-endian. EN and nRDY are reached through callbacks: GPIO
+ on the device, the fake sensor's pins in the harness.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pm_i2cbus.h"
+
+template<typename Bus>
+class Sunrise {
+public:
+    static constexpr uint8_t  ADDR        = 0x68;
+    static constexpr uint32_t WAKE_WINDOW_US = 15000;  // awake this long after a transfer
+    static constexpr size_t   STATE_LEN   = 24;       // 0xC4..0xDB
+    static constexpr uint32_t BOOT_MS     = 40;       // EN high to first transfer (datasheet 35 ms)
+    static constexpr uint32_t CONVERT_MS  = 2400;     // factory 8 samples take ~2 s
+    static constexpr uint32_t LATE_POLL_MS = 100;     // "no measurement completed" still set: ask again
+    static constexpr uint8_t  LATE_POLLS_MAX = 10;
+    static constexpr uint32_t NRDY_POLL_MS = 20;      // GPIO read, no bus traffic
+    static constexpr uint32_t HOUR_MS     = 3600000;
+
+    // ErrorStatus (0x00..0x01)
+    enum : uint16_t {
+        ERR_FATAL = 0x0001, ERR_I2C = 0x0002, ERR_ALGORITHM = 0x0004, ERR_CALIBRATION = 0x0008,
+        ERR_SELF_DIAG = 0x0010, ERR_OUT_OF_RANGE = 0x0020, ERR_MEMORY = 0x0040,
+        ERR_NO_MEASUREMENT = 0x0080, ERR_LOW_VOLTAGE = 0x0100, ERR_TIMEOUT = 0x0200,
+        ERR_SIGNAL = 0x0400, ERR_SCALE = 0x8000,
+    };
+
+    // WAIT: step again after waitMs(). BUS: a transfer is queued, step again
+    // when it completes.
+    enum Step : uint8_t { WAIT, BUS, READY, FAILED };
+
+    struct Reading {
+        uint16_t co2_ppm;    // filtered, pressure compensated
+        int16_t  t_x100;     // sensor's own temperature, °C × 100
+        uint16_t status;     // ErrorStatus at read time (out-of-range etc. still give a value)
+    };
+
+    typedef void (*PowerFn)(bool on);   // drives EN; nullptr = EN tied high
+    typedef bool (*ReadyFn)();          // true once nRDY is low; nullptr = timing only
+
+    explicit Sunrise(Bus& bus, PowerFn power = nullptr, ReadyFn ready = nullptr)
+        : bus_(bus), power_(power), ready_(ready) {}
+
+    // Starts a measurement. False if one is already running. Call step()
+    // after waitMs(), then as each step asks.
+    bool measure(uint32_t now) {
+        if (phase_ != OFF) return false;
+        abcTick(now);
+        startedMs_ = now;
+        resetTried_ = false;
+        latePolls_ = 0;
+        if (power_) power_(true);
+        phase_ = BOOTING;
+        wait_ = power_ ? BOOT_MS : 0;
+        return true;
+    }
+
+    Step step() {
+        if (txn_.busy()) return BUS;
+        const bool ok = txn_.state == I2cTxn::DONE;
+        switch (phase_) {
+            case BOOTING:
+                if (single_) return queueStart();
+                txn_.read(ADDR, REG_MEAS_MODE, 1);
+                return queue(MODE);
+            case MODE:
+                if (!ok) { const bool was = present_; present_ = false; return fail(was); }
+                present_ = true;
+                if (txn_.buf[0] == MODE_SINGLE) { single_ = true; return queueStart(); }
+                if (resetTried_) return fail(true);                       // EE write did not stick
+                return queueWrite(REG_MEAS_MODE, MODE_SINGLE, EE_WRITE);
+            case EE_WRITE:
+                if (!ok) return fail(true);
+                ++eeWrites_;
+                return queueWrite(REG_SCR, SCR_RESET, RESET);
+            case RESET:
+                if (!ok) return fail(true);
+                resetTried_ = true;
+                phase_ = BOOTING;                                         // mode applies after the reset
+                return waitFor(BOOT_MS);
+            case STARTING:
+                if (!ok) return fail(true);
+                phase_ = CONVERTING;
+                convWaited_ = 0;
+                return waitFor(ready_ ? NRDY_POLL_MS : CONVERT_MS);
+            case CONVERTING:
+                if (ready_ && !latePolls_ && !ready_() && convWaited_ < CONVERT_MS + LATE_POLLS_MAX * LATE_POLL_MS) {
+                    convWaited_ += NRDY_POLL_MS;
+                    return waitFor(NRDY_POLL_MS);
+                }
+                txn_.read(ADDR, REG_ERROR_STATUS, 10);                    // status .. temperature
+                return queue(STATUS);
+            case STATUS: {
+                if (!ok) return fail(true);
+                const uint16_t status = (uint16_t)(txn_.buf[0] << 8 | txn_.buf[1]);
+                if (status & ERR_NO_MEASUREMENT) {
+                    if (++latePolls_ > LATE_POLLS_MAX) return fail(true);
+                    ++latePollsTotal_;
+                    phase_ = CONVERTING;
+                    return waitFor(LATE_POLL_MS);
+                }
+                if (status & ERR_FATAL) return fail(true);
+                next_.co2_ppm = (uint16_t)(txn_.buf[6] << 8 | txn_.buf[7]);
+                next_.t_x100  = (int16_t)(txn_.buf[8] << 8 | txn_.buf[9]);
+                next_.status  = status;
+                txn_.read(ADDR, REG_STATE, STATE_LEN);
+                return queue(STATE);
+            }
+            case STATE:
+                if (!ok) return fail(true);
+                if (!haveState_) abcMark_ = startedMs_;                 // ABC hours count from here
+                memcpy(state_, txn_.buf, STATE_LEN);
+                haveState_ = true;
+                r_ = next_;
+                ++conversions_;
+                off();
+                return READY;
+            default:
+                return FAILED;
+        }
+    }
+
+    uint32_t       waitMs() const       { return wait_; }
+    bool           busy() const         { return phase_ != OFF; }
+    bool           present() const      { return present_; }
+    const Reading& reading() const      { return r_; }
+    uint32_t       conversions() const  { return conversions_; }
+    uint32_t       errors() const       { return errors_; }
+    uint32_t       latePolls() const    { return latePollsTotal_; }
+    uint32_t       eeWrites() const     { return eeWrites_; }
+
+    // ABC state between measurements (and, via the caller, across resets).
+    bool           haveState() const    { return haveState_; }
+    const uint8_t* state() const        { return state_; }
+    uint16_t       abcHours() const     { return (uint16_t)(state_[0] << 8 | state_[1]); }
+    void restoreState(const uint8_t* s, uint32_t now) {
+        memcpy(state_, s, STATE_LEN);
+        haveState_ = true;
+        abcMark_ = now;
+    }
+
+private:
+    enum Phase : uint8_t { OFF, BOOTING, MODE, EE_WRITE, RESET, STARTING, CONVERTING, STATUS, STATE };
+    enum : uint8_t {
+        REG_ERROR_STATUS = 0x00, REG_MEAS_MODE = 0x95, REG_SCR = 0xA3, REG_START = 0xC3, REG_STATE = 0xC4,
+        MODE_SINGLE = 1, SCR_RESET = 0xFF, CMD_START = 1,
+    };
+
+    // Hours the sensor spent off still count towards its ABC period.
+    void abcTick(uint32_t now) {
+        if (!haveState_) return;
+        while (now - abcMark_ >= HOUR_MS) {
+            abcMark_ += HOUR_MS;
+            const uint16_t h = abcHours();
+            if (h != 0xFFFF) { state_[0] = (uint8_t)((h + 1) >> 8); state_[1] = (uint8_t)(h + 1); }
+        }
+    }
+
+    Step queue(Phase next) {
+        if (!bus_.submit(txn_)) return fail(true);
+        phase_ = next;
+        return BUS;
+    }
+
+    Step queueWrite(uint8_t reg, uint8_t v, Phase next) {
+        const uint8_t b[2] = {reg, v};
+        txn_.write(ADDR, b, 2);
+        return queue(next);
+    }
+
+    // Start command, followed by the saved state when there is one.
+    Step queueStart() {
+        uint8_t cmd[2 + STATE_LEN] = {REG_START, CMD_START};
+        size_t n = 2;
+        if (haveState_) { memcpy(cmd + 2, state_, STATE_LEN); n += STATE_LEN; }
+        txn_.write(ADDR, cmd, n);
+        return queue(STARTING);
+    }
+
+    Step waitFor(uint32_t ms) {
+        wait_ = ms;
+        return WAIT;
+    }
+
+    Step fail(bool count) {
+        if (count) ++errors_;
+        off();
+        return FAILED;
+    }
+
+    void off() {
+        if (power_) power_(false);
+        phase_ = OFF;
+        wait_ = 0;
+    }
+
+    Bus&     bus_;
+    PowerFn  power_;
+    ReadyFn  ready_;
+    I2cTxn   txn_;
+    Reading  r_{}, next_{};
+    uint8_t  state_[STATE_LEN] = {};
+    uint32_t abcMark_ = 0, startedMs_ = 0;
+    uint32_t wait_ = 0, convWaited_ = 0;
+    Phase    phase_ = OFF;
+    bool     present_ = false, single_ = false, haveState_ = false, resetTried_ = false;
+    uint8_t  latePolls_ = 0;
+    uint32_t conversions_ = 0, errors_ = 0, latePollsTotal_ = 0, eeWrites_ = 0;
+};
@@ -0,0 +1,85 @@
+/*
+ pm_warmup.h — sensor warm-up gate: minimum time, then a stability test
+ ------------------------------------------------------------
+ Why: a PMS5003 needs ~30 s after power-on before its fan and laser settle,
+ and its first frames read low and jump around. They used to be published
+ like any other. Here a sensor counts as warm once both hold:
+ • at least minMs have passed since restart() (power-on);
+ • the last W values agree: standard deviation ≤ sdAbs + sdPct % of their
+ mean. A relative part is needed because the counting noise grows with
+ the concentration.
+ If the values never settle (very dirty air changes fast too), it counts
+ as warm after maxMs anyway and says so: TIMEOUT instead of STABLE.
+ maxMs = 0 disables the gate: the first value is warm.
+
+ durationMs() is how long warming took. Across a fleet it is the data for
+ duty cycling: power the sensor up that long before each sample.
+
+ O(1) per value: a ring of W values with a running sum and sum of squares.
+ The test is done on squares, with no square root and no division by the
+ variance.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+template<size_t W>
+class WarmupGate {
+    static_assert(W >= 2, "stability needs at least two values");
+public:
+    struct Params {
+        uint32_t minMs, maxMs;
+        uint16_t sdAbs_x10;       // absolute part of the allowed deviation, × 10
+        uint8_t  sdPct;           // plus this share of the window's mean
+    };
+    enum State : uint8_t { WARMING, STABLE, TIMEOUT };
+
+    explicit WarmupGate(const Params& p) : p_(p) {}
+
+    // Power-on (again): warm-up starts over.
+    void restart(uint32_t now) {
+        start_ = now; state_ = WARMING; doneMs_ = 0;
+        n_ = head_ = 0; sum_ = 0; sq_ = 0;
+    }
+
+    // One value, at now. True once warm; stays true until restart().
+    bool add(uint16_t x, uint32_t now) {
+        if (state_ != WARMING) return true;
+        if (n_ == W) { const uint16_t old = ring_[head_]; sum_ -= old; sq_ -= (uint64_t)old * old; }
+        else ++n_;
+        ring_[head_] = x;
+        head_ = (head_ + 1) % W;
+        sum_ += x;
+        sq_  += (uint64_t)x * x;
+        const uint32_t t = now - start_;
+        if (!p_.maxMs || (t >= p_.minMs && stable())) finish(STABLE, t);
+        else if (t >= p_.maxMs)                       finish(TIMEOUT, t);
+        return state_ != WARMING;
+    }
+
+    // sd ≤ thr  ⇔  n·Σx² − (Σx)² ≤ n²·thr², here with thr in tenths.
+    bool stable() const {
+        if (n_ < W) return false;
+        const uint64_t spread  = (uint64_t)W * sq_ - (uint64_t)sum_ * sum_;
+        const uint64_t thr_x10 = p_.sdAbs_x10 + (uint64_t)sum_ * 10 * p_.sdPct / 100 / W;
+        return spread * 100 <= thr_x10 * thr_x10 * W * W;
+    }
+
+    bool     warm() const                  { return state_ != WARMING; }
+    State    state() const                 { return state_; }
+    uint32_t durationMs() const            { return doneMs_; }            // 0 while warming
+    uint32_t elapsedMs(uint32_t now) const { return warm() ? doneMs_ : now - start_; }
+    size_t   values() const                { return n_; }
+
+private:
+    void finish(State s, uint32_t t) { state_ = s; doneMs_ = t; }
+
+    Params   p_;
+    uint16_t ring_[W] = {};
+    size_t   n_ = 0, head_ = 0;
+    uint32_t sum_ = 0;
+    uint64_t sq_ = 0;
+    uint32_t start_ = 0, doneMs_ = 0;
+    State    state_ = WARMING;
+};